@@ -0,0 +1,450 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+/*
+** Description:
+**   by2bench runs barnyard2 in batch mode (-o, ie. ProcessBatch()) over a
+**   unified2 file once per output plugin under test and reports records per
+**   second, CPU time per record and peak RSS of each run. Every output gets
+**   a fresh working directory with a generated configuration, and the median
+**   of the repeated runs is reported so a single noisy run does not skew the
+**   figures.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_OUTPUTS     16
+#define MAX_EXTRA       16
+#define MAX_RUNS        32
+
+typedef struct _BenchOutput
+{
+    const char  *name;
+    const char  *config;    /* output line, without "output " */
+} BenchOutput;
+
+typedef struct _BenchRun
+{
+    double      wall;       /* seconds */
+    double      cpu;        /* user + system seconds */
+    long        maxrss;     /* KB */
+} BenchRun;
+
+typedef struct _BenchConfig
+{
+    const char  *barnyard2;
+    const char  *workdir;
+    const char  *input;
+    const char  *database;
+    const char  *extra[MAX_EXTRA];
+    int         num_extra;
+    int         runs;
+    int         keep;
+    BenchOutput outputs[MAX_OUTPUTS];
+    int         num_outputs;
+} BenchConfig;
+
+static const BenchOutput default_outputs[] =
+{
+    { "alert_fast", "alert_fast: alert.fast" },
+    { "alert_csv", "alert_csv: alert.csv default" },
+    { "log_tcpdump", "log_tcpdump: tcpdump.log" },
+    { "log_null", "log_null" },
+};
+
+static void Usage(const char *progname)
+{
+    fprintf(stderr,
+        "USAGE: %s [-options] <file.u2>\n"
+        "\n"
+        "  -b <barnyard2>   binary to run (default: ../src/barnyard2)\n"
+        "  -w <dir>         working directory (default: bench.out)\n"
+        "  -O <outputs>     comma separated output plugins to run, their\n"
+        "                   default options are used\n"
+        "                   (default: alert_fast,alert_csv,log_tcpdump,log_null)\n"
+        "  -D <options>     also run \"output database: log, <options>\", eg.\n"
+        "                   \"mysql, user=by2 dbname=bench host=localhost\"\n"
+        "  -e <line>        extra configuration line for every run, may be\n"
+        "                   repeated (eg. \"config event_cache_size: 8192\")\n"
+        "  -n <runs>        runs per output, the median is reported (default: 3)\n"
+        "  -k               keep the output files of the last run\n",
+        progname);
+    exit(1);
+}
+
+static void ParseOutputs(BenchConfig *bc, char *arg)
+{
+    char *tok;
+    unsigned int i;
+
+    bc->num_outputs = 0;
+
+    for (tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        if (bc->num_outputs == MAX_OUTPUTS)
+        {
+            fprintf(stderr, "by2bench: too many outputs\n");
+            exit(1);
+        }
+
+        bc->outputs[bc->num_outputs].name = tok;
+        bc->outputs[bc->num_outputs].config = tok;
+
+        for (i = 0; i < sizeof(default_outputs) / sizeof(default_outputs[0]); i++)
+        {
+            if (strcmp(tok, default_outputs[i].name) == 0)
+                bc->outputs[bc->num_outputs].config = default_outputs[i].config;
+        }
+
+        bc->num_outputs++;
+    }
+}
+
+/* walk the record headers so the rate does not rely on barnyard2's output */
+static uint64_t CountRecords(const char *path)
+{
+    unsigned char hdr[8];
+    uint64_t records = 0;
+    uint32_t len;
+    FILE *fp;
+
+    if ( (fp=fopen(path, "rb")) == NULL )
+    {
+        fprintf(stderr, "by2bench: unable to open '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    while (fread(hdr, sizeof(hdr), 1, fp) == 1)
+    {
+        len = (uint32_t)hdr[4] << 24 | hdr[5] << 16 | hdr[6] << 8 | hdr[7];
+
+        if (fseeko(fp, len, SEEK_CUR) != 0)
+            break;
+
+        records++;
+    }
+
+    fclose(fp);
+    return records;
+}
+
+static void WriteFile(const char *dir, const char *name, const char *content)
+{
+    char path[4200];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    if ( (fp=fopen(path, "w")) == NULL || fputs(content, fp) == EOF || fclose(fp) != 0 )
+    {
+        fprintf(stderr, "by2bench: unable to write '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+}
+
+static void MakeDir(const char *path)
+{
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "by2bench: unable to create '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+}
+
+/* drop what the outputs wrote so every run starts from empty files, the
+ * outputs log to <dir>/log and everything else in <dir> is ours */
+static void CleanDir(const char *dir)
+{
+    char path[4500];
+    struct dirent *de;
+    DIR *d;
+
+    if ( (d=opendir(dir)) == NULL )
+        return;
+
+    while ( (de=readdir(d)) != NULL )
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        unlink(path);
+    }
+
+    closedir(d);
+}
+
+static void WriteConfig(BenchConfig *bc, const char *dir, const char *output)
+{
+    char conf[8192];
+    size_t len;
+    int i;
+
+    /* barnyard2 wants the maps, u2gen uses classifications 1 to 3 */
+    WriteFile(dir, "classification.config",
+              "config classification: bench-low,Benchmark Low,3\n"
+              "config classification: bench-medium,Benchmark Medium,2\n"
+              "config classification: bench-high,Benchmark High,1\n");
+    WriteFile(dir, "sid-msg.map", "1000001 || BENCH signature\n");
+    WriteFile(dir, "gen-msg.map", "");
+    WriteFile(dir, "reference.config", "");
+
+    len = snprintf(conf, sizeof(conf),
+                   "input unified2\n"
+                   "config logdir: %s/log\n"
+                   "config classification_file: %s/classification.config\n"
+                   "config reference_file: %s/reference.config\n"
+                   "config sid_file: %s/sid-msg.map\n"
+                   "config gen_file: %s/gen-msg.map\n",
+                   dir, dir, dir, dir, dir);
+
+    for (i = 0; i < bc->num_extra && len < sizeof(conf); i++)
+        len += snprintf(conf + len, sizeof(conf) - len, "%s\n", bc->extra[i]);
+
+    if (len < sizeof(conf))
+        len += snprintf(conf + len, sizeof(conf) - len, "output %s\n", output);
+
+    if (len >= sizeof(conf))
+    {
+        fprintf(stderr, "by2bench: configuration too long\n");
+        exit(1);
+    }
+
+    WriteFile(dir, "barnyard2.conf", conf);
+}
+
+static int RunOnce(BenchConfig *bc, const char *dir, BenchRun *run)
+{
+    char conf[4200];
+    char log[4200];
+    struct timeval start, end;
+    struct rusage ru;
+    pid_t pid;
+    int status;
+    int fd;
+
+    snprintf(conf, sizeof(conf), "%s/barnyard2.conf", dir);
+    snprintf(log, sizeof(log), "%s/barnyard2.log", dir);
+
+    gettimeofday(&start, NULL);
+
+    if ( (pid=fork()) == -1 )
+    {
+        fprintf(stderr, "by2bench: fork failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        if ( (fd=open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1 )
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        execl(bc->barnyard2, bc->barnyard2, "-q", "-c", conf, "-o", bc->input, (char *)NULL);
+        fprintf(stderr, "by2bench: unable to run '%s': %s\n", bc->barnyard2, strerror(errno));
+        _exit(127);
+    }
+
+    if (wait4(pid, &status, 0, &ru) == -1)
+    {
+        fprintf(stderr, "by2bench: wait failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    gettimeofday(&end, NULL);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "by2bench: barnyard2 failed, see %s\n", log);
+        return -1;
+    }
+
+    run->wall = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    run->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+               ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    run->maxrss = ru.ru_maxrss;
+
+    return 0;
+}
+
+static int CompareRuns(const void *a, const void *b)
+{
+    double d = ((const BenchRun *)a)->wall - ((const BenchRun *)b)->wall;
+
+    return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig bc;
+    BenchRun runs[MAX_RUNS];
+    BenchRun *median;
+    char dir[4096];
+    char logdir[4200];
+    char database[4096];
+    char *outputs = NULL;
+    uint64_t records;
+    int failed = 0;
+    int ch;
+    int i, r;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.barnyard2 = "../src/barnyard2";
+    bc.workdir = "bench.out";
+    bc.runs = 3;
+
+    while ( (ch=getopt(argc, argv, "b:w:O:D:e:n:kh")) != -1 )
+    {
+        switch (ch)
+        {
+            case 'b':
+                bc.barnyard2 = optarg;
+                break;
+            case 'w':
+                bc.workdir = optarg;
+                break;
+            case 'O':
+                outputs = optarg;
+                break;
+            case 'D':
+                bc.database = optarg;
+                break;
+            case 'e':
+                if (bc.num_extra == MAX_EXTRA)
+                    Usage(argv[0]);
+                bc.extra[bc.num_extra++] = optarg;
+                break;
+            case 'n':
+                bc.runs = atoi(optarg);
+                if (bc.runs < 1 || bc.runs > MAX_RUNS)
+                    Usage(argv[0]);
+                break;
+            case 'k':
+                bc.keep = 1;
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        Usage(argv[0]);
+
+    bc.input = argv[optind];
+
+    if (outputs != NULL)
+    {
+        ParseOutputs(&bc, outputs);
+    }
+    else
+    {
+        for (i = 0; i < (int)(sizeof(default_outputs) / sizeof(default_outputs[0])); i++)
+            bc.outputs[bc.num_outputs++] = default_outputs[i];
+    }
+
+    if (bc.database != NULL)
+    {
+        if (bc.num_outputs == MAX_OUTPUTS)
+            Usage(argv[0]);
+
+        snprintf(database, sizeof(database), "database: log, %s", bc.database);
+        bc.outputs[bc.num_outputs].name = "database";
+        bc.outputs[bc.num_outputs].config = database;
+        bc.num_outputs++;
+    }
+
+    /* barnyard2 changes directory, so hand it absolute paths */
+    MakeDir(bc.workdir);
+    if ( (bc.workdir=realpath(bc.workdir, NULL)) == NULL ||
+         (bc.input=realpath(bc.input, NULL)) == NULL )
+    {
+        fprintf(stderr, "by2bench: %s\n", strerror(errno));
+        return 1;
+    }
+
+    records = CountRecords(bc.input);
+
+    printf("input: %s, %llu records, %d run(s) per output\n\n", bc.input,
+           (unsigned long long)records, bc.runs);
+    printf("%-14s %12s %10s %14s %12s %12s\n", "output", "records", "wall s",
+           "records/s", "cpu us/rec", "peak rss KB");
+    fflush(stdout);
+
+    for (i = 0; i < bc.num_outputs; i++)
+    {
+        snprintf(dir, sizeof(dir), "%s/%s", bc.workdir, bc.outputs[i].name);
+        snprintf(logdir, sizeof(logdir), "%s/log", dir);
+        MakeDir(dir);
+        MakeDir(logdir);
+        CleanDir(logdir);
+        WriteConfig(&bc, dir, bc.outputs[i].config);
+
+        for (r = 0; r < bc.runs; r++)
+        {
+            CleanDir(logdir);
+
+            if (RunOnce(&bc, dir, &runs[r]) != 0)
+                break;
+        }
+
+        if (r < bc.runs)
+        {
+            printf("%-14s %12s\n", bc.outputs[i].name, "failed");
+            failed = 1;
+            continue;
+        }
+
+        if (!bc.keep)
+            CleanDir(logdir);
+
+        qsort(runs, bc.runs, sizeof(BenchRun), CompareRuns);
+        median = &runs[bc.runs / 2];
+
+        printf("%-14s %12llu %10.3f %14.0f %12.3f %12ld\n", bc.outputs[i].name,
+               (unsigned long long)records, median->wall,
+               median->wall > 0 ? records / median->wall : 0,
+               records > 0 ? median->cpu * 1e6 / records : 0,
+               median->maxrss);
+        fflush(stdout);
+    }
+
+    return failed;
+}
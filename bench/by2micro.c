@@ -0,0 +1,962 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+/*
+** Description:
+**   by2micro times the decoder and formatting kernels of barnyard2 in
+**   isolation. It is linked against the barnyard2 objects themselves, loads
+**   the packet and event records of a unified2 file (see u2gen, which can
+**   also convert a pcap) and runs every kernel over all of them: a number of
+**   warm-up passes followed by timed repetitions. The median and minimum
+**   time and cycles per call are printed as a table or written as JSON, so
+**   the figures of two builds can be diffed.
+**
+**   LogNetData() is static to log_text.c, it is measured through LogIPPkt()
+**   with the application data dump on, the way alert_full and log_ascii use
+**   it.
+**
+**   The output plugin kernels configure the plugin from an "output" line of
+**   their own and call it with each event and the packet logged with it,
+**   writing to /dev/null. syslog_full is timed up to the finished message,
+**   OpSyslog_FormatAlert(), its queue and socket are left out.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "barnyard2.h"
+#include "decode.h"
+#include "encode.h"
+#include "log_text.h"
+#include "map.h"
+#include "parser.h"
+#include "plugbase.h"
+#include "unified2.h"
+#include "util.h"
+#include "sfutil/sf_textlog.h"
+#include "output-plugins/spo_alert_fwsam.h"
+#include "output-plugins/spo_syslog_full.h"
+
+#define MAX_REPEATS     1000
+#define LOG_BUFFER      (64 * 1024)
+
+typedef struct _MicroPacket
+{
+    struct pcap_pkthdr  pkth;
+    uint32_t            linktype;
+    uint8_t             *record;    /* the Unified2Packet, as the spooler has it */
+    const uint8_t       *data;
+    Packet              *p;         /* decoded once for the later kernels */
+    const uint8_t       *ip4;       /* outer IPv4 header or NULL */
+    uint32_t            ip4_len;
+    uint32_t            tcp_len;
+    uint8_t             tunnel;     /* outermost TunnelType */
+} MicroPacket;
+
+typedef struct _MicroEvent
+{
+    uint32_t    sec;
+    uint32_t    usec;
+    uint32_t    gid;
+    uint32_t    sid;
+    uint32_t    rev;
+    uint32_t    type;
+    uint8_t     *record;    /* the unified2 event, as the spooler has it */
+    uint32_t    packet;     /* index + 1 of the packet logged with it, or 0 */
+    Packet      *p;
+} MicroEvent;
+
+typedef struct _MicroCorpus
+{
+    MicroPacket *packets;
+    uint32_t    num_packets;
+    MicroEvent  *events;
+    uint32_t    num_events;
+} MicroCorpus;
+
+typedef struct _MicroKernel
+{
+    const char  *name;
+    uint64_t    (*run)(MicroCorpus *);  /* one pass, returns the calls made */
+    void        (*init)(void);          /* before the warm-up, or NULL */
+} MicroKernel;
+
+typedef struct _MicroResult
+{
+    uint64_t    calls;                  /* per pass */
+    double      ns[MAX_REPEATS];        /* per call */
+    double      cycles[MAX_REPEATS];
+} MicroResult;
+
+static Packet scratch;
+static TextLog *text_log;
+static char *out_buf;
+static OutputFuncNode *csv_output;
+static OutputFuncNode *syslog_output;
+static OutputFuncNode *syslog_complete_output;
+
+extern OutputFuncNode *AlertList;
+
+static inline uint64_t Cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return (uint64_t)hi << 32 | lo;
+#else
+    return 0;
+#endif
+}
+
+static inline uint64_t Nanoseconds(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/*
+ * kernels
+ */
+static uint64_t RunDecodePacket(MicroCorpus *mc)
+{
+    DatalinkDecodeFunc decode = NULL;
+    int linktype = -1;
+    uint32_t i;
+
+    /* the datalink decoder is looked up per linktype, as the spooler does */
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        if ((int)mc->packets[i].linktype != linktype)
+        {
+            linktype = mc->packets[i].linktype;
+            decode = GetDatalinkDecoder(linktype);
+        }
+
+        DecodeDatalink(decode, linktype, &scratch, &mc->packets[i].pkth,
+                       mc->packets[i].data);
+    }
+
+    return mc->num_packets;
+}
+
+/* DecodePacket over the packets of one outermost tunnel type, so the cost
+ * of each encapsulation can be read off against the untunneled packets */
+static uint64_t RunDecodeTunnel(MicroCorpus *mc, uint8_t type)
+{
+    DatalinkDecodeFunc decode = NULL;
+    int linktype = -1;
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        if (mc->packets[i].tunnel != type)
+            continue;
+
+        if ((int)mc->packets[i].linktype != linktype)
+        {
+            linktype = mc->packets[i].linktype;
+            decode = GetDatalinkDecoder(linktype);
+        }
+
+        DecodeDatalink(decode, linktype, &scratch, &mc->packets[i].pkth,
+                       mc->packets[i].data);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunDecodeNoTunnel(MicroCorpus *mc)
+{
+    return RunDecodeTunnel(mc, TUNNEL_TYPE__NONE);
+}
+
+static uint64_t RunDecodeIPIP(MicroCorpus *mc)
+{
+    return RunDecodeTunnel(mc, TUNNEL_TYPE__IPIP);
+}
+
+static uint64_t RunDecodeGRE(MicroCorpus *mc)
+{
+    return RunDecodeTunnel(mc, TUNNEL_TYPE__GRE);
+}
+
+static uint64_t RunDecodeVXLAN(MicroCorpus *mc)
+{
+    return RunDecodeTunnel(mc, TUNNEL_TYPE__VXLAN);
+}
+
+static uint64_t RunDecodeGENEVE(MicroCorpus *mc)
+{
+    return RunDecodeTunnel(mc, TUNNEL_TYPE__GENEVE);
+}
+
+static uint64_t RunDecodeGTPU(MicroCorpus *mc)
+{
+    return RunDecodeTunnel(mc, TUNNEL_TYPE__GTPU);
+}
+
+static uint64_t RunDecodeIP(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        MicroPacket *mp = &mc->packets[i];
+
+        if (mp->ip4 == NULL)
+            continue;
+
+        /* what DecodeEthPkt() does ahead of it */
+        memset(&scratch, 0, PKT_ZERO_LEN);
+        scratch.pkth = &mp->pkth;
+        scratch.pkt = mp->data;
+
+        DecodeIP(mp->ip4, mp->ip4_len, &scratch);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunDecodeTCP(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        MicroPacket *mp = &mc->packets[i];
+
+        if (mp->tcp_len == 0)
+            continue;
+
+        DecodeTCP((const uint8_t *)mp->p->tcph, mp->tcp_len, mp->p);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunLogIPHeader(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        Packet *p = mc->packets[i].p;
+
+        if (!IPH_IS_VALID(p))
+            continue;
+
+        LogIPHeader(text_log, p);
+        TextLog_Reset(text_log);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunLogIPPkt(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        Packet *p = mc->packets[i].p;
+
+        if (!IPH_IS_VALID(p))
+            continue;
+
+        LogIPPkt(text_log, GET_IPH_PROTO(p), p);
+        TextLog_Reset(text_log);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunFasthex(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        Packet *p = mc->packets[i].p;
+
+        if (p->dsize == 0)
+            continue;
+
+        fasthex_STATIC(p->data, p->dsize, out_buf);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunBase64(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        Packet *p = mc->packets[i].p;
+
+        if (p->dsize == 0)
+            continue;
+
+        base64_STATIC(p->data, p->dsize, out_buf);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunAscii(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        Packet *p = mc->packets[i].p;
+
+        if (p->dsize == 0)
+            continue;
+
+        ascii_STATIC(p->data, p->dsize, out_buf);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunTimestamp(MicroCorpus *mc)
+{
+    uint32_t i;
+
+    for (i = 0; i < mc->num_events; i++)
+        GetTimestampByComponent_STATIC(mc->events[i].sec, mc->events[i].usec, 0, out_buf);
+
+    return mc->num_events;
+}
+
+static uint64_t RunSigLookup(MicroCorpus *mc)
+{
+    uint32_t i;
+
+    for (i = 0; i < mc->num_events; i++)
+        GetSigByGidSid(mc->events[i].gid, mc->events[i].sid, mc->events[i].rev);
+
+    return mc->num_events;
+}
+
+/* configures an output plugin as an "output" line of the configuration
+ * file would and returns the function it added to the alert list */
+static OutputFuncNode *InitOutput(const char *keyword, const char *args)
+{
+    OutputConfigFunc config;
+    OutputFuncNode *node;
+
+    if ( (config=GetOutputConfigFunc((char *)keyword)) == NULL )
+        FatalError("by2micro: output plugin %s is not built in\n", keyword);
+
+    config(SnortStrdup(args));
+
+    for (node = AlertList; node != NULL && node->next != NULL; node = node->next)
+        ;
+
+    if (node == NULL)
+        FatalError("by2micro: output plugin %s is not an alert output\n", keyword);
+
+    return node;
+}
+
+static void InitAlertCSV(void)
+{
+    /* a limit the runs never reach, /dev/null is not rolled */
+    csv_output = InitOutput("alert_csv", "/dev/null default 1024G");
+}
+
+static uint64_t RunAlertCSV(MicroCorpus *mc)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_events; i++)
+    {
+        MicroEvent *me = &mc->events[i];
+
+        if (me->p == NULL)
+            continue;
+
+        csv_output->func(me->p, me->record, me->type, csv_output->arg);
+        calls++;
+    }
+
+    return calls;
+}
+
+/* nothing listens there, the messages are never sent */
+#define SYSLOG_ARGS "sensor_name by2micro, server 127.0.0.1, protocol udp, port 9"
+
+static void InitSyslogFull(void)
+{
+    syslog_output = InitOutput("alert_syslog_full", SYSLOG_ARGS ", operation_mode default");
+}
+
+static void InitSyslogFullComplete(void)
+{
+    syslog_complete_output = InitOutput("alert_syslog_full", SYSLOG_ARGS ", operation_mode complete");
+}
+
+static uint64_t RunSyslogFormat(MicroCorpus *mc, OutputFuncNode *node)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < mc->num_events; i++)
+    {
+        MicroEvent *me = &mc->events[i];
+
+        /* what OpSyslog_Alert() takes */
+        if (me->p == NULL || me->type != UNIFIED2_IDS_EVENT)
+            continue;
+
+        OpSyslog_FormatAlert((OpSyslog_Data *)node->arg, me->p, me->record);
+        calls++;
+    }
+
+    return calls;
+}
+
+static uint64_t RunSyslogFull(MicroCorpus *mc)
+{
+    return RunSyslogFormat(mc, syslog_output);
+}
+
+static uint64_t RunSyslogFullComplete(MicroCorpus *mc)
+{
+    return RunSyslogFormat(mc, syslog_complete_output);
+}
+
+static uint64_t RunFWsamLookup(MicroCorpus *mc)
+{
+    uint32_t i;
+
+    for (i = 0; i < mc->num_events; i++)
+        FWsamGetOption(mc->events[i].gid, mc->events[i].sid);
+
+    return mc->num_events;
+}
+
+static const MicroKernel kernels[] =
+{
+    { "DecodePacket", RunDecodePacket },
+    { "DecodePacket/none", RunDecodeNoTunnel },
+    { "DecodePacket/ipip", RunDecodeIPIP },
+    { "DecodePacket/gre", RunDecodeGRE },
+    { "DecodePacket/vxlan", RunDecodeVXLAN },
+    { "DecodePacket/geneve", RunDecodeGENEVE },
+    { "DecodePacket/gtp", RunDecodeGTPU },
+    { "DecodeIP", RunDecodeIP },
+    { "DecodeTCP", RunDecodeTCP },
+    { "LogIPHeader", RunLogIPHeader },
+    { "LogIPPkt+LogNetData", RunLogIPPkt },
+    { "fasthex_STATIC", RunFasthex },
+    { "base64_STATIC", RunBase64 },
+    { "ascii_STATIC", RunAscii },
+    { "GetTimestampByComponent_STATIC", RunTimestamp },
+    { "GetSigByGidSid", RunSigLookup },
+    { "FWsamGetOption", RunFWsamLookup },
+    { "alert_csv", RunAlertCSV, InitAlertCSV },
+    { "syslog_full", RunSyslogFull, InitSyslogFull },
+    { "syslog_full/complete", RunSyslogFullComplete, InitSyslogFullComplete },
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static void Usage(const char *progname)
+{
+    unsigned int i;
+
+    fprintf(stderr,
+        "USAGE: %s [-options] <file.u2>\n"
+        "\n"
+        "  -n <repeats>     timed passes per kernel (default: 10)\n"
+        "  -W <passes>      warm-up passes per kernel (default: 2)\n"
+        "  -k <kernels>     comma separated kernels to run (default: all)\n"
+        "  -m <sid-msg.map> load a sid map for GetSigByGidSid\n"
+        "  -F <sid-block.map>\n"
+        "                   load an alert_fwsam sid map for FWsamGetOption\n"
+        "  -d <level>       decode level of the Decode kernels: l3, l4, options\n"
+        "                   or payload (default: payload)\n"
+        "  -l <label>       label for the results, eg. a commit id\n"
+        "  -j <file>        write the results as JSON, - for stdout\n"
+        "\n"
+        "kernels:",
+        progname);
+
+    for (i = 0; i < NUM_KERNELS; i++)
+        fprintf(stderr, " %s", kernels[i].name);
+
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* barnyard2.c fills these in from its (static) startup code */
+static void InitGlobals(void)
+{
+    int i;
+
+    barnyard2_conf = Barnyard2ConfNew();
+    barnyard2_conf->output_flags |= OUTPUT_FLAG__APP_DATA;
+    barnyard2_conf->logging_flags |= LOGGING_FLAG__QUIET;
+    DecodeInit();
+    RegisterOutputPlugins();
+
+    protocol_names = (char **)SnortAlloc(sizeof(char *) * NUM_IP_PROTOS);
+
+    for (i = 0; i < NUM_IP_PROTOS; i++)
+    {
+        struct protoent *pt = getprotobynumber(i);
+        char protoname[10];
+        size_t j;
+
+        if (pt != NULL)
+        {
+            protocol_names[i] = SnortStrdup(pt->p_name);
+            for (j = 0; j < strlen(protocol_names[i]); j++)
+                protocol_names[i][j] = toupper(protocol_names[i][j]);
+        }
+        else
+        {
+            SnortSnprintf(protoname, sizeof(protoname), "PROTO:%03d", i);
+            protocol_names[i] = SnortStrdup(protoname);
+        }
+    }
+}
+
+static void LoadCorpus(MicroCorpus *mc, const char *path)
+{
+    uint8_t hdr[8];
+    uint32_t type, len;
+    uint32_t max_packets = 0, max_events = 0;
+    uint8_t *data;
+    FILE *fp;
+
+    if ( (fp=fopen(path, "rb")) == NULL )
+        FatalError("by2micro: unable to open '%s': %s\n", path, strerror(errno));
+
+    while (fread(hdr, sizeof(hdr), 1, fp) == 1)
+    {
+        type = Get32(hdr);
+        len = Get32(hdr + 4);
+
+        if ( (data=malloc(len ? len : 1)) == NULL )
+            FatalError("by2micro: out of memory\n");
+
+        if (len != 0 && fread(data, len, 1, fp) != 1)
+            FatalError("by2micro: '%s' is truncated\n", path);
+
+        if (type == UNIFIED2_PACKET && len >= sizeof(Unified2Packet) - 4)
+        {
+            MicroPacket *mp;
+
+            if (mc->num_packets == max_packets)
+            {
+                max_packets = max_packets ? max_packets * 2 : 1024;
+                mc->packets = realloc(mc->packets, max_packets * sizeof(MicroPacket));
+                if (mc->packets == NULL)
+                    FatalError("by2micro: out of memory\n");
+            }
+
+            mp = &mc->packets[mc->num_packets++];
+            memset(mp, 0, sizeof(MicroPacket));
+            mp->record = data;
+            mp->data = ((Unified2Packet *)data)->packet_data;
+            mp->linktype = ntohl(((Unified2Packet *)data)->linktype);
+            mp->pkth.ts.tv_sec = ntohl(((Unified2Packet *)data)->packet_second);
+            mp->pkth.ts.tv_usec = ntohl(((Unified2Packet *)data)->packet_microsecond);
+            mp->pkth.caplen = ntohl(((Unified2Packet *)data)->packet_length);
+            mp->pkth.len = mp->pkth.caplen;
+
+            if (mp->pkth.caplen > len - (sizeof(Unified2Packet) - 4))
+                FatalError("by2micro: '%s' has a corrupt packet record\n", path);
+
+            /* a packet follows the event it is logged with */
+            if (mc->num_events != 0 && mc->events[mc->num_events - 1].packet == 0 &&
+                ((Unified2EventCommon *)mc->events[mc->num_events - 1].record)->event_id ==
+                ((Unified2Packet *)data)->event_id)
+                mc->events[mc->num_events - 1].packet = mc->num_packets;
+
+            continue;
+        }
+
+        if ((type == UNIFIED2_IDS_EVENT || type == UNIFIED2_IDS_EVENT_IPV6 ||
+             type == UNIFIED2_IDS_EVENT_MPLS || type == UNIFIED2_IDS_EVENT_IPV6_MPLS ||
+             type == UNIFIED2_IDS_EVENT_VLAN || type == UNIFIED2_IDS_EVENT_IPV6_VLAN) &&
+            len >= sizeof(Unified2EventCommon))
+        {
+            Unified2EventCommon *ev = (Unified2EventCommon *)data;
+            MicroEvent *me;
+
+            if (mc->num_events == max_events)
+            {
+                max_events = max_events ? max_events * 2 : 1024;
+                mc->events = realloc(mc->events, max_events * sizeof(MicroEvent));
+                if (mc->events == NULL)
+                    FatalError("by2micro: out of memory\n");
+            }
+
+            me = &mc->events[mc->num_events++];
+            memset(me, 0, sizeof(MicroEvent));
+            me->type = type;
+            me->record = data;
+            me->sec = ntohl(ev->event_second);
+            me->usec = ntohl(ev->event_microsecond);
+            me->gid = ntohl(ev->generator_id);
+            me->sid = ntohl(ev->signature_id);
+            me->rev = ntohl(ev->signature_revision);
+            continue;
+        }
+
+        free(data);
+    }
+
+    fclose(fp);
+
+    if (mc->num_packets == 0 && mc->num_events == 0)
+        FatalError("by2micro: '%s' has no packet or event records\n", path);
+}
+
+/* decode every packet once, the later kernels start from the result */
+static void PrepareCorpus(MicroCorpus *mc)
+{
+    uint32_t i;
+
+    for (i = 0; i < mc->num_packets; i++)
+    {
+        MicroPacket *mp = &mc->packets[i];
+        Packet *p;
+
+        p = mp->p = (Packet *)SnortAlloc(sizeof(Packet));
+        DecodePacket(mp->linktype, p, &mp->pkth, mp->data);
+
+        if (p->tunnel_depth)
+            mp->tunnel = p->tunnels[0].type;
+
+        if (p->iph != NULL && (const uint8_t *)p->iph >= mp->data &&
+            (const uint8_t *)p->iph < mp->data + mp->pkth.caplen &&
+            (*(const uint8_t *)p->iph >> 4) == 4)
+        {
+            mp->ip4 = (const uint8_t *)p->iph;
+            mp->ip4_len = mp->pkth.caplen - (mp->ip4 - mp->data);
+        }
+
+        if (p->tcph != NULL && !p->frag_flag)
+        {
+            const uint8_t *end = mp->data + mp->pkth.caplen;
+            uint32_t payload_len = (GET_IP_PAYLEN(p));
+
+            mp->tcp_len = end - (const uint8_t *)p->tcph;
+            if (payload_len < mp->tcp_len)
+                mp->tcp_len = payload_len;
+        }
+    }
+
+    for (i = 0; i < mc->num_events; i++)
+    {
+        if (mc->events[i].packet != 0)
+            mc->events[i].p = mc->packets[mc->events[i].packet - 1].p;
+    }
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+    double d = *(const double *)a - *(const double *)b;
+
+    return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+static void RunKernel(const MicroKernel *mk, MicroCorpus *mc, int warmup, int repeats,
+                      MicroResult *mr)
+{
+    uint64_t ns, cycles, calls;
+    int i;
+
+    if (mk->init != NULL)
+        mk->init();
+
+    for (i = 0; i < warmup; i++)
+        mk->run(mc);
+
+    for (i = 0; i < repeats; i++)
+    {
+        ns = Nanoseconds();
+        cycles = Cycles();
+        calls = mk->run(mc);
+        cycles = Cycles() - cycles;
+        ns = Nanoseconds() - ns;
+
+        mr->calls = calls;
+        mr->ns[i] = calls ? (double)ns / calls : 0;
+        mr->cycles[i] = calls ? (double)cycles / calls : 0;
+    }
+
+    qsort(mr->ns, repeats, sizeof(double), CompareDoubles);
+    qsort(mr->cycles, repeats, sizeof(double), CompareDoubles);
+}
+
+static void PrintJSONString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, fp);
+    }
+
+    fputc('"', fp);
+}
+
+int main(int argc, char *argv[])
+{
+    MicroCorpus mc;
+    MicroResult *results;
+    const char *label = "";
+    const char *json = NULL;
+    char *selected = NULL;
+    char *sid_map = NULL;
+    char *block_map = NULL;
+    static const char *level_names[DECODE_LEVEL__MAX] =
+        { "none", "l3", "l4", "options", "payload" };
+    int decode_level = DECODE_LEVEL__PAYLOAD;
+    int run[NUM_KERNELS];
+    int repeats = 10;
+    int warmup = 2;
+    int have_cycles = (Cycles() != 0);
+    unsigned int i;
+    char *tok;
+    FILE *fp;
+    int ch;
+
+    while ( (ch=getopt(argc, argv, "n:W:k:m:F:d:l:j:h")) != -1 )
+    {
+        switch (ch)
+        {
+            case 'n':
+                repeats = atoi(optarg);
+                if (repeats < 1 || repeats > MAX_REPEATS)
+                    Usage(argv[0]);
+                break;
+            case 'W':
+                warmup = atoi(optarg);
+                if (warmup < 0)
+                    Usage(argv[0]);
+                break;
+            case 'k':
+                selected = optarg;
+                break;
+            case 'm':
+                sid_map = optarg;
+                break;
+            case 'F':
+                block_map = optarg;
+                break;
+            case 'd':
+                if (strcasecmp(optarg, "l3") == 0)
+                    decode_level = DECODE_LEVEL__L3;
+                else if (strcasecmp(optarg, "l4") == 0)
+                    decode_level = DECODE_LEVEL__L4;
+                else if (strcasecmp(optarg, "options") == 0)
+                    decode_level = DECODE_LEVEL__OPTIONS;
+                else if (strcasecmp(optarg, "payload") == 0)
+                    decode_level = DECODE_LEVEL__PAYLOAD;
+                else
+                    Usage(argv[0]);
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            case 'j':
+                json = optarg;
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        Usage(argv[0]);
+
+    for (i = 0; i < NUM_KERNELS; i++)
+        run[i] = (selected == NULL);
+
+    for (tok = selected ? strtok(selected, ",") : NULL; tok != NULL; tok = strtok(NULL, ","))
+    {
+        for (i = 0; i < NUM_KERNELS; i++)
+        {
+            if (strcasecmp(tok, kernels[i].name) == 0)
+                break;
+        }
+
+        if (i == NUM_KERNELS)
+            Usage(argv[0]);
+
+        run[i] = 1;
+    }
+
+    InitGlobals();
+
+    if (sid_map != NULL)
+    {
+        ConfigSidFile(barnyard2_conf, sid_map);
+        if (ReadSidFiles(barnyard2_conf) == 0)
+            FatalError("by2micro: unable to read '%s'\n", sid_map);
+    }
+
+    if (block_map != NULL && !FWsamReadOptions(block_map))
+        FatalError("by2micro: unable to open '%s': %s\n", block_map, strerror(errno));
+
+    if ( (out_buf=SnortAlloc(MAX_QUERY_LENGTH)) == NULL ||
+         (text_log=TextLog_Init("/dev/null", LOG_BUFFER, 0)) == NULL )
+        FatalError("by2micro: initialisation failed\n");
+
+    memset(&mc, 0, sizeof(mc));
+    LoadCorpus(&mc, argv[optind]);
+    PrepareCorpus(&mc);
+
+    /* the log kernels use packets decoded in full above */
+    barnyard2_conf->decode_level = decode_level;
+
+    results = (MicroResult *)SnortAlloc(sizeof(MicroResult) * NUM_KERNELS);
+
+    for (i = 0; i < NUM_KERNELS; i++)
+    {
+        if (run[i])
+            RunKernel(&kernels[i], &mc, warmup, repeats, &results[i]);
+    }
+
+    if (json == NULL)
+    {
+        printf("input: %s, %u packets, %u events, %d warm-up and %d timed passes\n"
+               "encoders: %s, decode level: %s\n\n",
+               argv[optind], mc.num_packets, mc.num_events, warmup, repeats,
+               EncodeImplementation(), level_names[decode_level]);
+        printf("%-32s %10s %12s %12s %12s %12s\n", "kernel", "calls",
+               "ns median", "ns min", "cyc median", "cyc min");
+
+        for (i = 0; i < NUM_KERNELS; i++)
+        {
+            if (!run[i])
+                continue;
+
+            printf("%-32s %10llu %12.1f %12.1f", kernels[i].name,
+                   (unsigned long long)results[i].calls,
+                   results[i].ns[repeats / 2], results[i].ns[0]);
+
+            if (have_cycles)
+                printf(" %12.0f %12.0f\n", results[i].cycles[repeats / 2], results[i].cycles[0]);
+            else
+                printf(" %12s %12s\n", "-", "-");
+        }
+
+        return 0;
+    }
+
+    if (strcmp(json, "-") == 0)
+        fp = stdout;
+    else if ( (fp=fopen(json, "w")) == NULL )
+        FatalError("by2micro: unable to open '%s': %s\n", json, strerror(errno));
+
+    fprintf(fp, "{\n  \"label\": ");
+    PrintJSONString(fp, label);
+    fprintf(fp, ",\n  \"input\": ");
+    PrintJSONString(fp, argv[optind]);
+    fprintf(fp, ",\n  \"encoders\": \"%s\",\n  \"decode_level\": \"%s\",\n  \"packets\": %u,\n  \"events\": %u,\n"
+                "  \"warmup\": %d,\n  \"repeats\": %d,\n  \"kernels\": [",
+            EncodeImplementation(), level_names[decode_level], mc.num_packets, mc.num_events, warmup, repeats);
+
+    for (ch = 0, i = 0; i < NUM_KERNELS; i++)
+    {
+        if (!run[i])
+            continue;
+
+        fprintf(fp, "%s\n    { \"name\": \"%s\", \"calls\": %llu, "
+                    "\"ns_per_call\": { \"median\": %.2f, \"min\": %.2f }, ",
+                ch++ ? "," : "", kernels[i].name, (unsigned long long)results[i].calls,
+                results[i].ns[repeats / 2], results[i].ns[0]);
+
+        if (have_cycles)
+            fprintf(fp, "\"cycles_per_call\": { \"median\": %.1f, \"min\": %.1f } }",
+                    results[i].cycles[repeats / 2], results[i].cycles[0]);
+        else
+            fprintf(fp, "\"cycles_per_call\": null }");
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+
+    if (fp != stdout && fclose(fp) != 0)
+        FatalError("by2micro: write failed: %s\n", strerror(errno));
+
+    return 0;
+}
@@ -0,0 +1,902 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+/*
+** Description:
+**   u2gen writes a synthetic unified2 file for benchmarking. Events are
+**   drawn from a configurable mix of the legacy IPv4/IPv6 records and the
+**   VLAN and MPLS records, each optionally followed by an ethernet packet
+**   (VLAN tagged or MPLS labelled to match its event) with a payload of
+**   random size, and by extra data records. The tunnel kinds carry their
+**   IPv4 packet in IP in IP, GRE, VXLAN, GENEVE or GTP-U between a set of
+**   tunnel endpoints, the event has the inner addresses. The output only depends on the
+**   options and the seed, so runs can be compared across builds.
+**
+**   With -P the packets of a libpcap capture file are converted instead, each
+**   one preceded by an IDS event carrying its addresses, so captured traffic
+**   can be replayed through barnyard2 and the bench/by2micro kernels.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "unified2.h"
+
+#define ETH_HLEN            14
+#define VLAN_HLEN           4
+#define MPLS_HLEN           4
+#define IP4_HLEN            20
+#define IP6_HLEN            40
+#define TCP_HLEN            20
+#define UDP_HLEN            8
+#define ICMP_HLEN           8
+#define GRE_HLEN            8       /* with a key */
+#define TUNNEL_HLEN         8       /* VXLAN, GENEVE without options, GTP-U */
+
+#define MAX_PAYLOAD         1400
+#define MAX_PACKET          (ETH_HLEN + VLAN_HLEN + MPLS_HLEN + IP6_HLEN + TCP_HLEN + MAX_PAYLOAD + \
+                             IP4_HLEN + UDP_HLEN + TUNNEL_HLEN + ETH_HLEN)
+
+#define LINKTYPE_ETHERNET   1
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define PCAP_HDR_LEN        24
+#define PCAP_REC_HDR_LEN    16
+#define PCAP_MAX_PACKET     65535
+
+typedef enum _EventKind
+{
+    KIND_IPV4 = 0,
+    KIND_IPV6,
+    KIND_VLAN4,
+    KIND_VLAN6,
+    KIND_MPLS4,
+    KIND_MPLS6,
+    KIND_IPIP4,
+    KIND_GRE4,
+    KIND_VXLAN4,
+    KIND_GENEVE4,
+    KIND_GTP4,
+    KIND_MAX
+} EventKind;
+
+static const char *kind_names[KIND_MAX] =
+{
+    "ipv4", "ipv6", "vlan4", "vlan6", "mpls4", "mpls6",
+    "ipip4", "gre4", "vxlan4", "geneve4", "gtp4"
+};
+
+static const uint32_t kind_types[KIND_MAX] =
+{
+    UNIFIED2_IDS_EVENT, UNIFIED2_IDS_EVENT_IPV6,
+    UNIFIED2_IDS_EVENT_VLAN, UNIFIED2_IDS_EVENT_IPV6_VLAN,
+    UNIFIED2_IDS_EVENT_MPLS, UNIFIED2_IDS_EVENT_IPV6_MPLS,
+    UNIFIED2_IDS_EVENT, UNIFIED2_IDS_EVENT, UNIFIED2_IDS_EVENT,
+    UNIFIED2_IDS_EVENT, UNIFIED2_IDS_EVENT
+};
+
+static const uint16_t service_ports[] = { 80, 443, 53, 22, 25, 445 };
+
+typedef struct _U2GenConfig
+{
+    uint64_t        events;
+    uint64_t        seed;
+    unsigned int    mix[KIND_MAX];      /* relative weights */
+    unsigned int    mix_total;
+    unsigned int    packet_pct;         /* events followed by a packet */
+    unsigned int    extra_pct;          /* events followed by extra data */
+    unsigned int    payload_min;
+    unsigned int    payload_max;
+    unsigned int    signatures;         /* distinct sids */
+    unsigned int    hosts;              /* distinct addresses per side */
+    uint32_t        start;              /* time of the first event */
+    unsigned int    rate;               /* events per second */
+    const char      *pcap;              /* capture to convert instead */
+    const char      *output;
+} U2GenConfig;
+
+static uint64_t rng_state;
+
+/* xorshift64*, so the output does not depend on the libc */
+static uint64_t Random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t RandomRange(uint32_t n)
+{
+    return n != 0 ? (uint32_t)((Random() >> 32) % n) : 0;
+}
+
+static void Put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void Put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static uint32_t ChecksumAdd(uint32_t sum, const uint8_t *p, size_t len)
+{
+    while (len > 1)
+    {
+        sum += (p[0] << 8) | p[1];
+        p += 2;
+        len -= 2;
+    }
+
+    if (len)
+        sum += p[0] << 8;
+
+    return sum;
+}
+
+static uint16_t ChecksumFold(uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return (uint16_t)~sum;
+}
+
+static void Usage(const char *progname)
+{
+    fprintf(stderr,
+        "USAGE: %s [-options] -w <file>\n"
+        "\n"
+        "  -w <file>        unified2 file to write\n"
+        "  -n <events>      number of events (default: 100000)\n"
+        "  -s <seed>        random seed (default: 1)\n"
+        "  -m <mix>         event mix as kind:weight,... with kinds ipv4, ipv6,\n"
+        "                   vlan4, vlan6, mpls4, mpls6, ipip4, gre4, vxlan4,\n"
+        "                   geneve4, gtp4\n"
+        "                   (default: ipv4:50,ipv6:20,vlan4:10,vlan6:5,mpls4:10,mpls6:5)\n"
+        "  -p <percent>     events followed by a packet (default: 90)\n"
+        "  -x <percent>     events followed by extra data (default: 10)\n"
+        "  -z <min>:<max>   payload size range in bytes (default: 0:%d)\n"
+        "  -S <sids>        distinct signatures (default: 100)\n"
+        "  -H <hosts>       distinct addresses on each side (default: 1024)\n"
+        "  -t <time>        time of the first event (default: 1400000000)\n"
+        "  -r <rate>        events per second of event time (default: 1000)\n"
+        "  -P <pcap>        convert the packets of a capture file instead, up to\n"
+        "                   -n of them, -m/-p/-x/-z/-H/-t/-r do not apply\n",
+        progname, MAX_PAYLOAD);
+    exit(1);
+}
+
+static unsigned long ParseNumber(const char *arg, const char *what)
+{
+    unsigned long val;
+    char *end;
+
+    errno = 0;
+    val = strtoul(arg, &end, 10);
+
+    if (errno != 0 || end == arg || *end != '\0')
+    {
+        fprintf(stderr, "u2gen: invalid %s: %s\n", what, arg);
+        exit(1);
+    }
+
+    return val;
+}
+
+static void ParseMix(U2GenConfig *gc, char *arg)
+{
+    char *tok;
+    char *sep;
+    int i;
+
+    memset(gc->mix, 0, sizeof(gc->mix));
+    gc->mix_total = 0;
+
+    for (tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        if ( (sep=strchr(tok, ':')) == NULL )
+        {
+            fprintf(stderr, "u2gen: invalid mix entry: %s\n", tok);
+            exit(1);
+        }
+
+        *sep++ = '\0';
+
+        for (i = 0; i < KIND_MAX; i++)
+        {
+            if (strcmp(tok, kind_names[i]) == 0)
+                break;
+        }
+
+        if (i == KIND_MAX)
+        {
+            fprintf(stderr, "u2gen: unknown event kind: %s\n", tok);
+            exit(1);
+        }
+
+        gc->mix[i] = (unsigned int)ParseNumber(sep, "mix weight");
+        gc->mix_total += gc->mix[i];
+    }
+
+    if (gc->mix_total == 0)
+    {
+        fprintf(stderr, "u2gen: empty event mix\n");
+        exit(1);
+    }
+}
+
+static void WriteRecord(FILE *fp, uint32_t type, const void *data, uint32_t len)
+{
+    uint8_t hdr[8];
+
+    Put32(hdr, type);
+    Put32(hdr + 4, len);
+
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1 ||
+        (len != 0 && fwrite(data, len, 1, fp) != 1))
+    {
+        fprintf(stderr, "u2gen: write failed: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+/* build the packet an event fired on, returns its length */
+static uint32_t BuildPacket(uint8_t *pkt, EventKind kind, uint8_t proto,
+                            const uint8_t *src, const uint8_t *dst,
+                            uint16_t sport, uint16_t dport, uint16_t vlan,
+                            uint32_t mpls, unsigned int payload_len)
+{
+    static const uint8_t macs[12] =
+        { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb };
+    int ip6 = (kind == KIND_IPV6 || kind == KIND_VLAN6 || kind == KIND_MPLS6);
+    uint8_t *p = pkt;
+    uint8_t *outer = NULL;
+    uint8_t *udp = NULL;
+    uint8_t *gtp = NULL;
+    uint8_t *ip;
+    uint8_t *l4;
+    uint32_t l4_len;
+    uint32_t sum;
+    unsigned int i;
+
+    memcpy(p, macs, sizeof(macs));
+    p += sizeof(macs);
+
+    if (kind == KIND_VLAN4 || kind == KIND_VLAN6)
+    {
+        Put16(p, 0x8100);
+        Put16(p + 2, vlan & 0x0fff);
+        p += VLAN_HLEN;
+    }
+
+    if (kind == KIND_MPLS4 || kind == KIND_MPLS6)
+    {
+        Put16(p, 0x8847);
+        /* one label, bottom of stack, ttl 64 */
+        Put32(p + 2, (mpls << 12) | 0x100 | 64);
+        p += 2 + MPLS_HLEN;
+    }
+    else
+    {
+        Put16(p, ip6 ? 0x86dd : 0x0800);
+        p += 2;
+    }
+
+    /* the outer header is filled in once the length is known */
+    if (kind >= KIND_IPIP4)
+    {
+        outer = p;
+        p += IP4_HLEN;
+    }
+
+    switch (kind)
+    {
+        case KIND_GRE4:
+            Put16(p, 0x2000);   /* key present */
+            Put16(p + 2, 0x0800);
+            Put32(p + 4, 1 + RandomRange(16));
+            p += GRE_HLEN;
+            break;
+
+        case KIND_VXLAN4:
+        case KIND_GENEVE4:
+            udp = p;
+            Put16(udp, 49152 + RandomRange(16384));
+            Put16(udp + 2, kind == KIND_VXLAN4 ? 4789 : 6081);
+            p += UDP_HLEN;
+
+            memset(p, 0, TUNNEL_HLEN);
+            if (kind == KIND_VXLAN4)
+                p[0] = 0x08;    /* VNI valid */
+            else
+                Put16(p + 2, 0x6558);
+            Put32(p + 4, (1 + RandomRange(16)) << 8);
+            p += TUNNEL_HLEN;
+
+            memcpy(p, macs, sizeof(macs));
+            Put16(p + sizeof(macs), 0x0800);
+            p += ETH_HLEN;
+            break;
+
+        case KIND_GTP4:
+            udp = p;
+            Put16(udp, 2152);
+            Put16(udp + 2, 2152);
+            p += UDP_HLEN;
+
+            gtp = p;
+            gtp[0] = 0x30;      /* version 1, GTP */
+            gtp[1] = 0xff;      /* G-PDU */
+            Put32(gtp + 4, 0x10000 + RandomRange(4096));
+            p += TUNNEL_HLEN;
+            break;
+
+        default:
+            break;
+    }
+
+    ip = p;
+    l4 = ip + (ip6 ? IP6_HLEN : IP4_HLEN);
+
+    switch (proto)
+    {
+        case IPPROTO_TCP:
+            l4_len = TCP_HLEN + payload_len;
+            memset(l4, 0, TCP_HLEN);
+            Put16(l4, sport);
+            Put16(l4 + 2, dport);
+            Put32(l4 + 4, (uint32_t)Random());
+            Put32(l4 + 8, (uint32_t)Random());
+            l4[12] = (TCP_HLEN / 4) << 4;
+            l4[13] = 0x18;      /* PSH ACK */
+            Put16(l4 + 14, 8192);
+            break;
+
+        case IPPROTO_UDP:
+            l4_len = UDP_HLEN + payload_len;
+            memset(l4, 0, UDP_HLEN);
+            Put16(l4, sport);
+            Put16(l4 + 2, dport);
+            Put16(l4 + 4, l4_len);
+            break;
+
+        default:
+            l4_len = ICMP_HLEN + payload_len;
+            memset(l4, 0, ICMP_HLEN);
+            l4[0] = ip6 ? 128 : 8;  /* echo request */
+            Put16(l4 + 4, (uint16_t)Random());
+            Put16(l4 + 6, 1);
+            break;
+    }
+
+    for (i = 0; i < payload_len; i++)
+        l4[l4_len - payload_len + i] = (uint8_t)Random();
+
+    if (ip6)
+    {
+        memset(ip, 0, IP6_HLEN);
+        ip[0] = 0x60;
+        Put16(ip + 4, l4_len);
+        ip[6] = proto;
+        ip[7] = 64;
+        memcpy(ip + 8, src, 16);
+        memcpy(ip + 24, dst, 16);
+
+        /* pseudo header */
+        sum = ChecksumAdd(0, ip + 8, 32);
+        sum += l4_len + proto;
+    }
+    else
+    {
+        memset(ip, 0, IP4_HLEN);
+        ip[0] = 0x45;
+        Put16(ip + 2, IP4_HLEN + l4_len);
+        Put16(ip + 4, (uint16_t)Random());
+        Put16(ip + 6, 0x4000);
+        ip[8] = 64;
+        ip[9] = proto;
+        memcpy(ip + 12, src, 4);
+        memcpy(ip + 16, dst, 4);
+        Put16(ip + 10, ChecksumFold(ChecksumAdd(0, ip, IP4_HLEN)));
+
+        sum = ChecksumAdd(0, ip + 12, 8);
+        sum += l4_len + proto;
+    }
+
+    /* ICMPv4 has no pseudo header */
+    if (proto == IPPROTO_ICMP)
+        sum = 0;
+
+    switch (proto)
+    {
+        case IPPROTO_TCP:
+            Put16(l4 + 16, ChecksumFold(ChecksumAdd(sum, l4, l4_len)));
+            break;
+        case IPPROTO_UDP:
+            Put16(l4 + 6, ChecksumFold(ChecksumAdd(sum, l4, l4_len)));
+            break;
+        default:
+            Put16(l4 + 2, ChecksumFold(ChecksumAdd(sum, l4, l4_len)));
+            break;
+    }
+
+    if (outer != NULL)
+    {
+        uint8_t *end = l4 + l4_len;
+
+        memset(outer, 0, IP4_HLEN);
+        outer[0] = 0x45;
+        Put16(outer + 2, end - outer);
+        Put16(outer + 4, (uint16_t)Random());
+        outer[8] = 64;
+        outer[9] = kind == KIND_IPIP4 ? IPPROTO_IPIP :
+                   kind == KIND_GRE4 ? IPPROTO_GRE : IPPROTO_UDP;
+        /* 198.51.100.0/24 to 203.0.113.0/24 */
+        Put32(outer + 12, 0xc6336400 + 1 + RandomRange(8));
+        Put32(outer + 16, 0xcb007100 + 1 + RandomRange(8));
+        Put16(outer + 10, ChecksumFold(ChecksumAdd(0, outer, IP4_HLEN)));
+
+        /* no UDP checksum, as tunnel endpoints usually send */
+        if (udp != NULL)
+        {
+            Put16(udp + 4, end - udp);
+            Put16(udp + 6, 0);
+        }
+
+        if (gtp != NULL)
+            Put16(gtp + 2, end - gtp - TUNNEL_HLEN);
+    }
+
+    return (uint32_t)(l4 + l4_len - pkt);
+}
+
+static void Generate(U2GenConfig *gc, FILE *fp)
+{
+    static uint8_t rec[sizeof(Unified2Packet) + MAX_PACKET];
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint64_t n;
+    uint32_t event_id = 0;
+    uint32_t sec, usec;
+    uint32_t pick;
+    uint32_t len;
+    uint16_t sport, dport, vlan;
+    uint32_t mpls;
+    uint8_t proto;
+    EventKind kind;
+    int ip6;
+
+    for (n = 0; n < gc->events; n++)
+    {
+        event_id++;
+        sec = gc->start + (uint32_t)(n / gc->rate);
+        usec = (uint32_t)((n % gc->rate) * (1000000 / gc->rate));
+
+        pick = RandomRange(gc->mix_total);
+        for (kind = 0; kind < KIND_MAX - 1 && pick >= gc->mix[kind]; kind++)
+            pick -= gc->mix[kind];
+
+        ip6 = (kind == KIND_IPV6 || kind == KIND_VLAN6 || kind == KIND_MPLS6);
+
+        pick = RandomRange(10);
+        proto = pick < 6 ? IPPROTO_TCP : pick < 9 ? IPPROTO_UDP :
+                ip6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+
+        memset(src, 0, sizeof(src));
+        memset(dst, 0, sizeof(dst));
+
+        if (ip6)
+        {
+            /* 2001:db8::/64 and 2001:db8:1::/64 */
+            src[0] = 0x20; src[1] = 0x01; src[2] = 0x0d; src[3] = 0xb8;
+            dst[0] = 0x20; dst[1] = 0x01; dst[2] = 0x0d; dst[3] = 0xb8; dst[5] = 1;
+            Put32(src + 12, 1 + RandomRange(gc->hosts));
+            Put32(dst + 12, 1 + RandomRange(gc->hosts));
+        }
+        else
+        {
+            /* 10.0.0.0/8 and 192.168.0.0/16 */
+            Put32(src, 0x0a000000 + 1 + RandomRange(gc->hosts));
+            Put32(dst, 0xc0a80000 + 1 + RandomRange(gc->hosts));
+        }
+
+        if (proto == IPPROTO_TCP || proto == IPPROTO_UDP)
+        {
+            sport = 1024 + RandomRange(64512);
+            dport = service_ports[RandomRange(sizeof(service_ports) / sizeof(service_ports[0]))];
+        }
+        else
+        {
+            /* icmp type and code */
+            sport = ip6 ? 128 : 8;
+            dport = 0;
+        }
+
+        vlan = 1 + RandomRange(4094);
+        mpls = 16 + RandomRange(1000);
+
+        /* the event */
+        memset(rec, 0, sizeof(Unified2IDSEventIPv6));
+        Put32(rec + 4, event_id);
+        Put32(rec + 8, sec);
+        Put32(rec + 12, usec);
+        Put32(rec + 16, 1000000 + 1 + RandomRange(gc->signatures));
+        Put32(rec + 20, 1);
+        Put32(rec + 24, 1 + RandomRange(3));
+        Put32(rec + 28, 1 + RandomRange(3));
+        Put32(rec + 32, 1 + RandomRange(3));
+
+        if (ip6)
+        {
+            memcpy(rec + 36, src, 16);
+            memcpy(rec + 52, dst, 16);
+            len = 68;
+        }
+        else
+        {
+            memcpy(rec + 36, src, 4);
+            memcpy(rec + 40, dst, 4);
+            len = 44;
+        }
+
+        Put16(rec + len, sport);
+        Put16(rec + len + 2, dport);
+        rec[len + 4] = proto;
+        len += 8;
+
+        if (kind != KIND_IPV4 && kind != KIND_IPV6)
+        {
+            Put32(rec + len, kind == KIND_MPLS4 || kind == KIND_MPLS6 ? mpls : 0);
+            Put16(rec + len + 4, kind == KIND_VLAN4 || kind == KIND_VLAN6 ? vlan : 0);
+            len += 8;
+        }
+
+        WriteRecord(fp, kind_types[kind], rec, len);
+
+        /* the packet */
+        if (RandomRange(100) < gc->packet_pct)
+        {
+            uint32_t payload_len = gc->payload_min +
+                RandomRange(gc->payload_max - gc->payload_min + 1);
+            uint32_t pkt_len;
+
+            pkt_len = BuildPacket(rec + sizeof(Unified2Packet) - 4, kind, proto,
+                                  src, dst, sport, dport, vlan, mpls, payload_len);
+
+            Put32(rec, 0);
+            Put32(rec + 4, event_id);
+            Put32(rec + 8, sec);
+            Put32(rec + 12, sec);
+            Put32(rec + 16, usec);
+            Put32(rec + 20, LINKTYPE_ETHERNET);
+            Put32(rec + 24, pkt_len);
+
+            WriteRecord(fp, UNIFIED2_PACKET, rec, sizeof(Unified2Packet) - 4 + pkt_len);
+        }
+
+        /* an X-Forwarded-For the event came with */
+        if (RandomRange(100) < gc->extra_pct)
+        {
+            uint32_t data_len = ip6 ? 16 : 4;
+            uint8_t *extra = rec + sizeof(Unified2ExtraDataHdr);
+
+            Put32(rec, EVENT_TYPE_EXTRA_DATA);
+            Put32(rec + 4, sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData) + data_len);
+
+            Put32(extra, 0);
+            Put32(extra + 4, event_id);
+            Put32(extra + 8, sec);
+            Put32(extra + 12, ip6 ? EVENT_INFO_XFF_IPV6 : EVENT_INFO_XFF_IPV4);
+            Put32(extra + 16, EVENT_DATA_TYPE_BLOB);
+            Put32(extra + 20, data_len + 8);
+
+            if (ip6)
+                memcpy(extra + sizeof(Unified2ExtraData), src, 16);
+            else
+                Put32(extra + sizeof(Unified2ExtraData), 0xcb007100 + 1 + RandomRange(254));
+
+            WriteRecord(fp, UNIFIED2_EXTRA_DATA, rec,
+                        sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData) + data_len);
+        }
+    }
+}
+
+static uint32_t Get32(const uint8_t *p, int swap)
+{
+    if (swap)
+        return (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* the addresses and ports of an ethernet (optionally VLAN tagged) packet,
+ * returns the event type to use for it */
+static uint32_t ParseAddresses(const uint8_t *pkt, uint32_t len, uint32_t linktype,
+                               uint8_t *rec)
+{
+    uint32_t off = ETH_HLEN;
+    uint32_t l4 = 0;
+    uint16_t type;
+    uint8_t proto = 0;
+
+    if (linktype != LINKTYPE_ETHERNET || len < ETH_HLEN)
+        return UNIFIED2_IDS_EVENT;
+
+    type = pkt[12] << 8 | pkt[13];
+
+    while ((type == 0x8100 || type == 0x88a8) && len >= off + VLAN_HLEN)
+    {
+        type = pkt[off + 2] << 8 | pkt[off + 3];
+        off += VLAN_HLEN;
+    }
+
+    if (type == 0x0800 && len >= off + IP4_HLEN && (pkt[off] >> 4) == 4)
+    {
+        memcpy(rec + 36, pkt + off + 12, 8);
+        proto = pkt[off + 9];
+        l4 = off + (pkt[off] & 0x0f) * 4;
+
+        if (len >= l4 + 4 && (proto == IPPROTO_TCP || proto == IPPROTO_UDP))
+            memcpy(rec + 44, pkt + l4, 4);
+
+        rec[48] = proto;
+        return UNIFIED2_IDS_EVENT;
+    }
+
+    if (type == 0x86dd && len >= off + IP6_HLEN && (pkt[off] >> 4) == 6)
+    {
+        memcpy(rec + 36, pkt + off + 8, 32);
+        proto = pkt[off + 6];
+        l4 = off + IP6_HLEN;
+
+        if (len >= l4 + 4 && (proto == IPPROTO_TCP || proto == IPPROTO_UDP))
+            memcpy(rec + 68, pkt + l4, 4);
+
+        rec[72] = proto;
+        return UNIFIED2_IDS_EVENT_IPV6;
+    }
+
+    return UNIFIED2_IDS_EVENT;
+}
+
+static void ConvertPcap(U2GenConfig *gc, FILE *fp)
+{
+    static uint8_t rec[sizeof(Unified2Packet) + PCAP_MAX_PACKET];
+    uint8_t *pkt = rec + sizeof(Unified2Packet) - 4;
+    uint8_t hdr[PCAP_HDR_LEN];
+    uint8_t ev[sizeof(Unified2IDSEventIPv6)];
+    uint32_t magic, linktype, type;
+    uint32_t sec, usec, caplen;
+    uint32_t event_id = 0;
+    uint64_t skipped = 0;
+    int swap, nsec;
+    FILE *in;
+
+    if ( (in=fopen(gc->pcap, "rb")) == NULL )
+    {
+        fprintf(stderr, "u2gen: unable to open '%s': %s\n", gc->pcap, strerror(errno));
+        exit(1);
+    }
+
+    if (fread(hdr, sizeof(hdr), 1, in) != 1)
+    {
+        fprintf(stderr, "u2gen: '%s' is not a pcap file\n", gc->pcap);
+        exit(1);
+    }
+
+    magic = Get32(hdr, 0);
+    swap = (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC);
+    if (swap)
+        magic = Get32(hdr, 1);
+
+    if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+    {
+        fprintf(stderr, "u2gen: '%s' is not a pcap file (pcapng is not supported)\n",
+                gc->pcap);
+        exit(1);
+    }
+
+    nsec = (magic == PCAP_MAGIC_NSEC);
+    linktype = Get32(hdr + 20, swap);
+
+    while (event_id < gc->events && fread(hdr, PCAP_REC_HDR_LEN, 1, in) == 1)
+    {
+        sec = Get32(hdr, swap);
+        usec = Get32(hdr + 4, swap);
+        caplen = Get32(hdr + 8, swap);
+
+        if (nsec)
+            usec /= 1000;
+
+        if (caplen > PCAP_MAX_PACKET)
+        {
+            fprintf(stderr, "u2gen: '%s' is corrupt\n", gc->pcap);
+            exit(1);
+        }
+
+        if (caplen != 0 && fread(pkt, caplen, 1, in) != 1)
+            break;
+
+        if (caplen == 0)
+        {
+            skipped++;
+            continue;
+        }
+
+        event_id++;
+
+        memset(ev, 0, sizeof(ev));
+        type = ParseAddresses(pkt, caplen, linktype, ev);
+        Put32(ev + 4, event_id);
+        Put32(ev + 8, sec);
+        Put32(ev + 12, usec);
+        Put32(ev + 16, 1000000 + 1 + RandomRange(gc->signatures));
+        Put32(ev + 20, 1);
+        Put32(ev + 24, 1);
+        Put32(ev + 28, 1 + RandomRange(3));
+        Put32(ev + 32, 1 + RandomRange(3));
+
+        WriteRecord(fp, type, ev, type == UNIFIED2_IDS_EVENT ? 52 : 76);
+
+        Put32(rec, 0);
+        Put32(rec + 4, event_id);
+        Put32(rec + 8, sec);
+        Put32(rec + 12, sec);
+        Put32(rec + 16, usec);
+        Put32(rec + 20, linktype);
+        Put32(rec + 24, caplen);
+
+        WriteRecord(fp, UNIFIED2_PACKET, rec, sizeof(Unified2Packet) - 4 + caplen);
+    }
+
+    if (skipped != 0)
+        fprintf(stderr, "u2gen: skipped %llu empty packets\n", (unsigned long long)skipped);
+
+    fclose(in);
+}
+
+int main(int argc, char *argv[])
+{
+    U2GenConfig gc;
+    char mix[] = "ipv4:50,ipv6:20,vlan4:10,vlan6:5,mpls4:10,mpls6:5";
+    char *sep;
+    FILE *fp;
+    int ch;
+
+    memset(&gc, 0, sizeof(gc));
+    gc.events = 100000;
+    gc.seed = 1;
+    gc.packet_pct = 90;
+    gc.extra_pct = 10;
+    gc.payload_max = MAX_PAYLOAD;
+    gc.signatures = 100;
+    gc.hosts = 1024;
+    gc.start = 1400000000;
+    gc.rate = 1000;
+    ParseMix(&gc, mix);
+
+    while ( (ch=getopt(argc, argv, "w:n:s:m:p:x:z:S:H:t:r:P:h")) != -1 )
+    {
+        switch (ch)
+        {
+            case 'w':
+                gc.output = optarg;
+                break;
+            case 'n':
+                gc.events = ParseNumber(optarg, "event count");
+                break;
+            case 's':
+                gc.seed = ParseNumber(optarg, "seed");
+                break;
+            case 'm':
+                ParseMix(&gc, optarg);
+                break;
+            case 'p':
+                gc.packet_pct = (unsigned int)ParseNumber(optarg, "packet percentage");
+                break;
+            case 'x':
+                gc.extra_pct = (unsigned int)ParseNumber(optarg, "extra data percentage");
+                break;
+            case 'z':
+                if ( (sep=strchr(optarg, ':')) == NULL )
+                    Usage(argv[0]);
+                *sep++ = '\0';
+                gc.payload_min = (unsigned int)ParseNumber(optarg, "payload size");
+                gc.payload_max = (unsigned int)ParseNumber(sep, "payload size");
+                break;
+            case 'S':
+                gc.signatures = (unsigned int)ParseNumber(optarg, "signature count");
+                break;
+            case 'H':
+                gc.hosts = (unsigned int)ParseNumber(optarg, "host count");
+                break;
+            case 't':
+                gc.start = (uint32_t)ParseNumber(optarg, "start time");
+                break;
+            case 'r':
+                gc.rate = (unsigned int)ParseNumber(optarg, "rate");
+                break;
+            case 'P':
+                gc.pcap = optarg;
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+
+    if (gc.output == NULL || optind != argc)
+        Usage(argv[0]);
+
+    if (gc.payload_min > gc.payload_max || gc.payload_max > MAX_PAYLOAD)
+    {
+        fprintf(stderr, "u2gen: payload sizes must be within 0:%d\n", MAX_PAYLOAD);
+        return 1;
+    }
+
+    if (gc.rate == 0 || gc.rate > 1000000 || gc.signatures == 0 || gc.hosts == 0 ||
+        gc.hosts > 65534 || gc.packet_pct > 100 || gc.extra_pct > 100)
+    {
+        fprintf(stderr, "u2gen: option out of range\n");
+        return 1;
+    }
+
+    /* zero would leave xorshift stuck */
+    rng_state = gc.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    if ( (fp=fopen(gc.output, "wb")) == NULL )
+    {
+        fprintf(stderr, "u2gen: unable to open '%s': %s\n", gc.output, strerror(errno));
+        return 1;
+    }
+
+    if (gc.pcap != NULL)
+        ConvertPcap(&gc, fp);
+    else
+        Generate(&gc, fp);
+
+    if (fclose(fp) != 0)
+    {
+        fprintf(stderr, "u2gen: write failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,510 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+/*
+** Description:
+**   Event aggregation stage that sits between the spooler and the output
+**   plugins. Events are keyed on a configurable subset of gid/sid, addresses,
+**   ports and protocol. The first "samples" events of a key, with their
+**   packets, are passed on as usual; further duplicates inside the window are
+**   only counted. When the window of a key closes a summary with the counts
+**   and first/last timestamps is written to the aggregation log.
+**
+**   Keys live in a fixed pool of max_keys entries, indexed by a khash table
+**   and threaded onto a one second time wheel by the time their window
+**   closes. Time is taken from the events themselves so that replaying old
+**   spool files aggregates the same way as live traffic; while idle, the
+**   clock is moved on with the wall clock so quiet keys still get reported.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aggregate.h"
+#include "barnyard2.h"
+#include "khash.h"
+#include "log.h"
+#include "parser.h"
+#include "plugbase.h"
+#include "unified2.h"
+#include "util.h"
+
+#define AGGREGATE_NIL   0xffffffff
+
+typedef struct _AggregateKey    /* what makes an event a duplicate, no padding */
+{
+    uint32_t        gid;
+    uint32_t        sid;
+    uint32_t        src[4];
+    uint32_t        dst[4];
+    uint16_t        sport;
+    uint16_t        dport;
+    uint8_t         proto;
+    uint8_t         family;
+    uint8_t         unused[2];
+} AggregateKey;
+
+typedef struct _AggregateEntry
+{
+    AggregateKey    key;
+    uint32_t        first_sec;
+    uint32_t        first_usec;
+    uint32_t        last_sec;
+    uint32_t        last_usec;
+    uint32_t        sample_event_id;    /* first event passed on */
+    uint32_t        expire;             /* second the window closes */
+    uint64_t        count;
+    uint64_t        suppressed;
+
+    /* time wheel slot list, "next" doubles as the free list link */
+    uint32_t        next;
+    uint32_t        prev;
+} AggregateEntry;
+
+static inline khint_t AggregateKeyHash(AggregateKey key)
+{
+    const uint8_t *k = (const uint8_t *)&key;
+    khint_t h = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(key); i++)
+        h = (h ^ k[i]) * 16777619U;
+
+    return h;
+}
+
+#define AggregateKeyEqual(a, b) (memcmp(&(a), &(b), sizeof(AggregateKey)) == 0)
+
+KHASH_INIT(AggregateKeys, AggregateKey, uint32_t, 1, AggregateKeyHash, AggregateKeyEqual)
+
+typedef struct _AggregateState
+{
+    AggregateConfig         config;
+    khash_t(AggregateKeys)  *keys;
+
+    AggregateEntry          *entries;
+    uint32_t                free_list;
+    uint32_t                used;
+
+    uint32_t                *wheel;
+    uint32_t                wheel_mask;
+
+    uint32_t                now;        /* newest event second seen */
+    time_t                  now_wall;   /* wall clock when "now" last moved */
+
+    FILE                    *log;
+
+    uint64_t                events;
+    uint64_t                suppressed;
+    uint64_t                overflow;   /* passed on because no key was free */
+    uint64_t                summaries;
+} AggregateState;
+
+static AggregateState *agg = NULL;
+
+static void AggregateIdleFunc(int, void *);
+
+static void AggregateFormatAddr(AggregateEntry *e, uint32_t *addr, char *buf, size_t len)
+{
+    if (inet_ntop(e->key.family, addr, buf, len) == NULL)
+        SnortStrncpy(buf, "?", len);
+}
+
+static void AggregateReport(AggregateEntry *e)
+{
+    char src[INET6_ADDRSTRLEN] = "*";
+    char dst[INET6_ADDRSTRLEN] = "*";
+    char sport[8] = "*";
+    char dport[8] = "*";
+    char first[TIMEBUF_SIZE];
+    char last[TIMEBUF_SIZE];
+    char sig[32] = "*";
+    char proto[8] = "*";
+    uint32_t key = agg->config.key;
+
+    if (key & AGGREGATE_KEY_SIG)
+        SnortSnprintf(sig, sizeof(sig), "%u:%u", e->key.gid, e->key.sid);
+    if (key & AGGREGATE_KEY_SRC)
+        AggregateFormatAddr(e, e->key.src, src, sizeof(src));
+    if (key & AGGREGATE_KEY_DST)
+        AggregateFormatAddr(e, e->key.dst, dst, sizeof(dst));
+    if (key & AGGREGATE_KEY_SPORT)
+        SnortSnprintf(sport, sizeof(sport), "%u", e->key.sport);
+    if (key & AGGREGATE_KEY_DPORT)
+        SnortSnprintf(dport, sizeof(dport), "%u", e->key.dport);
+    if (key & AGGREGATE_KEY_PROTO)
+        SnortSnprintf(proto, sizeof(proto), "%u", e->key.proto);
+
+    /* ts_print2() leaves a trailing blank */
+    ts_print2(e->first_sec, e->first_usec, first);
+    ts_print2(e->last_sec, e->last_usec, last);
+    first[strlen(first) - 1] = '\0';
+    last[strlen(last) - 1] = '\0';
+
+    if (agg->log != NULL)
+    {
+        fprintf(agg->log, "[%s] %s:%s -> %s:%s proto %s, " STDu64 " events, "
+                STDu64 " suppressed, first %s, last %s, sample event %u\n",
+                sig, src, sport, dst, dport, proto, e->count, e->suppressed,
+                first, last, e->sample_event_id);
+    }
+    else
+    {
+        LogMessage("aggregate: [%s] %s:%s -> %s:%s proto %s, " STDu64 " events, "
+                STDu64 " suppressed, first %s, last %s, sample event %u\n",
+                sig, src, sport, dst, dport, proto, e->count, e->suppressed,
+                first, last, e->sample_event_id);
+    }
+
+    agg->summaries++;
+}
+
+static void AggregateWheelUnlink(uint32_t idx)
+{
+    AggregateEntry *e = &agg->entries[idx];
+
+    if (e->prev != AGGREGATE_NIL)
+        agg->entries[e->prev].next = e->next;
+    else
+        agg->wheel[e->expire & agg->wheel_mask] = e->next;
+
+    if (e->next != AGGREGATE_NIL)
+        agg->entries[e->next].prev = e->prev;
+}
+
+static void AggregateWheelLink(uint32_t idx)
+{
+    AggregateEntry *e = &agg->entries[idx];
+    uint32_t *slot = &agg->wheel[e->expire & agg->wheel_mask];
+
+    e->prev = AGGREGATE_NIL;
+    e->next = *slot;
+
+    if (*slot != AGGREGATE_NIL)
+        agg->entries[*slot].prev = idx;
+
+    *slot = idx;
+}
+
+/* close the window of a key: report it if anything was held back and
+ * return the entry to the free list */
+static void AggregateExpire(uint32_t idx)
+{
+    AggregateEntry *e = &agg->entries[idx];
+    khiter_t k;
+
+    if (e->suppressed > 0)
+        AggregateReport(e);
+
+    AggregateWheelUnlink(idx);
+
+    k = kh_get(AggregateKeys, agg->keys, e->key);
+    if (k != kh_end(agg->keys))
+        kh_del(AggregateKeys, agg->keys, k);
+
+    e->next = agg->free_list;
+    agg->free_list = idx;
+    agg->used--;
+}
+
+static void AggregateExpireSlot(uint32_t slot, uint32_t now)
+{
+    uint32_t idx = agg->wheel[slot];
+    uint32_t next;
+
+    while (idx != AGGREGATE_NIL)
+    {
+        next = agg->entries[idx].next;
+
+        /* keys a full turn of the wheel away share the slot */
+        if (agg->entries[idx].expire <= now)
+            AggregateExpire(idx);
+
+        idx = next;
+    }
+}
+
+/* move the aggregation clock forward, closing the windows it passes */
+static void AggregateAdvance(uint32_t now)
+{
+    uint32_t t;
+
+    if (agg->now == 0)
+    {
+        agg->now = now;
+        return;
+    }
+
+    if (now <= agg->now)
+        return;
+
+    if (now - agg->now > agg->wheel_mask)
+    {
+        for (t = 0; t <= agg->wheel_mask; t++)
+            AggregateExpireSlot(t, now);
+    }
+    else
+    {
+        for (t = agg->now + 1; t != now + 1; t++)
+            AggregateExpireSlot(t & agg->wheel_mask, now);
+    }
+
+    agg->now = now;
+}
+
+void AggregateInit(AggregateConfig *config)
+{
+    uint32_t wheel_size = 1;
+    uint32_t i;
+
+    if (config == NULL || agg != NULL)
+        return;
+
+    agg = (AggregateState *)SnortAlloc(sizeof(AggregateState));
+    agg->config = *config;
+    agg->config.log_file = NULL;
+
+    /* the wheel must be longer than a window so a slot never holds keys
+     * that close on two different turns it has not reached yet */
+    while (wheel_size <= config->window)
+        wheel_size <<= 1;
+
+    agg->wheel = (uint32_t *)SnortAlloc(wheel_size * sizeof(uint32_t));
+    agg->wheel_mask = wheel_size - 1;
+    for (i = 0; i < wheel_size; i++)
+        agg->wheel[i] = AGGREGATE_NIL;
+
+    agg->entries = (AggregateEntry *)SnortAlloc(config->max_keys * sizeof(AggregateEntry));
+    for (i = 0; i < config->max_keys; i++)
+        agg->entries[i].next = i + 1 < config->max_keys ? i + 1 : AGGREGATE_NIL;
+    agg->free_list = 0;
+
+    agg->keys = kh_init(AggregateKeys);
+    kh_resize(AggregateKeys, agg->keys, config->max_keys);
+
+    if (config->log_file != NULL)
+    {
+        char *filename = ProcessFileOption(barnyard2_conf, config->log_file);
+
+        agg->log = OpenAlertFile(filename);
+        free(filename);
+    }
+
+    AddFuncToIdleList(AggregateIdleFunc, NULL);
+
+    LogMessage("Aggregating events over %u seconds, %u samples per key, "
+               "%u keys\n", config->window, config->samples, config->max_keys);
+}
+
+/*
+ * Decide whether an event goes on to the outputs. Returns 1 for a duplicate
+ * that was folded into its key and must not be output, 0 otherwise.
+ */
+int AggregateEvent(uint32_t type, void *event)
+{
+    Unified2EventCommon *common = (Unified2EventCommon *)event;
+    AggregateKey key;
+    AggregateEntry *e;
+    uint32_t sec, usec, idx;
+    uint32_t mask;
+    khiter_t k;
+    int ret;
+
+    if (agg == NULL || event == NULL)
+        return 0;
+
+    memset(&key, 0, sizeof(key));
+    mask = agg->config.key;
+
+    switch (type)
+    {
+        case UNIFIED2_IDS_EVENT:
+        case UNIFIED2_IDS_EVENT_MPLS:
+        case UNIFIED2_IDS_EVENT_VLAN:
+            key.family = AF_INET;
+            if (mask & AGGREGATE_KEY_SRC)
+                key.src[0] = ((Unified2IDSEvent *)event)->ip_source;
+            if (mask & AGGREGATE_KEY_DST)
+                key.dst[0] = ((Unified2IDSEvent *)event)->ip_destination;
+            if (mask & AGGREGATE_KEY_SPORT)
+                key.sport = ntohs(((Unified2IDSEvent *)event)->sport_itype);
+            if (mask & AGGREGATE_KEY_DPORT)
+                key.dport = ntohs(((Unified2IDSEvent *)event)->dport_icode);
+            if (mask & AGGREGATE_KEY_PROTO)
+                key.proto = ((Unified2IDSEvent *)event)->protocol;
+            break;
+
+        case UNIFIED2_IDS_EVENT_IPV6:
+        case UNIFIED2_IDS_EVENT_IPV6_MPLS:
+        case UNIFIED2_IDS_EVENT_IPV6_VLAN:
+            key.family = AF_INET6;
+            if (mask & AGGREGATE_KEY_SRC)
+                memcpy(key.src, &((Unified2IDSEventIPv6 *)event)->ip_source, 16);
+            if (mask & AGGREGATE_KEY_DST)
+                memcpy(key.dst, &((Unified2IDSEventIPv6 *)event)->ip_destination, 16);
+            if (mask & AGGREGATE_KEY_SPORT)
+                key.sport = ntohs(((Unified2IDSEventIPv6 *)event)->sport_itype);
+            if (mask & AGGREGATE_KEY_DPORT)
+                key.dport = ntohs(((Unified2IDSEventIPv6 *)event)->dport_icode);
+            if (mask & AGGREGATE_KEY_PROTO)
+                key.proto = ((Unified2IDSEventIPv6 *)event)->protocol;
+            break;
+
+        default:
+            return 0;
+    }
+
+    /* the address family only tells keys apart when addresses are in them */
+    if (!(mask & (AGGREGATE_KEY_SRC | AGGREGATE_KEY_DST)))
+        key.family = 0;
+
+    if (mask & AGGREGATE_KEY_SIG)
+    {
+        key.gid = ntohl(common->generator_id);
+        key.sid = ntohl(common->signature_id);
+    }
+
+    sec = ntohl(common->event_second);
+    usec = ntohl(common->event_microsecond);
+
+    agg->events++;
+    AggregateAdvance(sec);
+    agg->now_wall = time(NULL);
+
+    k = kh_get(AggregateKeys, agg->keys, key);
+    if (k != kh_end(agg->keys))
+    {
+        e = &agg->entries[kh_value(agg->keys, k)];
+        e->count++;
+
+        if (sec > e->last_sec || (sec == e->last_sec && usec > e->last_usec))
+        {
+            e->last_sec = sec;
+            e->last_usec = usec;
+        }
+
+        if (e->count <= agg->config.samples)
+            return 0;
+
+        e->suppressed++;
+        agg->suppressed++;
+        pc.total_aggregated++;
+        return 1;
+    }
+
+    if (agg->free_list == AGGREGATE_NIL)
+    {
+        /* fail open rather than lose events when every key is taken */
+        agg->overflow++;
+        return 0;
+    }
+
+    idx = agg->free_list;
+    e = &agg->entries[idx];
+    agg->free_list = e->next;
+    agg->used++;
+
+    k = kh_put(AggregateKeys, agg->keys, key, &ret);
+    kh_value(agg->keys, k) = idx;
+
+    e->key = key;
+    e->first_sec = e->last_sec = sec;
+    e->first_usec = e->last_usec = usec;
+    e->sample_event_id = ntohl(common->event_id);
+    e->count = 1;
+    e->suppressed = 0;
+
+    /* events older than the clock still get a full window */
+    e->expire = (sec > agg->now ? sec : agg->now) + agg->config.window;
+    AggregateWheelLink(idx);
+
+    return 0;
+}
+
+/* keep closing windows while no events arrive */
+static void AggregateIdleFunc(int signal, void *arg)
+{
+    time_t wall;
+
+    if (agg == NULL || agg->now == 0)
+        return;
+
+    wall = time(NULL);
+
+    if (wall > agg->now_wall)
+    {
+        AggregateAdvance(agg->now + (uint32_t)(wall - agg->now_wall));
+        agg->now_wall = wall;
+    }
+
+    if (agg->log != NULL)
+        fflush(agg->log);
+}
+
+/* report every open key and release the aggregation state */
+void AggregateCleanup(void)
+{
+    uint32_t t;
+
+    if (agg == NULL)
+        return;
+
+    for (t = 0; t <= agg->wheel_mask; t++)
+    {
+        while (agg->wheel[t] != AGGREGATE_NIL)
+            AggregateExpire(agg->wheel[t]);
+    }
+
+    LogMessage("aggregate: " STDu64 " events, " STDu64 " suppressed, "
+               STDu64 " summaries, " STDu64 " passed on with the key table full\n",
+               agg->events, agg->suppressed, agg->summaries, agg->overflow);
+
+    if (agg->log != NULL)
+        fclose(agg->log);
+
+    kh_destroy(AggregateKeys, agg->keys);
+    free(agg->entries);
+    free(agg->wheel);
+    free(agg);
+    agg = NULL;
+}
+
+void AggregateConfigFree(AggregateConfig *config)
+{
+    if (config == NULL)
+        return;
+
+    if (config->log_file != NULL)
+        free(config->log_file);
+
+    free(config);
+}
@@ -0,0 +1,64 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+#ifndef __AGGREGATE_H__
+#define __AGGREGATE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include "sf_types.h"
+
+/* fields that make two events duplicates of each other */
+#define AGGREGATE_KEY_SIG           0x01    /* gid and sid */
+#define AGGREGATE_KEY_SRC           0x02
+#define AGGREGATE_KEY_DST           0x04
+#define AGGREGATE_KEY_SPORT         0x08
+#define AGGREGATE_KEY_DPORT         0x10
+#define AGGREGATE_KEY_PROTO         0x20
+#define AGGREGATE_KEY_DEFAULT       0x3f
+
+#define AGGREGATE_DEFAULT_WINDOW    60
+#define AGGREGATE_MAX_WINDOW        86400
+#define AGGREGATE_DEFAULT_SAMPLES   1
+#define AGGREGATE_DEFAULT_MAX_KEYS  65536
+#define AGGREGATE_MAX_KEYS          (1 << 24)
+
+/* set by "config aggregate", NULL when aggregation is off */
+typedef struct _AggregateConfig
+{
+    uint32_t    key;            /* AGGREGATE_KEY_* */
+    uint32_t    window;         /* seconds from the first event of a key */
+    uint32_t    samples;        /* events per key and window passed on */
+    uint32_t    max_keys;       /* keys tracked at once */
+    char        *log_file;      /* summaries, LogMessage() if NULL */
+} AggregateConfig;
+
+void AggregateInit(AggregateConfig *);
+int AggregateEvent(uint32_t, void *);
+void AggregateCleanup(void);
+void AggregateConfigFree(AggregateConfig *);
+
+#endif /* __AGGREGATE_H__ */
@@ -141,6 +141,7 @@ OutputConfigFuncNode *output_config_funcs = NULL;
 PluginSignalFuncNode *plugin_shutdown_funcs = NULL;
 PluginSignalFuncNode *plugin_clean_exit_funcs = NULL;
 PluginSignalFuncNode *plugin_restart_funcs = NULL;
+PluginSignalFuncNode *plugin_idle_funcs = NULL;
 
 InputFuncNode *InputList = NULL;
 OutputFuncNode *AlertList = NULL;   /* Alert function list */
@@ -212,6 +213,7 @@ static void SetNoCores(void);
 #endif
 
 static void Barnyard2Cleanup(int,int);
+static void Barnyard2Finish(void);
 
 static void FreeInputConfigs(InputConfig *);
 static void FreeOutputConfigs(OutputConfig *);
@@ -364,6 +366,9 @@ restart:
 		}
 	    }
         }
+
+        /* let the output plugins close their files properly */
+        Barnyard2Finish();
     }
     /* Continual processing mode */
     else if (BcContinuousMode())
@@ -378,7 +383,7 @@ restart:
 	    goto restart;
 	}
     }
-    
+
 #ifndef WIN32
     closelog();
 #endif
@@ -1066,6 +1071,29 @@ void CleanExit(int exit_val)
 }
 
 
+/*
+ * Runs the output plugins' clean exit functions, so queued events are
+ * drained and files are closed, then leaves the final aggregate and metrics
+ * reports behind.  Batch mode and the signal driven exit both end here.
+ */
+static void Barnyard2Finish(void)
+{
+    PluginSignalFuncNode *idxPlugin = plugin_clean_exit_funcs;
+    PluginSignalFuncNode *idxPluginNext = NULL;
+
+    while(idxPlugin)
+    {
+        idxPluginNext = idxPlugin->next;
+        idxPlugin->func(SIGQUIT, idxPlugin->arg);
+        free(idxPlugin);
+        idxPlugin = idxPluginNext;
+    }
+    plugin_clean_exit_funcs = NULL;
+
+    AggregateCleanup();
+    MetricsCleanup();
+}
+
 static void Barnyard2Cleanup(int exit_val,int exit_needed)
 {
     PluginSignalFuncNode *idxPlugin = NULL;
@@ -1086,15 +1114,7 @@ static void Barnyard2Cleanup(int exit_val,int exit_needed)
     if (BcContinuousMode() || BcBatchMode())
     {
         /* Do some post processing on any incomplete Plugin Data */
-	idxPlugin = plugin_clean_exit_funcs;
-        while(idxPlugin)
-        {
-	    idxPluginNext = idxPlugin->next;
-            idxPlugin->func(SIGQUIT, idxPlugin->arg);
-	    free(idxPlugin);
-            idxPlugin = idxPluginNext;
-        }
-	plugin_clean_exit_funcs = NULL;
+        Barnyard2Finish();
     }
 
 
@@ -1123,6 +1143,15 @@ static void Barnyard2Cleanup(int exit_val,int exit_needed)
         }
 	plugin_shutdown_funcs = NULL;
 
+	idxPlugin = plugin_idle_funcs;
+	while(idxPlugin)
+        {
+            idxPluginNext = idxPlugin->next;
+            free(idxPlugin);
+            idxPlugin = idxPluginNext;
+        }
+	plugin_idle_funcs = NULL;
+
     
     if (!exit_val)
     {
@@ -1145,15 +1174,7 @@ static void Barnyard2Cleanup(int exit_val,int exit_needed)
     if (BcContinuousMode() || BcBatchMode() || BcTestMode())
     {
         /* Do some post processing on any incomplete Plugin Data */
-        idxPlugin = plugin_clean_exit_funcs;
-        while(idxPlugin)
-        {
-	    idxPluginNext = idxPlugin->next;
-            idxPlugin->func(SIGQUIT, idxPlugin->arg);
-	    free(idxPlugin);
-            idxPlugin = idxPluginNext;
-        }
-	plugin_clean_exit_funcs = NULL;
+        Barnyard2Finish();
     }
 
     /* Print Statistics */
@@ -1429,6 +1450,9 @@ Barnyard2Config * Barnyard2ConfNew(void)
     bc->user_id = -1;
     bc->group_id = -1;
 
+    /* lowered to what the outputs need by ConfigureOutputPlugins() */
+    bc->decode_level = DECODE_LEVEL__PAYLOAD;
+
     memset(bc->pid_path, 0, sizeof(bc->pid_path));
     memset(bc->pid_filename, 0, sizeof(bc->pid_filename));
     memset(bc->pidfile_suffix, 0, sizeof(bc->pidfile_suffix));
@@ -1534,6 +1558,10 @@ void Barnyard2ConfFree(Barnyard2Config *bc)
     }
 
     FreeSigSuppression(&bc->ssHead);
+    AggregateConfigFree(bc->aggregate);
+    bc->aggregate = NULL;
+    MetricsConfigFree(bc->metrics);
+    bc->metrics = NULL;
     FreeSigNodes(&bc->sigHead);
     FreeClassifications(&bc->classifications);
     FreeReferences(&bc->references);
@@ -1901,6 +1929,7 @@ static void Barnyard2Init(int argc, char **argv)
          * If output plugins should become dynamic, this needs to move */
         RegisterInputPlugins();
         RegisterOutputPlugins();
+        DecodeInit();
     }
 
     /* if we're using the rules system, it gets initialized here */
@@ -2003,6 +2032,9 @@ static void Barnyard2PostInit(void)
 
     PostConfigInitPlugins(barnyard2_conf->plugin_post_config_funcs);
 
+    AggregateInit(barnyard2_conf->aggregate);
+    MetricsInit(barnyard2_conf->metrics);
+
 #ifdef DEBUG
         DumpInputPlugins();
         DumpOutputPlugins();
@@ -50,6 +50,8 @@
 #include "map.h"
 #include "sf_types.h"
 #include "spooler.h"
+#include "aggregate.h"
+#include "metrics.h"
 
 /* TODO: check this should live in the plugin */
 #if defined(HAVE_LIBPRELUDE)
@@ -389,6 +391,7 @@ typedef struct _Barnyard2Config
     int usr_signal;
     int cant_hup_signal;
     unsigned int event_cache_size;
+    int decode_level;               /* DecodeLevel the outputs need */
     uint8_t verbose;                /* -v */
     uint8_t localtime;
 
@@ -399,6 +402,8 @@ typedef struct _Barnyard2Config
     vartable_t *ip_vartable;
 #endif
     SigSuppress_list *ssHead;
+    AggregateConfig *aggregate;    /* config aggregate */
+    MetricsConfig *metrics;        /* config metrics */
     
     ClassType *classifications;
     ReferenceSystemNode *references;
@@ -443,6 +448,9 @@ typedef struct _PacketCount
     uint64_t total_processed;
     uint64_t total_unknown;
     uint64_t total_suppressed;
+    uint64_t total_aggregated;
+    uint64_t total_extra_data;
+    uint64_t total_extra_unmatched;     /* no cached event to attach to */
 
     uint64_t s5tcp1;
     uint64_t s5tcp2;
@@ -495,6 +503,10 @@ typedef struct _PacketCount
     uint64_t gre_loopback;
     uint64_t gre_vlan;
     uint64_t gre_ppp;
+
+    uint64_t vxlan;
+    uint64_t geneve;
+    uint64_t gtp;
 #endif
 
     uint64_t discards;
@@ -683,6 +695,11 @@ static INLINE int BcProcessNewRecordsOnly(void)
     return barnyard2_conf->process_new_records_only_flag;
 }
 
+static INLINE int BcDecodeLevel(void)
+{
+    return barnyard2_conf->decode_level;
+}
+
 static INLINE int BcVerboseByteDump(void)
 {
     return barnyard2_conf->output_flags & OUTPUT_FLAG__VERBOSE_DUMP;
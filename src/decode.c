@@ -108,159 +108,458 @@ IPH_API ip6 =
     };
 #endif
 
-int DecodePacket(int linktype, Packet *p, const struct pcap_pkthdr *pkthdr, const uint8_t *pkt)
+/*
+ * Decoder registry
+ *
+ * The datalink decoders are looked up by DLT once per linktype (the spooler
+ * keeps the result), the next layer by ethertype and IP protocol through
+ * tables filled in by DecodeInit(), so dispatch is an index and an indirect
+ * call. New decoders only have to be registered there.
+ */
+#define MAX_DATALINK_DECODERS   32
+#define MAX_ETHERTYPE_DECODERS  32
+
+typedef struct _DatalinkDecoder
+{
+    int linktype;
+    DatalinkDecodeFunc func;
+    const char *no_datalink_msg;    /* for -e when it has no layer 2 header */
+
+} DatalinkDecoder;
+
+typedef struct _IPProtoDecoder
+{
+    ProtoDecodeFunc func;
+    uint64_t *count;                /* PacketCount member to increment */
+
+} IPProtoDecoder;
+
+static DatalinkDecoder datalink_decoders[MAX_DATALINK_DECODERS];
+static int num_datalink_decoders = 0;
+
+/* slot 0 is the decoder for unknown ethertypes */
+static uint8_t ethertype_slots[0x10000];
+static ProtoDecodeFunc ethertype_decoders[MAX_ETHERTYPE_DECODERS];
+static int num_ethertype_decoders = 0;
+
+static IPProtoDecoder ip_decoders[256];
+#ifdef SUP_IP6
+static IPProtoDecoder ipv6_decoders[256];
+#endif
+static uint64_t uncounted;
+
+#ifdef GRE
+#define MAX_UDP_TUNNEL_DECODERS 8
+
+/* slot 0 is for ports that aren't tunnels */
+static uint8_t udp_tunnel_slots[0x10000];
+static ProtoDecodeFunc udp_tunnel_decoders[MAX_UDP_TUNNEL_DECODERS];
+static int num_udp_tunnel_decoders = 1;
+#endif
+
+static int decoders_registered = 0;
+
+static const char *tunnel_names[TUNNEL_TYPE__MAX] =
+{
+    "none", "ipip", "gre", "vxlan", "geneve", "gtp"
+};
+
+static INLINE void DecodeEthertype(uint16_t type, const uint8_t *pkt,
+                                   const uint32_t len, Packet *p)
+{
+    ethertype_decoders[ethertype_slots[type]](pkt, len, p);
+}
+
+static INLINE void DecodeIPProto(const IPProtoDecoder *table, uint8_t proto,
+                                 const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    const IPProtoDecoder *d = &table[proto];
+
+    (*d->count)++;
+    d->func(pkt, len, p);
+}
+
+static void DecodeUnknownEthertype(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    pc.other++;
+}
+
+/* protocols without a decoder, the rest of the datagram is the payload */
+static void DecodeIPPayload(const uint8_t *pkt, const uint32_t len, Packet *p)
 {
-	DEBUG_WRAP(DebugMessage(DEBUG_DECODE,"Decoding linktype %d\n",linktype););
-    switch(linktype)
+    p->data = pkt;
+    p->dsize = (uint16_t)len;
+}
+
+#ifndef NO_NON_ETHER_DECODER
+/* DecodePPPoEPkt() parses from the Ethernet header, so PPPoE is only
+ * decoded straight after one */
+static void DecodePPPoEEthertype(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    if (pkt != p->pkt + ETHERNET_HEADER_LEN)
     {
-		case DLT_EN10MB:        /* Ethernet */
-            DecodeEthPkt(p, pkthdr, pkt);
-            break;
+        pc.other++;
+        return;
+    }
 
-#ifdef DLT_IEEE802_11
-        case DLT_IEEE802_11:
-            DecodeIEEE80211Pkt(p, pkthdr, pkt);
-            break;
+    DecodePPPoEPkt(p, p->pkth, p->pkt);
+}
 #endif
-#ifdef DLT_ENC
-        case DLT_ENC:           /* Encapsulated data */
-            DecodeEncPkt(p, pkthdr, pkt);
-            break;
 
+#ifdef MPLS
+static void DecodeMPLSEthertype(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    struct pcap_pkthdr pkthdrTmp;
+
+    pkthdrTmp.caplen = len;
+    pkthdrTmp.len = p->pkth->len - (p->pkth->caplen - len);
+    DecodeMPLS(pkt, &pkthdrTmp, p);
+}
+#endif
+
+#ifdef SUP_IP6
+void DecodeICMP6(const uint8_t *, uint32_t, Packet *);
+void DecodeIPV6Options(int, const uint8_t *, uint32_t, Packet *);
+
+static void DecodeIPV6ExtHdr(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    DecodeIPV6Options(p->ip6h->next, pkt, len, p);
+}
+
+static void DecodeIPV6NoNext(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    p->dsize = 0;
+}
+#endif
+
+#ifdef GRE
+/* records the tunnel the packet enters at hdr, or returns NULL if it is
+ * already TUNNEL_MAX_DEPTH tunnels deep */
+static TunnelLayer *PushTunnel(Packet *p, uint8_t type, const uint8_t *hdr,
+                               uint16_t sp, uint16_t dp)
+{
+    TunnelLayer *t;
+
+    if (p->tunnel_depth >= TUNNEL_MAX_DEPTH)
+        return NULL;
+
+    t = &p->tunnels[p->tunnel_depth++];
+    t->iph = p->iph;
+    t->hdr = hdr;
+    t->id = 0;
+    t->sp = sp;
+    t->dp = dp;
+    t->type = type;
+#ifdef SUP_IP6
+    t->family = (uint8_t)p->family;
 #else
-        case 13:
-#endif /* DLT_ENC */
-        case DLT_IEEE802:                /* Token Ring */
-            DecodeTRPkt(p, pkthdr, pkt);
-            break;
+    t->family = AF_INET;
+#endif
 
-        case DLT_FDDI:                /* FDDI */
-            DecodeFDDIPkt(p, pkthdr, pkt);
-            break;
+    return t;
+}
 
-#ifdef DLT_CHDLC
-        case DLT_CHDLC:              /* Cisco HDLC */
-            DecodeChdlcPkt(p, pkthdr, pkt);
-            break;
+/* the outer UDP header belongs to the tunnel layer from here on */
+static TunnelLayer *PushUDPTunnel(Packet *p, uint8_t type, const uint8_t *hdr)
+{
+    TunnelLayer *t = PushTunnel(p, type, hdr, p->sp, p->dp);
+
+    if (t != NULL)
+    {
+        p->udph = NULL;
+        p->sp = p->dp = 0;
+    }
+
+    return t;
+}
+
+static void DecodeIP4Tunnel(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    if (PushTunnel(p, TUNNEL_TYPE__IPIP, pkt, 0, 0) == NULL)
+    {
+        DecoderAlertGRE(p, DECODE_GRE_MULTIPLE_ENCAPSULATION,
+                        DECODE_GRE_MULTIPLE_ENCAPSULATION_STR,
+                        pkt, len);
+        return;
+    }
+
+    DecodeIP(pkt, len, p);
+}
+
+static void DecodeIP6Tunnel(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    if (PushTunnel(p, TUNNEL_TYPE__IPIP, pkt, 0, 0) == NULL)
+    {
+        DecoderAlertGRE(p, DECODE_GRE_MULTIPLE_ENCAPSULATION,
+                        DECODE_GRE_MULTIPLE_ENCAPSULATION_STR,
+                        pkt, len);
+        return;
+    }
+
+    DecodeIPV6(pkt, len, p);
+}
 #endif
 
-        case DLT_SLIP:                /* Serial Line Internet Protocol */
-            if (BcOutputDataLink())
-            {
-                LogMessage("Second layer header parsing for this datalink "
-                        "isn't implemented yet\n");
+const char *TunnelName(uint8_t type)
+{
+    if (type >= TUNNEL_TYPE__MAX)
+        return "unknown";
 
-                barnyard2_conf->output_flags &= ~OUTPUT_FLAG__SHOW_DATA_LINK;
-            }
-            DecodeSlipPkt(p, pkthdr, pkt);
+    return tunnel_names[type];
+}
 
+void RegisterDatalinkDecoder(int linktype, DatalinkDecodeFunc func,
+                             const char *no_datalink_msg)
+{
+    int i;
+
+    for (i = 0; i < num_datalink_decoders; i++)
+    {
+        if (datalink_decoders[i].linktype == linktype)
             break;
+    }
 
-        case DLT_PPP:                /* point-to-point protocol */
-            if (BcOutputDataLink())
-            {
-                /* do we need ppp header showup? it's only 4 bytes anyway ;-) */
-                LogMessage("Second layer header parsing for this datalink "
-                        "isn't implemented yet\n");
+    if (i == MAX_DATALINK_DECODERS)
+        FatalError("Too many datalink decoders, can't add %d\n", linktype);
 
-                barnyard2_conf->output_flags &= ~OUTPUT_FLAG__SHOW_DATA_LINK;
-            }
-            DecodePppPkt(p, pkthdr, pkt);
-            break;
+    if (i == num_datalink_decoders)
+        num_datalink_decoders++;
 
-#ifdef DLT_PPP_SERIAL
-        case DLT_PPP_SERIAL:         /* PPP with full HDLC header*/
-            if (BcOutputDataLink())
-            {
-                /* do we need ppp header showup? it's only 4 bytes anyway ;-) */
-                LogMessage("Second layer header parsing for this datalink "
-                        "isn't implemented yet\n");
-                
-                barnyard2_conf->output_flags &= ~OUTPUT_FLAG__SHOW_DATA_LINK;
-            }
-            DecodePppSerialPkt(p, pkthdr, pkt);
+    datalink_decoders[i].linktype = linktype;
+    datalink_decoders[i].func = func;
+    datalink_decoders[i].no_datalink_msg = no_datalink_msg;
+}
+
+void RegisterEthertypeDecoder(uint16_t type, ProtoDecodeFunc func)
+{
+    int i;
+
+    /* types with the same decoder share its slot */
+    for (i = 0; i < num_ethertype_decoders; i++)
+    {
+        if (ethertype_decoders[i] == func)
             break;
+    }
+
+    if (i == MAX_ETHERTYPE_DECODERS)
+        FatalError("Too many ethertype decoders, can't add 0x%04X\n", type);
+
+    if (i == num_ethertype_decoders)
+        ethertype_decoders[num_ethertype_decoders++] = func;
+
+    ethertype_slots[type] = (uint8_t)i;
+}
+
+void RegisterIPDecoder(uint8_t proto, ProtoDecodeFunc func, uint64_t *count)
+{
+    ip_decoders[proto].func = func;
+    ip_decoders[proto].count = count ? count : &uncounted;
+}
+
+#ifdef SUP_IP6
+void RegisterIPV6Decoder(uint8_t proto, ProtoDecodeFunc func, uint64_t *count)
+{
+    ipv6_decoders[proto].func = func;
+    ipv6_decoders[proto].count = count ? count : &uncounted;
+}
 #endif
 
-#ifdef DLT_LINUX_SLL
-        case DLT_LINUX_SLL:
-            DecodeLinuxSLLPkt(p, pkthdr, pkt);
+#ifdef GRE
+/* decodes UDP datagrams to the port as a tunnel */
+void RegisterUDPTunnelDecoder(uint16_t port, ProtoDecodeFunc func)
+{
+    int i;
+
+    for (i = 1; i < num_udp_tunnel_decoders; i++)
+    {
+        if (udp_tunnel_decoders[i] == func)
             break;
+    }
+
+    if (i == MAX_UDP_TUNNEL_DECODERS)
+        FatalError("Too many UDP tunnel decoders, can't add port %u\n", port);
+
+    if (i == num_udp_tunnel_decoders)
+        udp_tunnel_decoders[num_udp_tunnel_decoders++] = func;
+
+    udp_tunnel_slots[port] = (uint8_t)i;
+}
 #endif
 
+void DecodeInit(void)
+{
+    int i;
+
+    if (decoders_registered)
+        return;
+
+    decoders_registered = 1;
+
+    /* datalinks */
+    RegisterDatalinkDecoder(DLT_EN10MB, DecodeEthPkt, NULL);
+#ifdef DLT_IEEE802_11
+    RegisterDatalinkDecoder(DLT_IEEE802_11, DecodeIEEE80211Pkt, NULL);
+#endif
+#ifdef DLT_ENC
+    RegisterDatalinkDecoder(DLT_ENC, DecodeEncPkt, NULL);
+#else
+    RegisterDatalinkDecoder(13, DecodeTRPkt, NULL);
+#endif
+    RegisterDatalinkDecoder(DLT_IEEE802, DecodeTRPkt, NULL);
+    RegisterDatalinkDecoder(DLT_FDDI, DecodeFDDIPkt, NULL);
+#ifdef DLT_CHDLC
+    RegisterDatalinkDecoder(DLT_CHDLC, DecodeChdlcPkt, NULL);
+#endif
+    RegisterDatalinkDecoder(DLT_SLIP, DecodeSlipPkt,
+        "Second layer header parsing for this datalink isn't implemented yet\n");
+    RegisterDatalinkDecoder(DLT_PPP, DecodePppPkt,
+        "Second layer header parsing for this datalink isn't implemented yet\n");
+#ifdef DLT_PPP_SERIAL
+    RegisterDatalinkDecoder(DLT_PPP_SERIAL, DecodePppSerialPkt,
+        "Second layer header parsing for this datalink isn't implemented yet\n");
+#endif
+#ifdef DLT_LINUX_SLL
+    RegisterDatalinkDecoder(DLT_LINUX_SLL, DecodeLinuxSLLPkt, NULL);
+#endif
 #ifdef DLT_PFLOG
-        case DLT_PFLOG:
-            DecodePflog(p, pkthdr, pkt);
-            break;
+    RegisterDatalinkDecoder(DLT_PFLOG, DecodePflog, NULL);
 #endif
-
 #ifdef DLT_OLDPFLOG
-        case DLT_OLDPFLOG:
-            DecodeOldPflog(p, pkthdr, pkt);
-            break;
+    RegisterDatalinkDecoder(DLT_OLDPFLOG, DecodeOldPflog, NULL);
 #endif
-
 #ifdef DLT_LOOP
-        case DLT_LOOP:
+    RegisterDatalinkDecoder(DLT_LOOP, DecodeNullPkt,
+        "Data link layer header parsing for this network  type isn't implemented yet\n");
 #endif
-        case DLT_NULL:            /* loopback and stuff.. you wouldn't perform
-                                   * intrusion detection on it, but it's ok for
-                                   * testing. */
-            if (BcOutputDataLink())
-            {
-                LogMessage("Data link layer header parsing for this network "
-                        " type isn't implemented yet\n");
-
-                barnyard2_conf->output_flags &= ~OUTPUT_FLAG__SHOW_DATA_LINK;
-            }
-            DecodeNullPkt(p, pkthdr, pkt);
-            break;
-
-
+    RegisterDatalinkDecoder(DLT_NULL, DecodeNullPkt,
+        "Data link layer header parsing for this network  type isn't implemented yet\n");
 #ifdef DLT_RAW
-        case DLT_RAW:
+    RegisterDatalinkDecoder(DLT_RAW, DecodeRawPkt,
+        "There's no second layer header available for this datalink\n");
+#endif
+    /* DLT_IPV4 and DLT_IPV6 in some bpf implementations */
+    RegisterDatalinkDecoder(228, DecodeRawPkt,
+        "There's no second layer header available for this datalink\n");
+    RegisterDatalinkDecoder(229, DecodeRawPkt,
+        "There's no second layer header available for this datalink\n");
+    /* you need the I4L modified version of libpcap for these */
+#ifdef DLT_I4L_RAWIP
+    RegisterDatalinkDecoder(DLT_I4L_RAWIP, DecodeI4LRawIPPkt, NULL);
+#endif
+#ifdef DLT_I4L_IP
+    RegisterDatalinkDecoder(DLT_I4L_IP, DecodeEthPkt, NULL);
+#endif
+#ifdef DLT_I4L_CISCOHDLC
+    RegisterDatalinkDecoder(DLT_I4L_CISCOHDLC, DecodeI4LCiscoIPPkt, NULL);
 #endif
-        case 228:       /*Defined in some bpf implementation as  DLT_IPV4: */
-        case 229:      /* Defined in some bpf implementation as     DLT_IPV6 */
 
-            if (BcOutputDataLink())
-            {
-                LogMessage("There's no second layer header available for "
-                     "this datalink\n");
+    /* ethertypes, after Ethernet and VLAN headers */
+    RegisterEthertypeDecoder(0, DecodeUnknownEthertype);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_IP, DecodeIP);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_ARP, DecodeARP);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_REVARP, DecodeARP);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_IPV6, DecodeIPV6);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_LOOP, DecodeEthLoopback);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_8021Q, DecodeVlan);
+#ifndef NO_NON_ETHER_DECODER
+    RegisterEthertypeDecoder(ETHERNET_TYPE_PPPoE_DISC, DecodePPPoEEthertype);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_PPPoE_SESS, DecodePPPoEEthertype);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_IPX, DecodeIPX);
+#endif
+#ifdef MPLS
+    RegisterEthertypeDecoder(ETHERNET_TYPE_MPLS_MULTICAST, DecodeMPLSEthertype);
+    RegisterEthertypeDecoder(ETHERNET_TYPE_MPLS_UNICAST, DecodeMPLSEthertype);
+#endif
 
-                barnyard2_conf->output_flags &= ~OUTPUT_FLAG__SHOW_DATA_LINK;
-            }
-            DecodeRawPkt(p, pkthdr, pkt);
-            break;
+    /* IP protocols, after the IPv4 header */
+    for (i = 0; i < 256; i++)
+        RegisterIPDecoder((uint8_t)i, DecodeIPPayload, &pc.other);
 
-            /*
-             * you need the I4L modified version of libpcap to get this stuff
-             * working
-             */
-#ifdef DLT_I4L_RAWIP
-        case DLT_I4L_RAWIP:
-            DecodeI4LRawIPPkt(p, pkthdr, pkt);
-            break;
+    RegisterIPDecoder(IPPROTO_TCP, DecodeTCP, &pc.tcp);
+    RegisterIPDecoder(IPPROTO_UDP, DecodeUDP, &pc.udp);
+    RegisterIPDecoder(IPPROTO_ICMP, DecodeICMP, &pc.icmp);
+#ifdef GRE
+    RegisterIPDecoder(IPPROTO_IPV6, DecodeIP6Tunnel, &pc.ip4ip6);
+    RegisterIPDecoder(IPPROTO_GRE, DecodeGRE, &pc.gre);
+    RegisterIPDecoder(IPPROTO_IPIP, DecodeIP4Tunnel, &pc.ip4ip4);
 #endif
 
-#ifdef DLT_I4L_IP
-        case DLT_I4L_IP:
-            DecodeEthPkt(p, pkthdr, pkt);
-            break;
+#ifdef SUP_IP6
+    /* and after the IPv6 header and each extension header */
+    for (i = 0; i < 256; i++)
+        RegisterIPV6Decoder((uint8_t)i, DecodeIPPayload, &pc.other);
+
+    RegisterIPV6Decoder(IPPROTO_TCP, DecodeTCP, &pc.tcp6);
+    RegisterIPV6Decoder(IPPROTO_UDP, DecodeUDP, &pc.udp6);
+    RegisterIPV6Decoder(IPPROTO_ICMP, DecodeICMP, &pc.icmp);
+    RegisterIPV6Decoder(IPPROTO_ICMPV6, DecodeICMP6, &pc.icmp6);
+    RegisterIPV6Decoder(IPPROTO_NONE, DecodeIPV6NoNext, NULL);
+    RegisterIPV6Decoder(IPPROTO_HOPOPTS, DecodeIPV6ExtHdr, NULL);
+    RegisterIPV6Decoder(IPPROTO_DSTOPTS, DecodeIPV6ExtHdr, NULL);
+    RegisterIPV6Decoder(IPPROTO_ROUTING, DecodeIPV6ExtHdr, NULL);
+    RegisterIPV6Decoder(IPPROTO_FRAGMENT, DecodeIPV6ExtHdr, NULL);
+#ifdef GRE
+    RegisterIPV6Decoder(IPPROTO_GRE, DecodeGRE, &pc.gre);
+    RegisterIPV6Decoder(IPPROTO_IPIP, DecodeIP4Tunnel, &pc.ip6ip4);
+    RegisterIPV6Decoder(IPPROTO_IPV6, DecodeIP6Tunnel, &pc.ip6ip6);
+#endif
 #endif
 
-#ifdef DLT_I4L_CISCOHDLC
-        case DLT_I4L_CISCOHDLC:
-            DecodeI4LCiscoIPPkt(p, pkthdr, pkt);
-            break;
+#ifdef GRE
+    /* UDP tunnels */
+    RegisterUDPTunnelDecoder(VXLAN_PORT, DecodeVXLAN);
+    RegisterUDPTunnelDecoder(GENEVE_PORT, DecodeGENEVE);
+    RegisterUDPTunnelDecoder(GTPU_PORT, DecodeGTPU);
 #endif
+}
+
+/* NULL if there's no decoder for the linktype */
+DatalinkDecodeFunc GetDatalinkDecoder(int linktype)
+{
+    int i;
+
+    DecodeInit();
+
+    for (i = 0; i < num_datalink_decoders; i++)
+    {
+        if (datalink_decoders[i].linktype != linktype)
+            continue;
+
+        if (datalink_decoders[i].no_datalink_msg != NULL && BcOutputDataLink())
+        {
+            LogMessage("%s", datalink_decoders[i].no_datalink_msg);
+            barnyard2_conf->output_flags &= ~OUTPUT_FLAG__SHOW_DATA_LINK;
+        }
 
-        default:            /* oops, don't know how to handle this one */
-            ErrorMessage("\nCannot handle data link type %d\n", linktype);
+        return datalink_decoders[i].func;
     }
 
+    return NULL;
+}
+
+/* decode with a decoder from GetDatalinkDecoder() */
+void DecodeDatalink(DatalinkDecodeFunc decoder, int linktype, Packet *p,
+                    const struct pcap_pkthdr *pkthdr, const uint8_t *pkt)
+{
+    DEBUG_WRAP(DebugMessage(DEBUG_DECODE,"Decoding linktype %d\n",linktype););
+
+    if (decoder != NULL)
+        decoder(p, pkthdr, pkt);
+    else
+        ErrorMessage("\nCannot handle data link type %d\n", linktype);
+
+    /* portscan pseudo packets (IP protocol 255) fail the IP length checks,
+     * their header is still wanted for logging */
+    if (p->iph == NULL && p->inner_iph != NULL && p->inner_iph->ip_proto == 255)
+        p->iph = p->inner_iph;
+
     /* add linktype to this packet for per plugin tracking */
     p->linktype = linktype;
+}
+
+int DecodePacket(int linktype, Packet *p, const struct pcap_pkthdr *pkthdr, const uint8_t *pkt)
+{
+    DecodeDatalink(GetDatalinkDecoder(linktype), linktype, p, pkthdr, pkt);
 
     return 0;
 }
@@ -349,74 +648,8 @@ void DecodeEthPkt(Packet * p, const struct pcap_pkthdr * pkthdr, const uint8_t *
             );
 
     /* grab out the network type */
-    switch(ntohs(p->eh->ether_type))
-    {
-        case ETHERNET_TYPE_IP:
-            DEBUG_WRAP(
-                    DebugMessage(DEBUG_DECODE, 
-                        "IP datagram size calculated to be %lu bytes\n",
-                        (unsigned long)(cap_len - ETHERNET_HEADER_LEN));
-                    );
-
-            DecodeIP(p->pkt + ETHERNET_HEADER_LEN, 
+    DecodeEthertype(ntohs(p->eh->ether_type), p->pkt + ETHERNET_HEADER_LEN,
                     cap_len - ETHERNET_HEADER_LEN, p);
-
-            return;
-
-        case ETHERNET_TYPE_ARP:
-        case ETHERNET_TYPE_REVARP:
-            DecodeARP(p->pkt + ETHERNET_HEADER_LEN, 
-                    cap_len - ETHERNET_HEADER_LEN, p);
-            return;
-
-        case ETHERNET_TYPE_IPV6:
-            DecodeIPV6(p->pkt + ETHERNET_HEADER_LEN, 
-                    (cap_len - ETHERNET_HEADER_LEN), p);
-            return;
-
-#ifndef NO_NON_ETHER_DECODER
-        case ETHERNET_TYPE_PPPoE_DISC:
-        case ETHERNET_TYPE_PPPoE_SESS:
-            DecodePPPoEPkt(p, pkthdr, pkt);
-           return;
-
-        case ETHERNET_TYPE_IPX:
-            DecodeIPX(p->pkt + ETHERNET_HEADER_LEN, 
-                    (cap_len - ETHERNET_HEADER_LEN), p);
-            return;
-#endif
-
-        case ETHERNET_TYPE_LOOP:
-            DecodeEthLoopback(p->pkt + ETHERNET_HEADER_LEN, 
-                    (cap_len - ETHERNET_HEADER_LEN), p);
-            return; 
-
-        case ETHERNET_TYPE_8021Q:
-            DecodeVlan(p->pkt + ETHERNET_HEADER_LEN, 
-                    cap_len - ETHERNET_HEADER_LEN, p);
-            return; 
-#ifdef MPLS
-        case ETHERNET_TYPE_MPLS_MULTICAST:
-// barnyard2 should not add additional events
-//            if(!ScMplsMulticast())
-//            {
-//                //additional check for DecoderAlerts will be done now.
-//            	queueDecoderEvent(GENERATOR_SNORT_DECODE, DECODE_BAD_MPLS, 1, DECODE_CLASS, 3, DECODE_MULTICAST_MPLS_STR, 0);            	
-//            }
-        case ETHERNET_TYPE_MPLS_UNICAST:
-            {
-                struct pcap_pkthdr pkthdrTmp;
-                pkthdrTmp.caplen = pkthdr->caplen - ETHERNET_HEADER_LEN;
-                pkthdrTmp.len = pkthdr->len - ETHERNET_HEADER_LEN;
-                DecodeMPLS(p->pkt + ETHERNET_HEADER_LEN, &pkthdrTmp, p);
-                return;
-            }
-#endif        
-        default:
-            pc.other++;
-            return;
-    }
-
     return;
 }
 
@@ -574,6 +807,9 @@ void DecodeIEEE80211Pkt(Packet * p, const struct pcap_pkthdr * pkthdr,
                                 sizeof(EthLlcOther), p);
                         return;
                     case ETHERNET_TYPE_EAPOL:
+                        if (BcDecodeLevel() < DECODE_LEVEL__PAYLOAD)
+                            return;
+
                         DecodeEapol(p->pkt + IEEE802_11_DATA_HDR_LEN + sizeof(EthLlc) +
                                 sizeof(EthLlcOther),
                                 pkt_len - IEEE802_11_DATA_HDR_LEN - sizeof(EthLlc) -
@@ -979,133 +1215,23 @@ void DecodeVlan(const uint8_t * pkt, const uint32_t len, Packet * p)
                         ntohs(p->ehllcother->proto_id));
                     );
 
-            switch(ntohs(p->ehllcother->proto_id))
-            {
-                case ETHERNET_TYPE_IP:
-                    DecodeIP(p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther),
-                             len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther), p);
-                    return;
-
-                case ETHERNET_TYPE_ARP:
-                case ETHERNET_TYPE_REVARP:
-                    DecodeARP(p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther),
-                              len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther), p);
-                    return;
-
-                case ETHERNET_TYPE_IPV6:
-                    DecodeIPV6(p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther), 
-                               len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther), p);
-                    return;
-
-                case ETHERNET_TYPE_8021Q:
-                    pc.nested_vlan++;
-                    DecodeVlan(p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther),
-                               len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther), p);
-                    return;
-
-                case ETHERNET_TYPE_LOOP:
-                    DecodeEthLoopback(p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther),
-                                      len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther), p);
-                    return;
-
-#ifndef NO_NON_ETHER_DECODER
-                case ETHERNET_TYPE_IPX:
-                    DecodeIPX(p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther),
-                              len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther), p);
-                    return;
-
-                /* Add these after DecodePPPoEPkt() has been reimplemented */
-                case ETHERNET_TYPE_PPPoE_DISC:
-                case ETHERNET_TYPE_PPPoE_SESS:
-	            {	
-                        struct pcap_pkthdr pkthdrTmp;
-                        pkthdrTmp.caplen = len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther);
-                        pkthdrTmp.len = len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther);
-                        DecodePPPoEPkt(p,&pkthdrTmp, p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther));
-                        return;
-                    }
-#endif
-#ifdef MPLS
-                case ETHERNET_TYPE_MPLS_MULTICAST:
-                case ETHERNET_TYPE_MPLS_UNICAST:
-                    {
-                        struct pcap_pkthdr pkthdrTmp;
-                        pkthdrTmp.caplen = len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther);
-                        pkthdrTmp.len = len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther);
-                        DecodeMPLS(p->pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther), &pkthdrTmp, p);
-                        return;
-                    }
-#endif
-
+            if(ntohs(p->ehllcother->proto_id) == ETHERNET_TYPE_8021Q)
+                pc.nested_vlan++;
 
-                default:
-                    pc.other++;
-                    return;
-            }
+            DecodeEthertype(ntohs(p->ehllcother->proto_id),
+                            pkt + sizeof(VlanTagHdr) + sizeof(EthLlc) + sizeof(EthLlcOther),
+                            len - sizeof(VlanTagHdr) - sizeof(EthLlc) - sizeof(EthLlcOther), p);
+            return;
         }
     }
     else
     {
-        switch(ntohs(p->vh->vth_proto))
-        {
-            case ETHERNET_TYPE_IP:
-                DecodeIP(pkt + sizeof(VlanTagHdr), 
-                         len - sizeof(VlanTagHdr), p);
-                return;
-
-            case ETHERNET_TYPE_ARP:
-            case ETHERNET_TYPE_REVARP:
-                DecodeARP(pkt + sizeof(VlanTagHdr), 
-                          len - sizeof(VlanTagHdr), p);
-                return;
+        if(ntohs(p->vh->vth_proto) == ETHERNET_TYPE_8021Q)
+            pc.nested_vlan++;
 
-            case ETHERNET_TYPE_IPV6:
-                DecodeIPV6(pkt +sizeof(VlanTagHdr), 
-                           len - sizeof(VlanTagHdr), p);
-                return;
-
-            case ETHERNET_TYPE_8021Q:
-                pc.nested_vlan++;
-                DecodeVlan(pkt + sizeof(VlanTagHdr), 
-                           len - sizeof(VlanTagHdr), p);
-                return;
-
-            case ETHERNET_TYPE_LOOP:
-                DecodeEthLoopback(pkt + sizeof(VlanTagHdr), 
-                                  len - sizeof(VlanTagHdr), p);
-                return;
-
-#ifndef NO_NON_ETHER_DECODER
-            case ETHERNET_TYPE_IPX:
-                DecodeIPX(pkt + sizeof(VlanTagHdr), 
-                           len - sizeof(VlanTagHdr), p);
-                return;
-
-#if 0
-            /* Add these after DecodePPPoEPkt() has been reimplemented */
-            case ETHERNET_TYPE_PPPoE_DISC:
-            case ETHERNET_TYPE_PPPoE_SESS:
-                DecodePPPoEPkt(pkt + sizeof(VlanTagHdr), 
-                               len - sizeof(VlanTagHdr), p);
-                return;
-#endif
-#endif
-
-#ifdef MPLS
-            case ETHERNET_TYPE_MPLS_MULTICAST:
-            case ETHERNET_TYPE_MPLS_UNICAST:
-                {
-                    struct pcap_pkthdr pkthdrTmp;
-                    pkthdrTmp.caplen = len - sizeof(VlanTagHdr);
-                    pkthdrTmp.len = len - sizeof(VlanTagHdr);
-                    DecodeMPLS(pkt + sizeof(VlanTagHdr), &pkthdrTmp, p);
-                    return;
-                }
-#endif
-            default:
-                pc.other++;
-                return;
-        }
+        DecodeEthertype(ntohs(p->vh->vth_proto), pkt + sizeof(VlanTagHdr),
+                        len - sizeof(VlanTagHdr), p);
+        return;
     }
 
     pc.other++;
@@ -2678,33 +2804,18 @@ void DecodeIP(const uint8_t * pkt, const uint32_t len, Packet * p)
     }
 
 #ifdef GRE
+    /* inside a tunnel, the outermost delivery header stays the outer one.
+     * How deep tunnels go is limited by PushTunnel() */
 #ifndef SUP_IP6
-    if (p->iph != NULL)
+    if (p->iph != NULL && !p->encapsulated)
 #else
-    if (p->family != NO_IP)
+    if (p->family != NO_IP && !p->encapsulated)
 #endif  /* SUP_IP6 */
     {
-        IPHdr *tmp = (IPHdr *)pkt;
-
-        if (p->encapsulated ||
-            ((tmp->ip_proto == IPPROTO_IPIP) || (tmp->ip_proto == IPPROTO_GRE))
-#ifdef SUP_IP6
-             || (tmp->ip_proto == IPPROTO_IPV6)
-#endif
-           )
-        {
-            DecoderAlertGRE(p, DECODE_GRE_MULTIPLE_ENCAPSULATION,
-                            DECODE_GRE_MULTIPLE_ENCAPSULATION_STR,
-                            pkt, len);
-            return;
-        }
-        else
-        {
-            p->encapsulated = 1;
-            p->outer_iph = p->iph;
-            p->outer_ip_data = p->ip_data;
-            p->outer_ip_dsize = p->ip_dsize;
-        }
+        p->encapsulated = 1;
+        p->outer_iph = p->iph;
+        p->outer_ip_data = p->ip_data;
+        p->outer_ip_dsize = p->ip_dsize;
     }
 #endif  /* GRE */
 
@@ -2843,7 +2954,9 @@ void DecodeIP(const uint8_t * pkt, const uint32_t len, Packet * p)
     if(p->ip_options_len > 0)
     {
         p->ip_options_data = pkt + IP_HEADER_LEN;
-        DecodeIPOptions((pkt + IP_HEADER_LEN), p->ip_options_len, p);
+
+        if (BcDecodeLevel() >= DECODE_LEVEL__OPTIONS)
+            DecodeIPOptions((pkt + IP_HEADER_LEN), p->ip_options_len, p);
     }
     else
     {
@@ -2911,61 +3024,7 @@ void DecodeIP(const uint8_t * pkt, const uint32_t len, Packet * p)
         DEBUG_WRAP(DebugMessage(DEBUG_DECODE, "IP header length: %lu\n", 
                     (unsigned long)hlen););
 
-        switch(p->iph->ip_proto)
-        {
-            case IPPROTO_TCP:
-                pc.tcp++;
-                DecodeTCP(pkt + hlen, ip_len, p);
-                //ClearDumpBuf();
-                return;
-
-            case IPPROTO_UDP:
-                pc.udp++;
-                DecodeUDP(pkt + hlen, ip_len, p);
-                //ClearDumpBuf();
-                return;
-
-            case IPPROTO_ICMP:
-                pc.icmp++;
-                DecodeICMP(pkt + hlen, ip_len, p);
-                //ClearDumpBuf();
-                return;
-            
-#ifdef GRE
-            case IPPROTO_IPV6:
-                if (ip_len < 40)
-                {
-                    /* Insufficient size for IPv6 Header. */
-                    /* This could be an attempt to exploit Linux kernel
-                     * vulnerability, so log an alert */
-//                    DecoderEvent(p, DECODE_IPV6_TUNNELED_IPV4_TRUNCATED,
-//                                DECODE_IPV6_TUNNELED_IPV4_TRUNCATED_STR,
-//                                pv.decoder_flags.decode_alerts,
-//                                pv.decoder_flags.drop_alerts);
-                }
-                pc.ip4ip6++;
-                DecodeIPV6(pkt + hlen, ip_len, p);
-                return;
-
-            case IPPROTO_GRE:
-                pc.gre++;
-                DecodeGRE(pkt + hlen, ip_len, p);
-                //ClearDumpBuf();
-                return;
-
-            case IPPROTO_IPIP:
-                pc.ip4ip4++;
-                DecodeIP(pkt + hlen, ip_len, p);
-                return;
-#endif
-
-            default:
-                pc.other++;
-                p->data = pkt + hlen;
-                p->dsize = (u_short) ip_len;
-                //ClearDumpBuf();
-                return;
-        }
+        DecodeIPProto(ip_decoders, p->iph->ip_proto, pkt + hlen, ip_len, p);
     }
     else
     {
@@ -3011,6 +3070,10 @@ void DecodeTCP(const uint8_t * pkt, const uint32_t len, Packet * p)
 #endif
 
 
+    /* no configured output reads the transport layer */
+    if (BcDecodeLevel() < DECODE_LEVEL__L4)
+        return;
+
     if(len < TCP_HEADER_LEN)
     {
         if (BcLogVerbose())
@@ -3129,7 +3192,9 @@ void DecodeTCP(const uint8_t * pkt, const uint32_t len, Packet * p)
                     (unsigned long)(p->tcp_options_len)););
 
         p->tcp_options_data = pkt + TCP_HEADER_LEN;
-        DecodeTCPOptions((uint8_t *) (pkt + TCP_HEADER_LEN), p->tcp_options_len, p);
+
+        if (BcDecodeLevel() >= DECODE_LEVEL__OPTIONS)
+            DecodeTCPOptions((uint8_t *) (pkt + TCP_HEADER_LEN), p->tcp_options_len, p);
     }
     else
     {
@@ -3159,6 +3224,50 @@ void DecodeTCP(const uint8_t * pkt, const uint32_t len, Packet * p)
 }
 
 
+#ifdef GRE
+/*
+ * Function: DecodeUDPTunnel(uint8_t *, const uint32_t, Packet *)
+ *
+ * Purpose: Below L4 the UDP header isn't decoded, but tunnels are still
+ *          followed like GRE and IP-in-IP are, so the L3 addresses are the
+ *          inner ones whatever else the outputs ask for.  Only the ports
+ *          and length are looked at, the ports are cleared again if the
+ *          datagram isn't a tunnel.
+ *
+ * Arguments: pkt => ptr to the UDP header
+ *            len => length from here to the end of the packet
+ *            p   => pointer to decoded packet struct
+ *
+ * Returns: void function
+ */
+static void DecodeUDPTunnel(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    const UDPHdr *udph = (const UDPHdr *)pkt;
+    uint16_t uhlen;
+    uint8_t depth = p->tunnel_depth;
+
+    if (p->frag_flag || len < sizeof(UDPHdr))
+        return;
+
+    if (udp_tunnel_slots[ntohs(udph->uh_dport)] == 0)
+        return;
+
+    uhlen = ntohs(udph->uh_len);
+
+    if (uhlen < UDP_HEADER_LEN || uhlen > len)
+        return;
+
+    p->sp = ntohs(udph->uh_sport);
+    p->dp = ntohs(udph->uh_dport);
+
+    udp_tunnel_decoders[udp_tunnel_slots[p->dp]](pkt + UDP_HEADER_LEN,
+                                                 uhlen - UDP_HEADER_LEN, p);
+
+    if (p->tunnel_depth == depth)
+        p->sp = p->dp = 0;
+}
+#endif  /* GRE */
+
 /*
  * Function: DecodeUDP(uint8_t *, const uint32_t, Packet *)
  *
@@ -3195,6 +3304,14 @@ void DecodeUDP(const uint8_t * pkt, const uint32_t len, Packet * p)
 #endif
     u_char fragmented_udp_flag = 0;
 
+    if (BcDecodeLevel() < DECODE_LEVEL__L4)
+    {
+#ifdef GRE
+        DecodeUDPTunnel(pkt, len, p);
+#endif
+        return;
+    }
+
     if(len < sizeof(UDPHdr))
     {
         if (BcLogVerbose())
@@ -3359,6 +3476,11 @@ void DecodeUDP(const uint8_t * pkt, const uint32_t len, Packet * p)
 //    }
 
     p->proto_bits |= PROTO_BIT__UDP;
+
+#ifdef GRE
+    if (udp_tunnel_slots[p->dp] != 0 && !fragmented_udp_flag)
+        udp_tunnel_decoders[udp_tunnel_slots[p->dp]](p->data, p->dsize, p);
+#endif
 }
 
 
@@ -3378,6 +3500,9 @@ void DecodeICMP(const uint8_t * pkt, const uint32_t len, Packet * p)
 {
     uint16_t csum;
 
+    if (BcDecodeLevel() < DECODE_LEVEL__L4)
+        return;
+
     if(len < ICMP_HEADER_LEN)
     {
         if (BcLogVerbose())
@@ -3506,7 +3631,8 @@ void DecodeICMP(const uint8_t * pkt, const uint32_t len, Packet * p)
             p->dsize -= 4; 
             p->data += 4;
 
-            DecodeICMPEmbeddedIP(p->data, p->dsize, p);
+            if (BcDecodeLevel() >= DECODE_LEVEL__OPTIONS)
+                DecodeICMPEmbeddedIP(p->data, p->dsize, p);
 
             break;
     }
@@ -3940,6 +4066,9 @@ void DecodeICMPEmbeddedIP6(const uint8_t *pkt, const uint32_t len, Packet *p)
 
 void DecodeICMP6(const uint8_t *pkt, uint32_t len, Packet *p)
 {
+    if (BcDecodeLevel() < DECODE_LEVEL__L4)
+        return;
+
     if(len < ICMP6_MIN_HEADER_LEN)
     {
         if (BcLogVerbose())
@@ -4023,7 +4152,9 @@ void DecodeICMP6(const uint8_t *pkt, uint32_t len, Packet *p)
                 /* Set data pointer past the 'unused/mtu/pointer block */
                 p->data += 4;
                 p->dsize -= 4;
-                DecodeICMPEmbeddedIP6(p->data, p->dsize, p);
+
+                if (BcDecodeLevel() >= DECODE_LEVEL__OPTIONS)
+                    DecodeICMPEmbeddedIP6(p->data, p->dsize, p);
             }
             else
             {
@@ -4197,70 +4328,7 @@ void DecodeIPV6Extensions(uint8_t next, const uint8_t *pkt, uint32_t len, Packet
     /* XXX might this introduce an issue if the "next" field is invalid? */
     p->ip6h->next = next;
 
-    switch(next) {
-        case IPPROTO_TCP:
-            pc.tcp6++;
-            DecodeTCP(pkt, len, p);
-            return;
-        case IPPROTO_UDP:
-            pc.udp6++;
-            DecodeUDP(pkt, len, p);
-            return;
-        case IPPROTO_ICMP:
-            pc.icmp++;
-            DecodeICMP(pkt, len, p);
-            return;
-        case IPPROTO_ICMPV6:
-            pc.icmp6++;
-            DecodeICMP6(pkt , len, p);
-            return;
-#ifndef SUP_IP6
-        case IPPROTO_FRAGMENT:
-            // XXX
-            // Fragmentation not yet supported
-            // DecodeIPv6FragHdr(p, pkt);
-            // XXX 
-             
-            p->frag_flag = 1;
-            pc.frag6++;
-            p->dsize = 0;
-            return;
-#endif
-        case IPPROTO_NONE:
-            p->dsize = 0;
-            return;
-        case IPPROTO_HOPOPTS:
-        case IPPROTO_DSTOPTS:
-        case IPPROTO_ROUTING:
-#ifdef SUP_IP6
-        case IPPROTO_FRAGMENT:
-#endif
-            DecodeIPV6Options(next, pkt, len, p); 
-            // Anything special to do here?  just return?
-            return;
-#ifdef GRE
-        case IPPROTO_GRE:
-            pc.gre++;
-            DecodeGRE(pkt, len, p);
-            return;
-        case IPPROTO_IPIP:
-            pc.ip6ip4++;
-            DecodeIP(pkt, len, p);
-            return;
-        case IPPROTO_IPV6:
-            pc.ip6ip6++;
-            DecodeIPV6(pkt, len, p);
-            return;
-#endif
-        default: 
-            // There may be valid headers after this unsupported one,
-            // need to decode this header, set "next" and continue 
-            // looping.
-            pc.other++;
-            p->data = pkt;
-            p->dsize = (uint16_t)len;
-            break;
-    };
+    DecodeIPProto(ipv6_decoders, next, pkt, len, p);
 }
 #endif /* SUP_IP6 */
 
@@ -4422,27 +4490,12 @@ void DecodeIPV6(const uint8_t *pkt, uint32_t len, Packet *p)
     }
 
 #ifdef GRE
-    if (p->family != NO_IP)
+    if (p->family != NO_IP && !p->encapsulated)
     {
-        IP6RawHdr *tmp = (IP6RawHdr *)pkt;
-
-        if (p->encapsulated ||
-            ((tmp->ip6nxt == IPPROTO_IPIP) || (tmp->ip6nxt == IPPROTO_GRE) ||
-             (tmp->ip6nxt == IPPROTO_IPV6)))
-        {
-
-            DecoderAlertGRE(p, DECODE_GRE_MULTIPLE_ENCAPSULATION,
-                            DECODE_GRE_MULTIPLE_ENCAPSULATION_STR,
-                            pkt, len);
-            return;
-        }
-        else
-        {
-            p->encapsulated = 1;
-            p->outer_iph = p->iph;
-            p->outer_ip_data = p->ip_data;
-            p->outer_ip_dsize = p->ip_dsize;
-        }
+        p->encapsulated = 1;
+        p->outer_iph = p->iph;
+        p->outer_ip_data = p->ip_data;
+        p->outer_ip_dsize = p->ip_dsize;
     }
 #endif
     /* lay the IP struct over the raw data */
@@ -4604,6 +4657,7 @@ void DecodeGRE(const uint8_t *pkt, const uint32_t len, Packet *p)
 {
     uint32_t hlen;    /* GRE header length */
     uint32_t payload_len;
+    TunnelLayer *t;
 
     if (len < GRE_HEADER_LEN)
     {
@@ -4613,10 +4667,8 @@ void DecodeGRE(const uint8_t *pkt, const uint32_t len, Packet *p)
         return;
     }
 
-    if (p->encapsulated)
+    if ((t = PushTunnel(p, TUNNEL_TYPE__GRE, pkt, 0, 0)) == NULL)
     {
-        /* discard packet - multiple GRE encapsulation */
-        /* not sure if this is ever used but I am assuming it is not */
         DecoderAlertGRE(p, DECODE_GRE_MULTIPLE_ENCAPSULATION,
                         DECODE_GRE_MULTIPLE_ENCAPSULATION_STR,
                         pkt, len);
@@ -4745,6 +4797,16 @@ void DecodeGRE(const uint8_t *pkt, const uint32_t len, Packet *p)
 
     payload_len = len - hlen;
 
+    if (GRE_KEY(p->greh))
+    {
+        const uint8_t *key = pkt + GRE_HEADER_LEN;
+
+        if (GRE_CHKSUM(p->greh) || GRE_ROUTE(p->greh))
+            key += GRE_CHKSUM_LEN + GRE_OFFSET_LEN;
+
+        t->id = (uint32_t)key[0] << 24 | key[1] << 16 | key[2] << 8 | key[3];
+    }
+
     /* Send to next protocol decoder */
     /* As described in RFC 2784 the possible protocols are listed in
      * RFC 1700 under "ETHER TYPES"
@@ -4757,6 +4819,7 @@ void DecodeGRE(const uint8_t *pkt, const uint32_t len, Packet *p)
             return;
 
         case GRE_TYPE_TRANS_BRIDGING:
+            pc.gre_eth++;
             DecodeTransBridging(pkt + hlen, payload_len, p); 
             return;
 
@@ -4804,7 +4867,8 @@ void DecodeGRE(const uint8_t *pkt, const uint32_t len, Packet *p)
 /*
  * Function: DecodeTransBridging(uint8_t *, const uint32_t, Packet)
  *
- * Purpose: Decode Transparent Ethernet Bridging
+ * Purpose: Decode Transparent Ethernet Bridging, the Ethernet frames
+ *          carried by GRE, VXLAN and GENEVE
  *
  * Arguments: pkt => pointer to the real live packet data
  *            len => length of remaining data in packet
@@ -4819,8 +4883,6 @@ void DecodeGRE(const uint8_t *pkt, const uint32_t len, Packet *p)
  */
 void DecodeTransBridging(const uint8_t *pkt, const uint32_t len, Packet *p)
 {
-    pc.gre_eth++;
-
     if(len < ETHERNET_HEADER_LEN)
     {
         DecoderAlertGRE(p, DECODE_GRE_TRANS_DGRAM_LT_TRANSHDR,
@@ -4871,6 +4933,148 @@ void DecodeTransBridging(const uint8_t *pkt, const uint32_t len, Packet *p)
     }
 }
 
+/*
+ * Function: DecodeVXLAN(uint8_t *, const uint32_t, Packet *)
+ *
+ * Purpose: Decode VXLAN (RFC 7348), an Ethernet frame in UDP
+ *
+ * Arguments: pkt => pointer to the UDP payload
+ *            len => length of the UDP payload
+ *            p => pointer to the decoded packet struct
+ *
+ * Returns: void function
+ *
+ * Note: Datagrams that don't look like VXLAN are left as UDP payload, as
+ * are those of the UDP tunnels below.
+ */
+void DecodeVXLAN(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    TunnelLayer *t;
+
+    if (len < VXLAN_HEADER_LEN || !(pkt[0] & VXLAN_FLAG_I))
+        return;
+
+    if ((t = PushUDPTunnel(p, TUNNEL_TYPE__VXLAN, pkt)) == NULL)
+        return;
+
+    pc.vxlan++;
+    t->id = (uint32_t)pkt[4] << 16 | pkt[5] << 8 | pkt[6];
+
+    DecodeTransBridging(pkt + VXLAN_HEADER_LEN, len - VXLAN_HEADER_LEN, p);
+}
+
+/*
+ * Function: DecodeGENEVE(uint8_t *, const uint32_t, Packet *)
+ *
+ * Purpose: Decode GENEVE (RFC 8926), options are skipped
+ *
+ * Arguments: pkt => pointer to the UDP payload
+ *            len => length of the UDP payload
+ *            p => pointer to the decoded packet struct
+ *
+ * Returns: void function
+ */
+void DecodeGENEVE(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    TunnelLayer *t;
+    uint32_t hlen;
+
+    if (len < GENEVE_HEADER_LEN || GENEVE_VERSION(pkt) != 0)
+        return;
+
+    hlen = GENEVE_HEADER_LEN + GENEVE_OPT_LEN(pkt);
+
+    if (hlen > len)
+        return;
+
+    if ((t = PushUDPTunnel(p, TUNNEL_TYPE__GENEVE, pkt)) == NULL)
+        return;
+
+    pc.geneve++;
+    t->id = (uint32_t)pkt[4] << 16 | pkt[5] << 8 | pkt[6];
+
+    p->data = pkt + hlen;
+    p->dsize = (uint16_t)(len - hlen);
+
+    /* the protocol is an ethertype */
+    if (GENEVE_PROTO(pkt) == GRE_TYPE_TRANS_BRIDGING)
+        DecodeTransBridging(pkt + hlen, len - hlen, p);
+    else
+        DecodeEthertype(GENEVE_PROTO(pkt), pkt + hlen, len - hlen, p);
+}
+
+/*
+ * Function: DecodeGTPU(uint8_t *, const uint32_t, Packet *)
+ *
+ * Purpose: Decode the user plane of GTP version 1 (3GPP TS 29.281), the
+ *          IP datagrams of G-PDU messages
+ *
+ * Arguments: pkt => pointer to the UDP payload
+ *            len => length of the UDP payload
+ *            p => pointer to the decoded packet struct
+ *
+ * Returns: void function
+ */
+void DecodeGTPU(const uint8_t *pkt, const uint32_t len, Packet *p)
+{
+    TunnelLayer *t;
+    uint32_t hlen = GTPU_HEADER_LEN;
+
+    if (len < GTPU_HEADER_LEN || GTPU_VERSION(pkt) != 1 || !GTPU_PT(pkt) ||
+        pkt[1] != GTPU_TYPE_GPDU)
+        return;
+
+    if (GTPU_OPTS(pkt))
+    {
+        hlen += GTPU_OPT_LEN;
+
+        if (hlen > len)
+            return;
+
+        /* walk the extension headers, each ends with the next one's type */
+        if (GTPU_EXT(pkt))
+        {
+            while (pkt[hlen - 1] != 0)
+            {
+                if (hlen >= len || pkt[hlen] == 0)
+                    return;
+
+                hlen += pkt[hlen] * 4;
+
+                if (hlen > len)
+                    return;
+            }
+        }
+    }
+
+    if (hlen >= len)
+        return;
+
+    if ((t = PushUDPTunnel(p, TUNNEL_TYPE__GTPU, pkt)) == NULL)
+        return;
+
+    pc.gtp++;
+    t->id = (uint32_t)pkt[4] << 24 | pkt[5] << 16 | pkt[6] << 8 | pkt[7];
+
+    p->data = pkt + hlen;
+    p->dsize = (uint16_t)(len - hlen);
+
+    switch (pkt[hlen] >> 4)
+    {
+        case 4:
+            DecodeIP(pkt + hlen, len - hlen, p);
+            return;
+
+        case 6:
+            DecodeIPV6(pkt + hlen, len - hlen, p);
+            return;
+
+        default:
+            pc.other++;
+            return;
+    }
+}
+
 /* should probably generalize for all decoder alerts */
 void DecoderAlertGRE(Packet *p, int type, const char *str, const uint8_t *pkt, uint32_t len)
 {
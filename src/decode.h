@@ -1258,8 +1258,60 @@ typedef struct _GREHdr
 #define GRE_V1_FLAGS(x)  (x->version & 0x78)
 #define GRE_V1_ACK(x)    (x->version & 0x80)
 
+/* tunnels over UDP, recognised by their IANA destination port */
+#define VXLAN_PORT          4789
+#define GENEVE_PORT         6081
+#define GTPU_PORT           2152
+
+#define VXLAN_HEADER_LEN    8
+#define VXLAN_FLAG_I        0x08    /* VNI present */
+
+#define GENEVE_HEADER_LEN   8
+#define GENEVE_VERSION(x)   ((x)[0] >> 6)
+#define GENEVE_OPT_LEN(x)   (((x)[0] & 0x3F) * 4)
+#define GENEVE_PROTO(x)     ((uint16_t)((x)[2] << 8 | (x)[3]))
+
+#define GTPU_HEADER_LEN     8
+#define GTPU_OPT_LEN        4       /* sequence, N-PDU and next extension */
+#define GTPU_VERSION(x)     ((x)[0] >> 5)
+#define GTPU_PT(x)          ((x)[0] & 0x10)
+#define GTPU_EXT(x)         ((x)[0] & 0x04)
+#define GTPU_OPTS(x)        ((x)[0] & 0x07)
+#define GTPU_TYPE_GPDU      0xFF    /* user data, the rest is signalling */
+
 #endif  /* GRE */
 
+/* the tunnels a packet was decoded through, outermost first */
+#define TUNNEL_MAX_DEPTH    4
+
+typedef enum _TunnelType
+{
+    TUNNEL_TYPE__NONE = 0,
+    TUNNEL_TYPE__IPIP,          /* IPv4 or IPv6 directly in IPv4 or IPv6 */
+    TUNNEL_TYPE__GRE,
+    TUNNEL_TYPE__VXLAN,
+    TUNNEL_TYPE__GENEVE,
+    TUNNEL_TYPE__GTPU,
+    TUNNEL_TYPE__MAX
+
+} TunnelType;
+
+typedef struct _TunnelLayer
+{
+    const IPHdr *iph;           /* delivery header, an IPv6 one for AF_INET6 */
+    const uint8_t *hdr;         /* tunnel header, the inner IP one for IPIP */
+    uint32_t id;                /* GRE key, VXLAN/GENEVE VNI or GTP TEID */
+    uint16_t sp;                /* delivery UDP ports, 0 for IPIP and GRE */
+    uint16_t dp;
+    uint8_t type;               /* TunnelType */
+    uint8_t family;             /* AF_INET or AF_INET6 */
+
+} TunnelLayer;
+
+/* delivery header addresses, 4 or 16 bytes depending on the family */
+#define TUNNEL_SRC_ADDR(t) ((const uint8_t *)(t)->iph + ((t)->family == AF_INET6 ? 8 : 12))
+#define TUNNEL_DST_ADDR(t) ((const uint8_t *)(t)->iph + ((t)->family == AF_INET6 ? 24 : 16))
+
 
 /* more macros for TCP offset */
 #define TCP_OFFSET(tcph)        (((tcph)->th_offx2 & 0xf0) >> 4)
@@ -1582,6 +1634,7 @@ typedef struct _Packet
     uint8_t uri_count;          /* number of URIs in this packet */
     uint8_t csum_flags;         /* checksum flags */
     uint8_t encapsulated;
+    uint8_t tunnel_depth;       /* number of tunnels[] in use */
 
     uint8_t ip_option_count;    /* number of options in this packet */
     uint8_t tcp_option_count;
@@ -1622,6 +1675,7 @@ typedef struct _Packet
     Options ip_options[IP_OPTMAX];         /* ip options decode structure */
     Options tcp_options[TCP_OPTLENMAX];    /* tcp options decode struct */
     IP6Option ip6_extensions[IP6_EXTMAX];  /* IPv6 Extension References */
+    TunnelLayer tunnels[TUNNEL_MAX_DEPTH]; /* tunnel layers, see tunnel_depth */
 
     /**policyId provided in configuration file. Used for correlating configuration 
      * with event output
@@ -1726,10 +1780,38 @@ typedef struct _DecoderFlags
 
 } DecoderFlags;
 
+/* How far DecodePacket() goes. Each output registers the level it reads
+ * and the spooler decodes to the deepest one configured. */
+typedef enum _DecodeLevel
+{
+    DECODE_LEVEL__NONE = 0,     /* raw packet only, DecodePacket() isn't called */
+    DECODE_LEVEL__L3,           /* link layer and IP headers, through tunnels */
+    DECODE_LEVEL__L4,           /* TCP/UDP/ICMP headers, ports and payload */
+    DECODE_LEVEL__OPTIONS,      /* IP/TCP options, headers in ICMP errors */
+    DECODE_LEVEL__PAYLOAD,      /* everything, including 802.11 EAPOL */
+    DECODE_LEVEL__MAX
+
+} DecodeLevel;
+
 #define        ALERTMSG_LENGTH 256
 
 
+/* decoders for a datalink (looked up by DLT) and for the header following
+ * an ethertype or IP protocol number */
+typedef void (*DatalinkDecodeFunc)(Packet *, const struct pcap_pkthdr *, const uint8_t *);
+typedef void (*ProtoDecodeFunc)(const uint8_t *, const uint32_t, Packet *);
+
+
 /*  P R O T O T Y P E S  ******************************************************/
+void DecodeInit(void);
+void RegisterDatalinkDecoder(int, DatalinkDecodeFunc, const char *);
+void RegisterEthertypeDecoder(uint16_t, ProtoDecodeFunc);
+void RegisterIPDecoder(uint8_t, ProtoDecodeFunc, uint64_t *);
+#ifdef SUP_IP6
+void RegisterIPV6Decoder(uint8_t, ProtoDecodeFunc, uint64_t *);
+#endif
+DatalinkDecodeFunc GetDatalinkDecoder(int);
+void DecodeDatalink(DatalinkDecodeFunc, int, Packet *, const struct pcap_pkthdr *, const uint8_t *);
 int DecodePacket(int, Packet *, const struct pcap_pkthdr *, const uint8_t *);
 void DecodeARP(const uint8_t *, uint32_t, Packet *);
 void DecodeEthPkt(Packet *, const struct pcap_pkthdr *, const uint8_t *);
@@ -1748,9 +1830,14 @@ void DecodeICMPEmbeddedIP(const uint8_t *, const uint32_t, Packet *);
 void DecodeIPOptions(const uint8_t *, uint32_t, Packet *);
 void DecodeTCPOptions(const uint8_t *, uint32_t, Packet *);
 void DecodePPPoEPkt(Packet *, const struct pcap_pkthdr *, const uint8_t *);
+const char *TunnelName(uint8_t);
 #ifdef GRE
+void RegisterUDPTunnelDecoder(uint16_t, ProtoDecodeFunc);
 void DecodeGRE(const uint8_t *, const uint32_t, Packet *);
 void DecodeTransBridging(const uint8_t *, const uint32_t, Packet *);
+void DecodeVXLAN(const uint8_t *, const uint32_t, Packet *);
+void DecodeGENEVE(const uint8_t *, const uint32_t, Packet *);
+void DecodeGTPU(const uint8_t *, const uint32_t, Packet *);
 void DecoderAlertGRE(Packet *, int, const char *, const uint8_t *, uint32_t);
 #endif  /* GRE */
 #ifdef GIDS
@@ -0,0 +1,597 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+/*
+** Description:
+**   Payload encoders shared by the outputs and the text log. Each has a
+**   portable scalar version and, when configure found x86 intrinsics
+**   (HAVE_SIMD_DISPATCH), SSE2/SSSE3/AVX2 versions compiled with per
+**   function target attributes. The first call picks the best one the CPU
+**   runs, so a single binary works everywhere. The SIMD loops only handle
+**   whole vectors and hand the remainder to the scalar code, which keeps
+**   the output identical whichever version runs.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#ifdef HAVE_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
+
+#include "encode.h"
+
+#define IS_PRINTABLE(c) ((c) > 0x1F && (c) < 0x7F)
+
+typedef size_t (*EncodeFunc)(char *, const uint8_t *, size_t);
+typedef char *(*Base64BlockFunc)(char *, const uint8_t *, size_t, size_t);
+
+static const char hex_digits[] = "0123456789ABCDEF";
+static const char base64_alpha[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void EncodeSelect(void);
+static size_t EncodeHexFirst(char *, const uint8_t *, size_t);
+static char *Base64BlockFirst(char *, const uint8_t *, size_t, size_t);
+static size_t EncodeAsciiFirst(char *, const uint8_t *, size_t);
+static size_t EncodeAsciiLenFirst(char *, const uint8_t *, size_t);
+static size_t EncodePrintableFirst(char *, const uint8_t *, size_t);
+
+/* point at the *First() functions until EncodeSelect() has run */
+static EncodeFunc hex_func = EncodeHexFirst;
+static Base64BlockFunc base64_block_func = Base64BlockFirst;
+static EncodeFunc ascii_func = EncodeAsciiFirst;
+static EncodeFunc ascii_len_func = EncodeAsciiLenFirst;
+static EncodeFunc printable_func = EncodePrintableFirst;
+static const char *encode_impl = NULL;
+
+/*
+ * scalar versions, also used for whatever the SIMD loops leave over
+ */
+static size_t EncodeHexScalar(char *out, const uint8_t *in, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        out[2 * i] = hex_digits[in[i] >> 4];
+        out[2 * i + 1] = hex_digits[in[i] & 0x0F];
+    }
+
+    out[2 * len] = '\0';
+    return 2 * len;
+}
+
+/* len is a multiple of 3, avail the bytes readable from in */
+static char *Base64BlockScalar(char *out, const uint8_t *in, size_t len, size_t avail)
+{
+    const uint8_t *end = in + len;
+
+    (void)avail;
+
+    for ( ; in < end; in += 3)
+    {
+        *out++ = base64_alpha[in[0] >> 2];
+        *out++ = base64_alpha[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+        *out++ = base64_alpha[((in[1] & 0x0F) << 2) | (in[2] >> 6)];
+        *out++ = base64_alpha[in[2] & 0x3F];
+    }
+
+    return out;
+}
+
+static char *AsciiBytes(char *out, const uint8_t *in, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (!IS_PRINTABLE(in[i]))
+        {
+            *out++ = '.';
+        }
+        else if (in[i] == '<')
+        {
+            memcpy(out, "&lt;", 4);
+            out += 4;
+        }
+        else if (in[i] == '&')
+        {
+            memcpy(out, "&amp;", 5);
+            out += 5;
+        }
+        else if (in[i] == '>')
+        {
+            memcpy(out, "&gt;", 4);
+            out += 4;
+        }
+        else
+        {
+            *out++ = in[i];
+        }
+    }
+
+    return out;
+}
+
+static size_t EncodeAsciiScalar(char *out, const uint8_t *in, size_t len)
+{
+    char *end = AsciiBytes(out, in, len);
+
+    *end = '\0';
+    return end - out;
+}
+
+/* matches the EncodeFunc signature so it can be dispatched, out is unused */
+static size_t EncodeAsciiLenScalar(char *out, const uint8_t *in, size_t len)
+{
+    size_t extra = 0;
+    size_t i;
+
+    (void)out;
+
+    for (i = 0; i < len; i++)
+    {
+        if (in[i] == '<' || in[i] == '>')
+            extra += 3;
+        else if (in[i] == '&')
+            extra += 4;
+    }
+
+    return len + extra;
+}
+
+static size_t EncodePrintableScalar(char *out, const uint8_t *in, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        out[i] = IS_PRINTABLE(in[i]) ? in[i] : '.';
+
+    out[len] = '\0';
+    return len;
+}
+
+#ifdef HAVE_SIMD_DISPATCH
+
+/*
+ * SSE2
+ */
+
+/* nibbles to '0'-'9', 'A'-'F' */
+#define HEX_NIBBLES_SSE2(n) \
+    _mm_add_epi8(_mm_add_epi8((n), _mm_set1_epi8('0')), \
+                 _mm_and_si128(_mm_cmpgt_epi8((n), _mm_set1_epi8(9)), \
+                               _mm_set1_epi8('A' - '0' - 10)))
+
+__attribute__((target("sse2")))
+static size_t EncodeHexSSE2(char *out, const uint8_t *in, size_t len)
+{
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+
+        hi = HEX_NIBBLES_SSE2(hi);
+        lo = HEX_NIBBLES_SSE2(lo);
+
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+
+    return 2 * i + EncodeHexScalar(out + 2 * i, in + i, len - i);
+}
+
+/* all 0xFF where the byte is printable */
+#define PRINTABLE_SSE2(v) \
+    _mm_and_si128(_mm_cmpgt_epi8((v), _mm_set1_epi8(0x1F)), \
+                  _mm_cmplt_epi8((v), _mm_set1_epi8(0x7F)))
+
+#define DOTS_SSE2(v, printable) \
+    _mm_or_si128(_mm_and_si128((printable), (v)), \
+                 _mm_andnot_si128((printable), _mm_set1_epi8('.')))
+
+#define SPECIAL3_SSE2(v) \
+    _mm_or_si128(_mm_cmpeq_epi8((v), _mm_set1_epi8('<')), \
+                 _mm_cmpeq_epi8((v), _mm_set1_epi8('>')))
+
+#define SPECIAL4_SSE2(v) \
+    _mm_cmpeq_epi8((v), _mm_set1_epi8('&'))
+
+__attribute__((target("sse2")))
+static size_t EncodeAsciiSSE2(char *out, const uint8_t *in, size_t len)
+{
+    char *o = out;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+
+        /* entities expand, leave those vectors to the scalar code */
+        if (_mm_movemask_epi8(_mm_or_si128(SPECIAL3_SSE2(v), SPECIAL4_SSE2(v))))
+        {
+            o = AsciiBytes(o, in + i, 16);
+            continue;
+        }
+
+        _mm_storeu_si128((__m128i *)o, DOTS_SSE2(v, PRINTABLE_SSE2(v)));
+        o += 16;
+    }
+
+    return (o - out) + EncodeAsciiScalar(o, in + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t EncodeAsciiLenSSE2(char *out, const uint8_t *in, size_t len)
+{
+    size_t extra = 0;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+
+        extra += 3 * __builtin_popcount(_mm_movemask_epi8(SPECIAL3_SSE2(v)));
+        extra += 4 * __builtin_popcount(_mm_movemask_epi8(SPECIAL4_SSE2(v)));
+    }
+
+    return i + extra + EncodeAsciiLenScalar(out, in + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t EncodePrintableSSE2(char *out, const uint8_t *in, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+
+        _mm_storeu_si128((__m128i *)(out + i), DOTS_SSE2(v, PRINTABLE_SSE2(v)));
+    }
+
+    return i + EncodePrintableScalar(out + i, in + i, len - i);
+}
+
+/*
+ * SSSE3 base64, after Wojciech Mula's pshufb method: spread 12 bytes to
+ * the 16 6-bit indices with a shuffle and two multiplies, then map the
+ * index ranges to their alphabet offsets with a second shuffle
+ */
+#define BASE64_RESHUFFLE_SSSE3(in, out) \
+    do { \
+        __m128i _s = _mm_shuffle_epi8((in), _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, \
+                                                         4, 5, 3, 4, 1, 2, 0, 1)); \
+        __m128i _t0 = _mm_mulhi_epu16(_mm_and_si128(_s, _mm_set1_epi32(0x0FC0FC00)), \
+                                      _mm_set1_epi32(0x04000040)); \
+        __m128i _t1 = _mm_mullo_epi16(_mm_and_si128(_s, _mm_set1_epi32(0x003F03F0)), \
+                                      _mm_set1_epi32(0x01000010)); \
+        (out) = _mm_or_si128(_t0, _t1); \
+    } while (0)
+
+#define BASE64_SHIFT_LUT \
+    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, \
+    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0
+
+#define BASE64_TRANSLATE_SSSE3(idx, out) \
+    do { \
+        __m128i _r = _mm_subs_epu8((idx), _mm_set1_epi8(51)); \
+        __m128i _lt = _mm_cmpgt_epi8(_mm_set1_epi8(26), (idx)); \
+        _r = _mm_or_si128(_r, _mm_and_si128(_lt, _mm_set1_epi8(13))); \
+        _r = _mm_shuffle_epi8(_mm_setr_epi8(BASE64_SHIFT_LUT), _r); \
+        (out) = _mm_add_epi8(_r, (idx)); \
+    } while (0)
+
+__attribute__((target("ssse3")))
+static char *Base64BlockSSSE3(char *out, const uint8_t *in, size_t len, size_t avail)
+{
+    /* 12 bytes are encoded per round but 16 are loaded */
+    while (len >= 12 && avail >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)in);
+
+        BASE64_RESHUFFLE_SSSE3(v, v);
+        BASE64_TRANSLATE_SSSE3(v, v);
+        _mm_storeu_si128((__m128i *)out, v);
+
+        in += 12;
+        out += 16;
+        len -= 12;
+        avail -= 12;
+    }
+
+    return Base64BlockScalar(out, in, len, avail);
+}
+
+/*
+ * AVX2, the same methods on two lanes
+ */
+#define HEX_NIBBLES_AVX2(n) \
+    _mm256_add_epi8(_mm256_add_epi8((n), _mm256_set1_epi8('0')), \
+                    _mm256_and_si256(_mm256_cmpgt_epi8((n), _mm256_set1_epi8(9)), \
+                                     _mm256_set1_epi8('A' - '0' - 10)))
+
+__attribute__((target("avx2")))
+static size_t EncodeHexAVX2(char *out, const uint8_t *in, size_t len)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        __m256i lo = _mm256_and_si256(v, mask);
+        __m256i a, b;
+
+        hi = HEX_NIBBLES_AVX2(hi);
+        lo = HEX_NIBBLES_AVX2(lo);
+
+        /* unpack works within lanes, put the four halves back in order */
+        a = _mm256_unpacklo_epi8(hi, lo);
+        b = _mm256_unpackhi_epi8(hi, lo);
+
+        _mm256_storeu_si256((__m256i *)(out + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+
+    return 2 * i + EncodeHexSSE2(out + 2 * i, in + i, len - i);
+}
+
+#define PRINTABLE_AVX2(v) \
+    _mm256_and_si256(_mm256_cmpgt_epi8((v), _mm256_set1_epi8(0x1F)), \
+                     _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7F), (v)))
+
+#define DOTS_AVX2(v, printable) \
+    _mm256_blendv_epi8(_mm256_set1_epi8('.'), (v), (printable))
+
+#define SPECIAL_AVX2(v) \
+    _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8((v), _mm256_set1_epi8('<')), \
+                                    _mm256_cmpeq_epi8((v), _mm256_set1_epi8('>'))), \
+                    _mm256_cmpeq_epi8((v), _mm256_set1_epi8('&')))
+
+__attribute__((target("avx2")))
+static size_t EncodeAsciiAVX2(char *out, const uint8_t *in, size_t len)
+{
+    char *o = out;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+
+        if (_mm256_movemask_epi8(SPECIAL_AVX2(v)))
+        {
+            o = AsciiBytes(o, in + i, 32);
+            continue;
+        }
+
+        _mm256_storeu_si256((__m256i *)o, DOTS_AVX2(v, PRINTABLE_AVX2(v)));
+        o += 32;
+    }
+
+    return (o - out) + EncodeAsciiSSE2(o, in + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t EncodePrintableAVX2(char *out, const uint8_t *in, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+
+        _mm256_storeu_si256((__m256i *)(out + i), DOTS_AVX2(v, PRINTABLE_AVX2(v)));
+    }
+
+    return i + EncodePrintableSSE2(out + i, in + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static char *Base64BlockAVX2(char *out, const uint8_t *in, size_t len, size_t avail)
+{
+    const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i lut = _mm256_setr_epi8(BASE64_SHIFT_LUT, BASE64_SHIFT_LUT);
+
+    /* 24 bytes per round as two 12 byte lanes, the second load ends at 28 */
+    while (len >= 24 && avail >= 28)
+    {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)in)),
+            _mm_loadu_si128((const __m128i *)(in + 12)), 1);
+        __m256i t0, t1, r, lt;
+
+        v = _mm256_shuffle_epi8(v, spread);
+        t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00)),
+                                _mm256_set1_epi32(0x04000040));
+        t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0)),
+                                _mm256_set1_epi32(0x01000010));
+        v = _mm256_or_si256(t0, t1);
+
+        r = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        lt = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+        r = _mm256_or_si256(r, _mm256_and_si256(lt, _mm256_set1_epi8(13)));
+        v = _mm256_add_epi8(_mm256_shuffle_epi8(lut, r), v);
+
+        _mm256_storeu_si256((__m256i *)out, v);
+
+        in += 24;
+        out += 32;
+        len -= 24;
+        avail -= 24;
+    }
+
+    return Base64BlockSSSE3(out, in, len, avail);
+}
+
+#endif /* HAVE_SIMD_DISPATCH */
+
+static void EncodeSelect(void)
+{
+    hex_func = EncodeHexScalar;
+    base64_block_func = Base64BlockScalar;
+    ascii_func = EncodeAsciiScalar;
+    ascii_len_func = EncodeAsciiLenScalar;
+    printable_func = EncodePrintableScalar;
+    encode_impl = "scalar";
+
+#ifdef HAVE_SIMD_DISPATCH
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        hex_func = EncodeHexSSE2;
+        ascii_func = EncodeAsciiSSE2;
+        ascii_len_func = EncodeAsciiLenSSE2;
+        printable_func = EncodePrintableSSE2;
+        encode_impl = "sse2";
+    }
+
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        base64_block_func = Base64BlockSSSE3;
+        encode_impl = "ssse3";
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        hex_func = EncodeHexAVX2;
+        base64_block_func = Base64BlockAVX2;
+        ascii_func = EncodeAsciiAVX2;
+        printable_func = EncodePrintableAVX2;
+        encode_impl = "avx2";
+    }
+#endif
+}
+
+static size_t EncodeHexFirst(char *out, const uint8_t *in, size_t len)
+{
+    EncodeSelect();
+    return hex_func(out, in, len);
+}
+
+static char *Base64BlockFirst(char *out, const uint8_t *in, size_t len, size_t avail)
+{
+    EncodeSelect();
+    return base64_block_func(out, in, len, avail);
+}
+
+static size_t EncodeAsciiFirst(char *out, const uint8_t *in, size_t len)
+{
+    EncodeSelect();
+    return ascii_func(out, in, len);
+}
+
+static size_t EncodeAsciiLenFirst(char *out, const uint8_t *in, size_t len)
+{
+    EncodeSelect();
+    return ascii_len_func(out, in, len);
+}
+
+static size_t EncodePrintableFirst(char *out, const uint8_t *in, size_t len)
+{
+    EncodeSelect();
+    return printable_func(out, in, len);
+}
+
+/*
+ * public interface
+ */
+size_t EncodeHex(char *out, const uint8_t *in, size_t len)
+{
+    return hex_func(out, in, len);
+}
+
+size_t EncodeBase64(char *out, const uint8_t *in, size_t len, int wrap)
+{
+    size_t line = wrap >= 4 ? (size_t)(wrap / 4) * 3 : 0;
+    size_t pos = 0;
+    size_t full;
+    char *o = out;
+
+    /* full lines, each ends in a newline (the last one too) */
+    if (line != 0)
+    {
+        for ( ; len - pos >= line; pos += line)
+        {
+            o = base64_block_func(o, in + pos, line, len - pos);
+            *o++ = '\n';
+        }
+    }
+
+    full = (len - pos) / 3 * 3;
+    o = base64_block_func(o, in + pos, full, len - pos);
+    pos += full;
+
+    switch (len - pos)
+    {
+        case 1:
+            *o++ = base64_alpha[in[pos] >> 2];
+            *o++ = base64_alpha[(in[pos] & 0x03) << 4];
+            *o++ = '=';
+            *o++ = '=';
+            break;
+
+        case 2:
+            *o++ = base64_alpha[in[pos] >> 2];
+            *o++ = base64_alpha[((in[pos] & 0x03) << 4) | (in[pos + 1] >> 4)];
+            *o++ = base64_alpha[(in[pos + 1] & 0x0F) << 2];
+            *o++ = '=';
+            break;
+    }
+
+    *o = '\0';
+    return o - out;
+}
+
+size_t EncodeAscii(char *out, const uint8_t *in, size_t len)
+{
+    return ascii_func(out, in, len);
+}
+
+size_t EncodeAsciiLen(const uint8_t *in, size_t len)
+{
+    return ascii_len_func(NULL, in, len);
+}
+
+size_t EncodePrintable(char *out, const uint8_t *in, size_t len)
+{
+    return printable_func(out, in, len);
+}
+
+const char *EncodeImplementation(void)
+{
+    if (encode_impl == NULL)
+        EncodeSelect();
+
+    return encode_impl;
+}
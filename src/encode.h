@@ -0,0 +1,65 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+#ifndef __ENCODE_H__
+#define __ENCODE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include "sf_types.h"
+
+/* base64 line length used by the database and syslog_full outputs */
+#define ENCODE_BASE64_WRAP      72
+
+/* output lengths without the terminating NUL, wrap as for EncodeBase64() */
+#define ENCODE_HEX_LEN(len)     ((len) * 2)
+#define ENCODE_BASE64_LEN(len, wrap) \
+    ((((len) + 2) / 3) * 4 + ((wrap) >= 4 ? ((len) / 3) / ((wrap) / 4) : 0))
+
+/*
+ * The encoders write exactly the returned number of characters plus a NUL
+ * and nothing else, so the output buffer only has to be as large as the
+ * encoding. SIMD versions are used where the CPU has them.
+ */
+
+/* upper case hex */
+size_t EncodeHex(char *, const uint8_t *, size_t);
+
+/* base64, with a newline after every wrap characters (a multiple of 4, 0
+ * for none) */
+size_t EncodeBase64(char *, const uint8_t *, size_t, int);
+
+/* printable characters with <, > and & as XML entities, '.' for the rest */
+size_t EncodeAscii(char *, const uint8_t *, size_t);
+size_t EncodeAsciiLen(const uint8_t *, size_t);
+
+/* printable characters, '.' for the rest (the text of hex dumps) */
+size_t EncodePrintable(char *, const uint8_t *, size_t);
+
+/* "avx2", "ssse3", "sse2" or "scalar" */
+const char *EncodeImplementation(void);
+
+#endif /* __ENCODE_H__ */
@@ -0,0 +1,259 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+/*
+** Description:
+**   Unified2 extra data records (type 110) carry what snort learnt about an
+**   event besides the packet: the X-Forwarded-For client address, HTTP URI
+**   and host name, SMTP envelope and headers and so on. The spooler parses
+**   them with ExtraDataParse() and keeps them on the cached event they name,
+**   the record buffer is kept as is and ExtraData points into it.
+**
+**   While an event is handed to the output plugins the spooler binds its
+**   extra data with ExtraDataBind(), the plugins look it up by the event
+**   pointer they were called with, so the output API stays the same.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_H
+#include <strings.h>
+#endif
+
+#include "extradata.h"
+#include "unified2.h"
+#include "util.h"
+
+/* the blob length counts itself and data_type as well as the data */
+#define EXTRA_DATA_BLOB_HDR     8
+
+/* output names by EVENT_INFO_*, both XFF records are "xff" */
+static const char *extra_data_names[EVENT_INFO_MAX] =
+{
+    NULL,
+    "xff",
+    "xff",
+    "reviewed_by",
+    "gzip_data",
+    "smtp_filename",
+    "smtp_mailfrom",
+    "smtp_rcptto",
+    "smtp_headers",
+    "http_uri",
+    "http_hostname",
+    "ipv6_src",
+    "ipv6_dst",
+    "jsnorm_data"
+};
+
+static void *bound_event;
+static ExtraData *bound_extra;
+
+/*
+ * Function: ExtraDataParse(void *, uint32_t)
+ *
+ * Purpose: Check an extra data record and describe it.  On success the
+ *          record belongs to the returned ExtraData and is freed with it.
+ *
+ * Arguments: record => the record as read, starting at Unified2ExtraDataHdr
+ *               len => its length
+ *
+ * Returns: the ExtraData or NULL if the record is malformed
+ */
+ExtraData *ExtraDataParse(void *record, uint32_t len)
+{
+    Unified2ExtraDataHdr *hdr = (Unified2ExtraDataHdr *)record;
+    Unified2ExtraData *xd;
+    ExtraData *ed;
+    uint32_t blob;
+
+    if (len < sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData) ||
+        ntohl(hdr->event_type) != EVENT_TYPE_EXTRA_DATA)
+        return NULL;
+
+    len -= sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData);
+    xd = (Unified2ExtraData *)(hdr + 1);
+    blob = ntohl(xd->blob_length);
+
+    if (blob < EXTRA_DATA_BLOB_HDR || blob - EXTRA_DATA_BLOB_HDR > len)
+        return NULL;
+
+    ed = (ExtraData *)SnortAlloc(sizeof(ExtraData));
+    ed->event_id = ntohl(xd->event_id);
+    ed->type = ntohl(xd->type);
+    ed->data_type = ntohl(xd->data_type);
+    ed->length = blob - EXTRA_DATA_BLOB_HDR;
+    ed->data = (const uint8_t *)(xd + 1);
+    ed->record = record;
+
+    return ed;
+}
+
+/* frees the list from ed on */
+void ExtraDataFree(ExtraData *ed)
+{
+    ExtraData *next;
+
+    for (; ed != NULL; ed = next)
+    {
+        next = ed->next;
+        free(ed->record);
+        free(ed);
+    }
+}
+
+/* event is about to be output with extra, NULL when done */
+void ExtraDataBind(void *event, ExtraData *extra)
+{
+    bound_event = event;
+    bound_extra = extra;
+}
+
+/*
+ * Function: GetExtraData(void *)
+ *
+ * Purpose: The extra data records of the event an output plugin was called
+ *          with, follow ->next for the rest.
+ *
+ * Arguments: event => the event passed to the output function
+ *
+ * Returns: the first record or NULL if the event has none
+ */
+const ExtraData *GetExtraData(void *event)
+{
+    if (event == NULL || event != bound_event)
+        return NULL;
+
+    return bound_extra;
+}
+
+/* first record of the event of that EVENT_INFO_* type, or of the other
+ * address family for the XFF types */
+const ExtraData *GetExtraDataByType(void *event, uint32_t type)
+{
+    const ExtraData *ed;
+
+    if (type == EVENT_INFO_XFF_IPV6)
+        type = EVENT_INFO_XFF_IPV4;
+
+    for (ed = GetExtraData(event); ed != NULL; ed = ed->next)
+    {
+        if (ed->type == type ||
+            (ed->type == EVENT_INFO_XFF_IPV6 && type == EVENT_INFO_XFF_IPV4))
+            return ed;
+    }
+
+    return NULL;
+}
+
+/* output name of an EVENT_INFO_* type, NULL for types we don't know */
+const char *ExtraDataName(uint32_t type)
+{
+    if (type >= EVENT_INFO_MAX)
+        return NULL;
+
+    return extra_data_names[type];
+}
+
+/* EVENT_INFO_* type of an output name, 0 if there is none */
+uint32_t ExtraDataType(const char *name)
+{
+    uint32_t type;
+
+    for (type = 1; type < EVENT_INFO_MAX; type++)
+    {
+        if (strcasecmp(name, extra_data_names[type]) == 0)
+            return type;
+    }
+
+    return 0;
+}
+
+/* AF_INET or AF_INET6 for records holding an address, 0 otherwise */
+int ExtraDataFamily(const ExtraData *ed)
+{
+    switch (ed->type)
+    {
+        case EVENT_INFO_XFF_IPV4:
+            return ed->length == 4 ? AF_INET : 0;
+
+        case EVENT_INFO_XFF_IPV6:
+        case EVENT_INFO_IPV6_SRC:
+        case EVENT_INFO_IPV6_DST:
+            return ed->length == 16 ? AF_INET6 : 0;
+
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Function: ExtraDataText(const ExtraData *, char *, uint32_t)
+ *
+ * Purpose: Render a record as text: addresses in their usual notation,
+ *          anything else with bytes that aren't printable ASCII shown as
+ *          '.', the same as ascii() does for payloads.
+ *
+ * Arguments: ed => the record
+ *           buf => where to render it, EXTRA_DATA_TEXT_MAX bytes are enough
+ *          size => size of buf
+ *
+ * Returns: length of the text, which is NUL terminated
+ */
+uint32_t ExtraDataText(const ExtraData *ed, char *buf, uint32_t size)
+{
+    int family = ExtraDataFamily(ed);
+    uint32_t len;
+    uint32_t i;
+
+    if (size == 0)
+        return 0;
+
+    if (family != 0 && size >= INET6_ADDRSTRLEN)
+    {
+        if (inet_ntop(family, ed->data, buf, size) == NULL)
+            buf[0] = '\0';
+
+        return strlen(buf);
+    }
+
+    len = ed->length;
+    if (len > size - 1)
+        len = size - 1;
+    if (len > EXTRA_DATA_TEXT_MAX - 1)
+        len = EXTRA_DATA_TEXT_MAX - 1;
+
+    for (i = 0; i < len; i++)
+        buf[i] = (ed->data[i] >= 0x20 && ed->data[i] < 0x7f) ? ed->data[i] : '.';
+
+    buf[len] = '\0';
+
+    return len;
+}
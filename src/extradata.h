@@ -0,0 +1,61 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+#ifndef __EXTRADATA_H__
+#define __EXTRADATA_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include "sf_types.h"
+
+/* longest value ExtraDataText() renders, longer data is cut */
+#define EXTRA_DATA_TEXT_MAX     1024
+
+/* one unified2 extra data record, attached to its cached event */
+typedef struct _ExtraData
+{
+    uint32_t            event_id;
+    uint32_t            type;       /* EVENT_INFO_* */
+    uint32_t            data_type;  /* EVENT_DATA_TYPE_* */
+    uint32_t            length;
+    const uint8_t       *data;      /* points into record */
+    void                *record;
+    struct _ExtraData   *next;      /* in the order they were read */
+} ExtraData;
+
+ExtraData *ExtraDataParse(void *, uint32_t);
+void ExtraDataFree(ExtraData *);
+void ExtraDataBind(void *, ExtraData *);
+
+/* for the output plugins, valid while the event is being output */
+const ExtraData *GetExtraData(void *);
+const ExtraData *GetExtraDataByType(void *, uint32_t);
+const char *ExtraDataName(uint32_t);
+uint32_t ExtraDataType(const char *);
+int ExtraDataFamily(const ExtraData *);
+uint32_t ExtraDataText(const ExtraData *, char *, uint32_t);
+
+#endif /* __EXTRADATA_H__ */
@@ -38,9 +38,11 @@
 #endif /* !WIN32 */
 #include <errno.h>
 #include <signal.h>
+#include <stdarg.h>
 
 #include "log.h"
 #include "util.h"
+#include "encode.h"
 #include "debug.h"
 
 #include "barnyard2.h"
@@ -1230,28 +1232,6 @@ void LogICMPHeader(TextLog*  log, Packet * p)
  * reference stuff cloned from signature.c
  *--------------------------------------------------------------------
  */
-/* print a reference node */
-static void LogReference(TextLog* log, ReferenceNode *refNode)
-{
-    if(refNode)
-    {
-        if(refNode->system)
-        {
-            if(refNode->system->url)
-                TextLog_Print(log, "[Xref => %s%s]", refNode->system->url, 
-                        refNode->id);
-            else
-                TextLog_Print(log, "[Xref => %s %s]", refNode->system->name,
-                        refNode->id);
-        }
-        else
-        {
-            TextLog_Print(log, "[Xref => %s]", refNode->id);
-        }
-    }
-    return;   
-}
-
 /*
  * Function: LogXrefs(TextLog* )
  *
@@ -1264,23 +1244,328 @@ static void LogReference(TextLog* log, ReferenceNode *refNode)
  */ 
 void LogXrefs(TextLog* log, SigNode *sn, int doNewLine)
 {
-    ReferenceNode *refNode = NULL;
+    if(sn != NULL && sn->refs != NULL)
+    {
+        LogSigFragment(log, sn, SIG_FRAG_XREFS, NULL);
+
+        /* print a newline in Full mode */
+        if(doNewLine)
+            TextLog_NewLine(log);
+    }
+}
+
+/*--------------------------------------------------------------------
+ * signature text cache
+ *--------------------------------------------------------------------
+ */
+#define SIG_FRAG_BUF  4096
+
+/* bounded append used while rendering, output is truncated when full */
+static void FragAppend(char *buf, uint32_t *pos, const char *format, ...)
+{
+    va_list ap;
+    int len;
+
+    if ( *pos >= SIG_FRAG_BUF - 1 )
+        return;
+
+    va_start(ap, format);
+    len = vsnprintf(buf + *pos, SIG_FRAG_BUF - *pos, format, ap);
+    va_end(ap);
+
+    if ( len < 0 )
+        return;
 
-    if(sn != NULL)
+    *pos += len;
+
+    if ( *pos > SIG_FRAG_BUF - 1 )
+        *pos = SIG_FRAG_BUF - 1;
+}
+
+/* CEF header fields must have '|' and '\' escaped */
+static void FragAppendCEF(char *buf, uint32_t *pos, const char *str)
+{
+    while ( *str && *pos < SIG_FRAG_BUF - 2 )
     {
-        refNode = sn->refs;
+        if ( *str == '|' || *str == '\\' )
+            buf[(*pos)++] = '\\';
 
-        while(refNode  != NULL)
-        {
-            LogReference(log, refNode);
-            refNode = refNode->next;
+        buf[(*pos)++] = *str++;
+    }
+    buf[*pos] = '\0';
+}
+
+/* length of the valid UTF-8 sequence at s, 0 if it isn't one */
+static int JSONUtf8Len(const u_char *s)
+{
+    uint32_t cp;
+    int n, i;
 
-            /* on the last loop through, print a newline in
-               Full mode */
-            if(doNewLine && (refNode == NULL))
-                TextLog_NewLine(log);
+    if ( s[0] < 0xc2 || s[0] > 0xf4 )
+        return 0;
+
+    n = s[0] >= 0xf0 ? 4 : s[0] >= 0xe0 ? 3 : 2;
+    cp = s[0] & (0x3f >> (n - 1));
+
+    for ( i = 1; i < n; i++ )
+    {
+        /* also stops at the terminating NUL */
+        if ( (s[i] & 0xc0) != 0x80 )
+            return 0;
+
+        cp = (cp << 6) | (s[i] & 0x3f);
+    }
+
+    /* overlong forms, surrogates and beyond U+10FFFF */
+    if ( (n == 3 && cp < 0x800) || (n == 4 && cp < 0x10000) ||
+         cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff) )
+        return 0;
+
+    return n;
+}
+
+/* JSON string contents, stops at limit so the members after it still fit.
+ * Valid UTF-8 is kept, any other byte outside printable ASCII is written
+ * as \u00XX, which reads Latin-1 messages right. */
+static void FragAppendJSON(char *buf, uint32_t *pos, const char *str, uint32_t limit)
+{
+    static const char hex[] = "0123456789abcdef";
+    const u_char *s = (const u_char *)str;
+    int n;
+
+    while ( *s != '\0' && *pos < limit - 6 )
+    {
+        if ( *s == '"' || *s == '\\' )
+        {
+            buf[(*pos)++] = '\\';
+            buf[(*pos)++] = *s++;
+        }
+        else if ( *s >= 0x20 && *s < 0x7f )
+        {
+            buf[(*pos)++] = *s++;
+        }
+        else if ( (n = JSONUtf8Len(s)) != 0 )
+        {
+            memcpy(buf + *pos, s, n);
+            *pos += n;
+            s += n;
+        }
+        else
+        {
+            memcpy(buf + *pos, "\\u00", 4);
+            buf[*pos + 4] = hex[*s >> 4];
+            buf[*pos + 5] = hex[*s & 0x0f];
+            *pos += 6;
+            s++;
         }
     }
+    buf[*pos] = '\0';
+}
+
+static uint32_t RenderSigFragment(SigNode *sn, u_int8_t type, uint32_t gid,
+        uint32_t sid, uint32_t rev, uint32_t class_id, uint32_t priority_id,
+        char *buf)
+{
+    ClassType *cn = NULL;
+    ReferenceNode *refNode;
+    uint32_t pos = 0;
+    int severity;
+
+    buf[0] = '\0';
+
+    switch ( type )
+    {
+        case SIG_FRAG_FAST:
+            FragAppend(buf, &pos, "[%lu:%lu:%lu] ", (unsigned long)gid,
+                       (unsigned long)sid, (unsigned long)rev);
+
+            if ( BcAlertInterface() )
+                FragAppend(buf, &pos, "<%s> ",
+                           PRINT_INTERFACE(barnyard2_conf->interface));
+
+            FragAppend(buf, &pos, "%s [**] ", sn ? sn->msg : "ALERT");
+            break;
+
+        case SIG_FRAG_FULL:
+            if ( sn == NULL )
+            {
+                FragAppend(buf, &pos, "[**] Snort Alert! [**]\n");
+                break;
+            }
+
+            FragAppend(buf, &pos, "[**] [%lu:%lu:%lu] ", (unsigned long)gid,
+                       (unsigned long)sid, (unsigned long)rev);
+
+            if ( BcAlertInterface() )
+                FragAppend(buf, &pos, " <%s> ",
+                           PRINT_INTERFACE(barnyard2_conf->interface));
+
+            FragAppend(buf, &pos, "%s [**]\n", sn->msg);
+            break;
+
+        case SIG_FRAG_PRIORITY:
+            cn = ClassTypeLookupById(barnyard2_conf, class_id);
+
+            if ( cn != NULL )
+                FragAppend(buf, &pos, "[Classification: %s] [Priority: %d] ",
+                           cn->name, cn->priority);
+            else
+                FragAppend(buf, &pos, "[Classification ID: %d] [Priority ID: %d] ",
+                           class_id, priority_id);
+            break;
+
+        case SIG_FRAG_XREFS:
+            for ( refNode = sn ? sn->refs : NULL; refNode; refNode = refNode->next )
+            {
+                if ( refNode->system == NULL )
+                    FragAppend(buf, &pos, "[Xref => %s]", refNode->id);
+                else if ( refNode->system->url )
+                    FragAppend(buf, &pos, "[Xref => %s%s]",
+                               refNode->system->url, refNode->id);
+                else
+                    FragAppend(buf, &pos, "[Xref => %s %s]",
+                               refNode->system->name, refNode->id);
+            }
+            break;
+
+        case SIG_FRAG_SYSLOG:
+        case SIG_FRAG_SYSLOG_FULL:
+            cn = ClassTypeLookupById(barnyard2_conf, class_id);
+
+            FragAppend(buf, &pos, "[%lu:%lu:%lu] %s", (unsigned long)gid,
+                       (unsigned long)sid, (unsigned long)rev,
+                       sn ? sn->msg : "ALERT");
+
+            /* syslog_full always separates the message from the priority */
+            if ( type == SIG_FRAG_SYSLOG_FULL )
+                FragAppend(buf, &pos, " ");
+
+            if ( cn != NULL && cn->name != NULL )
+                FragAppend(buf, &pos, "%s[Classification: %s] [Priority: %d]:",
+                           type == SIG_FRAG_SYSLOG ? " " : "",
+                           cn->name, priority_id);
+            else if ( priority_id != 0 )
+                FragAppend(buf, &pos, "[Priority: %d]:", priority_id);
+            break;
+
+        case SIG_FRAG_CEF:
+            severity = 11 - (int)priority_id;
+
+            if ( severity < 0 )
+                severity = 0;
+            else if ( severity > 10 )
+                severity = 10;
+
+            FragAppend(buf, &pos, "%lu:%lu:%lu|", (unsigned long)gid,
+                       (unsigned long)sid, (unsigned long)rev);
+            FragAppendCEF(buf, &pos, sn ? sn->msg : "ALERT");
+            FragAppend(buf, &pos, "|%d|", severity);
+            break;
+
+        case SIG_FRAG_JSON:
+            cn = ClassTypeLookupById(barnyard2_conf, class_id);
+
+            FragAppend(buf, &pos, "\"gid\":%lu,\"sid\":%lu,\"rev\":%lu,\"msg\":\"",
+                       (unsigned long)gid, (unsigned long)sid, (unsigned long)rev);
+            FragAppendJSON(buf, &pos, sn ? sn->msg : "ALERT", SIG_FRAG_BUF - 512);
+            FragAppend(buf, &pos, "\",\"class\":\"");
+            FragAppendJSON(buf, &pos, cn ? cn->type : "unknown", SIG_FRAG_BUF - 256);
+            FragAppend(buf, &pos, "\",\"priority\":%lu", (unsigned long)priority_id);
+
+            if ( sn == NULL || sn->refs == NULL )
+                break;
+
+            FragAppend(buf, &pos, ",\"refs\":[");
+            for ( refNode = sn->refs; refNode; refNode = refNode->next )
+            {
+                /* drop the references that no longer fit */
+                if ( pos > SIG_FRAG_BUF - 128 )
+                    break;
+
+                FragAppend(buf, &pos, "%s\"", refNode == sn->refs ? "" : ",");
+                if ( refNode->system != NULL )
+                {
+                    FragAppendJSON(buf, &pos, refNode->system->url ?
+                                   refNode->system->url : refNode->system->name,
+                                   SIG_FRAG_BUF - 64);
+                    if ( refNode->system->url == NULL )
+                        FragAppend(buf, &pos, " ");
+                }
+                FragAppendJSON(buf, &pos, refNode->id, SIG_FRAG_BUF - 8);
+                FragAppend(buf, &pos, "\"");
+            }
+            FragAppend(buf, &pos, "]");
+            break;
+
+        default:
+            break;
+    }
+
+    return pos;
+}
+
+/*--------------------------------------------------------------------
+ * Function: GetSigFragment(SigNode *, u_int8_t, Unified2EventCommon *)
+ *
+ * Purpose: Returns the signature derived text of an alert for a given
+ *          output format.  The text is rendered on first use and kept
+ *          on the SigNode so later alerts only need to copy it.
+ *
+ * Arguments: sn => signature of the alert (may be NULL)
+ *            type => SIG_FRAG_* format
+ *            event => unified2 event (NULL for event independent text)
+ *
+ * Returns: the rendered fragment, never NULL
+ *--------------------------------------------------------------------
+ */
+const SigFragment* GetSigFragment(SigNode *sn, u_int8_t type, Unified2EventCommon *event)
+{
+    static char buf[SIG_FRAG_BUF];
+    static SigFragment scratch;
+    SigFragment *frag;
+    uint32_t gid = 0, sid = 0, rev = 0, class_id = 0, priority_id = 0;
+    uint32_t len;
+
+    if ( event != NULL )
+    {
+        gid = ntohl(event->generator_id);
+        sid = ntohl(event->signature_id);
+        rev = ntohl(event->signature_revision);
+        class_id = ntohl(event->classification_id);
+        priority_id = ntohl(event->priority_id);
+    }
+
+    if ( (frag = SigFragmentLookup(sn, type, gid, rev, class_id, priority_id)) != NULL )
+        return frag;
+
+    len = RenderSigFragment(sn, type, gid, sid, rev, class_id, priority_id, buf);
+
+    if ( (frag = SigFragmentStore(sn, type, gid, rev, class_id, priority_id, buf, len)) != NULL )
+        return frag;
+
+    /* no signature to attach the text to */
+    scratch.data = buf;
+    scratch.len = len;
+
+    return &scratch;
+}
+
+/*--------------------------------------------------------------------
+ * Function: LogSigFragment(TextLog*, SigNode *, u_int8_t, Unified2EventCommon *)
+ *
+ * Purpose: Writes the cached signature text of an alert to a TextLog
+ *
+ * Arguments: log => pointer to TextLog to write the data to
+ *            sn, type, event => see GetSigFragment()
+ *
+ * Returns: void function
+ *--------------------------------------------------------------------
+ */
+void LogSigFragment(TextLog* log, SigNode *sn, u_int8_t type, Unified2EventCommon *event)
+{
+    const SigFragment *frag = GetSigFragment(sn, type, event);
+
+    TextLog_Write(log, frag->data, frag->len);
 }
 
 /*--------------------------------------------------------------------
@@ -1358,7 +1643,10 @@ static void LogNetData (TextLog* log, const u_char* data, const int len)
     const u_char* end = data + len;
 
     int offset = 0;
-    char conv[] = "0123456789ABCDEF";   /* xlation lookup table */
+    /* offset, hex, padding, ascii and the newline of one frame */
+    char line[16 + 4*BYTES_PER_FRAME + 2];
+    char hexbuf[2*BYTES_PER_FRAME + 1];
+    int padlen = strlen(pad3);
 
     if ( !len )
     {
@@ -1383,41 +1671,39 @@ static void LogNetData (TextLog* log, const u_char* data, const int len)
         end = data + BYTES_PER_FRAME;
     }
 
-    /* loop thru the whole buffer */
+    /* loop thru the whole buffer, building each frame as one line */
     while ( pb < end )
     {
-        int i = 0;
+        int n = (end - pb < BYTES_PER_FRAME) ? (int)(end - pb) : BYTES_PER_FRAME;
+        char* lp = line;
+        int i;
 
         if (BcVerboseByteDump())
         {
-            TextLog_Print(log, "0x%04X: ", offset);
+            lp += snprintf(line, 16, "0x%04X: ", offset);
             offset += BYTES_PER_FRAME;
         }
         /* process one frame */
-        /* first print the binary as ascii hex */
-        for (i = 0; i < BYTES_PER_FRAME && pb+i < end; i++)
+        /* first the binary as ascii hex */
+        EncodeHex(hexbuf, pb, n);
+
+        for (i = 0; i < n; i++)
         {
-            char b = pb[i];
-            TextLog_Putc(log, conv[(b & 0xFF) >> 4]);
-            TextLog_Putc(log, conv[(b & 0xFF) & 0x0F]);
-            TextLog_Putc(log, ' ');
+            *lp++ = hexbuf[2*i];
+            *lp++ = hexbuf[2*i + 1];
+            *lp++ = ' ';
         }
-        /* print ' ' past end of packet and before ascii */
-        TextLog_Puts(log, pad3+(3*i));
+        /* ' ' past end of packet and before ascii */
+        memcpy(lp, pad3+(3*n), padlen - (3*n));
+        lp += padlen - (3*n);
 
-        /* then print the actual ascii chars */
+        /* then the actual ascii chars */
         /* or a '.' for control chars */
-        for (i = 0; i < BYTES_PER_FRAME && pb+i < end; i++)
-        {
-            char b = pb[i];
+        lp += EncodePrintable(lp, pb, n);
+        *lp++ = '\n';
 
-            if ( b > 0x1F && b < 0x7F)
-                TextLog_Putc(log, (char)(b & 0xFF));
-            else
-                TextLog_Putc(log, '.');
-        }
+        TextLog_Write(log, line, lp - line);
         pb += BYTES_PER_FRAME;
-        TextLog_NewLine(log);
     }
     TextLog_NewLine(log);
 }
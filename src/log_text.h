@@ -34,10 +34,13 @@
 #define _LOG_TEXT_H
 
 #include "map.h"
+#include "unified2.h"
 #include "sfutil/sf_textlog.h"
 
 void LogPriorityData(TextLog*, u_int32_t, u_int32_t, bool);
 void LogXrefs(TextLog*, SigNode*, bool doNewLine);
+const SigFragment* GetSigFragment(SigNode*, u_int8_t type, Unified2EventCommon*);
+void LogSigFragment(TextLog*, SigNode*, u_int8_t type, Unified2EventCommon*);
 
 void LogIPPkt(TextLog*, int type, Packet*);
 
@@ -59,7 +62,6 @@ static void LogIpOptions(TextLog* , Packet*);
 static void LogTcpOptions(TextLog*, Packet*);
 static void LogEmbeddedICMPHeader(TextLog*, const ICMPHdr*);
 static void LogICMPEmbeddedIP(TextLog*, Packet*);
-static void LogReference(TextLog*, ReferenceNode*);
 static void LogCharData(TextLog*, char* data, int len);
 static void LogNetData (TextLog*, const u_char* data, const int len);
 #endif
@@ -1113,13 +1113,71 @@ SigNode *CreateSigNode(SidGidMsgMap *gidsidmap,SigNode * sn) {
 		memset(dn, 0, sizeof *dn);
 	} else {
 		dn = &kh_value(map, k);
-		ClearSigNode(sn);
+		ClearSigNode(dn);
 	}
 	memcpy(dn,sn,sizeof *dn);
 
 	return dn;
 }
 
+/**
+ * Lookup a pre-rendered output fragment of a signature.
+ *
+ * Fragments embed values taken from the event (the gid for SO rules matched
+ * against a v1 map, the revision, classification and priority), so they are
+ * only returned when rendered for the same values.
+ *
+ * @return NULL if the fragment has not been rendered for these values.
+ */
+SigFragment *SigFragmentLookup(SigNode *sn, u_int8_t type, u_int32_t gid,
+		u_int32_t rev, u_int32_t class_id, u_int32_t priority_id) {
+	SigFragment *frag;
+
+	if (sn == NULL || sn->frags == NULL || type >= SIG_FRAG_MAX)
+		return NULL;
+
+	frag = &sn->frags[type];
+
+	if (frag->data == NULL || frag->gid != gid || frag->rev != rev ||
+			frag->class_id != class_id || frag->priority_id != priority_id)
+		return NULL;
+
+	return frag;
+}
+
+/**
+ * Store a rendered output fragment on a signature, replacing any fragment of
+ * the same type.
+ *
+ * @return NULL on error | the stored SigFragment on success.
+ */
+SigFragment *SigFragmentStore(SigNode *sn, u_int8_t type, u_int32_t gid,
+		u_int32_t rev, u_int32_t class_id, u_int32_t priority_id,
+		const char *data, u_int32_t len) {
+	SigFragment *frag;
+
+	if (sn == NULL || data == NULL || type >= SIG_FRAG_MAX)
+		return NULL;
+
+	if (sn->frags == NULL)
+		sn->frags = (SigFragment *)SnortAlloc(SIG_FRAG_MAX * sizeof(SigFragment));
+
+	frag = &sn->frags[type];
+
+	if (frag->data != NULL)
+		free(frag->data);
+
+	frag->data = (char *)SnortAlloc(len + 1);
+	memcpy(frag->data, data, len);
+	frag->len = len;
+	frag->gid = gid;
+	frag->rev = rev;
+	frag->class_id = class_id;
+	frag->priority_id = priority_id;
+
+	return frag;
+}
+
 /**
  * Parse a single line of a gen-msg.map file. When successful, the results are
  * stored in the global SidMsgMap.
@@ -1225,6 +1283,20 @@ void FreeSigNodeReferences(SigNode * sn) {
 	sn->refs = NULL;
 }
 
+void FreeSigNodeFragments(SigNode * sn) {
+	int i;
+
+	if (sn == NULL || sn->frags == NULL) return;
+
+	for (i = 0; i < SIG_FRAG_MAX; i++) {
+		if (sn->frags[i].data != NULL)
+			free(sn->frags[i].data);
+	}
+
+	free(sn->frags);
+	sn->frags = NULL;
+}
+
 void ClearSigNode(SigNode *dn) {
 	if (dn->classLiteral != NULL) {
 		free(dn->classLiteral);
@@ -1238,6 +1310,8 @@ void ClearSigNode(SigNode *dn) {
 
 	/* free the references (NOT the reference systems) */
 	FreeSigNodeReferences(dn);
+
+	FreeSigNodeFragments(dn);
 }
 
 void FreeSigNodes(SidGidMsgMap ** mapPtr) {
@@ -92,6 +92,29 @@ typedef struct _ClassType
 
 } ClassType;
 
+/* pre-rendered, output specific signature text (see GetSigFragment()) */
+#define SIG_FRAG_FAST        0  /* "[g:s:r] [<iface> ]msg [**] " */
+#define SIG_FRAG_FULL        1  /* "[**] [g:s:r] [ <iface> ]msg [**]\n" */
+#define SIG_FRAG_PRIORITY    2  /* "[Classification: c] [Priority: p] " */
+#define SIG_FRAG_XREFS       3  /* "[Xref => ...]..." */
+#define SIG_FRAG_SYSLOG      4  /* "[g:s:r] msg [Classification: c] [Priority: p]:" */
+#define SIG_FRAG_SYSLOG_FULL 5  /* as above, syslog_full spacing */
+#define SIG_FRAG_CEF         6  /* "g:s:r|msg|severity|" (CEF escaped) */
+#define SIG_FRAG_JSON        7  /* "\"gid\":g,...,\"priority\":p" (JSON escaped members) */
+#define SIG_FRAG_MAX         8
+
+typedef struct _SigFragment
+{
+    /* event values the fragment was rendered for */
+    uint32_t gid;
+    uint32_t rev;
+    uint32_t class_id;
+    uint32_t priority_id;
+
+    uint32_t len;
+    char *data;
+} SigFragment;
+
 typedef uint32_t sig_gid_t;
 typedef uint32_t sig_sid_t;
 typedef uint32_t sig_rev_t;
@@ -109,6 +132,7 @@ typedef struct _SigNode {
 	char *classLiteral;  /* sid-msg.map v2 type only */
 	char *msg; /* messages */
 	ReferenceNode		*refs; /* references (eg bugtraq) */
+	SigFragment		*frags; /* lazily rendered output text, SIG_FRAG_MAX entries */
 
 } SigNode;
 
@@ -138,6 +162,9 @@ ReferenceNode * AddReference(struct _Barnyard2Config *, ReferenceNode **, char *
 
 SigNode *GetSigByGidSid(uint32_t, uint32_t, uint32_t);
 SigNode *CreateSigNode(SidGidMsgMap *gidsidmap,SigNode *sn);
+SigFragment *SigFragmentLookup(SigNode *, u_int8_t, uint32_t, uint32_t, uint32_t, uint32_t);
+SigFragment *SigFragmentStore(SigNode *, u_int8_t, uint32_t, uint32_t, uint32_t, uint32_t,
+                              const char *, uint32_t);
 
 ClassType * ClassTypeLookupByType(struct _Barnyard2Config *, char *);
 ClassType * ClassTypeLookupById(struct _Barnyard2Config *, int);
@@ -0,0 +1,797 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+/*
+** Description:
+**   Runtime metrics in the Prometheus text format. The record counters of
+**   DropStats() are exported together with the record rate, histograms of
+**   packet decode time, of every output function call and of database
+**   commits, the event cache occupancy and how far the spooler is behind
+**   the spool head.
+**
+**   The metrics are served over HTTP on a local unix or TCP socket and/or
+**   rewritten periodically to a stats file (suitable for the node_exporter
+**   textfile collector). Both are serviced from the processing loop, every
+**   METRICS_TICK_RECORDS records and from the idle functions, so there are
+**   no threads or locks involved and the cost per record is a counter
+**   increment plus the clock reads of the timed sections.
+**
+**   With tracing on, every output call is also timed against the time of
+**   the event it delivers and against the time its record was read, into
+**   per output log-linear histograms. Their quantiles are exported as
+**   summaries and printed with the statistics on SIGUSR1 and exit.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "barnyard2.h"
+#include "log.h"
+#include "parser.h"
+#include "plugbase.h"
+#include "spooler.h"
+#include "unified2.h"
+#include "util.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define METRICS_TICK_RECORDS    1024        /* records between clock checks */
+#define METRICS_POLL_NS         100000000   /* serve scrapes at least every 100ms */
+#define METRICS_IO_TIMEOUT      1000        /* ms a scrape may take */
+#define METRICS_WARNING_GAP     60          /* seconds between lag warnings */
+
+typedef struct _MetricsBuffer
+{
+    char        *data;
+    size_t      len;
+    size_t      size;
+} MetricsBuffer;
+
+typedef struct _MetricsState
+{
+    int             fd;             /* listening socket, -1 if none */
+    char            *unix_path;     /* unlinked on cleanup */
+    char            *file;
+    char            *file_tmp;
+    uint64_t        interval_ns;
+
+    uint32_t        ticks;
+    uint64_t        start;
+    uint64_t        last_poll;
+    uint64_t        last_file;
+
+    /* records per second, over the last second or more */
+    uint64_t        rate_time;
+    uint64_t        rate_records;
+    double          rate;
+
+    uint64_t        lag_warning_us;
+    time_t          last_warning;
+
+    MetricsBuffer   buf;
+} MetricsState;
+
+int metrics_enabled = 0;
+int metrics_trace = 0;
+MetricsHistogram metrics_decode;
+MetricsHistogram metrics_db_commit;
+
+static MetricsState *metrics = NULL;
+
+extern OutputFuncNode *AlertList;
+extern OutputFuncNode *LogList;
+
+static void MetricsIdleFunc(int, void *);
+
+static void MetricsPrintf(MetricsBuffer *buf, const char *format, ...)
+{
+    va_list ap;
+    int ret;
+
+    while (1)
+    {
+        va_start(ap, format);
+        ret = vsnprintf(buf->data + buf->len, buf->size - buf->len, format, ap);
+        va_end(ap);
+
+        if (ret < 0)
+            return;
+
+        if ((size_t)ret < buf->size - buf->len)
+        {
+            buf->len += ret;
+            return;
+        }
+
+        buf->size = (buf->size + ret) * 2;
+
+        if ( (buf->data=(char *)realloc(buf->data, buf->size)) == NULL )
+            FatalError("metrics: out of memory\n");
+    }
+}
+
+static void MetricsHeader(MetricsBuffer *buf, const char *name, const char *type,
+                          const char *help)
+{
+    MetricsPrintf(buf, "# HELP barnyard2_%s %s\n# TYPE barnyard2_%s %s\n",
+                  name, help, name, type);
+}
+
+static void MetricsValue(MetricsBuffer *buf, const char *name, const char *type,
+                         const char *help, uint64_t value)
+{
+    MetricsHeader(buf, name, type, help);
+    MetricsPrintf(buf, "barnyard2_%s " STDu64 "\n", name, value);
+}
+
+static void MetricsHistogramPrint(MetricsBuffer *buf, const char *name,
+                                  const char *labels, MetricsHistogram *h)
+{
+    uint64_t cumulative = 0;
+    const char *sep = labels[0] != '\0' ? "," : "";
+    int i;
+
+    for (i = 0; i < METRICS_BUCKETS - 1; i++)
+    {
+        cumulative += h->bucket[i];
+        MetricsPrintf(buf, "barnyard2_%s_bucket{%s%sle=\"%g\"} " STDu64 "\n",
+                      name, labels, sep, (double)(1 << i) / 1000000, cumulative);
+    }
+
+    MetricsPrintf(buf, "barnyard2_%s_bucket{%s%sle=\"+Inf\"} " STDu64 "\n",
+                  name, labels, sep, h->count);
+
+    if (labels[0] != '\0')
+    {
+        MetricsPrintf(buf, "barnyard2_%s_sum{%s} %.9f\n", name, labels, h->sum_ns / 1e9);
+        MetricsPrintf(buf, "barnyard2_%s_count{%s} " STDu64 "\n", name, labels, h->count);
+    }
+    else
+    {
+        MetricsPrintf(buf, "barnyard2_%s_sum %.9f\n", name, h->sum_ns / 1e9);
+        MetricsPrintf(buf, "barnyard2_%s_count " STDu64 "\n", name, h->count);
+    }
+}
+
+static void MetricsLatencyRecord(MetricsLatency *l, uint64_t usec)
+{
+    unsigned int msb = 0;
+    unsigned int group;
+    uint64_t v;
+
+    if (usec >= (uint64_t)1 << (METRICS_LATENCY_MAX_BITS + 1))
+        usec = ((uint64_t)1 << (METRICS_LATENCY_MAX_BITS + 1)) - 1;
+
+    for (v = usec >> 1; v != 0; v >>= 1)
+        msb++;
+
+    /* values below 2^(SUB_BITS+1) map one to one, above that each power
+     * of two is split into 2^SUB_BITS buckets */
+    group = msb > METRICS_LATENCY_SUB_BITS ? msb - METRICS_LATENCY_SUB_BITS : 0;
+
+    l->bucket[(group << METRICS_LATENCY_SUB_BITS) + (usec >> group)]++;
+    l->count++;
+    l->sum_us += usec;
+
+    if (usec > l->max_us)
+        l->max_us = usec;
+}
+
+/* upper bound, in microseconds, of the bucket holding quantile q */
+static uint64_t MetricsLatencyQuantile(MetricsLatency *l, double q)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    unsigned int group;
+    unsigned int i;
+
+    if (l->count == 0)
+        return 0;
+
+    rank = (uint64_t)(q * l->count);
+    if (rank >= l->count)
+        rank = l->count - 1;
+
+    for (i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+    {
+        seen += l->bucket[i];
+
+        if (seen > rank)
+        {
+            group = i >> METRICS_LATENCY_SUB_BITS;
+            if (group > 0)
+                group--;
+
+            /* never claim more than was seen */
+            if ((((uint64_t)(i - (group << METRICS_LATENCY_SUB_BITS)) + 1) << group) - 1 > l->max_us)
+                return l->max_us;
+
+            return (((uint64_t)(i - (group << METRICS_LATENCY_SUB_BITS)) + 1) << group) - 1;
+        }
+    }
+
+    return l->max_us;
+}
+
+static const double metrics_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+#define METRICS_QUANTILES (sizeof(metrics_quantiles) / sizeof(metrics_quantiles[0]))
+
+static void MetricsLatencyPrint(MetricsBuffer *buf, const char *name,
+                                const char *labels, MetricsLatency *l)
+{
+    unsigned int i;
+
+    for (i = 0; i < METRICS_QUANTILES; i++)
+    {
+        MetricsPrintf(buf, "barnyard2_%s{%s,quantile=\"%g\"} %.6f\n", name, labels,
+                      metrics_quantiles[i], MetricsLatencyQuantile(l, metrics_quantiles[i]) / 1e6);
+    }
+
+    MetricsPrintf(buf, "barnyard2_%s_sum{%s} %.6f\n", name, labels, l->sum_us / 1e6);
+    MetricsPrintf(buf, "barnyard2_%s_count{%s} " STDu64 "\n", name, labels, l->count);
+}
+
+static void MetricsOutputLabels(OutputFuncNode *node, const char *type, char *labels, size_t len)
+{
+    SnortSnprintf(labels, len, "output=\"%s\",instance=\"%d\",type=\"%s\"",
+                  node->keyword != NULL ? node->keyword : "unknown",
+                  node->instance, type);
+}
+
+static void MetricsOutputs(MetricsBuffer *buf, OutputFuncNode *list, const char *type)
+{
+    char labels[256];
+
+    for (; list != NULL; list = list->next)
+    {
+        MetricsOutputLabels(list, type, labels, sizeof(labels));
+        MetricsHistogramPrint(buf, "output_seconds", labels, &list->latency);
+    }
+}
+
+static void MetricsOutputLags(MetricsBuffer *buf, OutputFuncNode *list, const char *type,
+                              int event_lag)
+{
+    char labels[256];
+
+    for (; list != NULL; list = list->next)
+    {
+        if (list->event_lag == NULL)
+            continue;
+
+        MetricsOutputLabels(list, type, labels, sizeof(labels));
+
+        if (event_lag)
+            MetricsLatencyPrint(buf, "output_event_lag_seconds", labels, list->event_lag);
+        else
+            MetricsLatencyPrint(buf, "output_read_lag_seconds", labels, list->read_lag);
+    }
+}
+
+static void MetricsUpdateRate(uint64_t now)
+{
+    if (now - metrics->rate_time < 1000000000)
+        return;
+
+    metrics->rate = (double)(pc.total_records - metrics->rate_records) * 1e9 /
+                    (now - metrics->rate_time);
+    metrics->rate_time = now;
+    metrics->rate_records = pc.total_records;
+}
+
+static void MetricsFormat(uint64_t now)
+{
+    MetricsBuffer *buf = &metrics->buf;
+    Spooler *spooler = barnyard2_conf != NULL ? barnyard2_conf->spooler : NULL;
+    uint64_t lag_bytes, lag_records;
+    uint32_t lag_files;
+
+    buf->len = 0;
+
+    MetricsValue(buf, "records_total", "counter", "Unified2 records processed.", pc.total_records);
+    MetricsValue(buf, "events_total", "counter", "Event records processed.", pc.total_events);
+    MetricsValue(buf, "packets_total", "counter", "Packet records processed.", pc.total_packets);
+    MetricsValue(buf, "unknown_total", "counter", "Records of unknown type.", pc.total_unknown);
+    MetricsValue(buf, "suppressed_total", "counter", "Events dropped by sig_suppress.", pc.total_suppressed);
+    MetricsValue(buf, "aggregated_total", "counter", "Events folded into an aggregate.", pc.total_aggregated);
+
+    MetricsUpdateRate(now);
+    MetricsHeader(buf, "records_per_second", "gauge", "Records processed per second.");
+    MetricsPrintf(buf, "barnyard2_records_per_second %.3f\n", metrics->rate);
+
+    MetricsHeader(buf, "uptime_seconds", "gauge", "Seconds since metrics were started.");
+    MetricsPrintf(buf, "barnyard2_uptime_seconds %.3f\n", (now - metrics->start) / 1e9);
+
+    MetricsValue(buf, "event_cache_events", "gauge", "Events held in the event cache.",
+                 spooler != NULL ? spooler->events_cached : 0);
+
+    spoolerGetLag(spooler, &lag_bytes, &lag_records, &lag_files);
+    MetricsValue(buf, "spool_lag_bytes", "gauge", "Spooled bytes not processed yet.", lag_bytes);
+    MetricsValue(buf, "spool_lag_records", "gauge", "Spooled records not processed yet (estimate).", lag_records);
+    MetricsValue(buf, "spool_lag_files", "gauge", "Spool files newer than the current one.", lag_files);
+
+    MetricsHeader(buf, "decode_seconds", "histogram", "Time spent decoding packets.");
+    MetricsHistogramPrint(buf, "decode_seconds", "", &metrics_decode);
+
+    MetricsHeader(buf, "output_seconds", "histogram", "Time spent in each output function call.");
+    MetricsOutputs(buf, AlertList, "alert");
+    MetricsOutputs(buf, LogList, "log");
+
+    MetricsHeader(buf, "db_commit_seconds", "histogram", "Time spent committing database transactions.");
+    MetricsHistogramPrint(buf, "db_commit_seconds", "", &metrics_db_commit);
+
+    if (metrics_trace)
+    {
+        MetricsHeader(buf, "output_event_lag_seconds", "summary",
+                      "Time from the event to its delivery by each output.");
+        MetricsOutputLags(buf, AlertList, "alert", 1);
+        MetricsOutputLags(buf, LogList, "log", 1);
+
+        MetricsHeader(buf, "output_read_lag_seconds", "summary",
+                      "Time from reading a record to its delivery by each output.");
+        MetricsOutputLags(buf, AlertList, "alert", 0);
+        MetricsOutputLags(buf, LogList, "log", 0);
+    }
+}
+
+static void MetricsWriteFile(uint64_t now)
+{
+    FILE *fp;
+
+    MetricsFormat(now);
+
+    if ( (fp=fopen(metrics->file_tmp, "w")) == NULL )
+    {
+        ErrorMessage("metrics: unable to open '%s': %s\n", metrics->file_tmp, strerror(errno));
+        return;
+    }
+
+    if (fwrite(metrics->buf.data, 1, metrics->buf.len, fp) != metrics->buf.len)
+    {
+        ErrorMessage("metrics: unable to write '%s': %s\n", metrics->file_tmp, strerror(errno));
+        fclose(fp);
+        unlink(metrics->file_tmp);
+        return;
+    }
+
+    fclose(fp);
+
+    /* swap it in whole so readers never see a partial file */
+    if (rename(metrics->file_tmp, metrics->file) != 0)
+        ErrorMessage("metrics: unable to rename '%s': %s\n", metrics->file_tmp, strerror(errno));
+}
+
+/* wait for a socket to become ready, returns 0 when it is */
+static int MetricsWait(int fd, short events, uint64_t deadline)
+{
+    struct pollfd pfd;
+    uint64_t now;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = events;
+
+    while ( (now=MetricsNow()) < deadline )
+    {
+        ret = poll(&pfd, 1, (int)((deadline - now) / 1000000) + 1);
+
+        if (ret > 0)
+            return 0;
+
+        if (ret < 0 && errno != EINTR)
+            return -1;
+    }
+
+    return -1;
+}
+
+/* answer one scrape: read whatever request comes, reply with the metrics */
+static void MetricsServe(int fd, uint64_t now)
+{
+    char header[128];
+    char request[1024];
+    uint64_t deadline = now + (uint64_t)METRICS_IO_TIMEOUT * 1000000;
+    size_t off = 0;
+    ssize_t ret;
+    int header_len;
+
+    if (MetricsWait(fd, POLLIN, deadline) == 0)
+        (void)recv(fd, request, sizeof(request), MSG_DONTWAIT);
+
+    MetricsFormat(now);
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %lu\r\n\r\n",
+                          (unsigned long)metrics->buf.len);
+
+    if (send(fd, header, header_len, MSG_NOSIGNAL | MSG_DONTWAIT) != header_len)
+        return;
+
+    while (off < metrics->buf.len)
+    {
+        ret = send(fd, metrics->buf.data + off, metrics->buf.len - off,
+                   MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (ret > 0)
+        {
+            off += ret;
+        }
+        else if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (MetricsWait(fd, POLLOUT, deadline) != 0)
+                return;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+static void MetricsPoll(uint64_t now)
+{
+    int fd;
+
+    metrics->last_poll = now;
+
+    if (metrics->fd != -1)
+    {
+        while ( (fd=accept(metrics->fd, NULL, NULL)) != -1 )
+        {
+            MetricsServe(fd, now);
+            close(fd);
+        }
+    }
+
+    if (metrics->file != NULL && now - metrics->last_file >= metrics->interval_ns)
+    {
+        metrics->last_file = now;
+        MetricsWriteFile(now);
+    }
+
+    MetricsUpdateRate(now);
+}
+
+/* called after every record while metrics are on */
+void MetricsTick(void)
+{
+    uint64_t now;
+
+    if (++metrics->ticks < METRICS_TICK_RECORDS)
+        return;
+
+    metrics->ticks = 0;
+    now = MetricsNow();
+
+    if (now - metrics->last_poll >= METRICS_POLL_NS)
+        MetricsPoll(now);
+}
+
+/* account an output call that just returned, when tracing; read_time is
+ * when the record it output was read */
+void MetricsTrace(OutputFuncNode *node, Packet *packet, void *event, uint64_t read_time)
+{
+    struct timeval tv;
+    uint64_t now = MetricsNow();
+    uint64_t event_time;
+    uint64_t wall;
+    uint64_t lag = 0;
+
+    if (node->event_lag == NULL)
+    {
+        node->event_lag = (MetricsLatency *)SnortAlloc(sizeof(MetricsLatency));
+        node->read_lag = (MetricsLatency *)SnortAlloc(sizeof(MetricsLatency));
+    }
+
+    if (read_time != 0 && now > read_time)
+        MetricsLatencyRecord(node->read_lag, (now - read_time) / 1000);
+
+    if (event != NULL)
+    {
+        event_time = (uint64_t)ntohl(((Unified2EventCommon *)event)->event_second) * 1000000 +
+                     ntohl(((Unified2EventCommon *)event)->event_microsecond);
+    }
+    else if (packet != NULL && packet->pkth != NULL)
+    {
+        event_time = (uint64_t)packet->pkth->ts.tv_sec * 1000000 + packet->pkth->ts.tv_usec;
+    }
+    else
+    {
+        return;
+    }
+
+    gettimeofday(&tv, NULL);
+    wall = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    /* sensor clocks ahead of ours count as no lag */
+    if (wall > event_time)
+        lag = wall - event_time;
+
+    MetricsLatencyRecord(node->event_lag, lag);
+
+    if (metrics->lag_warning_us != 0 && lag >= metrics->lag_warning_us &&
+        tv.tv_sec - metrics->last_warning >= METRICS_WARNING_GAP)
+    {
+        metrics->last_warning = tv.tv_sec;
+        LogMessage("WARNING: output %s delivered an event %.1f seconds after "
+                   "it happened\n", node->keyword != NULL ? node->keyword : "unknown",
+                   lag / 1e6);
+    }
+}
+
+static void MetricsTraceReportList(OutputFuncNode *list, const char *type)
+{
+    char name[64];
+    MetricsLatency *l;
+    int i;
+
+    for (; list != NULL; list = list->next)
+    {
+        if (list->event_lag == NULL)
+            continue;
+
+        SnortSnprintf(name, sizeof(name), "%s (%d, %s)",
+                      list->keyword != NULL ? list->keyword : "unknown",
+                      list->instance, type);
+
+        for (i = 0; i < 2; i++)
+        {
+            l = i == 0 ? list->event_lag : list->read_lag;
+
+            LogMessage("   %-24s %-5s" FMTu64("10") " %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                       i == 0 ? name : "", i == 0 ? "event" : "read", l->count,
+                       MetricsLatencyQuantile(l, 0.5) / 1e3,
+                       MetricsLatencyQuantile(l, 0.9) / 1e3,
+                       MetricsLatencyQuantile(l, 0.99) / 1e3,
+                       MetricsLatencyQuantile(l, 0.999) / 1e3,
+                       l->max_us / 1e3);
+        }
+    }
+}
+
+/* print the traced latencies with the statistics, if there are any */
+void MetricsTraceReport(void)
+{
+    OutputFuncNode *idx;
+
+    for (idx = AlertList; idx != NULL && idx->event_lag == NULL; idx = idx->next)
+        ;
+
+    if (idx == NULL)
+    {
+        for (idx = LogList; idx != NULL && idx->event_lag == NULL; idx = idx->next)
+            ;
+
+        if (idx == NULL)
+            return;
+    }
+
+    LogMessage("================================================"
+               "===============================\n");
+    LogMessage("Output latency (ms, event time or record read to output):\n");
+    LogMessage("   %-24s %-5s%10s %10s %10s %10s %10s %10s\n", "Output", "From",
+               "Count", "p50", "p90", "p99", "p99.9", "Max");
+
+    MetricsTraceReportList(AlertList, "alert");
+    MetricsTraceReportList(LogList, "log");
+}
+
+static void MetricsIdleFunc(int signal, void *arg)
+{
+    if (metrics != NULL)
+        MetricsPoll(MetricsNow());
+}
+
+static int MetricsListen(const char *spec)
+{
+    struct sockaddr_un sun;
+    struct sockaddr_in sin;
+    struct sockaddr *sa;
+    socklen_t sa_len;
+    char *addr;
+    char *port;
+    unsigned long val;
+    int on = 1;
+    int fd;
+
+    if (strncmp(spec, "unix:", 5) == 0)
+    {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+
+        if (SnortStrncpy(sun.sun_path, spec + 5, sizeof(sun.sun_path)) != SNORT_STRNCPY_SUCCESS)
+            FatalError("metrics: socket path too long: %s\n", spec + 5);
+
+        /* a socket left behind by an earlier run */
+        unlink(sun.sun_path);
+        metrics->unix_path = SnortStrdup(sun.sun_path);
+
+        sa = (struct sockaddr *)&sun;
+        sa_len = sizeof(sun);
+    }
+    else
+    {
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        addr = SnortStrdup(spec);
+
+        if ( (port=strrchr(addr, ':')) != NULL )
+        {
+            *port++ = '\0';
+
+            if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1)
+                FatalError("metrics: invalid listen address: %s\n", spec);
+        }
+        else
+        {
+            port = addr;
+        }
+
+        if (BY2Strtoul(port, &val) || val == 0 || val > 65535)
+            FatalError("metrics: invalid listen port: %s\n", spec);
+
+        sin.sin_port = htons((uint16_t)val);
+        free(addr);
+
+        sa = (struct sockaddr *)&sin;
+        sa_len = sizeof(sin);
+    }
+
+    if ( (fd=socket(sa->sa_family, SOCK_STREAM, 0)) == -1 )
+        FatalError("metrics: unable to create socket: %s\n", strerror(errno));
+
+    if (sa->sa_family == AF_INET)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if (bind(fd, sa, sa_len) != 0 || listen(fd, 16) != 0)
+        FatalError("metrics: unable to listen on %s: %s\n", spec, strerror(errno));
+
+    /* accept() must never stall record processing */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    return fd;
+}
+
+void MetricsInit(MetricsConfig *config)
+{
+    uint64_t now;
+
+    if (config == NULL || metrics != NULL)
+        return;
+
+    metrics = (MetricsState *)SnortAlloc(sizeof(MetricsState));
+    metrics->fd = -1;
+    metrics->interval_ns = (uint64_t)config->interval * 1000000000;
+    metrics->lag_warning_us = (uint64_t)config->lag_warning * 1000000;
+
+    memset(&metrics_decode, 0, sizeof(metrics_decode));
+    memset(&metrics_db_commit, 0, sizeof(metrics_db_commit));
+
+    if (config->listen != NULL)
+        metrics->fd = MetricsListen(config->listen);
+
+    if (config->file != NULL)
+    {
+        metrics->file = ProcessFileOption(barnyard2_conf, config->file);
+        metrics->file_tmp = (char *)SnortAlloc(strlen(metrics->file) + 5);
+        sprintf(metrics->file_tmp, "%s.tmp", metrics->file);
+    }
+
+    now = MetricsNow();
+    metrics->start = now;
+    metrics->last_poll = now;
+    metrics->rate_time = now;
+    metrics->rate_records = pc.total_records;
+
+    /* write the first stats file on the first poll */
+    metrics->last_file = now - metrics->interval_ns;
+
+    AddFuncToIdleList(MetricsIdleFunc, NULL);
+    metrics_enabled = 1;
+    metrics_trace = config->trace;
+
+    if (config->listen != NULL)
+        LogMessage("Serving metrics on %s\n", config->listen);
+
+    if (metrics->file != NULL)
+        LogMessage("Writing metrics to '%s' every %u seconds\n", metrics->file,
+                   config->interval);
+
+    if (config->trace)
+        LogMessage("Tracing output latency\n");
+}
+
+void MetricsCleanup(void)
+{
+    if (metrics == NULL)
+        return;
+
+    /* leave the final figures behind */
+    if (metrics->file != NULL)
+        MetricsWriteFile(MetricsNow());
+
+    metrics_enabled = 0;
+    metrics_trace = 0;
+
+    if (metrics->fd != -1)
+        close(metrics->fd);
+
+    if (metrics->unix_path != NULL)
+    {
+        unlink(metrics->unix_path);
+        free(metrics->unix_path);
+    }
+
+    if (metrics->file != NULL)
+        free(metrics->file);
+
+    if (metrics->file_tmp != NULL)
+        free(metrics->file_tmp);
+
+    if (metrics->buf.data != NULL)
+        free(metrics->buf.data);
+
+    free(metrics);
+    metrics = NULL;
+}
+
+void MetricsConfigFree(MetricsConfig *config)
+{
+    if (config == NULL)
+        return;
+
+    if (config->listen != NULL)
+        free(config->listen);
+
+    if (config->file != NULL)
+        free(config->file);
+
+    free(config);
+}
@@ -0,0 +1,134 @@
+/*
+**
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+**
+**
+*/
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "sf_types.h"
+
+#define METRICS_DEFAULT_INTERVAL    10
+#define METRICS_MAX_INTERVAL        3600
+
+/* bucket i counts observations below 2^i microseconds, the last one
+ * everything slower */
+#define METRICS_BUCKETS             24
+
+typedef struct _MetricsHistogram
+{
+    uint64_t    count;
+    uint64_t    sum_ns;
+    uint64_t    bucket[METRICS_BUCKETS];
+} MetricsHistogram;
+
+/* log-linear latency histogram in microseconds: 2^METRICS_LATENCY_SUB_BITS
+ * buckets per power of two, so quantiles are within ~6%, up to ~2^50us
+ * (decades, replayed spool files can be that old) */
+#define METRICS_LATENCY_SUB_BITS    4
+#define METRICS_LATENCY_MAX_BITS    50
+#define METRICS_LATENCY_BUCKETS     \
+    ((METRICS_LATENCY_MAX_BITS - METRICS_LATENCY_SUB_BITS + 2) << METRICS_LATENCY_SUB_BITS)
+
+typedef struct _MetricsLatency
+{
+    uint64_t    count;
+    uint64_t    sum_us;
+    uint64_t    max_us;
+    uint64_t    bucket[METRICS_LATENCY_BUCKETS];
+} MetricsLatency;
+
+/* set by "config metrics", NULL when metrics are off */
+typedef struct _MetricsConfig
+{
+    char        *listen;        /* unix:<path>, [<addr>:]<port> or NULL */
+    char        *file;          /* stats file or NULL */
+    uint32_t    interval;       /* seconds between stats file updates */
+    uint8_t     trace;          /* per record latency tracing */
+    uint32_t    lag_warning;    /* seconds of event lag to warn at, 0 = never */
+} MetricsConfig;
+
+/* barnyard2 processes records on a single thread, so the counters are plain
+ * integers owned by it; only the timing calls below are on the hot path */
+extern int metrics_enabled;
+extern int metrics_trace;
+
+extern MetricsHistogram metrics_decode;
+extern MetricsHistogram metrics_db_commit;
+
+static inline uint64_t MetricsNow(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_usec * 1000;
+#endif
+}
+
+static inline void MetricsObserve(MetricsHistogram *h, uint64_t start)
+{
+    uint64_t ns = MetricsNow() - start;
+    uint64_t usec = ns / 1000;
+    unsigned int i = 0;
+
+#ifdef __GNUC__
+    if (usec != 0)
+        i = 64 - __builtin_clzll(usec);
+#else
+    while (usec != 0)
+    {
+        usec >>= 1;
+        i++;
+    }
+#endif
+
+    if (i >= METRICS_BUCKETS)
+        i = METRICS_BUCKETS - 1;
+
+    h->count++;
+    h->sum_ns += ns;
+    h->bucket[i]++;
+}
+
+struct _OutputFuncNode;
+struct _Packet;
+
+void MetricsInit(MetricsConfig *);
+void MetricsTick(void);
+void MetricsTrace(struct _OutputFuncNode *, struct _Packet *, void *, uint64_t);
+void MetricsTraceReport(void);
+void MetricsCleanup(void);
+void MetricsConfigFree(MetricsConfig *);
+
+#endif /* __METRICS_H__ */
@@ -20,25 +20,36 @@
 /* $Id$ */
 
 /* spo_alert_arubaaction
- * 
+ *
  * Purpose: output plugin for dynamically changing station access status on
  *          an Aruba switch.
  *
- * Arguments:  switch secret_type secret action
+ * Arguments:  switch secret_type secret action [option=value ...]
  * 	switch		IP address of the Aruba switch
  * 	secret_type	How secret is represented, one of "sha1", "md5" or
  * 			"cleartext"
  *	secret		The shared secret configured on the Aruba switch
  *	action		The action the switch should take with the target user
- *   
+ *	queue=N		Actions waiting to be sent, newer ones are dropped
+ *			when it is full (default 1024)
+ *	window=S	Seconds in which repeated actions for the same host
+ *			are only sent once, 0 sends all of them (default 30)
+ *	pipeline=N	Requests sent ahead of the responses once the switch
+ *			keeps the connection open, 1 disables it (default 8)
+ *
  * Effect:
  *
- * When an alert is passed to this output plugin, the plugin connects to the
- * specified switch using the secret for authentication and applies the
- * configured action for the source IP address of the alert.  This allows the
+ * When an alert is passed to this output plugin, the plugin queues the
+ * configured action for the source IP address of the alert and sends it to
+ * the specified switch using the secret for authentication.  This allows the
  * administrator to establish rules that will dynamically blacklist a user,
  * allowing the administrator to define rules that take action based on the
  * power of the Snort rules language.
+ *
+ * The connection to the switch is kept open between actions and is never
+ * waited on, so a slow or unreachable switch does not hold up the other
+ * output plugins.  Pending actions are sent as the connection allows from
+ * the output and idle functions, and on exit for a few more seconds.
  */
 
 /* output plugin header file */
@@ -54,6 +65,7 @@
 #include "log.h"
 #include "mstring.h"
 #include "unified2.h"
+#include "khash.h"
 
 #include "barnyard2.h"
 
@@ -63,6 +75,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -70,12 +85,82 @@
 
 #ifndef WIN32
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #endif /* !WIN32 */
 
 #include <sys/types.h>
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_XML_PAYLOAD_LEN 512
+#define MAX_POST_LEN 1024
+#define MAX_RESPONSE_LEN 4096
+
+#define ARUBA_PORT 80
+#define ARUBA_QUEUE_MAX 1024	/* default number of pending actions */
+#define ARUBA_COALESCE_TIME 30	/* default seconds to coalesce actions per host */
+#define ARUBA_COALESCE_HOSTS 65536	/* hosts remembered for coalescing */
+#define ARUBA_PIPELINE_MAX 8	/* default requests in flight per connection */
+#define ARUBA_MAX_TRIES 2	/* an action is given up after this many tries */
+#define ARUBA_NETWAIT 5000	/* ms to wait for the connection or a response */
+#define ARUBA_RETRY_MIN 1000	/* ms to wait before reconnecting to the switch... */
+#define ARUBA_RETRY_MAX 60000	/* ...doubling up to this */
+#define ARUBA_EXIT_TIMEOUT 5	/* seconds to send pending actions on exit */
+
+#define ARUBA_STATE_CLOSED 0
+#define ARUBA_STATE_CONNECTING 1
+#define ARUBA_STATE_CONNECTED 2
+
+typedef struct _ArubaRequest
+{
+	char		*post;
+	int		len;
+	uint8_t		tries;
+	uint64_t	queued;		/* ms, for the latency counters */
+} ArubaRequest;
+
+typedef struct _ArubaHostKey	/* hashed as bytes, no padding */
+{
+	uint32_t	ip[4];
+	uint32_t	family;
+} ArubaHostKey;
+
+static inline khint_t ArubaHostKeyHash(ArubaHostKey key)
+{
+	const uint8_t *k = (const uint8_t *)&key;
+	khint_t h = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(key); i++)
+		h = (h ^ k[i]) * 16777619U;
+
+	return h;
+}
+
+#define ArubaHostKeyEqual(a, b) (memcmp(&(a), &(b), sizeof(ArubaHostKey)) == 0)
+
+KHASH_INIT(ArubaHosts, ArubaHostKey, time_t, 1, ArubaHostKeyHash, ArubaHostKeyEqual)
+
+typedef struct _ArubaActionStats
+{
+	uint64_t	queued;
+	uint64_t	coalesced;
+	uint64_t	dropped;	/* queue was full */
+	uint64_t	sent;		/* requests written, including resends */
+	uint64_t	succeeded;
+	uint64_t	failed;
+	uint64_t	connects;
+	uint32_t	max_depth;
+	uint64_t	responses;
+	uint64_t	latency_total;	/* ms from queueing to the response */
+	uint64_t	latency_max;
+} ArubaActionStats;
+
 typedef struct _SpoAlertArubaActionData
 {
 	char		*secret;
@@ -88,13 +173,39 @@ typedef struct _SpoAlertArubaActionData
 	struct in_addr aswitch;
 #endif
 	int		fd;
+
+	char		host[INET6_ADDRSTRLEN];
+	struct sockaddr_storage addr;
+	socklen_t	addrlen;
+	char		*xml_prefix;	/* request body up to the address */
+	char		*xml_suffix;	/* and after it */
+
+	int		state;
+	int		keepalive;	/* switch keeps connections open */
+	int		served;		/* responses on this connection */
+	uint64_t	deadline;
+	uint64_t	retrytime;
+	uint32_t	retrydelay;
+
+	ArubaRequest	*queue;
+	uint32_t	queuemax;
+	uint32_t	queuehead;
+	uint32_t	queuelen;
+	uint32_t	inflight;	/* sent from the head, not answered */
+	int		writeoff;	/* of the request being sent */
+	uint32_t	pipeline;
+
+	char		response[MAX_RESPONSE_LEN + 1];
+	int		resplen;
+
+	time_t		window;
+	time_t		recentstart;
+	khash_t(ArubaHosts) *recent[2];
+
+	ArubaActionStats stats;
 } SpoAlertArubaActionData;
 
 
-#define MAX_XML_PAYLOAD_LEN 512
-#define MAX_POST_LEN 1024
-#define MAX_RESPONSE_LEN MAX_POST_LEN
-
 typedef struct _ArubaSecretType {
 	uint8_t	type;
 	char	*name;
@@ -157,10 +268,14 @@ void AlertArubaActionInit(char *);
 SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *);
 void AlertArubaActionCleanExitFunc(int, void *);
 void AlertArubaActionRestartFunc(int, void *);
+void AlertArubaActionIdleFunc(int, void *);
 void AlertArubaAction(Packet *, void *, uint32_t, void *);
-int ArubaSwitchConnect(SpoAlertArubaActionData *data);
-int ArubaSwitchSend(SpoAlertArubaActionData *data, uint8_t *post, int len);
-int ArubaSwitchRecv(SpoAlertArubaActionData *data, uint8_t *recv, int maxlen);
+void ArubaSwitchConnect(SpoAlertArubaActionData *data);
+int ArubaSwitchSend(SpoAlertArubaActionData *data);
+int ArubaSwitchRecv(SpoAlertArubaActionData *data);
+void ArubaActionPump(SpoAlertArubaActionData *data);
+void ArubaActionDrain(SpoAlertArubaActionData *data, time_t deadline);
+void ArubaActionReport(SpoAlertArubaActionData *data);
 
 /*
  * Function: SetupAlertArubaAction()
@@ -179,7 +294,7 @@ void AlertArubaActionSetup(void)
 	/* link the preprocessor keyword to the init function in 
 	   the preproc list */
     RegisterOutputPlugin("alert_aruba_action", OUTPUT_TYPE_FLAG__ALERT,
-                         AlertArubaActionInit);
+                         DECODE_LEVEL__L3, AlertArubaActionInit);
 
 	DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: AlertArubaAction is "
 			"setup...\n"););
@@ -207,188 +322,410 @@ void AlertArubaActionInit(char *args)
 	/* parse the argument list from the rules file */
 	data = ParseAlertArubaActionArgs(args);
 
+	data->fd = -1;
+	data->state = ARUBA_STATE_CLOSED;
+	data->queue = (ArubaRequest *)SnortAlloc(data->queuemax *
+			sizeof(ArubaRequest));
+
 	DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Linking AlertArubaAction functions "
 			"to call lists...\n"););
-	
+
 	/* Set the preprocessor function into the function list */
 	AddFuncToOutputList(AlertArubaAction, OUTPUT_TYPE__ALERT, data);
 	AddFuncToCleanExitList(AlertArubaActionCleanExitFunc, data);
 	AddFuncToRestartList(AlertArubaActionRestartFunc, data);
+	AddFuncToIdleList(AlertArubaActionIdleFunc, data);
 }
 
-void AlertArubaAction(Packet *p, void *event, uint32_t event_type, void *arg)
+static uint64_t ArubaNow(void)
 {
-	char cmdbuf[MAX_XML_PAYLOAD_LEN], post[MAX_POST_LEN];
-	char response[MAX_RESPONSE_LEN];
-	char *cmdbufp, *responsecode, *responsemsg;
-	int postlen, xmllenrem, i, responsecodei;
+	struct timeval tv;
 
-	if ( p == NULL || arg == NULL )
-	{
-		return;
-	}
-
-	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
-	cmdbufp = cmdbuf;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
 
-	/* Establish a connection to the switch */
-	data->fd = ArubaSwitchConnect(data);
-	if (data->fd < 0) {
-		ErrorMessage("Unable to connect to Aruba switch at %s\n",
 #ifdef SUP_IP6
-				inet_ntoa(&data->aswitch));
+#define ARUBA_KEY_ADDR(dst, ip)	memcpy((dst), (ip)->ip32, (ip)->family == AF_INET6 ? 16 : 4)
 #else
-				inet_ntoa(data->aswitch));
+#define ARUBA_KEY_ADDR(dst, ip)	((dst)[0] = (uint32_t)(ip))
 #endif
-		return;
+
+/*
+ * Checks if an action was queued for the source of the packet within the
+ * coalescing window, and otherwise remembers it.  The hosts are kept in two
+ * hash tables, one for the current window and one for the previous one, so
+ * old entries expire by clearing a table.
+ */
+static int ArubaRecentAction(SpoAlertArubaActionData *data, Packet *p)
+{
+	ArubaHostKey key;
+	khash_t(ArubaHosts) *hosts;
+	time_t now;
+	khiter_t k;
+	int i, ret;
+
+	if (data->window == 0)
+		return 0;
+
+	memset(&key, 0, sizeof(key));
+	key.family = IS_IP6(p) ? 6 : 4;
+	ARUBA_KEY_ADDR(key.ip, GET_SRC_IP(p));
+
+	now = time(NULL);
+	if (data->recent[0] == NULL) {
+		data->recent[0] = kh_init(ArubaHosts);
+		data->recent[1] = kh_init(ArubaHosts);
+		data->recentstart = now;
 	}
 
-	xmllenrem = MAX_XML_PAYLOAD_LEN;
+	if (now - data->recentstart >= data->window) {
+		hosts = data->recent[1];
+		kh_clear(ArubaHosts, hosts);
+		if (now - data->recentstart >= 2 * data->window)
+			kh_clear(ArubaHosts, data->recent[0]);
+		data->recent[1] = data->recent[0];
+		data->recent[0] = hosts;
+		data->recentstart = now;
+	}
 
-	switch(data->action_type) {
-		case ARUBA_ACTION_BLACKLIST:
-		snprintf(cmdbufp, xmllenrem, "xml=<aruba "
-				"command=user_blacklist>");
-		break;
+	for (i = 0; i < 2; i++) {
+		hosts = data->recent[i];
+		k = kh_get(ArubaHosts, hosts, key);
+		if (k != kh_end(hosts) && now - kh_value(hosts, k) < data->window)
+			return 1;
+	}
 
-		case ARUBA_ACTION_SETROLE:
-		snprintf(cmdbufp, xmllenrem, "xml=<aruba command=user_add>"
-				"<role>%s</role>", data->role_name);
-		break;
+	if (kh_size(data->recent[0]) < ARUBA_COALESCE_HOSTS) {
+		k = kh_put(ArubaHosts, data->recent[0], key, &ret);
+		if (ret >= 0)
+			kh_value(data->recent[0], k) = now;
+	}
+
+	return 0;
+}
+
+void AlertArubaAction(Packet *p, void *event, uint32_t event_type, void *arg)
+{
+	SpoAlertArubaActionData *data;
+	ArubaRequest *req;
+	char post[MAX_POST_LEN];
+	char *ipaddr;
+	int postlen;
 
-		default: /* The parser prevents this from happening */
-		ErrorMessage("aruba_action: invalid action type specified");
+	if ( p == NULL || arg == NULL || !IPH_IS_VALID(p) )
+	{
 		return;
-		break;
 	}
 
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	data = (SpoAlertArubaActionData *)arg;
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
+	if (ArubaRecentAction(data, p)) {
+		data->stats.coalesced++;
 		return;
 	}
 
-	snprintf(cmdbufp, xmllenrem, "<ipaddr>%s</ipaddr>",
-			inet_ntoa(GET_SRC_ADDR(p)));
+	if (data->queuelen == data->queuemax) {
+		data->stats.dropped++;
+		ArubaActionPump(data);
+		return;
+	}
 
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	ipaddr = inet_ntoa(GET_SRC_ADDR(p));
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
+	postlen = snprintf(post, MAX_POST_LEN,
+			"POST /auth/command.xml HTTP/1.1\r\n"
+			"User-Agent: snort\r\n"
+			"Host: %s\r\n"
+			"Pragma: no-cache\r\n"
+			"Connection: keep-alive\r\n"
+			"Content-Length: %lu\r\n"
+			"Content-Type: application/xml\r\n"
+			"\r\n"
+			"%s%s%s",
+			data->host,
+			(unsigned long)(strlen(data->xml_prefix) + strlen(ipaddr) +
+				strlen(data->xml_suffix)),
+			data->xml_prefix, ipaddr, data->xml_suffix
+        );
+
+	if (postlen < 0 || postlen >= MAX_POST_LEN) {
+		ErrorMessage("aruba_action: request for %s too long\n", ipaddr);
+		data->stats.failed++;
 		return;
 	}
 
-	switch(data->secret_type) {
-		case ARUBA_SECRET_SHA1:
-		snprintf(cmdbufp, xmllenrem, "<authentication>sha-1"
-				"</authentication>");
-		break;
+	req = &data->queue[(data->queuehead + data->queuelen) % data->queuemax];
+	req->post = SnortStrdup(post);
+	req->len = postlen;
+	req->tries = 0;
+	req->queued = ArubaNow();
 
-		case ARUBA_SECRET_MD5:
-		snprintf(cmdbufp, xmllenrem, "<authentication>md5"
-				"</authentication>");
-		break;
+	if (++data->queuelen > data->stats.max_depth)
+		data->stats.max_depth = data->queuelen;
+	data->stats.queued++;
 
-		case ARUBA_SECRET_PLAIN:
-		snprintf(cmdbufp, xmllenrem, "<authentication>cleartext"
-				"</authentication>");
-		break;
+	ArubaActionPump(data);
+}
 
-		default: /* The parser prevents this from happening */
-		ErrorMessage("aruba_action: invalid secret type specified");
-		return;
-		break;
+static void ArubaSwitchDisconnect(SpoAlertArubaActionData *data)
+{
+	if (data->fd >= 0)
+		close(data->fd);
+
+	data->fd = -1;
+	data->state = ARUBA_STATE_CLOSED;
+	data->served = 0;
+	data->inflight = 0;
+	data->writeoff = 0;
+	data->resplen = 0;
+}
+
+static void ArubaRequestDone(SpoAlertArubaActionData *data)
+{
+	free(data->queue[data->queuehead].post);
+	data->queue[data->queuehead].post = NULL;
+	data->queuehead = (data->queuehead + 1) % data->queuemax;
+	data->queuelen--;
+	if (data->inflight)
+		data->inflight--;
+}
+
+/*
+ * The switch could not be reached.  The actions stay queued and we try
+ * again after a delay that grows while it stays unreachable.
+ */
+static void ArubaSwitchUnreachable(SpoAlertArubaActionData *data)
+{
+	ArubaSwitchDisconnect(data);
+
+	if (!data->retrydelay) {
+		ErrorMessage("aruba_action: Unable to connect to Aruba switch at "
+				"%s, will try again later\n", data->host);
+		data->retrydelay = ARUBA_RETRY_MIN;
+	}
+	else if ((data->retrydelay *= 2) > ARUBA_RETRY_MAX) {
+		data->retrydelay = ARUBA_RETRY_MAX;
 	}
 
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	data->retrytime = ArubaNow() + data->retrydelay;
+}
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
+/*
+ * Sending the requests in flight, or getting the responses to them, failed.
+ * If the connection was kept open from earlier requests, the switch has most
+ * likely closed it in the meantime and we just send them again on a new one.
+ * Otherwise the action at the head is given up after a few tries, and we
+ * stop pipelining in case the switch does not cope with it.
+ */
+static void ArubaRequestFailed(SpoAlertArubaActionData *data, const char *what)
+{
+	ArubaRequest *req = &data->queue[data->queuehead];
+	int pending = data->inflight || data->writeoff;
+	int reused = data->served;
+
+	ArubaSwitchDisconnect(data);
+
+	if (!pending || reused)
 		return;
+
+	ErrorMessage("aruba_action: %s Aruba switch at %s\n", what, data->host);
+	data->keepalive = 0;
+
+	if (++req->tries >= ARUBA_MAX_TRIES) {
+		ArubaRequestDone(data);
+		data->stats.failed++;
 	}
 
-	snprintf(cmdbufp, xmllenrem, "<key>%s</key>", data->secret);
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	data->retrytime = ArubaNow() + ARUBA_RETRY_MIN;
+}
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
+/*
+ * Starts connecting to the switch without waiting for it.
+ */
+void ArubaSwitchConnect(SpoAlertArubaActionData *data)
+{
+	data->fd = socket(data->addr.ss_family, SOCK_STREAM, 0);
+	if (data->fd < 0) {
+		ErrorMessage("aruba_action: socket error\n");
+		ArubaSwitchUnreachable(data);
 		return;
 	}
 
-	snprintf(cmdbufp, xmllenrem, "<version>1.0</version>");
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	fcntl(data->fd, F_SETFL, fcntl(data->fd, F_GETFL, 0) | O_NONBLOCK);
 
-	if (xmllenrem < 1) {
-		ErrorMessage("aruba_action: configuration parameters too "
-				"long\n");
-		FatalError("Unable to parse configuration parameters for Aruba"
-				"Action output plugin.\n");
-		return;
+	data->state = ARUBA_STATE_CONNECTING;
+	data->deadline = ArubaNow() + ARUBA_NETWAIT;
+
+	if (connect(data->fd, (struct sockaddr *)&data->addr, data->addrlen) < 0 &&
+			errno != EINPROGRESS)
+		ArubaSwitchUnreachable(data);
+}
+
+/*
+ * Sends queued requests until the socket buffer is full.  Only one request
+ * is in flight until the switch has shown that it keeps the connection open.
+ * Returns non-zero if anything was done.
+ */
+int ArubaSwitchSend(SpoAlertArubaActionData *data)
+{
+	ArubaRequest *req;
+	ssize_t len;
+	uint32_t window = data->keepalive ? data->pipeline : 1;
+	int progress = 0;
+
+	while (data->inflight < data->queuelen && data->inflight < window) {
+		req = &data->queue[(data->queuehead + data->inflight) %
+				data->queuemax];
+
+		len = send(data->fd, req->post + data->writeoff,
+				req->len - data->writeoff, MSG_NOSIGNAL);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			ArubaRequestFailed(data, "Error sending data to");
+			return 1;
+		}
+
+		progress = 1;
+		if ((data->writeoff += len) < req->len)
+			continue;
+
+		data->writeoff = 0;
+		if (data->inflight++ == 0)
+			data->deadline = ArubaNow() + ARUBA_NETWAIT;
+		data->stats.sent++;
 	}
 
-	snprintf(cmdbufp, xmllenrem, "</aruba>");
-	xmllenrem -= strlen(cmdbufp);
-	cmdbufp += strlen(cmdbufp);
+	return progress;
+}
 
-	cmdbufp = NULL;
+static int ArubaHeaderHas(const char *value, const char *end, const char *token)
+{
+	size_t len = strlen(token);
 
-	postlen = snprintf(post, MAX_POST_LEN-1,
-			"POST /auth/command.xml HTTP/1.0\r\n"
-			"User-Agent: snort\r\n"
-			"Host: %s\r\n"
-			"Pragma: no-cache\r\n"
-			"Content-Length: %lu\r\n"
-			"Content-Type: application/xml\r\n"
-			"\r\n"
-			"%s",
-#ifdef SUP_IP6
-			inet_ntoa(&data->aswitch),
-#else
-			inet_ntoa(data->aswitch),
-#endif
-			(unsigned long)strlen(cmdbuf), cmdbuf
-        );
-	
-	/* Send the action command to the switch */
-	if (ArubaSwitchSend(data, (uint8_t *)post, postlen) != postlen) {
-		ErrorMessage("aruba_action: Error sending data to Aruba "
-				"switch.\n");
-		close(data->fd);
-		return;
+	for (; value + len <= end; value++) {
+		if (strncasecmp(value, token, len) == 0)
+			return 1;
 	}
 
-	/* Read the response from the switch */
-	if (ArubaSwitchRecv(data, (uint8_t *)response, MAX_RESPONSE_LEN) < 0) {
-		ErrorMessage("aruba_action: Error reading response from Aruba"
-				" switch\n");
-		close(data->fd);
-		return;
+	return 0;
+}
+
+/*
+ * Parses the response at the start of the buffer into its status and body.
+ * Returns the number of bytes it took up, 0 if it is not complete yet or -1
+ * if it is malformed or does not fit in the buffer.
+ */
+static int ArubaParseResponse(SpoAlertArubaActionData *data, int eof,
+		int *status, char *body, int *persistent)
+{
+	char *buf = data->response, *end, *line, *next, *p;
+	int incomplete, hdrlen, bodylen, minor, clen = -1;
+	int chunked = 0, closing = 0, keepalive = 0;
+	long chunk;
+
+	if (data->resplen == 0)
+		return 0;
+
+	incomplete = (eof || data->resplen >= MAX_RESPONSE_LEN) ? -1 : 0;
+
+	if ((end = strstr(buf, "\r\n\r\n")) == NULL)
+		return incomplete;
+
+	if (sscanf(buf, "HTTP/1.%d %d", &minor, status) != 2)
+		return -1;
+
+	hdrlen = end - buf + 4;
+	for (line = strstr(buf, "\r\n") + 2; line < end + 2; line = next + 2) {
+		next = strstr(line, "\r\n");
+
+		if (strncasecmp(line, "Content-Length:", 15) == 0) {
+			clen = atoi(line + 15);
+		} else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+			chunked = ArubaHeaderHas(line + 18, next, "chunked");
+		} else if (strncasecmp(line, "Connection:", 11) == 0) {
+			closing = ArubaHeaderHas(line + 11, next, "close");
+			keepalive = ArubaHeaderHas(line + 11, next, "keep-alive");
+		}
+	}
+
+	*persistent = !closing && (minor >= 1 || keepalive);
+
+	if (chunked) {
+		p = buf + hdrlen;
+		bodylen = 0;
+		while (1) {
+			if ((next = strstr(p, "\r\n")) == NULL)
+				return incomplete;
+			chunk = strtol(p, NULL, 16);
+			if (chunk < 0 || chunk > MAX_RESPONSE_LEN)
+				return -1;
+			p = next + 2;
+			if (chunk == 0)
+				break;
+			if (chunk + 2 > buf + data->resplen - p)
+				return incomplete;
+			memcpy(body + bodylen, p, chunk);
+			bodylen += chunk;
+			p += chunk + 2;
+		}
+
+		/* skip the trailer up to the empty line */
+		while ((next = strstr(p, "\r\n")) != p) {
+			if (next == NULL)
+				return incomplete;
+			p = next + 2;
+		}
+		p += 2;
+	} else if (clen >= 0) {
+		if (clen > MAX_RESPONSE_LEN - hdrlen)
+			return -1;
+		if (hdrlen + clen > data->resplen)
+			return incomplete;
+		bodylen = clen;
+		memcpy(body, buf + hdrlen, bodylen);
+		p = buf + hdrlen + clen;
+	} else {
+		/* the body ends when the switch closes the connection */
+		if (!eof)
+			return incomplete;
+		bodylen = data->resplen - hdrlen;
+		memcpy(body, buf + hdrlen, bodylen);
+		p = buf + data->resplen;
+		*persistent = 0;
 	}
 
+	body[bodylen] = '\0';
+	return p - buf;
+}
+
+/*
+ * Reports the result of the action at the head of the queue.
+ */
+static void ArubaCheckResponse(SpoAlertArubaActionData *data, int status,
+		char *response)
+{
+	char *responsecode, *responsemsg;
+	int i, responsecodei;
+	uint64_t latency;
+
+	latency = ArubaNow() - data->queue[data->queuehead].queued;
+	data->stats.responses++;
+	data->stats.latency_total += latency;
+	if (latency > data->stats.latency_max)
+		data->stats.latency_max = latency;
+
+	ArubaRequestDone(data);
+
 	/* Extract the result code from the response */
 	responsecode = strstr(response, "<code>");
 	if (responsecode == NULL) {
 		ErrorMessage("aruba_action: Error extracting response code "
-				"from Aruba switch\n");
-		close(data->fd);
+				"from Aruba switch (HTTP status %d)\n", status);
+		data->stats.failed++;
 		return;
 	}
 
@@ -396,10 +733,10 @@ void AlertArubaAction(Packet *p, void *event, uint32_t event_type, void *arg)
 	responsecode += (strlen("<code>"));
 
 	/* Lookup code message */
-	//responsecodei = 0;
 	if (sscanf(responsecode, "%d", &responsecodei) != 1) {
 		ErrorMessage("aruba_action: Invalid response code returned from"
 				" the Aruba switch.\n");
+		data->stats.failed++;
 		return;
 	}
 
@@ -422,102 +759,201 @@ void AlertArubaAction(Packet *p, void *event, uint32_t event_type, void *arg)
 					responsecodei, responsemsg);
 		}
 
-		close(data->fd);
+		data->stats.failed++;
 		return;
 	}
 
-
-	close(data->fd);
-		
-	return;
+	data->stats.succeeded++;
 }
 
-int ArubaSwitchSend(SpoAlertArubaActionData *data, uint8_t *post, int len)
+/*
+ * Handles the responses received so far, in the order the requests were
+ * sent.  A response that does not keep the connection open ends it, and
+ * the requests sent after it are sent again on the next connection.
+ */
+static void ArubaProcessResponses(SpoAlertArubaActionData *data, int eof)
 {
-	return(write(data->fd, post, len));
+	char body[MAX_RESPONSE_LEN + 1];
+	int consumed, status, persistent;
+
+	while (data->inflight) {
+		consumed = ArubaParseResponse(data, eof, &status, body,
+				&persistent);
+		if (consumed == 0)
+			return;
+		if (consumed < 0) {
+			ArubaRequestFailed(data, "Invalid response from");
+			return;
+		}
+
+		ArubaCheckResponse(data, status, body);
+		data->served++;
+
+		data->resplen -= consumed;
+		memmove(data->response, data->response + consumed,
+				data->resplen + 1);
+
+		if (!persistent) {
+			data->keepalive = 0;
+			ArubaSwitchDisconnect(data);
+			return;
+		}
+
+		data->keepalive = 1;
+		data->deadline = ArubaNow() + ARUBA_NETWAIT;
+	}
+
+	/* nothing was asked for */
+	if (data->resplen)
+		ArubaSwitchDisconnect(data);
 }
 
-int ArubaSwitchRecv(SpoAlertArubaActionData *data, uint8_t *recv, int maxlen)
+/*
+ * Reads what the switch has sent.  Returns non-zero if anything was done.
+ */
+int ArubaSwitchRecv(SpoAlertArubaActionData *data)
 {
-	return(read(data->fd, recv, maxlen));
+	ssize_t len;
+	int progress = 0;
+
+	while (data->state == ARUBA_STATE_CONNECTED) {
+		len = recv(data->fd, data->response + data->resplen,
+				MAX_RESPONSE_LEN - data->resplen, 0);
+		if (len > 0) {
+			data->resplen += len;
+			data->response[data->resplen] = '\0';
+			ArubaProcessResponses(data, 0);
+			progress = 1;
+			continue;
+		}
+
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return progress;
+
+		if (len == 0)
+			ArubaProcessResponses(data, 1);
+		if (data->state == ARUBA_STATE_CONNECTED)
+			ArubaRequestFailed(data, "Error reading response from");
+		return 1;
+	}
+
+	return progress;
 }
 
-int ArubaSwitchConnect(SpoAlertArubaActionData *data)
+/*
+ * Moves the connection to the switch along as far as it can go without
+ * waiting for the network.
+ */
+void ArubaActionPump(SpoAlertArubaActionData *data)
 {
-	struct sockaddr_in sa4;
-	struct sockaddr_in6 sa6;
+	struct pollfd pfd;
+	socklen_t errlen;
+	int err;
+
+	while (1) {
+		switch (data->state) {
+			case ARUBA_STATE_CLOSED:
+			if (!data->queuelen || ArubaNow() < data->retrytime)
+				return;
+			ArubaSwitchConnect(data);
+			break;
 
-	data->fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (data->fd < 0) {
-		ErrorMessage("aruba_action: socket error\n");
-		return -1;
+			case ARUBA_STATE_CONNECTING:
+			pfd.fd = data->fd;
+			pfd.events = POLLOUT;
+			if (poll(&pfd, 1, 0) < 1) {
+				if (ArubaNow() >= data->deadline)
+					ArubaSwitchUnreachable(data);
+				return;
+			}
+
+			errlen = sizeof(err);
+			if (getsockopt(data->fd, SOL_SOCKET, SO_ERROR, &err,
+					&errlen) || err) {
+				ArubaSwitchUnreachable(data);
+				return;
+			}
+
+			if (data->retrydelay) {
+				LogMessage("aruba_action: Connected to Aruba switch "
+						"at %s again\n", data->host);
+				data->retrydelay = 0;
+			}
+			data->state = ARUBA_STATE_CONNECTED;
+			data->stats.connects++;
+			break;
+
+			case ARUBA_STATE_CONNECTED:
+			if (ArubaSwitchRecv(data))
+				break;
+			if (ArubaSwitchSend(data))
+				break;
+			if (data->inflight && ArubaNow() >= data->deadline) {
+				ArubaRequestFailed(data, "Timed out waiting for "
+						"response from");
+				break;
+			}
+			return;
+		}
 	}
+}
 
-#ifdef SUP_IP6
-    if(data->aswitch.family == AF_INET) {
-	    sa4.sin_addr.s_addr = data->aswitch.ip32[0];
-#else
-	    sa4.sin_addr.s_addr = (unsigned int)(data->aswitch.s_addr);
-#endif
-    	sa4.sin_family = AF_INET;
-    	sa4.sin_port = htons(80);
-
-    	if (connect(data->fd, (struct sockaddr *)&sa4, sizeof(sa4)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-#ifdef SUP_IP6
-    } 
-    else {
-	    memcpy(&sa6.sin6_addr, data->aswitch.ip8, 16);
-    	sa6.sin6_family = AF_INET6;
-    	sa6.sin6_port = htons(80);
-
-       	if (connect(data->fd, (struct sockaddr *)&sa6, sizeof(sa6)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-    }  
-#endif
+/*
+ * Waits for the pending actions to be sent, up to the deadline or, without
+ * one, until they are done or we are told to exit.
+ */
+void ArubaActionDrain(SpoAlertArubaActionData *data, time_t deadline)
+{
+	struct pollfd pfd;
 
+	while (1) {
+		ArubaActionPump(data);
 
+		if (!data->queuelen || (deadline && time(NULL) >= deadline) ||
+				(!deadline && exit_signal))
+			return;
 
-#ifdef SUP_IP6
-    if(data->aswitch.family == AF_INET) {
-	    sa4.sin_addr.s_addr = data->aswitch.ip32[0];
-    	sa4.sin_family = AF_INET;
-    	sa4.sin_port = htons(80);
-
-    	if (connect(data->fd, (struct sockaddr *)&sa4, sizeof(sa4)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-    } 
-    else {
-	    memcpy(&sa6.sin6_addr, data->aswitch.ip8, 16);
-#else
-	    memcpy(&sa6.sin6_addr, &data->aswitch, 16);
-#endif
-    	sa6.sin6_family = AF_INET6;
-    	sa6.sin6_port = htons(80);
-
-       	if (connect(data->fd, (struct sockaddr *)&sa6, sizeof(sa6)) < 0) {
-    		perror("connect");
-    		ErrorMessage("aruba_action: Unable to connect to switch\n");
-    		close(data->fd);
-    		return -1;
-    	}
-#ifdef SUP_IP6
-    }  
-#endif
-     
-	return data->fd;
+		if (data->state == ARUBA_STATE_CLOSED) {
+			/* waiting to retry */
+			if (!deadline)
+				return;
+			usleep(100000);
+			continue;
+		}
+
+		pfd.fd = data->fd;
+		pfd.events = POLLIN;
+		if (data->state == ARUBA_STATE_CONNECTING ||
+				data->inflight < data->queuelen)
+			pfd.events |= POLLOUT;
+		poll(&pfd, 1, 100);
+	}
+}
+
+void ArubaActionReport(SpoAlertArubaActionData *data)
+{
+	ArubaActionStats *s = &data->stats;
+
+	LogMessage("aruba_action: %s: " STDu64 " queued, " STDu64 " coalesced, "
+			STDu64 " dropped, " STDu64 " sent, " STDu64 " succeeded, "
+			STDu64 " failed, %u pending (max %u), " STDu64
+			" connections\n",
+			data->host, s->queued, s->coalesced, s->dropped, s->sent,
+			s->succeeded, s->failed, data->queuelen, s->max_depth,
+			s->connects);
+	LogMessage("aruba_action: %s: latency avg " STDu64 " ms, max " STDu64
+			" ms\n", data->host,
+			s->responses ? s->latency_total / s->responses : 0,
+			s->latency_max);
+}
+
+void AlertArubaActionIdleFunc(int signal, void *arg)
+{
+	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
+
+	ArubaActionPump(data);
 }
 
 
@@ -537,8 +973,15 @@ int ArubaSwitchConnect(SpoAlertArubaActionData *data)
 SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 {
 	char **toks, **action_toks;
+	char buf[MAX_XML_PAYLOAD_LEN];
+	char *auth_name, *endp;
 	int num_toks, num_action_toks, i;
+	unsigned long value;
 	SpoAlertArubaActionData *data;
+	struct sockaddr_in *sa4;
+#ifdef SUP_IP6
+	struct sockaddr_in6 *sa6;
+#endif
 
 	data = (SpoAlertArubaActionData *)SnortAlloc(sizeof(SpoAlertArubaActionData));
 
@@ -552,9 +995,9 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 	DEBUG_WRAP(DebugMessage(DEBUG_LOG, "ParseAlertArubaActionArgs: %s\n",
 			args););
 
-	toks = mSplit(args, " ", 4, &num_toks, 0);
+	toks = mSplit(args, " \t", 0, &num_toks, 0);
 
-	if (num_toks != 4) {
+	if (num_toks < 4) {
 		ErrorMessage("aruba_action: incorrect number of arguments "
 				"specified (%d)\n", num_toks);
 		FatalError("Invalid argument count\n");
@@ -562,7 +1005,7 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 	}
 
 #ifdef SUP_IP6 // XXX could probably be changed to a macro
-	if (sfip_pton(toks[0], &data->aswitch) == 0) 
+	if (sfip_pton(toks[0], &data->aswitch) != SFIP_SUCCESS)
 #else
 	if (inet_aton(toks[0], &data->aswitch) == 0) 
 #endif
@@ -573,6 +1016,30 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 		return NULL;
 	}
 
+#ifdef SUP_IP6
+	SnortStrncpy(data->host, inet_ntoa(&data->aswitch), sizeof(data->host));
+	if (data->aswitch.family == AF_INET6) {
+		sa6 = (struct sockaddr_in6 *)&data->addr;
+		sa6->sin6_family = AF_INET6;
+		sa6->sin6_port = htons(ARUBA_PORT);
+		memcpy(&sa6->sin6_addr, data->aswitch.ip8, 16);
+		data->addrlen = sizeof(*sa6);
+	} else {
+		sa4 = (struct sockaddr_in *)&data->addr;
+		sa4->sin_family = AF_INET;
+		sa4->sin_port = htons(ARUBA_PORT);
+		sa4->sin_addr.s_addr = data->aswitch.ip32[0];
+		data->addrlen = sizeof(*sa4);
+	}
+#else
+	SnortStrncpy(data->host, inet_ntoa(data->aswitch), sizeof(data->host));
+	sa4 = (struct sockaddr_in *)&data->addr;
+	sa4->sin_family = AF_INET;
+	sa4->sin_port = htons(ARUBA_PORT);
+	sa4->sin_addr = data->aswitch;
+	data->addrlen = sizeof(*sa4);
+#endif
+
 	for (i=0; secret_lookup[i].name != NULL; i++) {
 		if (strncmp(toks[1], secret_lookup[i].name, 
 				strlen(secret_lookup[i].name)) == 0) {
@@ -588,8 +1055,7 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 		return NULL;
 	}
 
-	data->secret = (char *)SnortAlloc(strlen(toks[2])+1);
-	strncpy(data->secret, toks[2], strlen(toks[2]));
+	data->secret = SnortStrdup(toks[2]);
 
 	/* action can be "blacklist" or "setrole:rolename", parse */
 	for (i=0; action_lookup[i].name != NULL; i++) {
@@ -615,12 +1081,70 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 					"specification \"%s\"\n", toks[3]);
 			FatalError("Improperly formatted action\n");
 			return NULL;
-		} 
+		}
+
+		data->role_name = SnortStrdup(action_toks[1]);
+		mSplitFree(&action_toks, num_action_toks);
+	}
+
+	data->queuemax = ARUBA_QUEUE_MAX;
+	data->window = ARUBA_COALESCE_TIME;
+	data->pipeline = ARUBA_PIPELINE_MAX;
+
+	for (i = 4; i < num_toks; i++) {
+		endp = strchr(toks[i], '=');
+		value = endp ? strtoul(endp + 1, &endp, 10) : 0;
+
+		if (endp == NULL || *endp != '\0') {
+			FatalError("aruba_action: invalid option \"%s\"\n", toks[i]);
+		} else if (strncasecmp(toks[i], "queue=", 6) == 0 && value > 0) {
+			data->queuemax = value;
+		} else if (strncasecmp(toks[i], "window=", 7) == 0) {
+			data->window = value;
+		} else if (strncasecmp(toks[i], "pipeline=", 9) == 0 && value > 0) {
+			data->pipeline = value;
+		} else {
+			FatalError("aruba_action: invalid option \"%s\"\n", toks[i]);
+		}
+	}
+
+	switch(data->secret_type) {
+		case ARUBA_SECRET_SHA1:
+		auth_name = "sha-1";
+		break;
 
-		data->role_name = (char *)SnortAlloc(strlen(action_toks[1])+1);
-		strncpy(data->role_name, action_toks[1], 
-				strlen(action_toks[1]));
-	}	
+		case ARUBA_SECRET_MD5:
+		auth_name = "md5";
+		break;
+
+		default:
+		auth_name = "cleartext";
+		break;
+	}
+
+	/* Everything but the address is the same for every action */
+	if (data->action_type == ARUBA_ACTION_SETROLE) {
+		snprintf(buf, sizeof(buf), "xml=<aruba command=user_add>"
+				"<role>%s</role><ipaddr>", data->role_name);
+	} else {
+		snprintf(buf, sizeof(buf), "xml=<aruba "
+				"command=user_blacklist><ipaddr>");
+	}
+	data->xml_prefix = SnortStrdup(buf);
+
+	snprintf(buf, sizeof(buf), "</ipaddr><authentication>%s"
+			"</authentication><key>%s</key><version>1.0</version>"
+			"</aruba>", auth_name, data->secret);
+	data->xml_suffix = SnortStrdup(buf);
+
+	if (strlen(data->xml_prefix) + INET6_ADDRSTRLEN +
+			strlen(data->xml_suffix) >= MAX_XML_PAYLOAD_LEN) {
+		ErrorMessage("aruba_action: configuration parameters too "
+				"long\n");
+		FatalError("Unable to parse configuration parameters for Aruba"
+				"Action output plugin.\n");
+		return NULL;
+	}
 
 	/* free toks */
 	mSplitFree(&toks, num_toks);
@@ -628,24 +1152,48 @@ SpoAlertArubaActionData *ParseAlertArubaActionArgs(char *args)
 	return data;
 }
 
-void AlertArubaActionCleanExitFunc(int signal, void *arg)
+static void ArubaActionFree(SpoAlertArubaActionData *data)
 {
-	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
+	ArubaSwitchDisconnect(data);
 
-	DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertArubaActionCleanExitFunc\n"););
+	if (data->queuelen) {
+		ErrorMessage("aruba_action: %u actions could not be sent to "
+				"Aruba switch at %s\n", data->queuelen, data->host);
+	}
+
+	while (data->queuelen)
+		ArubaRequestDone(data);
+
+	if (data->recent[0] != NULL) {
+		kh_destroy(ArubaHosts, data->recent[0]);
+		kh_destroy(ArubaHosts, data->recent[1]);
+	}
+
+	free(data->queue);
+	free(data->xml_prefix);
+	free(data->xml_suffix);
 	free(data->secret);
 	free(data->role_name);
 	free(data);
 }
 
+void AlertArubaActionCleanExitFunc(int signal, void *arg)
+{
+	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
+
+	DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertArubaActionCleanExitFunc\n"););
+	ArubaActionDrain(data, time(NULL) + ARUBA_EXIT_TIMEOUT);
+	ArubaActionReport(data);
+	ArubaActionFree(data);
+}
+
 void AlertArubaActionRestartFunc(int signal, void *arg)
 {
 	SpoAlertArubaActionData *data = (SpoAlertArubaActionData *)arg;
-	
+
 	DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertArubaActionRestartFunc\n"););
-	free(data->secret);
-	free(data->role_name);
-	free(data);
+	ArubaActionDrain(data, time(NULL) + ARUBA_EXIT_TIMEOUT);
+	ArubaActionReport(data);
+	ArubaActionFree(data);
 }
 
-
@@ -79,7 +79,7 @@ void AlertBroSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("alert_bro", OUTPUT_TYPE_FLAG__ALERT, AlertBroInit);
+    RegisterOutputPlugin("alert_bro", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertBroInit);
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: Alert-Bro is setup...\n"););
 }
 
@@ -60,6 +60,7 @@
 #include "barnyard2.h"
 #include "decode.h"
 #include "debug.h"
+#include "log_text.h"
 #include "map.h"
 #include "mstring.h"
 #include "parser.h"
@@ -101,7 +102,7 @@ void AlertCEFSetup(void)
 {
     /* link the preprocessor keyword to the init function in
        the preproc list */
-    RegisterOutputPlugin("alert_cef", OUTPUT_TYPE_FLAG__ALERT, AlertCEFInit);
+    RegisterOutputPlugin("alert_cef", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertCEFInit);
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: Alert-CEF is setup...\n"););
 }
 
@@ -493,11 +494,10 @@ void AlertCEF(Packet *p, void *event, u_int32_t event_type, void *arg)
     char sip[16];
     char dip[16];
 #define SYSLOG_BUF  1024
-    int                 cef_severity;
     char                cef_message[SYSLOG_BUF];
     CEFData			 	*data;
 	SigNode				*sn;
-	ClassType			*cn;
+	const SigFragment	*frag;
 
 	if ( p == NULL || event == NULL || arg == NULL )
 	{
@@ -509,8 +509,6 @@ void AlertCEF(Packet *p, void *event, u_int32_t event_type, void *arg)
 			    ntohl(((Unified2EventCommon *)event)->signature_id),
 			    ntohl(((Unified2EventCommon *)event)->signature_revision));
 
-	cn = ClassTypeLookupById(barnyard2_conf, ntohl(((Unified2EventCommon *)event)->classification_id));
-
     /* Remove this check when we support IPv6 below. */
     /* sip and dip char arrays need to change size for IPv6. */
     if (!IS_IP4(p))
@@ -528,19 +526,10 @@ void AlertCEF(Packet *p, void *event, u_int32_t event_type, void *arg)
         if (strlcpy(dip, inet_ntoa(GET_DST_ADDR(p)), sizeof(dip)) >= sizeof(dip))
             return;
 
-        /* calculate CEF severity */
-        cef_severity = (11 - ntohl(((Unified2EventCommon *)event)->priority_id));
-        if ( cef_severity < 0 )
-            cef_severity = 0;
-        else if ( cef_severity > 10 )
-            cef_severity = 10;
-
+        /* "gid:sid:rev|msg|severity|" */
+        frag = GetSigFragment(sn, SIG_FRAG_CEF, (Unified2EventCommon *)event);
 
-        if( SnortSnprintfAppend(cef_message, SYSLOG_BUF, "%lu:%lu:%lu|%s|%d|",
-                          (unsigned long) ntohl(((Unified2EventCommon *)event)->generator_id),
-                          (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_id),
-                          (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_revision),
-                          sn == NULL ? "ALERT" : sn->msg, cef_severity) != SNORT_SNPRINTF_SUCCESS )
+        if( strlcat(cef_message, frag->data, SYSLOG_BUF) >= SYSLOG_BUF )
                 return ;
 
         if( (GET_IPH_PROTO(p) != IPPROTO_TCP && GET_IPH_PROTO(p) != IPPROTO_UDP) || p->frag_flag )
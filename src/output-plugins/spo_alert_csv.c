@@ -61,6 +61,7 @@
 #include "log.h"
 #include "map.h"
 #include "unified2.h"
+#include "extradata.h"
 
 #include "barnyard2.h"
 
@@ -74,31 +75,33 @@
 #define DEFAULT_LIMIT (128*M_BYTES)
 #define LOG_BUFFER    (4*K_BYTES)
 
-typedef struct _AlertCSVConfig
+/* Writes a single CSV column for an alert; the packet is never NULL */
+typedef void (*AlertCSVFunc)(TextLog *, Packet *, Unified2EventCommon *);
+
+typedef struct _AlertCSVField
 {
-    char *type;
-    struct _AlertCSVConfig *next;
-} AlertCSVConfig;
+    const char *name;
+    size_t len;             /* number of leading characters to match */
+    AlertCSVFunc func;
+} AlertCSVField;
 
 typedef struct _AlertCSVData
 {
     TextLog* log;
     char * csvargs;
-    char ** args;
+    AlertCSVFunc *fields;   /* compiled csvargs, NULL for unknown fields */
     int numargs;
-    AlertCSVConfig *config;
 } AlertCSVData;
 
 
 /* list of function prototypes for this preprocessor */
 static void AlertCSVInit(char *);
 static AlertCSVData *AlertCSVParseArgs(char *);
+static void AlertCSVCompile(AlertCSVData *, char **, int);
 static void AlertCSV(Packet *, void *, uint32_t, void *);
 static void AlertCSVCleanExit(int, void *);
 static void AlertCSVRestart(int, void *);
-static void RealAlertCSV(
-    Packet*, void*, uint32_t, char **args, int numargs, TextLog*
-);
+static void RealAlertCSV(Packet *, void *, uint32_t, AlertCSVData *);
 
 /*
  * Function: SetupCSV()
@@ -116,7 +119,7 @@ void AlertCSVSetup(void)
 {
     /* link the preprocessor keyword to the init function in
        the preproc list */
-    RegisterOutputPlugin("alert_csv", OUTPUT_TYPE_FLAG__ALERT, AlertCSVInit);
+    RegisterOutputPlugin("alert_csv", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertCSVInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output plugin: alert_csv is setup...\n"););
 }
@@ -236,8 +239,8 @@ static AlertCSVData *AlertCSVParseArgs(char *args)
     mSplitFree(&toks, num_toks);
     toks = mSplit(data->csvargs, ",", 128, &num_toks, 0);
 
-    data->args = toks;
-    data->numargs = num_toks;
+    AlertCSVCompile(data, toks, num_toks);
+    mSplitFree(&toks, num_toks);
 
     DEBUG_WRAP(DebugMessage(
         DEBUG_INIT, "alert_csv: '%s' '%s' %ld\n", filename, data->csvargs, limit
@@ -256,7 +259,7 @@ static void AlertCSVCleanup(int signal, void *arg, const char* msg)
 
     if(data)
     {
-        mSplitFree(&data->args, data->numargs);
+        free(data->fields);
         if (data->log) TextLog_Term(data->log);
         free(data->csvargs);
         /* free memory from SpoCSVData */
@@ -278,292 +281,582 @@ static void AlertCSVRestart(int signal, void *arg)
 static void AlertCSV(Packet *p, void *event, uint32_t event_type, void *arg)
 {
     AlertCSVData *data = (AlertCSVData *)arg;
-    RealAlertCSV(p, event, event_type, data->args, data->numargs, data->log);
+    RealAlertCSV(p, event, event_type, data);
 }
 
 /*
- *
- * Function: RealAlertCSV(Packet *, char *, FILE *, char *, numargs const int)
- *
- * Purpose: Write a user defined CSV message
- *
- * Arguments:     p => packet. (could be NULL)
- *              msg => the message to send
- *             args => CSV output arguements
- *          numargs => number of arguements
- *             log => Log
- * Returns: void function
- *
+ * Column writers.  Numbers and addresses are formatted straight into the
+ * TextLog buffer, the output is the same as the printf formats noted.
  */
-static void RealAlertCSV(Packet * p, void *event, uint32_t event_type,
-        char **args, int numargs, TextLog* log)
+static void CSVPutIPv4(TextLog *log, const u_int8_t *addr)
 {
-    int num;
-    SigNode             *sn;
-    char *type;
-    char tcpFlags[9];
+    int i;
 
-    if(p == NULL)
+    for (i = 0; i < 4; i++)
+    {
+        if (i)
+            TextLog_Putc(log, '.');
+        TextLog_PutUInt(log, addr[i]);
+    }
+}
+
+#ifdef SUP_IP6
+/* same as sfip_ntoa() */
+static void CSVPutIP(TextLog *log, sfip_t *ip)
+{
+    static const char digits[] = "0123456789abcdef";
+    char buf[8*5];
+    u_int16_t field;
+    int i, pos = 0;
+
+    if (sfip_family(ip) == AF_INET)
+    {
+        CSVPutIPv4(log, ip->ip8);
         return;
+    }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"Logging CSV Alert data\n"););
+    for (i = 0; i < 8; i++)
+    {
+        field = ntohs(ip->ip16[i]);
+        buf[pos++] = digits[(field >> 12) & 0xF];
+        buf[pos++] = digits[(field >> 8) & 0xF];
+        buf[pos++] = digits[(field >> 4) & 0xF];
+        buf[pos++] = digits[field & 0xF];
+        buf[pos++] = ':';
+    }
+    TextLog_Write(log, buf, pos - 1);
+}
+#else
+/* same as inet_ntoa() */
+static void CSVPutIP(TextLog *log, struct in_addr ip)
+{
+    CSVPutIPv4(log, (u_int8_t *)&ip.s_addr);
+}
+#endif
 
-    for (num = 0; num < numargs; num++)
+static void CSVPutMAC(TextLog *log, const u_int8_t *mac)
+{
+    int i;
+
+    /* "%X:%X:%X:%X:%X:%X" */
+    for (i = 0; i < 6; i++)
     {
-        type = args[num];
+        if (i)
+            TextLog_Putc(log, ':');
+        TextLog_PutHex(log, mac[i]);
+    }
+}
 
-        DEBUG_WRAP(DebugMessage(DEBUG_LOG, "CSV Got type %s %d\n", type, num););
+/* "0x%X" */
+static void CSVPutHex(TextLog *log, unsigned long n)
+{
+    TextLog_Write(log, "0x", 2);
+    TextLog_PutHex(log, n);
+}
 
-        if(!strncasecmp("timestamp", type, 9))
-        {
-            LogTimeStamp(log, p);
-        }
-        else if(!strncasecmp("sig_generator",type,13))
-        {
-            if(event != NULL)
-            {
-                TextLog_Print(log, "%lu",
-                    (unsigned long) ntohl(((Unified2EventCommon *)event)->generator_id));
-            }
-        }
-        else if(!strncasecmp("sig_id",type,6))
-        {
-            if(event != NULL)
-            {
-                TextLog_Print(log, "%lu",
-                    (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_id));
-            }
-        }
-        else if(!strncasecmp("sig_rev",type,7))
-        {
-            if(event != NULL)
-            {
-                TextLog_Print(log, "%lu",
-                    (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_revision));
-            }
-        }
-        else if(!strncasecmp("msg", type, 3))
-        {
-            if ( event != NULL )
-            {
-                sn = GetSigByGidSid(ntohl(((Unified2EventCommon *)event)->generator_id),
-				    ntohl(((Unified2EventCommon *)event)->signature_id),
-				    ntohl(((Unified2EventCommon *)event)->signature_revision));
+static void CSVTimestamp(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    LogTimeStamp(log, p);
+}
 
-                if (sn != NULL)
-                {
-                    if ( !TextLog_Quote(log, sn->msg) )
-                    {
-                        FatalError("Not enough buffer space to escape msg string\n");
-                    }
-                }
-            }
-        }
-        else if(!strncasecmp("proto", type, 5))
-        {
-            if(IPH_IS_VALID(p))
-            {
-                switch (GET_IPH_PROTO(p))
-                {
-                    case IPPROTO_UDP:
-                        TextLog_Puts(log, "UDP");
-                        break;
-                    case IPPROTO_TCP:
-                        TextLog_Puts(log, "TCP");
-                        break;
-                    case IPPROTO_ICMP:
-                        TextLog_Puts(log, "ICMP");
-                        break;
-                }
-            }
-        }
-        else if(!strncasecmp("ethsrc", type, 6))
-        {
-            if(p->eh)
-            {
-                TextLog_Print(log,  "%X:%X:%X:%X:%X:%X", p->eh->ether_src[0],
-                    p->eh->ether_src[1], p->eh->ether_src[2], p->eh->ether_src[3],
-                    p->eh->ether_src[4], p->eh->ether_src[5]);
-            }
-        }
-        else if(!strncasecmp("ethdst", type, 6))
-        {
-            if(p->eh)
-            {
-                TextLog_Print(log,  "%X:%X:%X:%X:%X:%X", p->eh->ether_dst[0],
-                p->eh->ether_dst[1], p->eh->ether_dst[2], p->eh->ether_dst[3],
-                p->eh->ether_dst[4], p->eh->ether_dst[5]);
-            }
-        }
-        else if(!strncasecmp("ethtype", type, 7))
-        {
-            if(p->eh)
-            {
-                TextLog_Print(log, "0x%X",ntohs(p->eh->ether_type));
-            }
-        }
-        else if(!strncasecmp("udplength", type, 9))
-        {
-            if(p->udph)
-                TextLog_Print(log, "%d",ntohs(p->udph->uh_len));
-        }
-        else if(!strncasecmp("ethlen", type, 6))
+static void CSVSigGenerator(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (event != NULL)
+        TextLog_PutUInt(log, ntohl(event->generator_id));
+}
+
+static void CSVSigId(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (event != NULL)
+        TextLog_PutUInt(log, ntohl(event->signature_id));
+}
+
+static void CSVSigRev(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (event != NULL)
+        TextLog_PutUInt(log, ntohl(event->signature_revision));
+}
+
+static void CSVMsg(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    SigNode *sn;
+
+    if (event == NULL)
+        return;
+
+    sn = GetSigByGidSid(ntohl(event->generator_id),
+                        ntohl(event->signature_id),
+                        ntohl(event->signature_revision));
+
+    if (sn != NULL)
+    {
+        if ( !TextLog_Quote(log, sn->msg) )
         {
-            if(p->eh)
-                TextLog_Print(log, "0x%X",p->pkth->len);
+            FatalError("Not enough buffer space to escape msg string\n");
         }
+    }
+}
+
+static void CSVProto(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (!IPH_IS_VALID(p))
+        return;
+
+    switch (GET_IPH_PROTO(p))
+    {
+        case IPPROTO_UDP:
+            TextLog_Write(log, "UDP", 3);
+            break;
+        case IPPROTO_TCP:
+            TextLog_Write(log, "TCP", 3);
+            break;
+        case IPPROTO_ICMP:
+            TextLog_Write(log, "ICMP", 4);
+            break;
+    }
+}
+
+static void CSVEthSrc(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->eh)
+        CSVPutMAC(log, p->eh->ether_src);
+}
+
+static void CSVEthDst(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->eh)
+        CSVPutMAC(log, p->eh->ether_dst);
+}
+
+static void CSVEthType(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->eh)
+        CSVPutHex(log, ntohs(p->eh->ether_type));
+}
+
+static void CSVUdpLength(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->udph)
+        TextLog_PutUInt(log, ntohs(p->udph->uh_len));
+}
+
+static void CSVEthLen(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->eh)
+        CSVPutHex(log, p->pkth->len);
+}
+
 #ifndef NO_NON_ETHER_DECODER
-        else if(!strncasecmp("trheader", type, 8))
-        {
-            if(p->trh)
-                LogTrHeader(log, p);
-        }
+static void CSVTrHeader(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->trh)
+        LogTrHeader(log, p);
+}
 #endif
-        else if(!strncasecmp("srcport", type, 7))
-        {
-            if(IPH_IS_VALID(p))
-            {
-                switch(GET_IPH_PROTO(p))
-                {
-                    case IPPROTO_UDP:
-                    case IPPROTO_TCP:
-                        TextLog_Print(log,  "%d", p->sp);
-                        break;
-                }
-            }
-        }
-        else if(!strncasecmp("dstport", type, 7))
-        {
-            if(IPH_IS_VALID(p))
-            {
-                switch(GET_IPH_PROTO(p))
-                {
-                    case IPPROTO_UDP:
-                    case IPPROTO_TCP:
-                        TextLog_Print(log,  "%d", p->dp);
-                        break;
-                }
-            }
-        }
-        else if(!strncasecmp("src", type, 3))
-        {
-            if(IPH_IS_VALID(p))
-                TextLog_Puts(log, inet_ntoa(GET_SRC_ADDR(p)));
-        }
-        else if(!strncasecmp("dst", type, 3))
-        {
-            if(IPH_IS_VALID(p))
-                TextLog_Puts(log, inet_ntoa(GET_DST_ADDR(p)));
-        }
-        else if(!strncasecmp("icmptype",type,8))
-        {
-            if(p->icmph)
-            {
-            TextLog_Print(log, "%d",p->icmph->type);
-            }
-        }
-        else if(!strncasecmp("icmpcode",type,8))
-        {
-            if(p->icmph)
-            {
-                TextLog_Print(log, "%d",p->icmph->code);
-            }
-        }
-        else if(!strncasecmp("icmpid",type,6))
-        {
-            if(p->icmph)
-                TextLog_Print(log, "%d",ntohs(p->icmph->s_icmp_id));
-        }
-        else if(!strncasecmp("icmpseq",type,7))
-        {
-            if(p->icmph)
-                TextLog_Print(log, "%d",ntohs(p->icmph->s_icmp_seq));
-        }
-        else if(!strncasecmp("ttl",type,3))
-        {
-            if(IPH_IS_VALID(p))
-            TextLog_Print(log, "%d",GET_IPH_TTL(p));
-        }
-        else if(!strncasecmp("tos",type,3))
-        {
-            if(IPH_IS_VALID(p))
-            TextLog_Print(log, "%d",GET_IPH_TOS(p));
-        }
-        else if(!strncasecmp("id",type,2))
-        {
-            if(IPH_IS_VALID(p))
-                TextLog_Print(log, "%u", IS_IP6(p) ? ntohl(GET_IPH_ID(p)) : ntohs((u_int16_t)GET_IPH_ID(p)));
-        }
-        else if(!strncasecmp("iplen",type,5))
-        {
-            if(IPH_IS_VALID(p))
-            TextLog_Print(log, "%d",GET_IPH_LEN(p) << 2);
-        }
-        else if(!strncasecmp("dgmlen",type,6))
-        {
-            if(IPH_IS_VALID(p))
-                // XXX might cause a bug when IPv6 is printed?
-                TextLog_Print(log, "%d",ntohs(GET_IPH_LEN(p)));
-        }
-        else if(!strncasecmp("tcpseq",type,6))
-        {
-            if(p->tcph)
-            TextLog_Print(log, "0x%lX",(u_long) ntohl(p->tcph->th_seq));
-        }
-        else if(!strncasecmp("tcpack",type,6))
-            {
-            if(p->tcph)
-                TextLog_Print(log, "0x%lX",(u_long) ntohl(p->tcph->th_ack));
-        }
-        else if(!strncasecmp("tcplen",type,6))
-        {
-            if(p->tcph)
-                TextLog_Print(log, "%d",TCP_OFFSET(p->tcph) << 2);
-        }
-        else if(!strncasecmp("tcpwindow",type,9))
-        {
-            if(p->tcph)
-                TextLog_Print(log, "0x%X",ntohs(p->tcph->th_win));
-        }
-        else if(!strncasecmp("tcpflags",type,8))
+
+static void CSVSrcPort(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (!IPH_IS_VALID(p))
+        return;
+
+    switch (GET_IPH_PROTO(p))
+    {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+            TextLog_PutUInt(log, p->sp);
+            break;
+    }
+}
+
+static void CSVDstPort(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (!IPH_IS_VALID(p))
+        return;
+
+    switch (GET_IPH_PROTO(p))
+    {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+            TextLog_PutUInt(log, p->dp);
+            break;
+    }
+}
+
+static void CSVSrc(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (IPH_IS_VALID(p))
+        CSVPutIP(log, GET_SRC_ADDR(p));
+}
+
+static void CSVDst(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (IPH_IS_VALID(p))
+        CSVPutIP(log, GET_DST_ADDR(p));
+}
+
+static void CSVIcmpType(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->icmph)
+        TextLog_PutUInt(log, p->icmph->type);
+}
+
+static void CSVIcmpCode(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->icmph)
+        TextLog_PutUInt(log, p->icmph->code);
+}
+
+static void CSVIcmpId(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->icmph)
+        TextLog_PutUInt(log, ntohs(p->icmph->s_icmp_id));
+}
+
+static void CSVIcmpSeq(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->icmph)
+        TextLog_PutUInt(log, ntohs(p->icmph->s_icmp_seq));
+}
+
+static void CSVTtl(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (IPH_IS_VALID(p))
+        TextLog_PutUInt(log, GET_IPH_TTL(p));
+}
+
+static void CSVTos(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (IPH_IS_VALID(p))
+        TextLog_PutUInt(log, GET_IPH_TOS(p));
+}
+
+static void CSVId(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (IPH_IS_VALID(p))
+        TextLog_PutUInt(log, IS_IP6(p) ? ntohl(GET_IPH_ID(p)) : ntohs((u_int16_t)GET_IPH_ID(p)));
+}
+
+static void CSVIpLen(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (IPH_IS_VALID(p))
+        TextLog_PutUInt(log, GET_IPH_LEN(p) << 2);
+}
+
+static void CSVDgmLen(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (IPH_IS_VALID(p))
+        // XXX might cause a bug when IPv6 is printed?
+        TextLog_PutUInt(log, ntohs(GET_IPH_LEN(p)));
+}
+
+static void CSVTcpSeq(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tcph)
+        CSVPutHex(log, ntohl(p->tcph->th_seq));
+}
+
+static void CSVTcpAck(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tcph)
+        CSVPutHex(log, ntohl(p->tcph->th_ack));
+}
+
+static void CSVTcpLen(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tcph)
+        TextLog_PutUInt(log, TCP_OFFSET(p->tcph) << 2);
+}
+
+static void CSVTcpWindow(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tcph)
+        CSVPutHex(log, ntohs(p->tcph->th_win));
+}
+
+static void CSVTcpFlags(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    char tcpFlags[9];
+
+    if (p->tcph)
+    {
+        CreateTCPFlagString(p, tcpFlags);
+        TextLog_Puts(log, tcpFlags);
+    }
+}
+
+/*
+ * Tunnels: "tunnel" lists the tunnels the packet was decoded through,
+ * outermost first (eg. "gre/vxlan"), the other fields describe the outermost
+ * one. src, dst and the ports are always those of the innermost packet.
+ */
+static void CSVPutTunnelIP(TextLog *log, const TunnelLayer *t, const u_int8_t *addr)
+{
+#ifdef SUP_IP6
+    sfip_t ip;
+
+    if (t->family == AF_INET6)
+    {
+        sfip_set_raw(&ip, (void *)addr, AF_INET6);
+        CSVPutIP(log, &ip);
+        return;
+    }
+#endif
+    CSVPutIPv4(log, addr);
+}
+
+static void CSVTunnel(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    int i;
+
+    for (i = 0; i < p->tunnel_depth; i++)
+    {
+        if (i)
+            TextLog_Putc(log, '/');
+        TextLog_Puts(log, TunnelName(p->tunnels[i].type));
+    }
+}
+
+static void CSVTunnelId(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tunnel_depth)
+        TextLog_PutUInt(log, p->tunnels[0].id);
+}
+
+static void CSVOuterSrc(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tunnel_depth)
+        CSVPutTunnelIP(log, &p->tunnels[0], TUNNEL_SRC_ADDR(&p->tunnels[0]));
+}
+
+static void CSVOuterDst(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tunnel_depth)
+        CSVPutTunnelIP(log, &p->tunnels[0], TUNNEL_DST_ADDR(&p->tunnels[0]));
+}
+
+static void CSVOuterSrcPort(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tunnel_depth && p->tunnels[0].dp)
+        TextLog_PutUInt(log, p->tunnels[0].sp);
+}
+
+static void CSVOuterDstPort(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (p->tunnel_depth && p->tunnels[0].dp)
+        TextLog_PutUInt(log, p->tunnels[0].dp);
+}
+
+/*
+ * Extra data: the value of the event's first record of the type, quoted
+ * unless it is an address.
+ */
+static void CSVPutExtraData(TextLog *log, Unified2EventCommon *event, uint32_t type)
+{
+    const ExtraData *ed = GetExtraDataByType(event, type);
+    char text[EXTRA_DATA_TEXT_MAX];
+
+    if (ed == NULL)
+        return;
+
+    ExtraDataText(ed, text, sizeof(text));
+
+    if (ExtraDataFamily(ed))
+        TextLog_Puts(log, text);
+    else if (!TextLog_Quote(log, text))
+        LogMessage("WARNING: alert_csv: %s value too long, left out\n",
+                   ExtraDataName(type));
+}
+
+static void CSVXff(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_XFF_IPV4);
+}
+
+static void CSVHttpUri(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_HTTP_URI);
+}
+
+static void CSVHttpHostname(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_HTTP_HOSTNAME);
+}
+
+static void CSVSmtpFilename(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_SMTP_FILENAME);
+}
+
+static void CSVSmtpMailFrom(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_SMTP_MAILFROM);
+}
+
+static void CSVSmtpRcptTo(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_SMTP_RCPTTO);
+}
+
+static void CSVSmtpHeaders(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_SMTP_EMAIL_HDRS);
+}
+
+static void CSVReviewedBy(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_REVIEWED_BY);
+}
+
+static void CSVIPv6Src(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_IPV6_SRC);
+}
+
+static void CSVIPv6Dst(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    CSVPutExtraData(log, event, EVENT_INFO_IPV6_DST);
+}
+
+static void CSVInterface(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (barnyard2_conf->interface)
+        TextLog_Puts(log, barnyard2_conf->interface);
+    else
+        TextLog_Puts(log, "by2_no_interface_configured");
+}
+
+static void CSVHostname(TextLog *log, Packet *p, Unified2EventCommon *event)
+{
+    if (barnyard2_conf->hostname)
+        TextLog_Puts(log, barnyard2_conf->hostname);
+    else
+        TextLog_Puts(log, "by2_no_hostname_configured");
+}
+
+/*
+ * Fields are matched on a prefix of the configured name, in this order, so
+ * that e.g. "srcport" is found before "src".
+ */
+static const AlertCSVField csv_fields[] =
+{
+    { "timestamp",      9,  CSVTimestamp },
+    { "sig_generator",  13, CSVSigGenerator },
+    { "sig_id",         6,  CSVSigId },
+    { "sig_rev",        7,  CSVSigRev },
+    { "msg",            3,  CSVMsg },
+    { "proto",          5,  CSVProto },
+    { "ethsrc",         6,  CSVEthSrc },
+    { "ethdst",         6,  CSVEthDst },
+    { "ethtype",        7,  CSVEthType },
+    { "udplength",      9,  CSVUdpLength },
+    { "ethlen",         6,  CSVEthLen },
+#ifndef NO_NON_ETHER_DECODER
+    { "trheader",       8,  CSVTrHeader },
+#endif
+    { "srcport",        7,  CSVSrcPort },
+    { "dstport",        7,  CSVDstPort },
+    { "src",            3,  CSVSrc },
+    { "dst",            3,  CSVDst },
+    { "icmptype",       8,  CSVIcmpType },
+    { "icmpcode",       8,  CSVIcmpCode },
+    { "icmpid",         6,  CSVIcmpId },
+    { "icmpseq",        7,  CSVIcmpSeq },
+    { "ttl",            3,  CSVTtl },
+    { "tos",            3,  CSVTos },
+    { "id",             2,  CSVId },
+    { "iplen",          5,  CSVIpLen },
+    { "dgmlen",         6,  CSVDgmLen },
+    { "tcpseq",         6,  CSVTcpSeq },
+    { "tcpack",         6,  CSVTcpAck },
+    { "tcplen",         6,  CSVTcpLen },
+    { "tcpwindow",      9,  CSVTcpWindow },
+    { "tcpflags",       8,  CSVTcpFlags },
+    { "tunnel_id",      9,  CSVTunnelId },
+    { "tunnel",         6,  CSVTunnel },
+    { "outer_srcport",  13, CSVOuterSrcPort },
+    { "outer_dstport",  13, CSVOuterDstPort },
+    { "outer_src",      9,  CSVOuterSrc },
+    { "outer_dst",      9,  CSVOuterDst },
+    { "xff",            3,  CSVXff },
+    { "http_uri",       8,  CSVHttpUri },
+    { "http_hostname",  13, CSVHttpHostname },
+    { "smtp_filename",  13, CSVSmtpFilename },
+    { "smtp_mailfrom",  13, CSVSmtpMailFrom },
+    { "smtp_rcptto",    11, CSVSmtpRcptTo },
+    { "smtp_headers",   12, CSVSmtpHeaders },
+    { "reviewed_by",    11, CSVReviewedBy },
+    { "ipv6_src",       8,  CSVIPv6Src },
+    { "ipv6_dst",       8,  CSVIPv6Dst },
+    { "interface",      9,  CSVInterface },
+    { "hostname",       8,  CSVHostname },
+    { NULL,             0,  NULL }
+};
+
+/*
+ * Function: AlertCSVCompile(AlertCSVData *, char **, int)
+ *
+ * Purpose: Resolve the configured field names to their column writers once,
+ *          so that alerts do not have to compare names.  Unknown fields are
+ *          kept as empty columns.
+ *
+ * Arguments: data => plugin data to store the field list in
+ *            args => CSV field names
+ *         numargs => number of field names
+ *
+ * Returns: void function
+ */
+static void AlertCSVCompile(AlertCSVData *data, char **args, int numargs)
+{
+    const AlertCSVField *field;
+    int num;
+
+    data->numargs = numargs;
+    data->fields = (AlertCSVFunc *)SnortAlloc((numargs + 1) * sizeof(AlertCSVFunc));
+
+    for (num = 0; num < numargs; num++)
+    {
+        for (field = csv_fields; field->name != NULL; field++)
         {
-            if(p->tcph)
-            {
-                CreateTCPFlagString(p, tcpFlags);
-                TextLog_Print(log, "%s", tcpFlags);
-            }
+            if (!strncasecmp(field->name, args[num], field->len))
+                break;
         }
-	else if(!strncasecmp("interface",type,strlen("interface")))
-        {
-	    if( barnyard2_conf->interface )
-	    {
-		TextLog_Print(log, "%s", barnyard2_conf->interface);
-	    }
-	    else
-	    {
-		TextLog_Print(log, "%s", "by2_no_interface_configured");
-	    }
-	}
-	else if(!strncasecmp("hostname",type,strlen("hostname")))
-        {
-	    if( barnyard2_conf->hostname)
-	    {
-		TextLog_Print(log, "%s", barnyard2_conf->hostname);
-	    }
-	    else
-	    {
-		TextLog_Print(log, "%s", "by2_no_hostname_configured");
-	    }
-	}
 
+        data->fields[num] = field->func;
+    }
+}
 
-        DEBUG_WRAP(DebugMessage(DEBUG_LOG, "WOOT!\n"););
+/*
+ *
+ * Function: RealAlertCSV(Packet *, void *, uint32_t, AlertCSVData *)
+ *
+ * Purpose: Write a user defined CSV message
+ *
+ * Arguments:     p => packet. (could be NULL)
+ *            event => event that triggered the alert
+ *       event_type => unified2 type of the event
+ *             data => compiled CSV fields and log
+ * Returns: void function
+ *
+ */
+static void RealAlertCSV(Packet * p, void *event, uint32_t event_type,
+        AlertCSVData *data)
+{
+    TextLog *log = data->log;
+    int num;
 
-        if (num < numargs - 1)
-            TextLog_Putc(log, ',');
+    if(p == NULL)
+        return;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"Logging CSV Alert data\n"););
+
+    for (num = 0; num < data->numargs; num++)
+    {
+        if (data->fields[num] != NULL)
+            data->fields[num](log, p, (Unified2EventCommon *)event);
 
+        if (num < data->numargs - 1)
+            TextLog_Putc(log, ',');
     }
     TextLog_NewLine(log);
     TextLog_Flush(log);
 }
-
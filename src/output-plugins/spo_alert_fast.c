@@ -113,7 +113,7 @@ void AlertFastSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("alert_fast", OUTPUT_TYPE_FLAG__ALERT, AlertFastInit);
+    RegisterOutputPlugin("alert_fast", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertFastInit);
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: AlertFast is setup...\n"););
 }
 
@@ -179,27 +179,14 @@ static void AlertFast(Packet *p, void *event, uint32_t event_type, void *arg)
         TextLog_Puts(data->log, " [**] ");
 #endif
 
-        TextLog_Print(data->log, "[%lu:%lu:%lu] ",
-                (unsigned long) ntohl(((Unified2EventCommon *)event)->generator_id),
-                (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_id),
-                (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_revision));
-
-        if(BcAlertInterface())
-        {
-            TextLog_Print(data->log, "<%s> ", PRINT_INTERFACE(barnyard2_conf->interface));
-        }
-
-        TextLog_Puts(data->log, sn->msg);
-        TextLog_Puts(data->log, " [**] ");
+        /* "[gid:sid:rev] [<iface> ]msg [**] " */
+        LogSigFragment(data->log, sn, SIG_FRAG_FAST, (Unified2EventCommon *)event);
     }
 
     /* print the packet header to the alert file */
     if(p && IPH_IS_VALID(p))
     {
-        LogPriorityData(data->log,
-                        ntohl(((Unified2EventCommon *)event)->classification_id),
-                        ntohl(((Unified2EventCommon *)event)->priority_id),
-                        0);
+        LogSigFragment(data->log, sn, SIG_FRAG_PRIORITY, (Unified2EventCommon *)event);
 
         TextLog_Print(data->log, "{%s} ", protocol_names[GET_IPH_PROTO(p)]);
 
@@ -359,6 +346,8 @@ static SpoAlertFastData *ParseAlertFastArgs(char *args)
                 {
                     data->packet_flag = 1;
                     bufSize = FULL_BUF;
+                    /* the dump shows every decoded header */
+                    RequireDecodeLevel(DECODE_LEVEL__PAYLOAD);
                     break;
                 }
                 /* in this case, only 2 options allowed */
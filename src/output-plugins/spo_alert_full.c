@@ -105,7 +105,7 @@ void AlertFullSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("alert_full", OUTPUT_TYPE_FLAG__ALERT, AlertFullInit);
+    RegisterOutputPlugin("alert_full", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__OPTIONS, AlertFullInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: AlertFull is setup...\n"););
 }
@@ -154,41 +154,13 @@ static void AlertFull(Packet *p, void *event, uint32_t event_type, void *arg)
 
 
 
-    if(sn != NULL)
-    {
-        TextLog_Puts(data->log, "[**] ");
-
-        if(event != NULL)
-        {
-                TextLog_Print(data->log, "[%lu:%lu:%lu] ",
-						(unsigned long) ntohl(((Unified2EventCommon *)event)->generator_id),
-		                (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_id),
-		                (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_revision));
-        }
-
-        if(BcAlertInterface())
-        {
-            TextLog_Print(data->log, " <%s> ", PRINT_INTERFACE(barnyard2_conf->interface));
-            TextLog_Puts(data->log, sn->msg);
-            TextLog_Puts(data->log, " [**]\n");
-        }
-        else
-        {
-            TextLog_Puts(data->log, sn->msg);
-            TextLog_Puts(data->log, " [**]\n");
-        }
-    }
-    else
-    {
-        TextLog_Puts(data->log, "[**] Snort Alert! [**]\n");
-    }
+    /* "[**] [gid:sid:rev] [ <iface> ]msg [**]\n" */
+    LogSigFragment(data->log, sn, SIG_FRAG_FULL, (Unified2EventCommon *)event);
 
     if(p && IPH_IS_VALID(p))
     {
-        LogPriorityData(data->log,
-		                ntohl(((Unified2EventCommon *)event)->classification_id),
-						ntohl(((Unified2EventCommon *)event)->priority_id),
-						TRUE);
+        LogSigFragment(data->log, sn, SIG_FRAG_PRIORITY, (Unified2EventCommon *)event);
+        TextLog_NewLine(data->log);
     }
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Logging Alert data!\n"););
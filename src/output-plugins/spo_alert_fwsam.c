@@ -54,7 +54,9 @@
  * sid-fwsam Parameters:
  ***********************
  *
- * <sid>:   who[how],time;
+ * [<gid>:]<sid>:   who[how],time;
+ *
+ *  gid: Optional. Without it the line applies to the sid of any generator.
  *
  *  who: src, source, dst, dest, destination
  *          IP address to be blocked according to snort rule (some rules
@@ -78,6 +80,7 @@
  * 1487: src[either],15min;
  * 1292: dst[in], 2 days 4 hours
  * 1638: src, 1 hour
+ * 1:2003: src, 1 hour
  *
 */
 
@@ -86,10 +89,12 @@
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 
 #include "barnyard2.h"
 #include "decode.h"
+#include "khash.h"
 #include "spo_alert_fwsam.h"
 #include "twofish.h"
 #include "plugbase.h"
@@ -109,7 +114,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
 #include <netdb.h>
+#include <poll.h>
 
 #ifdef SOLARIS
 #include <sys/filio.h>
@@ -125,6 +132,10 @@ typedef int SOCKET;
 
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #ifndef FALSE
 #define FALSE   0
 #endif
@@ -180,38 +191,30 @@ typedef int SOCKET;
 
 /* user adjustable defines */
 
-#define FWSAM_REPET_BLOCKS      10  /* Snort remembers this amount of last blocks and... */
+#define FWSAM_REPET_BLOCKS      65536   /* Snort remembers up to this amount of recent blocks and... */
 #define FWSAM_REPET_TIME        20  /* ...checks if they fall within this time. If so,... */
                                     /* ...the blocking request is not send. */
 
 #define FWSAM_NETWAIT           300     /* 100th of a second. 3 sec timeout for network connections */
 #define FWSAM_NETHOLD           6000    /* 100th of a second. 60 sec timeout for holding */
 
+#define FWSAM_QUEUE_MAX         4096    /* block requests waiting per station, newer ones are dropped */
+#define FWSAM_MAX_TRIES         2       /* a request is given up after this many failed sends */
+#define FWSAM_RETRY_MIN         1000    /* ms to wait before reconnecting to an unreachable station... */
+#define FWSAM_RETRY_MAX         60000   /* ...doubling up to this */
+#define FWSAM_EXIT_TIMEOUT      5       /* seconds to finish pending requests on exit */
+
 #define SID_MAPFILE             "sid-block.map"
 #define SID_ALT_MAPFILE         "sid-fwsam.map"
 
-#define FWSAM_FANCYFETCH        /* This will invoke a fast sid lookup routine */
 
 
 /* vars */
 
-typedef struct _FWsamstation            /* structure of a mgmt station */
-{
-    unsigned short      myseqno;
-    unsigned short      stationseqno;
-    unsigned char       mykeymod[4];
-    unsigned char       fwkeymod[4];
-    unsigned short      stationport;
-    //struct in_addr        stationip;
-    sfip_t          stationip;
-    struct sockaddr_in  localsocketaddr;
-    struct sockaddr_in  stationsocketaddr;
-    TWOFISH         *stationfish;
-    char            initialkey[TwoFish_KEY_LENGTH+2];
-    char            stationkey[TwoFish_KEY_LENGTH+2];
-    time_t          lastcontact;
-/*  time_t          sleepstart; */
-}   FWsamStation;
+#define FWSAM_STATE_IDLE        0   /* nothing in flight, the connection may be kept open */
+#define FWSAM_STATE_CONNECTING  1
+#define FWSAM_STATE_WAITING     2   /* request sent, waiting for the response */
+#define FWSAM_STATE_HOLD        3   /* agent asked us to hold on for the final response */
 
 typedef struct _FWsampacket         /* 2 blocks (3rd block is header from TwoFish) */
 {
@@ -231,6 +234,45 @@ typedef struct _FWsampacket         /* 2 blocks (3rd block is header from TwoFis
     unsigned char       fluff;          /* 31 */
 }   FWsamPacket;                        /* 32 bytes in size */
 
+typedef struct _FWsamrequest            /* a queued block request */
+{
+    FWsamPacket         packet;         /* sequence numbers are filled in when sent */
+    unsigned char       tries;
+    unsigned char       checkedin;      /* checked in again after the agent reported an error */
+}   FWsamRequest;
+
+typedef struct _FWsamstation            /* structure of a mgmt station */
+{
+    unsigned short      myseqno;
+    unsigned short      stationseqno;
+    unsigned char       mykeymod[4];
+    unsigned char       fwkeymod[4];
+    unsigned short      stationport;
+    //struct in_addr        stationip;
+    sfip_t          stationip;
+    struct sockaddr_in  localsocketaddr;
+    struct sockaddr_in  stationsocketaddr;
+    TWOFISH         *stationfish;
+    char            initialkey[TwoFish_KEY_LENGTH+2];
+    char            stationkey[TwoFish_KEY_LENGTH+2];
+    time_t          lastcontact;
+/*  time_t          sleepstart; */
+
+    SOCKET          stationsocket;  /* kept open for as long as the agent allows */
+    int             state;          /* FWSAM_STATE_* */
+    unsigned long   served;         /* requests answered on this connection */
+    u_int64_t       deadline;       /* ms, for the connect or response in progress */
+    u_int64_t       retrytime;      /* ms, station is not contacted before this */
+    unsigned long   retrydelay;     /* ms, 0 while the station is reachable */
+    char            replybuf[sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE];
+    unsigned long   replylen;
+
+    FWsamRequest    *queue;         /* ring of pending block requests, head is in flight */
+    unsigned long   queuehead;
+    unsigned long   queuelen;
+    unsigned long   dropped;
+}   FWsamStation;
+
 typedef struct _FWsampacket2            /* 4 blocks (3rd block is header from TwoFish) */
 {
     unsigned short      endiancheck;    /* 0  */
@@ -252,7 +294,9 @@ typedef struct _FWsampacket2            /* 4 blocks (3rd block is header from Tw
 
 typedef struct _FWsamoptions    /* snort rule options */
 {
+    unsigned long   gid;        /* 0 if the line applies to any gid */
     unsigned long   sid;
+    unsigned long   line;       /* order in the map file, earlier lines win */
     unsigned long   duration;
     unsigned char   who;
     unsigned char   how;
@@ -265,6 +309,38 @@ typedef struct _FWsamlistpointer
     struct _FWsamlistpointer *next;
 }   FWsamList;
 
+typedef struct _FWsamblockkey   /* what makes a block request a repetition, no padding */
+{
+    u_int32_t       srcip[4];
+    u_int32_t       dstip[4];
+    u_int32_t       duration;
+    u_int16_t       dstport;
+    u_int8_t        protocol;
+    u_int8_t        family;
+    u_int8_t        mode;
+    u_int8_t        unused[3];
+}   FWsamBlockKey;
+
+static inline khint_t FWsamBlockKeyHash(FWsamBlockKey key)
+{
+    const u_int8_t *k = (const u_int8_t *)&key;
+    khint_t h = 2166136261U;
+    unsigned int i;
+
+    for(i=0; i<sizeof(key); i++)
+        h = (h ^ k[i]) * 16777619U;
+
+    return h;
+}
+
+#define FWsamBlockKeyEqual(a, b) (memcmp(&(a), &(b), sizeof(FWsamBlockKey)) == 0)
+
+KHASH_INIT(FWsamBlocks, FWsamBlockKey, time_t, 1, FWsamBlockKeyHash, FWsamBlockKeyEqual)
+
+#define FWSAM_OPTION_KEY(gid, sid)  (((khint64_t)(gid)<<32)|(khint64_t)(sid))
+
+KHASH_MAP_INIT_INT64(FWsamOptionMap, FWsamOptions *)
+
 /*
 ** PROTOTYPES
 */
@@ -281,8 +357,15 @@ void FWsamFree(FWsamList *fwsamlist);
 int FWsamStationExists(FWsamStation *who, FWsamList *list);
 int FWsamReadLine(char *, unsigned long, FILE *);
 void FWsamParseLine(FWsamOptions *, char *);
-FWsamOptions *FWsamGetOption(unsigned long);
+FWsamOptions *FWsamGetOption(unsigned long, unsigned long);
+void FWsamIndexOptions(void);
+int FWsamReadOptions(const char *);
 int FWsamParseOption(FWsamOptions *, char *);
+void AlertFWsamIdleFunc(int signal, void *arg);
+int FWsamRepetitiveBlock(Packet *p, FWsamOptions *optp);
+void FWsamQueueBlock(FWsamStation *station, FWsamPacket *packet);
+void FWsamPump(FWsamStation *station);
+void FWsamDrain(time_t deadline);
 
 
 /*
@@ -299,6 +382,11 @@ extern Barnyard2Config *barnyard2_conf;
 FWsamList *FWsamStationList=NULL;           /* Global (for all alert-types) list of snortsam stations */
 FWsamOptions *FWsamOptionField=NULL;
 unsigned long FWsamMaxOptions=0;
+khash_t(FWsamOptionMap) *FWsamOptionIndex=NULL;   /* (gid,sid) => entry in FWsamOptionField */
+
+/* recent blocks, in the current and the previous FWSAM_REPET_TIME window */
+static khash_t(FWsamBlocks) *FWsamRecentBlocks[2]={NULL,NULL};
+static time_t FWsamRecentStart=0;
 
 
 /*
@@ -318,7 +406,7 @@ unsigned long FWsamMaxOptions=0;
 void AlertFWsamSetup(void)
 {
     /* link the preprocessor keyword to the init function in the preproc list */
-    RegisterOutputPlugin("alert_fwsam", OUTPUT_TYPE_FLAG__ALERT, AlertFWsamInit);
+    RegisterOutputPlugin("alert_fwsam", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertFWsamInit);
 
 #ifdef FWSAMDEBUG   /* This allows debugging of fwsam only */
     LogMessage("DEBUG => [Alert_FWsam](AlertFWsamSetup) Output plugin is plugged in...\n");
@@ -340,15 +428,13 @@ void AlertFWsamSetup(void)
 void AlertFWsamInit(char *args)
 {
     char *ap;
-    unsigned long statip,cnt,again,i;
+    unsigned long statip;
     char *stathost, *statport, *statpass;
     FWsamStation *station;
     FWsamList *fwsamlist=NULL;  /* alert-type dependent list of snortsam stations  */
     FWsamList *listp,*newlistp;
     struct hostent *hoste;
     char buf[1024]="";
-    FILE *fp;
-    FWsamOptions tempopt;
 
 #ifdef FWSAMDEBUG
     unsigned long hostcnt=0;
@@ -366,58 +452,15 @@ void AlertFWsamInit(char *args)
 #ifdef FWSAMDEBUG
         LogMessage("DEBUG => [Alert_FWsam](AlertFWsamSetup) Using file: %s\n",buf);
 #endif
-        fp=fopen(buf,"rt");
-        if(!fp)
+        if(!FWsamReadOptions(buf))
         {
             strncpy(buf, barnyard2_conf->config_dir, sizeof(buf)-1);
             strncpy(buf+strlen(buf), SID_ALT_MAPFILE, sizeof(buf)-strlen(buf)-1);
             LogMessage("DEBUG => [Alert_FWsam](AlertFWsamSetup) Using alternative file: %s\n",buf);
-            fp=fopen(buf,"rt");
+            FWsamReadOptions(buf);
         }
 
-        if(fp)  /* Check for presence of map file and read those in, sorted. */
-        {
-            LogMessage("INFO => [Alert_FWsam](AlertFWsamSetup) Using sid-map file: %s\n",buf);
-            while( FWsamReadLine(buf,sizeof(buf),fp) )
-                if( *buf )
-                    FWsamMaxOptions++;
-
-            if( FWsamMaxOptions )
-            {
-                if( (FWsamOptionField=(FWsamOptions *)malloc(sizeof(FWsamOptions)*FWsamMaxOptions)) == NULL )
-                    FatalError("ERROR => [Alert_FWsam](AlertFWsamSetup) malloc failed for OptionField!\n");
-
-                fseek(fp,0,SEEK_SET);
-                for(cnt=0; cnt<FWsamMaxOptions; )
-                {
-                    FWsamReadLine(buf,sizeof(buf),fp);
-
-                if( *buf )
-                    FWsamParseLine(&(FWsamOptionField[cnt++]),buf);
-                }
-
-                if( FWsamMaxOptions>1 )
-                {
-                    for(again=TRUE,cnt=FWsamMaxOptions-1; cnt>=1 && again; cnt--)
-                    {
-                        for(again=FALSE,i=0; i<cnt; i++)
-                        {
-                            if( FWsamOptionField[i].sid>FWsamOptionField[i+1].sid )
-                            {   memcpy(&tempopt,&(FWsamOptionField[i]),sizeof(FWsamOptions));
-                                memcpy(&(FWsamOptionField[i]),&(FWsamOptionField[i+1]),sizeof(FWsamOptions));
-                                memcpy(&(FWsamOptionField[i+1]),&tempopt,sizeof(FWsamOptions));
-                                again=TRUE;
-                            }
-                        }
-                    }
-                }
-            }
-            else
-                FWsamMaxOptions=1;
-
-            fclose(fp);
-        }
-        else
+        if(!FWsamMaxOptions)
             FWsamMaxOptions=1;
     }
 
@@ -488,6 +531,8 @@ void AlertFWsamInit(char *args)
             if((station=(FWsamStation *)malloc(sizeof(FWsamStation)))==NULL)
                 FatalError("ERROR => [Alert_FWsam](AlertFWsamInit) malloc failed for station!\n");
 
+            station->stationip.family = AF_INET;
+            station->stationip.bits = 32;
             station->stationip.ip32[0] = statip; /* the IP address */
             if(statport!=NULL && atoi(statport)>0) /* if the user specified one */
                 station->stationport=atoi(statport); /* use users setting */
@@ -522,6 +567,18 @@ void AlertFWsamInit(char *args)
             station->mykeymod[3]=rand();
             station->stationseqno=0;                /* peer hasn't answered yet. */
 
+            station->stationsocket=INVALID_SOCKET;  /* connected on the first block */
+            station->state=FWSAM_STATE_IDLE;
+            station->served=0;
+            station->deadline=0;
+            station->retrytime=0;
+            station->retrydelay=0;
+            station->replylen=0;
+            station->queue=NULL;
+            station->queuehead=0;
+            station->queuelen=0;
+            station->dropped=0;
+
 
             /* If we don't have the station already in global list....*/
             if(!FWsamStationExists(station,FWsamStationList))
@@ -596,6 +653,7 @@ void AlertFWsamInit(char *args)
     AddFuncToOutputList(AlertFWsam, OUTPUT_TYPE__LOG, fwsamlist);
     AddFuncToCleanExitList(AlertFWsamCleanExitFunc, fwsamlist);
     AddFuncToRestartList(AlertFWsamRestartFunc, fwsamlist);
+    AddFuncToIdleList(AlertFWsamIdleFunc, fwsamlist);
 }
 
 
@@ -636,7 +694,7 @@ int FWsamReadLine(char *buf,unsigned long bufsize,FILE *fp)
             if(*p=='#' || *p==';')
             {
                 if(*(p-1)=='\\')
-                    strcpy(p-1,p);
+                    memmove(p-1,p,strlen(p)+1);
                 else
                     *p=0;
             }
@@ -822,30 +880,37 @@ int FWsamParseOption(FWsamOptions *optp,char *ap)
 */
 void FWsamParseLine(FWsamOptions *optp,char *buf)
 {
-    char *ap;
-
-    ap=buf; /* start at the beginning of the argument */
+    char *ap,*op;
+    unsigned long id;
 
-    while(*ap)
+    for(ap=op=buf; *ap; ap++)   /* remove spaces (tabs, etc) and set to lower case */
     {
-        if(isspace(*ap))        /* normalize spaces (tabs into space, etc) */
-            *ap=' ';
-        if(isupper(*ap))        /* and set to lower case */
-            *ap=tolower(*ap);
-        ap++;
+        if(!isspace(*ap))
+            *op++=tolower(*ap);
     }
-    while((ap=strrchr(buf,' '))!=NULL)  /* remove spaces */
-        strcpy(ap,ap+1);
+    *op=0;
 
+    optp->gid=0;
     ap=buf;
     if(*ap)
     {
+        optp->sid=strtoul(ap,&ap,10);
+
+        /* a second number followed by a separator means we got gid:sid */
+        if((*ap==':' || *ap=='|') && isdigit(ap[1]))
+        {
+            id=strtoul(ap+1,&op,10);
+            if(*op==':' || *op=='|')
+            {
+                optp->gid=optp->sid;
+                optp->sid=id;
+                ap=op;
+            }
+        }
+
         while(*ap && *ap!=':' && *ap!='|') ap++;
-        *ap++ =0;
         while(*ap && (*ap==':' || *ap=='|')) ap++;
 
-        optp->sid=(unsigned long)atol(buf);
-
         if(FWsamParseOption(optp,ap))
             LogMessage("WARNING %s (%d) => [Alert_FWsam](AlertFWamOptionInit) Possible option problem. Using %s[%s],%lu.\n",file_name,file_line,(optp->who==FWSAM_WHO_SRC)?"src":"dst",(optp->how==FWSAM_HOW_IN)?"in":((optp->how==FWSAM_HOW_OUT)?"out":"either"),optp->duration);
     }
@@ -912,37 +977,640 @@ char *inettoa(unsigned long ip)
 #endif
 
 
+static int FWsamOptionCompare(const void *a,const void *b)
+{
+    const FWsamOptions *x=(const FWsamOptions *)a;
+    const FWsamOptions *y=(const FWsamOptions *)b;
+
+    if(x->gid!=y->gid)
+        return (x->gid<y->gid) ? -1 : 1;
+    if(x->sid!=y->sid)
+        return (x->sid<y->sid) ? -1 : 1;
+    if(x->line!=y->line)
+        return (x->line<y->line) ? -1 : 1;
+    return 0;
+}
+
+/*  This reads the option list from a sid-block.map file and indexes it,
+ *  unless it can not be opened, in which case it returns FALSE.
+*/
+int FWsamReadOptions(const char *file)
+{
+    char buf[1024]="";
+    unsigned long cnt;
+    FILE *fp;
+
+    if((fp=fopen(file,"rt"))==NULL)
+        return FALSE;
+
+    LogMessage("INFO => [Alert_FWsam](AlertFWsamSetup) Using sid-map file: %s\n",file);
+    while( FWsamReadLine(buf,sizeof(buf),fp) )
+        if( *buf )
+            FWsamMaxOptions++;
+
+    if( FWsamMaxOptions )
+    {
+        if( (FWsamOptionField=(FWsamOptions *)malloc(sizeof(FWsamOptions)*FWsamMaxOptions)) == NULL )
+            FatalError("ERROR => [Alert_FWsam](AlertFWsamSetup) malloc failed for OptionField!\n");
+
+        fseek(fp,0,SEEK_SET);
+        for(cnt=0; cnt<FWsamMaxOptions; )
+        {
+            FWsamReadLine(buf,sizeof(buf),fp);
+
+            if( *buf )
+            {
+                FWsamOptionField[cnt].line=cnt;
+                FWsamParseLine(&(FWsamOptionField[cnt++]),buf);
+            }
+        }
+
+        FWsamIndexOptions(); /* sort them and index by gid and sid */
+    }
+
+    fclose(fp);
+    return TRUE;
+}
+
+/*  This sorts the option list read from the sid-block.map file by gid and
+ *  sid, and indexes it in a hash so a lookup takes the same time however
+ *  long the file is. If a sid is listed more than once, the first line wins.
+*/
+void FWsamIndexOptions(void)
+{
+    FWsamOptions *optp;
+    unsigned long i;
+    khiter_t k;
+    int ret;
+
+    qsort(FWsamOptionField,FWsamMaxOptions,sizeof(FWsamOptions),FWsamOptionCompare);
+
+    FWsamOptionIndex=kh_init(FWsamOptionMap);
+    kh_resize(FWsamOptionMap,FWsamOptionIndex,FWsamMaxOptions);
+
+    for(i=0;i<FWsamMaxOptions;i++)
+    {
+        optp=&(FWsamOptionField[i]);
+        if(!optp->sid)      /* nothing usable on that line */
+            continue;
+
+        k=kh_put(FWsamOptionMap,FWsamOptionIndex,FWSAM_OPTION_KEY(optp->gid,optp->sid),&ret);
+        if(ret<0)
+            FatalError("ERROR => [Alert_FWsam](AlertFWsamSetup) malloc failed for option index!\n");
+        if(!ret)
+            LogMessage("WARNING => [Alert_FWsam](AlertFWsamSetup) sid %lu:%lu listed more than once, using the first.\n",optp->gid,optp->sid);
+        else
+            kh_value(FWsamOptionIndex,k)=optp;
+    }
+}
+
+
 /*  This routing will search the option list as defined
  *  by the sid-block.map file and return a pointer
- *  to the matching record.
+ *  to the matching record. Lines with a gid take precedence
+ *  over lines for the sid of any gid.
 */
-FWsamOptions *FWsamGetOption(unsigned long sid)
+FWsamOptions *FWsamGetOption(unsigned long gid,unsigned long sid)
+{
+    khiter_t k;
+
+    if(FWsamOptionIndex==NULL)
+        return NULL;
+
+    k=kh_get(FWsamOptionMap,FWsamOptionIndex,FWSAM_OPTION_KEY(gid,sid));
+    if(k==kh_end(FWsamOptionIndex))
+        k=kh_get(FWsamOptionMap,FWsamOptionIndex,FWSAM_OPTION_KEY(0,sid));
+
+    return (k==kh_end(FWsamOptionIndex)) ? NULL : kh_value(FWsamOptionIndex,k);
+}
+
+
+#ifdef SUP_IP6
+#define FWSAM_KEY_ADDR(dst, ip)     memcpy((dst), (ip)->ip32, (ip)->family==AF_INET6 ? 16 : 4)
+#else
+#define FWSAM_KEY_ADDR(dst, ip)     ((dst)[0]=(u_int32_t)(ip))
+#endif
+
+/*  This checks if the same block was requested recently, in which case it
+ *  does not need to be sent again, and otherwise remembers it. The blocks
+ *  are kept in two hash tables, one for the current FWSAM_REPET_TIME window
+ *  and one for the previous one, so old blocks expire by clearing a table.
+ */
+int FWsamRepetitiveBlock(Packet *p, FWsamOptions *optp)
 {
-    signed long i,step,diff,o,o2;
+    FWsamBlockKey key;
+    khash_t(FWsamBlocks) *blocks;
+    unsigned long window;
+    time_t now;
+    khiter_t k;
+    int i,ret;
+
+    window=(optp->duration>FWSAM_REPET_TIME) ? FWSAM_REPET_TIME : optp->duration;
+    if(!window)                         /* permanent blocks are always sent */
+        return FALSE;
+
+    memset(&key,0,sizeof(key));
+    key.duration=optp->duration;
+    key.mode=optp->how|optp->who;
+    key.family=IS_IP6(p) ? 6 : 4;
+
+    if(optp->how==FWSAM_HOW_THIS)       /* if blocking mode SERVICE, check for src and dst */
+    {
+        FWSAM_KEY_ADDR(key.srcip,GET_SRC_IP(p));
+        FWSAM_KEY_ADDR(key.dstip,GET_DST_IP(p));
+        key.protocol=GET_IPH_PROTO(p);
+        if(IP_HAS_PORTS(p))             /* check port only of TCP or UDP */
+            key.dstport=p->dp;
+    }
+    else if(optp->who==FWSAM_WHO_SRC)   /* otherwise if we block source, only compare source. Same for dest. */
+        FWSAM_KEY_ADDR(key.srcip,GET_SRC_IP(p));
+    else
+        FWSAM_KEY_ADDR(key.dstip,GET_DST_IP(p));
 
-#ifdef FWSAM_FANCYFETCH       /* Fancy-fetch jumps in decreasing n/2 steps and takes much less lookups */
-    o=o2= -1;
-    i=step=FWsamMaxOptions>>1;
-    while(i>=0 && i<FWsamMaxOptions && i!=o2)
+    now=time(NULL);
+    if(!FWsamRecentBlocks[0])
     {
-        diff=sid-FWsamOptionField[i].sid;
-        if(!diff)
-            return &(FWsamOptionField[i]);
-        if(step>1)
-            step=step>>1;
-        o2=o;
-        o=i;
-        if(diff>0)
-            i+=step;
-        else
-            i-=step;
+        FWsamRecentBlocks[0]=kh_init(FWsamBlocks);
+        FWsamRecentBlocks[1]=kh_init(FWsamBlocks);
+        FWsamRecentStart=now;
     }
-#else                       /* This is just a sequential list lookup */
-    for(i=0;i<FWsamMaxOptions;i++)
-        if(FWsamOptionField[i].sid==sid)
-            return &(FWsamOptionField[i]);
+
+    if(now-FWsamRecentStart>=FWSAM_REPET_TIME)  /* start a new window, dropping the oldest */
+    {
+        blocks=FWsamRecentBlocks[1];
+        kh_clear(FWsamBlocks,blocks);
+        if(now-FWsamRecentStart>=2*FWSAM_REPET_TIME)
+            kh_clear(FWsamBlocks,FWsamRecentBlocks[0]);
+        FWsamRecentBlocks[1]=FWsamRecentBlocks[0];
+        FWsamRecentBlocks[0]=blocks;
+        FWsamRecentStart=now;
+    }
+
+    for(i=0;i<2;i++)
+    {
+        blocks=FWsamRecentBlocks[i];
+        k=kh_get(FWsamBlocks,blocks,key);
+        if(k!=kh_end(blocks) && now-kh_value(blocks,k)<(time_t)window)
+            return TRUE;
+    }
+
+    if(kh_size(FWsamRecentBlocks[0])<FWSAM_REPET_BLOCKS)
+    {
+        k=kh_put(FWsamBlocks,FWsamRecentBlocks[0],key,&ret);
+        if(ret>=0)
+            kh_value(FWsamRecentBlocks[0],k)=now;
+    }
+    return FALSE;
+}
+
+
+/*  Fills in a block request for the packet. The sequence numbers are
+ *  filled in when it is sent to a station.
+ */
+static void FWsamBuildBlock(FWsamPacket *sampacket,Packet *p,FWsamOptions *optp,uint32_t sig_id)
+{
+    memset(sampacket,0,sizeof(FWsamPacket));
+    sampacket->endiancheck=1;                        /* This is an endian indicator for Snortsam */
+    sampacket->status=FWSAM_STATUS_BLOCK;            /* set block mode */
+    sampacket->version=FWSAM_PACKETVERSION;          /* set packet version */
+    sampacket->duration[0]=(char)optp->duration;     /* set duration */
+    sampacket->duration[1]=(char)(optp->duration>>8);
+    sampacket->duration[2]=(char)(optp->duration>>16);
+    sampacket->duration[3]=(char)(optp->duration>>24);
+    sampacket->fwmode=optp->how|optp->who|optp->loglevel; /* set the mode */
+    sampacket->dstip[0]=(char)p->iph->ip_dst.s_addr; /* destination IP */
+    sampacket->dstip[1]=(char)(p->iph->ip_dst.s_addr>>8);
+    sampacket->dstip[2]=(char)(p->iph->ip_dst.s_addr>>16);
+    sampacket->dstip[3]=(char)(p->iph->ip_dst.s_addr>>24);
+    sampacket->srcip[0]=(char)p->iph->ip_src.s_addr; /* source IP */
+    sampacket->srcip[1]=(char)(p->iph->ip_src.s_addr>>8);
+    sampacket->srcip[2]=(char)(p->iph->ip_src.s_addr>>16);
+    sampacket->srcip[3]=(char)(p->iph->ip_src.s_addr>>24);
+    sampacket->protocol[0]=(char)p->iph->ip_proto;   /* protocol */
+    sampacket->protocol[1]=(char)(p->iph->ip_proto>>8);/* protocol */
+
+    if(IP_HAS_PORTS(p))
+    {   sampacket->srcport[0]=(char)p->sp;   /* set ports */
+        sampacket->srcport[1]=(char)(p->sp>>8);
+        sampacket->dstport[0]=(char)p->dp;
+        sampacket->dstport[1]=(char)(p->dp>>8);
+    }
+
+    sampacket->sig_id[0]=(char)sig_id;        /* set signature ID */
+    sampacket->sig_id[1]=(char)(sig_id>>8);
+    sampacket->sig_id[2]=(char)(sig_id>>16);
+    sampacket->sig_id[3]=(char)(sig_id>>24);
+}
+
+
+/*  Queues a block request for a station. If too many are waiting
+ *  already, the new one is dropped.
+ */
+void FWsamQueueBlock(FWsamStation *station,FWsamPacket *packet)
+{
+    FWsamRequest *req;
+
+    if(station->queue==NULL)
+    {
+        if((station->queue=(FWsamRequest *)malloc(sizeof(FWsamRequest)*FWSAM_QUEUE_MAX))==NULL)
+            FatalError("ERROR => [Alert_FWsam] malloc failed for request queue!\n");
+    }
+
+    if(station->queuelen>=FWSAM_QUEUE_MAX)
+    {
+        if(!station->dropped++)
+            ErrorMessage("WARNING => [Alert_FWsam] Too many blocks pending for host %s, dropping new ones.\n",sfip_ntoa(&station->stationip));
+        return;
+    }
+
+    req=&(station->queue[(station->queuehead+station->queuelen)%FWSAM_QUEUE_MAX]);
+    memcpy(&req->packet,packet,sizeof(FWsamPacket));
+    req->tries=0;
+    req->checkedin=FALSE;
+    station->queuelen++;
+}
+
+
+static u_int64_t FWsamNow(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (u_int64_t)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
+static void FWsamDisconnect(FWsamStation *station)
+{
+    if(station->stationsocket!=INVALID_SOCKET)
+    {
+#ifdef WIN32
+        closesocket(station->stationsocket);
+#else
+        close(station->stationsocket);
+#endif
+    }
+    station->stationsocket=INVALID_SOCKET;
+    station->state=FWSAM_STATE_IDLE;
+    station->served=0;
+    station->replylen=0;
+}
+
+static void FWsamRequestDone(FWsamStation *station)
+{
+    station->queuehead=(station->queuehead+1)%FWSAM_QUEUE_MAX;
+    station->queuelen--;
+}
+
+/*  Something is wrong with the station that retrying won't fix,
+ *  so we ignore it from now on.
+ */
+static void FWsamIgnoreStation(FWsamStation *station)
+{
+    FWsamDisconnect(station);
+    station->queuelen=0;
+    station->stationip.ip32[0]=0;
+}
+
+/*  The station could not be reached. Its requests stay queued and
+ *  we try again after a delay that grows while it stays unreachable.
+ */
+static void FWsamUnreachable(FWsamStation *station)
+{
+    FWsamDisconnect(station);
+
+    if(!station->retrydelay)
+    {
+        LogMessage("WARNING => [Alert_FWsam] Could not connect to host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
+        station->retrydelay=FWSAM_RETRY_MIN;
+    }
+    else if((station->retrydelay*=2)>FWSAM_RETRY_MAX)
+        station->retrydelay=FWSAM_RETRY_MAX;
+
+    station->retrytime=FWsamNow()+station->retrydelay;
+}
+
+/*  Sending the request at the head of the queue, or getting the response
+ *  to it, failed. If the connection was kept open from an earlier request,
+ *  the agent has most likely closed it in the meantime and we just send it
+ *  again on a new one. Otherwise the request is given up after a few tries.
+ */
+static void FWsamRequestFailed(FWsamStation *station,const char *what)
+{
+    FWsamRequest *req=&(station->queue[station->queuehead]);
+
+    if(station->served)
+    {
+        station->myseqno-=station->stationseqno;    /* the agent never saw it */
+        FWsamDisconnect(station);
+        return;
+    }
+
+    LogMessage("WARNING => [Alert_FWsam] %s host %s. Will try again later.\n",what,sfip_ntoa(&station->stationip));
+    FWsamDisconnect(station);
+
+    if(++req->tries>=FWSAM_MAX_TRIES)
+    {
+        FWsamRequestDone(station);
+        station->dropped++;
+    }
+    station->retrytime=FWsamNow()+FWSAM_RETRY_MIN;
+}
+
+/*  Starts connecting to the station without waiting for it.
+ */
+static void FWsamConnect(FWsamStation *station)
+{
+    int on=1;
+
+    station->stationsocket=socket(PF_INET,SOCK_STREAM,IPPROTO_TCP);
+    if(station->stationsocket==INVALID_SOCKET)
+        FatalError("ERROR => [Alert_FWsam] Funky socket error (socket)!\n");
+    if(bind(station->stationsocket,(struct sockaddr *)&(station->localsocketaddr),sizeof(struct sockaddr)))
+        FatalError("ERROR => [Alert_FWsam] Could not bind socket!\n");
+
+#ifdef WIN32
+    ioctlsocket(station->stationsocket,FIONBIO,&on);
+#else
+    ioctl(station->stationsocket,FIONBIO,&on);
+#endif
+
+    station->state=FWSAM_STATE_CONNECTING;
+    station->deadline=FWsamNow()+FWSAM_NETWAIT*10;
+
+    if(connect(station->stationsocket,(struct sockaddr *)&station->stationsocketaddr,sizeof(struct sockaddr)) &&
+       errno!=EINPROGRESS)
+        FWsamUnreachable(station);
+}
+
+/*  Checks if a connection kept open from an earlier request is still
+ *  usable, i.e. the agent has neither closed it nor sent anything.
+ */
+static int FWsamConnectionUsable(FWsamStation *station)
+{
+    char c;
+
+    return recv(station->stationsocket,&c,1,MSG_PEEK)<0 && (errno==EAGAIN || errno==EWOULDBLOCK);
+}
+
+/*  Sends the request at the head of the queue with the current
+ *  sequence numbers and key.
+ */
+static void FWsamSendBlock(FWsamStation *station)
+{
+    FWsamPacket sampacket;
+    char encbuf[sizeof(FWsamPacket)+2*TwoFish_BLOCK_SIZE];
+    char *encp=encbuf;
+    int len;
+
+    memcpy(&sampacket,&(station->queue[station->queuehead].packet),sizeof(FWsamPacket));
+
+    station->myseqno+=station->stationseqno; /* increase my seqno by adding agent seq no */
+    sampacket.snortseqno[0]=(char)station->myseqno;
+    sampacket.snortseqno[1]=(char)(station->myseqno>>8);
+    sampacket.fwseqno[0]=(char)station->stationseqno;/* fill station seqno */
+    sampacket.fwseqno[1]=(char)(station->stationseqno>>8);
+
+#ifdef FWSAMDEBUG
+    LogMessage("DEBUG => [Alert_FWsam] Sending BLOCK to host %s\n",sfip_ntoa(&station->stationip));
+    LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",station->myseqno);
+    LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
+#endif
+
+    len=TwoFishEncrypt((char *)&sampacket,&encp,sizeof(FWsamPacket),FALSE,station->stationfish); /* encrypt the packet with current key */
+
+    if(send(station->stationsocket,encbuf,len,MSG_NOSIGNAL)!=len) /* weird...could not send */
+    {
+        FWsamRequestFailed(station,"Could not send to");
+        return;
+    }
+
+    station->state=FWSAM_STATE_WAITING;
+    station->deadline=FWsamNow()+FWSAM_NETWAIT*10;
+    station->replylen=0;
+}
+
+/*  Handles the response to the request at the head of the queue.
+ */
+static void FWsamProcessReply(FWsamStation *station)
+{
+    FWsamPacket sampacket;
+    FWsamRequest *req=&(station->queue[station->queuehead]);
+    char *decbuf=(char *)&sampacket; /* get the pointer to the packet struct */
+    int len,hold=(station->state==FWSAM_STATE_HOLD);
+
+    station->replylen=0;
+    len=TwoFishDecrypt(station->replybuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try to decrypt the packet with current key */
+
+    if(len!=sizeof(FWsamPacket)) /* invalid decryption */
+    {   strcpy(station->stationkey,station->initialkey); /* try the intial key */
+        TwoFishDestroy(station->stationfish);
+        station->stationfish=TwoFishInit(station->stationkey); /* re-initialize the TwoFish with the intial key */
+        len=TwoFishDecrypt(station->replybuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try again to decrypt */
+        LogMessage("INFO => [Alert_FWsam] Had to use initial key!\n");
+    }
+
+    if(len!=sizeof(FWsamPacket)) /* if the intial key failed to decrypt as well, the keys are not configured the same, and we ignore that SnortSam station. */
+    {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+        FWsamIgnoreStation(station);
+        return;
+    }
+
+#ifdef FWSAMDEBUG
+    LogMessage("DEBUG => [Alert_FWsam] Received %s\n",sampacket.status==FWSAM_STATUS_OK?"OK":
+                                               sampacket.status==FWSAM_STATUS_NEWKEY?"NEWKEY":
+                                               sampacket.status==FWSAM_STATUS_RESYNC?"RESYNC":
+                                               sampacket.status==FWSAM_STATUS_HOLD?"HOLD":"ERROR");
+    LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",sampacket.snortseqno[0]|(sampacket.snortseqno[1]<<8));
+    LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",sampacket.fwseqno[0]|(sampacket.fwseqno[1]<<8));
+    LogMessage("DEBUG => [Alert_FWsam] Status     :  %i\n",sampacket.status);
+    LogMessage("DEBUG => [Alert_FWsam] Version    :  %i\n",sampacket.version);
 #endif
-    return NULL;
+
+    if(sampacket.version!=FWSAM_PACKETVERSION) /* if the SnortSam agent uses a different packet version, we have no choice but to ignore it. */
+    {   ErrorMessage("ERROR => [Alert_FWsam] Protocol version error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+        FWsamIgnoreStation(station);
+        return;
+    }
+
+    if(!hold && (sampacket.status==FWSAM_STATUS_OK || sampacket.status==FWSAM_STATUS_NEWKEY
+       || sampacket.status==FWSAM_STATUS_RESYNC || sampacket.status==FWSAM_STATUS_HOLD))
+    {   station->stationseqno=sampacket.fwseqno[0] | (sampacket.fwseqno[1]<<8); /* get stations seqno */
+        station->lastcontact=(unsigned long)time(NULL); /* set the last contact time (not used yet) */
+
+        if(sampacket.status==FWSAM_STATUS_HOLD)
+        {   station->state=FWSAM_STATE_HOLD;    /* Stay on hold for a maximum of 60 secs (default) */
+            station->deadline=FWsamNow()+FWSAM_NETHOLD*10;
+            return;
+        }
+    }
+
+    if(sampacket.status==FWSAM_STATUS_OK || sampacket.status==FWSAM_STATUS_NEWKEY || sampacket.status==FWSAM_STATUS_RESYNC)
+    {
+        if(sampacket.status==FWSAM_STATUS_RESYNC)  /* if station want's to resync... */
+        {   strcpy(station->stationkey,station->initialkey); /* ...we use the intial key... */
+            memcpy(station->fwkeymod,sampacket.duration,4);  /* and note the random key modifier */
+        }
+        if(sampacket.status==FWSAM_STATUS_NEWKEY || sampacket.status==FWSAM_STATUS_RESYNC)
+        {
+            FWsamNewStationKey(station,&sampacket); /* generate new TwoFish keys */
+#ifdef FWSAMDEBUG
+            LogMessage("DEBUG => [Alert_FWsam] Generated new encryption key...\n");
+#endif
+        }
+
+        FWsamRequestDone(station);
+        station->served++;
+        station->state=FWSAM_STATE_IDLE;
+    }
+    else if(!hold && sampacket.status==FWSAM_STATUS_ERROR) /* if SnortSam reports an error on second try, */
+    {
+        FWsamDisconnect(station);                   /* something is messed up and ... */
+        if(req->checkedin)                          /* we ignore that station. */
+        {   ErrorMessage("ERROR => [Alert_FWsam] Could not renegotiate key! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+            FWsamIgnoreStation(station);
+        }
+        else                                        /* if we get an error on the first try, */
+        {   if(!FWsamCheckIn(station))              /* we first try to check in again. */
+            {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+                FWsamIgnoreStation(station);
+            }
+            else
+                req->checkedin=TRUE;
+        }
+    }
+    else /* an unknown status means trouble... */
+    {   ErrorMessage("ERROR => [Alert_FWsam] Funky handshake error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
+        FWsamIgnoreStation(station);
+    }
+}
+
+
+/*  Moves the requests of a station along as far as it is possible
+ *  without waiting for the network.
+ */
+void FWsamPump(FWsamStation *station)
+{
+    struct pollfd pfd;
+    socklen_t errlen;
+    int err;
+    ssize_t len;
+
+    while(station->stationip.ip32[0])
+    {
+        switch(station->state)
+        {
+            case FWSAM_STATE_IDLE:
+                if(!station->queuelen || FWsamNow()<station->retrytime)
+                    return;
+
+                if(station->stationsocket!=INVALID_SOCKET && !FWsamConnectionUsable(station))
+                    FWsamDisconnect(station);
+
+                if(station->stationsocket==INVALID_SOCKET)
+                    FWsamConnect(station);
+                else
+                    FWsamSendBlock(station);
+                break;
+
+            case FWSAM_STATE_CONNECTING:
+                pfd.fd=station->stationsocket;
+                pfd.events=POLLOUT;
+                if(poll(&pfd,1,0)<1)
+                {
+                    if(FWsamNow()>=station->deadline)
+                        FWsamUnreachable(station);
+                    return;
+                }
+
+                errlen=sizeof(err);
+                if(getsockopt(station->stationsocket,SOL_SOCKET,SO_ERROR,&err,&errlen) || err)
+                {
+                    FWsamUnreachable(station);
+                    return;
+                }
+
+                if(station->retrydelay)
+                {
+                    LogMessage("INFO => [Alert_FWsam] Connected to host %s again.\n",sfip_ntoa(&station->stationip));
+                    station->retrydelay=0;
+                }
+                FWsamSendBlock(station);
+                break;
+
+            case FWSAM_STATE_WAITING:
+            case FWSAM_STATE_HOLD:
+                len=recv(station->stationsocket,station->replybuf+station->replylen,
+                         sizeof(station->replybuf)-station->replylen,0);
+                if(len>0)
+                {
+                    if((station->replylen+=len)==sizeof(station->replybuf))
+                        FWsamProcessReply(station);
+                    break;
+                }
+
+                if(len==0 || (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) ||
+                   FWsamNow()>=station->deadline)
+                    FWsamRequestFailed(station,"Did not receive response from");
+                else
+                    return;
+                break;
+        }
+    }
+}
+
+
+/*  Waits for the pending requests of all stations that can currently be
+ *  reached, up to the deadline or, without one, until we are told to exit.
+ */
+void FWsamDrain(time_t deadline)
+{
+    FWsamList *list;
+    FWsamStation *station;
+    struct pollfd *pfds;
+    int npfds;
+
+    for(npfds=1,list=FWsamStationList; list; list=list->next)
+        npfds++;
+
+    if((pfds=(struct pollfd *)calloc(npfds,sizeof(struct pollfd)))==NULL)
+        FatalError("ERROR => [Alert_FWsam] malloc failed for poll list!\n");
+
+    while(1)
+    {
+        for(npfds=0,list=FWsamStationList; list; list=list->next)
+        {
+            station=list->station;
+            if(station==NULL)
+                continue;
+
+            FWsamPump(station);
+
+            /* an idle station with requests left is waiting to retry */
+            if(!station->stationip.ip32[0] || !station->queuelen || station->state==FWSAM_STATE_IDLE)
+                continue;
+
+            pfds[npfds].fd=station->stationsocket;
+            pfds[npfds].events=(station->state==FWSAM_STATE_CONNECTING) ? POLLOUT : POLLIN;
+            npfds++;
+        }
+
+        if(!npfds || (deadline && time(NULL)>=deadline) || (!deadline && exit_signal))
+            break;
+
+        poll(pfds,npfds,100);
+    }
+
+    free(pfds);
+}
+
+
+void AlertFWsamIdleFunc(int signal, void *arg)
+{
+    FWsamList *list;
+
+    for(list=FWsamStationList; list; list=list->next)
+        if(list->station)
+            FWsamPump(list->station);
 }
 
 
@@ -950,7 +1618,8 @@ FWsamOptions *FWsamGetOption(unsigned long sid)
  *
  * Function: AlertFWsam(Packet *, char *)
  *
- * Purpose: Send the current alert to a remote module on a FW-1 mgmt station
+ * Purpose: Queue the block for the current alert to the remote modules on
+ *          the FW-1 mgmt stations and send what can be sent without waiting
  *
  * Arguments: p => pointer to the packet data struct
  *            msg => the message to print in the alert
@@ -964,19 +1633,6 @@ void AlertFWsam(Packet *p, void *event, uint32_t event_type, void *arg)
     FWsamPacket sampacket;
     FWsamStation *station=NULL;
     FWsamList *fwsamlist;
-    SOCKET stationsocket;
-    int i,len,deletestation,stationtry=0;
-    char *encbuf,*decbuf;
-    static unsigned long lastbsip[FWSAM_REPET_BLOCKS];
-    static unsigned long lastbdip[FWSAM_REPET_BLOCKS];
-    static unsigned long lastbduration[FWSAM_REPET_BLOCKS];
-    static unsigned long lastbtime[FWSAM_REPET_BLOCKS];
-    static unsigned short lastbsp[FWSAM_REPET_BLOCKS];
-    static unsigned short lastbdp[FWSAM_REPET_BLOCKS];
-    static unsigned short lastbproto[FWSAM_REPET_BLOCKS];
-    static unsigned short lastbpointer;
-    static unsigned char lastbmode[FWSAM_REPET_BLOCKS];
-    static unsigned long btime=0;
 
     SigNode     *sn = NULL;
     ClassType   *cn = NULL;
@@ -1010,8 +1666,8 @@ void AlertFWsam(Packet *p, void *event, uint32_t event_type, void *arg)
         return;
     }
 
-    /* SnortSam does no IPv6 */
-    if (!IS_IP4(p)) {
+    /* SnortSam does no IPv6, and there is nothing to block without an IP header */
+    if (!IPH_IS_VALID(p) || !IS_IP4(p)) {
 #ifdef FWSAMDEBUG
         LogMessage("DEBUG => [Alert_FWsam] not acting on non-IP4 packet!\n");
 #endif
@@ -1022,23 +1678,15 @@ void AlertFWsam(Packet *p, void *event, uint32_t event_type, void *arg)
     sn = GetSigByGidSid(ntohl(((Unified2EventCommon *)event)->generator_id),
                         ntohl(((Unified2EventCommon *)event)->signature_id),
 			ntohl(((Unified2EventCommon *)event)->signature_revision));
-    
+
     cn = ClassTypeLookupById(barnyard2_conf, ntohl(((Unified2EventCommon *)event)->classification_id));
 
     if(FWsamOptionField)            /* If using the file (field present), let's use that */
-        optp=FWsamGetOption(ntohl(((Unified2EventCommon *)event)->signature_id));
+        optp=FWsamGetOption(ntohl(((Unified2EventCommon *)event)->generator_id),
+                            ntohl(((Unified2EventCommon *)event)->signature_id));
 
     if(optp)    /* if options specified for this rule */
     {
-        if(!btime)          /* if this is the first time this function is */
-        {
-            for(i=0;i<FWSAM_REPET_BLOCKS;i++)   /*  called, reset the time and protocol to 0. */
-            {
-                lastbproto[i]=0;
-                lastbtime[i]=0;
-            }
-        }
-
         fwsamlist=(FWsamList *)arg;
 
 #ifdef FWSAMDEBUG
@@ -1046,340 +1694,43 @@ void AlertFWsam(Packet *p, void *event, uint32_t event_type, void *arg)
         LogMessage("DEBUG => [Alert_FWsam] Alert -> Option: %s[%s],%lu.\n",(optp->who==FWSAM_WHO_SRC)?"src":"dst",(optp->how==FWSAM_HOW_IN)?"in":((optp->how==FWSAM_HOW_OUT)?"out":"either"),optp->duration);
 #endif
 
-        len=TRUE;
-        btime=(unsigned long)time(NULL);    /* get current time */
         /* This is a cheap check to see if the blocking request matches any of the previous requests. */
-        for(i=0; i<FWSAM_REPET_BLOCKS && len; i++)
-        {
-            if( ( ( optp->how==FWSAM_HOW_THIS ) ?   /* if blocking mode SERVICE, check for src and dst    */
-		  ( lastbsip[i]==(unsigned long)GET_SRC_IP(p) && lastbdip[i]==(unsigned long)GET_DST_IP(p) && lastbproto[i]==GET_IPH_PROTO(p) &&
-		    ( IP_HAS_PORTS(p) ? /* check port only of TCP or UDP */
-/*                  ((optp->who==FWSAM_WHO_SRC)?(lastbsp[i]==record->sp):(lastbdp[i]==record->dp)):TRUE) ): */
-                        lastbdp[i]==p->dp : TRUE
-                      )
-                    ) :
-                    (
-                      ( optp->who==FWSAM_WHO_SRC) ?
-		      ( lastbsip[i]==(unsigned long)GET_SRC_IP(p) ) :
-		      ( lastbdip[i]==(unsigned long)GET_DST_IP(p) )
-                    )
-                 ) && /* otherwise if we block source, only compare source. Same for dest. */
-                 lastbduration[i]==optp->duration &&
-                 (lastbmode[i] & (FWSAM_HOW|FWSAM_WHO))==(optp->how|optp->who) &&
-                 ( btime-lastbtime[i]<((optp->duration>FWSAM_REPET_TIME) ? FWSAM_REPET_TIME : optp->duration))
-               )
-            {
-                len=FALSE;      /* If so, we don't need to block again. */
-            }
-        }
-
-        if(len)
+        if(FWsamRepetitiveBlock(p,optp))
         {
-            if(++lastbpointer>=FWSAM_REPET_BLOCKS)      /* increase repetitive check pointer */
-                lastbpointer=0;
-
-            lastbsip[lastbpointer]=(unsigned long)GET_SRC_IP(p);     /* and note packet details */
-            lastbdip[lastbpointer]=(unsigned long)GET_DST_IP(p);
-            lastbduration[lastbpointer]=optp->duration;
-            lastbmode[lastbpointer]=optp->how|optp->who|optp->loglevel;
-            lastbproto[lastbpointer]=GET_IPH_PROTO(p);
-            if(IP_HAS_PORTS(p))
-            {
-                lastbsp[lastbpointer]=p->sp;                   /* set ports if TCP or UDP */
-                lastbdp[lastbpointer]=p->dp;
-            }
-            lastbtime[lastbpointer]=btime;
-
-
-            while(fwsamlist!=NULL)
-            {
-                station=fwsamlist->station;
-                //if(station->stationip.s_addr)
-                if(station->stationip.ip32[0])
-                {
-                    deletestation=FALSE;
-                    stationtry++;               /* first try */
-                    /* create a socket for the station */
-                    stationsocket=socket(PF_INET,SOCK_STREAM,IPPROTO_TCP);
-                    if(stationsocket==INVALID_SOCKET)
-                        FatalError("ERROR => [Alert_FWsam] Funky socket error (socket)!\n");
-                    if(bind(stationsocket,(struct sockaddr *)&(station->localsocketaddr),sizeof(struct sockaddr)))
-                        FatalError("ERROR => [Alert_FWsam] Could not bind socket!\n");
-
-                    /* let's connect to the agent */
-                    if(connect(stationsocket,(struct sockaddr *)&station->stationsocketaddr,sizeof(struct sockaddr)))
-                    {
-                        LogMessage("WARNING => [Alert_FWsam] Could not send block to host %s. Will try later.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                        closesocket(stationsocket);
-#else
-                        close(stationsocket);
-#endif
-                        stationtry=0;
-                    }
-                    else
-                    {
 #ifdef FWSAMDEBUG
-                        LogMessage("DEBUG => [Alert_FWsam] Connected to host %s.\n",sfip_ntoa(&station->stationip));
+            LogMessage("DEBUG => [Alert_FWsam] Skipping repetitive block.\n");
 #endif
-                        /* now build the packet */
-                        station->myseqno+=station->stationseqno; /* increase my seqno by adding agent seq no */
-                        sampacket.endiancheck=1;                        /* This is an endian indicator for Snortsam */
-                        sampacket.snortseqno[0]=(char)station->myseqno;
-                        sampacket.snortseqno[1]=(char)(station->myseqno>>8);
-                        sampacket.fwseqno[0]=(char)station->stationseqno;/* fill station seqno */
-                        sampacket.fwseqno[1]=(char)(station->stationseqno>>8);
-                        sampacket.status=FWSAM_STATUS_BLOCK;            /* set block mode */
-                        sampacket.version=FWSAM_PACKETVERSION;          /* set packet version */
-                        sampacket.duration[0]=(char)optp->duration;     /* set duration */
-                        sampacket.duration[1]=(char)(optp->duration>>8);
-                        sampacket.duration[2]=(char)(optp->duration>>16);
-                        sampacket.duration[3]=(char)(optp->duration>>24);
-                        sampacket.fwmode=optp->how|optp->who|optp->loglevel; /* set the mode */
-                        sampacket.dstip[0]=(char)p->iph->ip_dst.s_addr; /* destination IP */
-                        sampacket.dstip[1]=(char)(p->iph->ip_dst.s_addr>>8);
-                        sampacket.dstip[2]=(char)(p->iph->ip_dst.s_addr>>16);
-                        sampacket.dstip[3]=(char)(p->iph->ip_dst.s_addr>>24);
-                        sampacket.srcip[0]=(char)p->iph->ip_src.s_addr; /* source IP */
-                        sampacket.srcip[1]=(char)(p->iph->ip_src.s_addr>>8);
-                        sampacket.srcip[2]=(char)(p->iph->ip_src.s_addr>>16);
-                        sampacket.srcip[3]=(char)(p->iph->ip_src.s_addr>>24);
-                        sampacket.protocol[0]=(char)p->iph->ip_proto;   /* protocol */
-                        sampacket.protocol[1]=(char)(p->iph->ip_proto>>8);/* protocol */
-
-                        if(IP_HAS_PORTS(p))
-                        {   sampacket.srcport[0]=(char)p->sp;   /* set ports */
-                            sampacket.srcport[1]=(char)(p->sp>>8);
-                            sampacket.dstport[0]=(char)p->dp;
-                            sampacket.dstport[1]=(char)(p->dp>>8);
-                        }
-                        else
-                            sampacket.srcport[0]=sampacket.srcport[1]=sampacket.dstport[0]=sampacket.dstport[1]=0;
+            return;
+        }
 
-                        uint32_t sig_id = ntohl(((Unified2EventCommon *)event)->signature_id);
-                        sampacket.sig_id[0]=(char)sig_id;        /* set signature ID */
-                        sampacket.sig_id[1]=(char)(sig_id>>8);
-                        sampacket.sig_id[2]=(char)(sig_id>>16);
-                        sampacket.sig_id[3]=(char)(sig_id>>24);
+        FWsamBuildBlock(&sampacket,p,optp,ntohl(((Unified2EventCommon *)event)->signature_id));
 
 #ifdef FWSAMDEBUG
-                        LogMessage("DEBUG => [Alert_FWsam] Sending BLOCK\n");
-                        LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",station->myseqno);
-                        LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
-                        LogMessage("DEBUG => [Alert_FWsam] Status     :  %i\n",FWSAM_STATUS_BLOCK);
-                        LogMessage("DEBUG => [Alert_FWsam] Mode       :  %i\n",optp->how|optp->who|optp->loglevel);
-                        LogMessage("DEBUG => [Alert_FWsam] Duration   :  %li\n",optp->duration);
-                        LogMessage("DEBUG => [Alert_FWsam] Protocol   :  %i\n",GET_IPH_PROTO(p));
+        LogMessage("DEBUG => [Alert_FWsam] Queueing BLOCK\n");
+        LogMessage("DEBUG => [Alert_FWsam] Mode       :  %i\n",optp->how|optp->who|optp->loglevel);
+        LogMessage("DEBUG => [Alert_FWsam] Duration   :  %li\n",optp->duration);
+        LogMessage("DEBUG => [Alert_FWsam] Protocol   :  %i\n",GET_IPH_PROTO(p));
 #ifdef SUP_IP6
-                        LogMessage("DEBUG => [Alert_FWsam] Src IP     :  %s\n",sfip_ntoa(GET_SRC_IP(p)));
-                        LogMessage("DEBUG => [Alert_FWsam] Dest IP    :  %s\n",sfip_ntoa(GET_DST_IP(p)));
+        LogMessage("DEBUG => [Alert_FWsam] Src IP     :  %s\n",sfip_ntoa(GET_SRC_IP(p)));
+        LogMessage("DEBUG => [Alert_FWsam] Dest IP    :  %s\n",sfip_ntoa(GET_DST_IP(p)));
 #else
-                        LogMessage("DEBUG => [Alert_FWsam] Src IP     :  %s\n",inet_ntoa(GET_SRC_ADDR(p)));
-                        LogMessage("DEBUG => [Alert_FWsam] Dest IP    :  %s\n",inet_ntoa(GET_DST_ADDR(p)));
+        LogMessage("DEBUG => [Alert_FWsam] Src IP     :  %s\n",inet_ntoa(GET_SRC_ADDR(p)));
+        LogMessage("DEBUG => [Alert_FWsam] Dest IP    :  %s\n",inet_ntoa(GET_DST_ADDR(p)));
 #endif
-                        LogMessage("DEBUG => [Alert_FWsam] Src Port   :  %i\n",p->sp);
-                        LogMessage("DEBUG => [Alert_FWsam] Dest Port  :  %i\n",p->dp);
-                        LogMessage("DEBUG => [Alert_FWsam] Sig_ID     :  %lu\n",ntohl(((Unified2EventCommon *)event)->signature_id));
-
+        LogMessage("DEBUG => [Alert_FWsam] Src Port   :  %i\n",p->sp);
+        LogMessage("DEBUG => [Alert_FWsam] Dest Port  :  %i\n",p->dp);
+        LogMessage("DEBUG => [Alert_FWsam] Sig_ID     :  %lu\n",ntohl(((Unified2EventCommon *)event)->signature_id));
 #endif
 
-                        encbuf=TwoFishAlloc(sizeof(FWsamPacket),FALSE,FALSE,station->stationfish); /* get the encryption buffer */
-                        len=TwoFishEncrypt((char *)&sampacket,&encbuf,sizeof(FWsamPacket),FALSE,station->stationfish); /* encrypt the packet with current key */
-
-                        if(send(stationsocket,encbuf,len,0)!=len) /* weird...could not send */
-                        {   LogMessage("WARNING => [Alert_FWsam] Could not send to host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                            closesocket(stationsocket);
-#else
-                            close(stationsocket);
-#endif
-                            stationtry=0;
-                        }
-                        else
-                        {   i=FWSAM_NETWAIT;
-#ifdef WIN32
-                            ioctlsocket(stationsocket,FIONBIO,&i);  /* set non blocking and wait for  */
-#else
-                            ioctl(stationsocket,FIONBIO,&i);        /* set non blocking and wait for  */
-#endif
-                            while(i-- >1)                           /* the response packet   */
-                            {   waitms(10); /* wait for response (default maximum 3 secs */
-                                if(recv(stationsocket,encbuf,len,0)==len)
-                                    i=0; /* if we received packet we set the counter to 0. */
-                                         /* by the time we check with if, it's already dec'ed to -1 */
-                            }
-                            if(!i) /* id we timed out (i was one, then dec'ed)... */
-                            {   LogMessage("WARNING => [Alert_FWsam] Did not receive response from host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                closesocket(stationsocket);
-#else
-                                close(stationsocket);
-#endif
-                                stationtry=0;
-                            }
-                            else /* got a packet */
-                            {   decbuf=(char *)&sampacket; /* get the pointer to the packet struct */
-                                len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try to decrypt the packet with current key */
-
-                                if(len!=sizeof(FWsamPacket)) /* invalid decryption */
-                                {   strcpy(station->stationkey,station->initialkey); /* try the intial key */
-                                    TwoFishDestroy(station->stationfish);
-                                    station->stationfish=TwoFishInit(station->stationkey); /* re-initialize the TwoFish with the intial key */
-                                    len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try again to decrypt */
-                                    LogMessage("INFO => [Alert_FWsam] Had to use initial key!\n");
-                                }
-                                if(len==sizeof(FWsamPacket)) /* valid decryption */
-                                {   if(sampacket.version==FWSAM_PACKETVERSION)/* master speaks my language */
-                                    {   if(sampacket.status==FWSAM_STATUS_OK || sampacket.status==FWSAM_STATUS_NEWKEY
-                                        || sampacket.status==FWSAM_STATUS_RESYNC || sampacket.status==FWSAM_STATUS_HOLD)
-                                        {   station->stationseqno=sampacket.fwseqno[0] | (sampacket.fwseqno[1]<<8); /* get stations seqno */
-                                            station->lastcontact=(unsigned long)time(NULL); /* set the last contact time (not used yet) */
-#ifdef FWSAMDEBUG
-                                    LogMessage("DEBUG => [Alert_FWsam] Received %s\n",sampacket.status==FWSAM_STATUS_OK?"OK":
-                                                                           sampacket.status==FWSAM_STATUS_NEWKEY?"NEWKEY":
-                                                                           sampacket.status==FWSAM_STATUS_RESYNC?"RESYNC":
-                                                                           sampacket.status==FWSAM_STATUS_HOLD?"HOLD":"ERROR");
-                                    LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",sampacket.snortseqno[0]|(sampacket.snortseqno[1]<<8));
-                                    LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
-                                    LogMessage("DEBUG => [Alert_FWsam] Status     :  %i\n",sampacket.status);
-                                    LogMessage("DEBUG => [Alert_FWsam] Version    :  %i\n",sampacket.version);
-#endif
-                                            if(sampacket.status==FWSAM_STATUS_HOLD)
-                                            {   i=FWSAM_NETHOLD;            /* Stay on hold for a maximum of 60 secs (default) */
-                                                while(i-- >1)                           /* the response packet   */
-                                                {   waitms(10); /* wait for response  */
-                                                    if(recv(stationsocket,encbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,0)==sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE)
-                                                      i=0; /* if we received packet we set the counter to 0. */
-                                                }
-                                                if(!i) /* id we timed out (i was one, then dec'ed)... */
-                                                {   LogMessage("WARNING => [Alert_FWsam] Did not receive response from host %s. Will try again later.\n",sfip_ntoa(&station->stationip));
-                                                    stationtry=0;
-                                                    sampacket.status=FWSAM_STATUS_ERROR;
-                                                }
-                                                else /* got a packet */
-                                                {   decbuf=(char *)&sampacket; /* get the pointer to the packet struct */
-                                                    len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try to decrypt the packet with current key */
-
-                                                    if(len!=sizeof(FWsamPacket)) /* invalid decryption */
-                                                    {   strcpy(station->stationkey,station->initialkey); /* try the intial key */
-                                                        TwoFishDestroy(station->stationfish);
-                                                        station->stationfish=TwoFishInit(station->stationkey); /* re-initialize the TwoFish with the intial key */
-                                                        len=TwoFishDecrypt(encbuf,&decbuf,sizeof(FWsamPacket)+TwoFish_BLOCK_SIZE,FALSE,station->stationfish); /* try again to decrypt */
-                                                        LogMessage("INFO => [Alert_FWsam] Had to use initial key again!\n");
-                                                    }
-#ifdef FWSAMDEBUG
-                                    LogMessage("DEBUG => [Alert_FWsam] Received %s\n",sampacket.status==FWSAM_STATUS_OK?"OK":
-                                                                           sampacket.status==FWSAM_STATUS_NEWKEY?"NEWKEY":
-                                                                           sampacket.status==FWSAM_STATUS_RESYNC?"RESYNC":
-                                                                           sampacket.status==FWSAM_STATUS_HOLD?"HOLD":"ERROR");
-                                    LogMessage("DEBUG => [Alert_FWsam] Snort SeqNo:  %x\n",sampacket.snortseqno[0]|(sampacket.snortseqno[1]<<8));
-                                    LogMessage("DEBUG => [Alert_FWsam] Mgmt SeqNo :  %x\n",station->stationseqno);
-                                    LogMessage("DEBUG => [Alert_FWsam] Status     :  %i\n",sampacket.status);
-                                    LogMessage("DEBUG => [Alert_FWsam] Version    :  %i\n",sampacket.version);
-#endif
-                                                    if(len!=sizeof(FWsamPacket)) /* invalid decryption */
-                                                    {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                        deletestation=TRUE;
-                                                        sampacket.status=FWSAM_STATUS_ERROR;
-                                                    }
-                                                    else if(sampacket.version!=FWSAM_PACKETVERSION) /* invalid protocol version */
-                                                    {   ErrorMessage("ERROR => [Alert_FWsam] Protocol version error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                        deletestation=TRUE;
-                                                        sampacket.status=FWSAM_STATUS_ERROR;
-                                                    }
-                                                    else if(sampacket.status!=FWSAM_STATUS_OK && sampacket.status!=FWSAM_STATUS_NEWKEY && sampacket.status!=FWSAM_STATUS_RESYNC)
-                                                    {   ErrorMessage("ERROR => [Alert_FWsam] Funky handshake error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                        deletestation=TRUE;
-                                                        sampacket.status=FWSAM_STATUS_ERROR;
-                                                    }
-                                                }
-                                            }
-                                            if(sampacket.status==FWSAM_STATUS_RESYNC)  /* if station want's to resync... */
-                                            {   strcpy(station->stationkey,station->initialkey); /* ...we use the intial key... */
-                                                memcpy(station->fwkeymod,sampacket.duration,4);  /* and note the random key modifier */
-                                            }
-                                            if(sampacket.status==FWSAM_STATUS_NEWKEY || sampacket.status==FWSAM_STATUS_RESYNC)
-                                            {
-                                                FWsamNewStationKey(station,&sampacket); /* generate new TwoFish keys */
-#ifdef FWSAMDEBUG
-                                                    LogMessage("DEBUG => [Alert_FWsam] Generated new encryption key...\n");
-#endif
-                                            }
-#ifdef WIN32
-                                            closesocket(stationsocket);
-#else
-                                            close(stationsocket);
-#endif
-                                            stationtry=0;
-                                        }
-                                        else if(sampacket.status==FWSAM_STATUS_ERROR) /* if SnortSam reports an error on second try, */
-                                        {
-#ifdef WIN32
-                                            closesocket(stationsocket);               /* something is messed up and ... */
-#else
-                                            close(stationsocket);
-#endif
-                                            if(stationtry>1)                          /* we ignore that station. */
-                                            {   deletestation=TRUE;                   /* flag for deletion */
-                                                ErrorMessage("ERROR => [Alert_FWsam] Could not renegotiate key! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                            }
-                                            else                            /* if we get an error on the first try, */
-                                            {   if(!FWsamCheckIn(station))  /* we first try to check in again. */
-                                                {   deletestation=TRUE;
-                                                    ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-                                                }
-                                            }
-                                        }
-                                        else /* an unknown status means trouble... */
-                                        {   ErrorMessage("ERROR => [Alert_FWsam] Funky handshake error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                            closesocket(stationsocket);
-#else
-                                            close(stationsocket);
-#endif
-                                            deletestation=TRUE;
-                                        }
-                                    }
-                                    else   /* if the SnortSam agent uses a different packet version, we have no choice but to ignore it. */
-                                    {   ErrorMessage("ERROR => [Alert_FWsam] Protocol version error! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                        closesocket(stationsocket);
-#else
-                                        close(stationsocket);
-#endif
-                                        deletestation=TRUE;
-                                    }
-                                }
-                                else /* if the intial key failed to decrypt as well, the keys are not configured the same, and we ignore that SnortSam station. */
-                                {   ErrorMessage("ERROR => [Alert_FWsam] Password mismatch! Ignoring host %s.\n",sfip_ntoa(&station->stationip));
-#ifdef WIN32
-                                    closesocket(stationsocket);
-#else
-                                    close(stationsocket);
-#endif
-                                    deletestation=TRUE;
-                                }
-                            }
-                        }
-                        free(encbuf); /* release of the TwoFishAlloc'ed encryption buffer */
-                    }
-                    if(stationtry==0 || deletestation)      /* if everything went real well, or real bad... */
-                    {   if(deletestation){                  /* If it went bad, we remove the station from the list by marking the IP */
-//                          station->stationip.s_addr=0;
-                            station->stationip.ip32[0]=0;
-                                                }
-                        fwsamlist=fwsamlist->next;
-                    }
-                }
-                else
-                    fwsamlist=fwsamlist->next;
-            }
-        }
-        else
+        /* queue the block for every station, and send without waiting for the agents */
+        for(; fwsamlist!=NULL; fwsamlist=fwsamlist->next)
         {
-#ifdef FWSAMDEBUG
-            LogMessage("DEBUG => [Alert_FWsam] Skipping repetitive block.\n");
-#endif
+            station=fwsamlist->station;
+            if(station->stationip.ip32[0])
+            {
+                FWsamQueueBlock(station,&sampacket);
+                FWsamPump(station);
+            }
         }
     }
 }
@@ -1487,6 +1838,7 @@ void FWsamFree(FWsamList *list)
         free(list);
         list=next;
     }
+    FWsamDrain(time(NULL)+FWSAM_EXIT_TIMEOUT); /* finish pending blocks, if we can */
     list=FWsamStationList;
 
     while(list) /* Free global pointer list and stations */
@@ -1494,10 +1846,20 @@ void FWsamFree(FWsamList *list)
         next=list->next;
         if (list->station)
         {
+            FWsamDisconnect(list->station);
+
             if(list->station->stationip.ip32[0])
             //if(list->station->stationip.s_addr)
+            {
+                if(list->station->queuelen || list->station->dropped)
+                    ErrorMessage("WARNING => [Alert_FWsam] %lu blocks could not be sent to host %s.\n",
+                                 list->station->queuelen+list->station->dropped,sfip_ntoa(&list->station->stationip));
+
                 FWsamCheckOut(list->station); /* Send a Check-Out to SnortSam, */
+            }
 
+            if(list->station->queue)
+                free(list->station->queue);
             TwoFishDestroy(list->station->stationfish); /* toss the fish, */
             free(list->station); /* free station, */
         }
@@ -1507,6 +1869,19 @@ void FWsamFree(FWsamList *list)
     FWsamStationList=NULL;
     if(FWsamOptionField)
         free(FWsamOptionField);
+    FWsamOptionField=NULL;
+    FWsamMaxOptions=0;
+
+    if(FWsamOptionIndex)
+        kh_destroy(FWsamOptionMap,FWsamOptionIndex);
+    FWsamOptionIndex=NULL;
+
+    if(FWsamRecentBlocks[0])
+    {
+        kh_destroy(FWsamBlocks,FWsamRecentBlocks[0]);
+        kh_destroy(FWsamBlocks,FWsamRecentBlocks[1]);
+        FWsamRecentBlocks[0]=FWsamRecentBlocks[1]=NULL;
+    }
 }
 
 void AlertFWsamCleanExitFunc(int signal, void *arg)
@@ -31,5 +31,7 @@
 #define __SPO_FWSAM_H__
 
 void AlertFWsamSetup(void);
+int FWsamReadOptions(const char *);
+struct _FWsamoptions *FWsamGetOption(unsigned long, unsigned long);
 
 #endif  /* __SPO_FWSAM_H__ */
@@ -0,0 +1,1088 @@
+/*
+** Copyright (C) 2008-2013 Ian Firns (SecurixLive) <dev@securixlive.com>
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* $Id$ */
+
+/* spo_alert_json
+ *
+ * Purpose: output plugin for JSON lines (NDJSON) alerting
+ *
+ * Arguments: comma separated list of
+ *      file <name>         - append to <name> in the log directory (default: alert.json)
+ *      unix <path>         - send to a unix stream socket
+ *      tcp <host>:<port>   - send to a TCP server ([addr]:port for IPv6 addresses)
+ *      payload             - add the packet payload, base64 encoded
+ *      buffer <size>       - output buffer, K/M/G suffixes allowed (default: 1M)
+ *      flush <seconds>     - longest time an alert may sit in the buffer (default: 1)
+ *
+ * Effect:
+ *
+ * Every alert is written as one JSON object followed by a newline.  Objects
+ * are rendered straight into the output buffer, the signature members are
+ * rendered once per signature (see GetSigFragment()).  Packets decoded
+ * through tunnels get "tunnel", "tunnel_id" and the outer_ and inner_
+ * address and port members.  The extra data snort logged with the event
+ * (XFF, HTTP URI and host name, SMTP envelope and so on) is added as
+ * members named after its type, see ExtraDataName().  The buffer is written
+ * out in blocks when it fills, when the flush interval has passed and when
+ * the spooler runs out of events.
+ *
+ * When the destination can't keep up, or goes away, the plugin blocks
+ * (reconnecting with an increasing delay) instead of dropping alerts, so the
+ * spooler only moves on once the alerts are written.
+ *
+ * Example:
+ *      output alert_json: tcp 127.0.0.1:5044, payload
+ *
+ * {"timestamp":"2013-05-01T10:00:00.123456Z","sensor_id":0,"event_id":1,
+ *  "gid":1,"sid":1000,"rev":1,"msg":"...","class":"attempted-recon",
+ *  "priority":2,"proto":6,"src_ip":"10.0.0.1","src_port":1024,
+ *  "dst_ip":"10.0.0.2","dst_port":80,"blocked":0,"ip_ver":4,...,
+ *  "payload":"R0VUIC8gSFRUUC8xLjENCg=="}
+ */
+
+/* for memrchr() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_H
+#include <strings.h>
+#endif
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "barnyard2.h"
+#include "debug.h"
+#include "decode.h"
+#include "encode.h"
+#include "extradata.h"
+#include "log_text.h"
+#include "map.h"
+#include "mstring.h"
+#include "parser.h"
+#include "plugbase.h"
+#include "unified2.h"
+#include "util.h"
+#include "ipv6_port.h"
+
+#include "spo_alert_json.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define DEFAULT_FILE  "alert.json"
+
+#define JSON_OUT_FILE   0
+#define JSON_OUT_UNIX   1
+#define JSON_OUT_TCP    2
+
+#define JSON_DEFAULT_BUFFER  (1024 * 1024)
+#define JSON_BATCH_SIZE      (64 * 1024)      /* write once this much is buffered */
+
+/* room for everything but the payload, the signature members are at most
+ * 4K (see SIG_FRAG_BUF in log_text.c) */
+#define JSON_EVENT_RESERVE   (8 * 1024)
+#define JSON_BASE64_LEN(n)   ((((n) + 2) / 3) * 4)
+#define JSON_EXTRA_DATA_LEN  (2 * EXTRA_DATA_TEXT_MAX + 32)   /* escaped, with its name */
+#define JSON_MIN_BUFFER      (JSON_EVENT_RESERVE + JSON_BASE64_LEN(IP_MAXPACKET) + \
+                              EVENT_INFO_MAX * JSON_EXTRA_DATA_LEN)
+
+#define JSON_FLUSH_INTERVAL  1
+#define JSON_RECONNECT_MIN   1
+#define JSON_RECONNECT_MAX   60
+#define JSON_CONNECT_TIMEOUT 5
+#define JSON_EXIT_TIMEOUT    5
+
+/* how long AlertJSONFlush() may wait for the destination */
+#define JSON_FLUSH_NOWAIT    0    /* write what can be written now */
+#define JSON_FLUSH_WAIT      1    /* until done or barnyard2 is told to exit */
+#define JSON_FLUSH_EXIT      2    /* until done or stalled for JSON_EXIT_TIMEOUT */
+
+typedef struct _AlertJSONData
+{
+    u_int8_t type;            /* JSON_OUT_* */
+    u_int8_t payload;
+    char *name;               /* file name, socket path or host */
+    char *port;
+
+    int fd;
+    time_t reconnect_time;
+    u_int32_t reconnect_backoff;
+
+    char *buf;
+    u_int32_t size;
+    u_int32_t len;
+    u_int32_t sent;           /* bytes of buf already written */
+    u_int32_t flush_interval;
+    time_t last_flush;
+    u_int64_t dropped;
+
+    /* "YYYY-MM-DDTHH:MM:SS" of the last event second */
+    u_int32_t ts_second;
+    char ts_text[32];
+    u_int32_t ts_len;
+} AlertJSONData;
+
+static void AlertJSONInit(char *);
+static AlertJSONData *ParseAlertJSONArgs(char *);
+static void AlertJSON(Packet *, void *, u_int32_t, void *);
+static void AlertJSONIdleFunc(int, void *);
+static void AlertJSONCleanExitFunc(int, void *);
+static void AlertJSONRestartFunc(int, void *);
+static int AlertJSONFlush(AlertJSONData *, int);
+
+/*
+ * Function: AlertJSONSetup()
+ *
+ * Purpose: Registers the output plugin keyword and initialization
+ *          function into the output plugin list.  This is the function that
+ *          gets called from InitOutputPlugins() in plugbase.c.
+ *
+ * Arguments: None.
+ *
+ * Returns: void function
+ *
+ */
+void AlertJSONSetup(void)
+{
+    /* link the preprocessor keyword to the init function in
+       the preproc list */
+    RegisterOutputPlugin("alert_json", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertJSONInit);
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output plugin: AlertJSON is setup...\n"););
+}
+
+/*
+ * Function: AlertJSONInit(char *)
+ *
+ * Purpose: Calls the argument parsing function, performs final setup on data
+ *          structs, links the preproc function into the function list.
+ *
+ * Arguments: args => ptr to argument string
+ *
+ * Returns: void function
+ *
+ */
+static void AlertJSONInit(char *args)
+{
+    AlertJSONData *data;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output: AlertJSON Initialized\n"););
+
+    /* parse the argument list from the rules file */
+    data = ParseAlertJSONArgs(args);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Linking AlertJSON functions to call lists...\n"););
+
+    /* Set the preprocessor function into the function list */
+    AddFuncToOutputList(AlertJSON, OUTPUT_TYPE__ALERT, data);
+    AddFuncToIdleList(AlertJSONIdleFunc, data);
+    AddFuncToCleanExitList(AlertJSONCleanExitFunc, data);
+    AddFuncToRestartList(AlertJSONRestartFunc, data);
+}
+
+/* <number>[K|M|G] */
+static u_int32_t ParseAlertJSONSize(const char *arg)
+{
+    unsigned long size;
+    char *end;
+
+    size = strtoul(arg, &end, 10);
+
+    if ( end == arg )
+        FatalError("alert_json: invalid size \"%s\" in %s(%i)\n",
+                   arg, file_name, file_line);
+
+    if ( toupper(*end) == 'G' )
+        size <<= 30;
+    else if ( toupper(*end) == 'M' )
+        size <<= 20;
+    else if ( toupper(*end) == 'K' )
+        size <<= 10;
+
+    return (u_int32_t)size;
+}
+
+/* <host>:<port> or [<ipv6 address>]:<port> */
+static void ParseAlertJSONHost(AlertJSONData *data, char *arg)
+{
+    char *sep = strrchr(arg, ':');
+
+    if ( sep == NULL || sep == arg || sep[1] == '\0' )
+        FatalError("alert_json: expected <host>:<port> in %s(%i): %s\n",
+                   file_name, file_line, arg);
+
+    *sep = '\0';
+    data->port = SnortStrdup(sep + 1);
+
+    if ( *arg == '[' && sep[-1] == ']' )
+    {
+        sep[-1] = '\0';
+        arg++;
+    }
+    data->name = SnortStrdup(arg);
+}
+
+/*
+ * Function: ParseAlertJSONArgs(char *)
+ *
+ * Purpose: Process the comma separated options.  Syntax is:
+ * output alert_json: [file <name> | unix <path> | tcp <host>:<port>]
+ *                    [, payload] [, buffer <size>] [, flush <seconds>]
+ *
+ * Arguments: args => argument list
+ *
+ * Returns: the plugin data
+ *
+ */
+static AlertJSONData *ParseAlertJSONArgs(char *args)
+{
+    AlertJSONData *data;
+    char **toks;
+    int num_toks;
+    int i;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "ParseAlertJSONArgs: %s\n", args););
+    data = (AlertJSONData *)SnortAlloc(sizeof(AlertJSONData));
+
+    data->fd = -1;
+    data->size = JSON_DEFAULT_BUFFER;
+    data->flush_interval = JSON_FLUSH_INTERVAL;
+
+    if ( !args ) args = "";
+    toks = mSplit(args, ",", 0, &num_toks, '\\');
+
+    for ( i = 0; i < num_toks; i++ )
+    {
+        char **stoks;
+        int num_stoks;
+        char *tok = toks[i];
+
+        while ( isspace((int)*tok) )
+            tok++;
+
+        stoks = mSplit(tok, " \t", 2, &num_stoks, 0);
+
+        if ( num_stoks == 0 )
+        {
+            mSplitFree(&stoks, num_stoks);
+            continue;
+        }
+
+        if ( num_stoks == 2 && data->name == NULL &&
+             (!strcasecmp(stoks[0], "file") || !strcasecmp(stoks[0], "unix")) )
+        {
+            data->type = !strcasecmp(stoks[0], "file") ? JSON_OUT_FILE : JSON_OUT_UNIX;
+
+            if ( data->type == JSON_OUT_FILE )
+                data->name = ProcessFileOption(barnyard2_conf_for_parsing, stoks[1]);
+            else
+                data->name = SnortStrdup(stoks[1]);
+        }
+        else if ( num_stoks == 2 && data->name == NULL && !strcasecmp(stoks[0], "tcp") )
+        {
+            data->type = JSON_OUT_TCP;
+            ParseAlertJSONHost(data, stoks[1]);
+        }
+        else if ( num_stoks == 1 && !strcasecmp(stoks[0], "payload") )
+        {
+            data->payload = 1;
+        }
+        else if ( num_stoks == 2 && !strcasecmp(stoks[0], "buffer") )
+        {
+            data->size = ParseAlertJSONSize(stoks[1]);
+        }
+        else if ( num_stoks == 2 && !strcasecmp(stoks[0], "flush") )
+        {
+            data->flush_interval = (u_int32_t)strtoul(stoks[1], NULL, 10);
+        }
+        else
+        {
+            FatalError("alert_json: unknown option in %s(%i): %s\n",
+                       file_name, file_line, tok);
+        }
+
+        mSplitFree(&stoks, num_stoks);
+    }
+    mSplitFree(&toks, num_toks);
+
+    if ( data->name == NULL )
+    {
+        data->type = JSON_OUT_FILE;
+        data->name = ProcessFileOption(barnyard2_conf_for_parsing, DEFAULT_FILE);
+    }
+
+    if ( data->type == JSON_OUT_UNIX &&
+         strlen(data->name) >= sizeof(((struct sockaddr_un *)NULL)->sun_path) )
+        FatalError("alert_json: socket path is too long: %s\n", data->name);
+
+    if ( data->size < JSON_MIN_BUFFER )
+    {
+        LogMessage("alert_json: buffer raised to the minimum of %u bytes\n",
+                   JSON_MIN_BUFFER);
+        data->size = JSON_MIN_BUFFER;
+    }
+
+    data->buf = (char *)SnortAlloc(data->size);
+    data->last_flush = time(NULL);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "alert_json: '%s' type %u payload %u buffer %u\n",
+                            data->name, data->type, data->payload, data->size););
+
+    return data;
+}
+
+/*
+ * JSON rendering.  AlertJSON() makes sure JSON_EVENT_RESERVE bytes (and the
+ * encoded payload) are free before it starts, so the helpers below don't
+ * check for space; each returns the position after what it appended.
+ */
+static INLINE char *JSON_Put(char *out, const char *str, u_int32_t len)
+{
+    memcpy(out, str, len);
+    return out + len;
+}
+
+#define JSON_PutLit(out, str) JSON_Put((out), (str), sizeof(str) - 1)
+
+/* same as "%lu" */
+static char *JSON_PutUInt(char *out, unsigned long n)
+{
+    char tmp[3 * sizeof(n)];
+    int i = sizeof(tmp);
+
+    do
+    {
+        tmp[--i] = '0' + (n % 10);
+        n /= 10;
+    } while ( n );
+
+    return JSON_Put(out, tmp + i, sizeof(tmp) - i);
+}
+
+/* zero padded to width digits */
+static char *JSON_PutUIntPad(char *out, unsigned long n, int width)
+{
+    int i;
+
+    for ( i = width - 1; i >= 0; i-- )
+    {
+        out[i] = '0' + (n % 10);
+        n /= 10;
+    }
+
+    return out + width;
+}
+
+/* quoted dotted quad of an address in network order */
+static char *JSON_PutIPv4(char *out, const u_int8_t *addr)
+{
+    int i;
+
+    *out++ = '"';
+    for ( i = 0; i < 4; i++ )
+    {
+        if ( i )
+            *out++ = '.';
+        out = JSON_PutUInt(out, addr[i]);
+    }
+    *out++ = '"';
+
+    return out;
+}
+
+static char *JSON_PutIPv6(char *out, const struct in6_addr *addr)
+{
+    *out++ = '"';
+    if ( inet_ntop(AF_INET6, addr, out, INET6_ADDRSTRLEN) != NULL )
+        out += strlen(out);
+    *out++ = '"';
+
+    return out;
+}
+
+/* quoted RFC 3339 UTC time, the date part is only rendered once a second */
+static char *JSON_PutTime(AlertJSONData *data, char *out, u_int32_t sec, u_int32_t usec)
+{
+    if ( sec != data->ts_second || data->ts_len == 0 )
+    {
+        time_t t = (time_t)sec;
+        struct tm tm;
+
+        gmtime_r(&t, &tm);
+        data->ts_len = strftime(data->ts_text, sizeof(data->ts_text),
+                                "%Y-%m-%dT%H:%M:%S", &tm);
+        data->ts_second = sec;
+    }
+
+    *out++ = '"';
+    out = JSON_Put(out, data->ts_text, data->ts_len);
+    *out++ = '.';
+    out = JSON_PutUIntPad(out, usec % 1000000, 6);
+    out = JSON_PutLit(out, "Z\"");
+
+    return out;
+}
+
+/* quoted base64 of len bytes */
+static char *JSON_PutBase64(char *out, const u_char *in, u_int32_t len)
+{
+    *out++ = '"';
+    out += EncodeBase64(out, in, len, 0);
+    *out++ = '"';
+
+    return out;
+}
+
+static char *JSON_PutAddr(char *out, int family, const u_int8_t *addr)
+{
+    return family == AF_INET6 ? JSON_PutIPv6(out, (const struct in6_addr *)addr) :
+                                JSON_PutIPv4(out, addr);
+}
+
+/* one member per extra data type, the first record of each; the rendered
+ * text is printable ASCII so only quotes and backslashes need escaping */
+static char *JSON_PutExtraData(char *out, void *event)
+{
+    const ExtraData *ed;
+    char text[EXTRA_DATA_TEXT_MAX];
+    u_int32_t seen = 0;
+    u_int32_t len, bit, i;
+    const char *name;
+
+    for ( ed = GetExtraData(event); ed != NULL; ed = ed->next )
+    {
+        if ( (name = ExtraDataName(ed->type)) == NULL )
+            continue;
+
+        /* both XFF types are "xff" */
+        bit = 1 << (ed->type == EVENT_INFO_XFF_IPV6 ? EVENT_INFO_XFF_IPV4 : ed->type);
+        if ( seen & bit )
+            continue;
+
+        seen |= bit;
+        len = ExtraDataText(ed, text, sizeof(text));
+
+        *out++ = ',';
+        *out++ = '"';
+        out = JSON_Put(out, name, strlen(name));
+        out = JSON_PutLit(out, "\":\"");
+
+        for ( i = 0; i < len; i++ )
+        {
+            if ( text[i] == '"' || text[i] == '\\' )
+                *out++ = '\\';
+            *out++ = text[i];
+        }
+
+        *out++ = '"';
+    }
+
+    return out;
+}
+
+/* the tunnels the packet came through, the delivery addresses and ports of
+ * the outermost one and those of the innermost packet, which the event may
+ * not have if the sensor didn't decode the tunnel */
+static char *JSON_PutTunnel(char *out, Packet *p)
+{
+    const TunnelLayer *t = &p->tunnels[0];
+    const char *name;
+    int i;
+
+    out = JSON_PutLit(out, ",\"tunnel\":\"");
+    for ( i = 0; i < p->tunnel_depth; i++ )
+    {
+        if ( i )
+            *out++ = '/';
+        name = TunnelName(p->tunnels[i].type);
+        out = JSON_Put(out, name, strlen(name));
+    }
+    *out++ = '"';
+
+    out = JSON_PutLit(out, ",\"tunnel_id\":");
+    out = JSON_PutUInt(out, t->id);
+    out = JSON_PutLit(out, ",\"outer_src_ip\":");
+    out = JSON_PutAddr(out, t->family, TUNNEL_SRC_ADDR(t));
+    out = JSON_PutLit(out, ",\"outer_dst_ip\":");
+    out = JSON_PutAddr(out, t->family, TUNNEL_DST_ADDR(t));
+
+    if ( t->dp )
+    {
+        out = JSON_PutLit(out, ",\"outer_src_port\":");
+        out = JSON_PutUInt(out, t->sp);
+        out = JSON_PutLit(out, ",\"outer_dst_port\":");
+        out = JSON_PutUInt(out, t->dp);
+    }
+
+    if ( IPH_IS_VALID(p) )
+    {
+        const u_int8_t *iph = (const u_int8_t *)p->iph;
+        int family = IS_IP6(p) ? AF_INET6 : AF_INET;
+
+        out = JSON_PutLit(out, ",\"inner_src_ip\":");
+        out = JSON_PutAddr(out, family, iph + (family == AF_INET6 ? 8 : 12));
+        out = JSON_PutLit(out, ",\"inner_dst_ip\":");
+        out = JSON_PutAddr(out, family, iph + (family == AF_INET6 ? 24 : 16));
+
+        if ( p->tcph != NULL || p->udph != NULL )
+        {
+            out = JSON_PutLit(out, ",\"inner_src_port\":");
+            out = JSON_PutUInt(out, p->sp);
+            out = JSON_PutLit(out, ",\"inner_dst_port\":");
+            out = JSON_PutUInt(out, p->dp);
+        }
+    }
+
+    return out;
+}
+
+/* decoded IP and transport header members */
+static char *JSON_PutPacket(char *out, Packet *p)
+{
+    out = JSON_PutLit(out, ",\"ip_ver\":");
+    out = JSON_PutUInt(out, IS_IP6(p) ? 6 : 4);
+    out = JSON_PutLit(out, ",\"ip_hlen\":");
+    out = JSON_PutUInt(out, GET_IPH_HLEN(p) << 2);
+    out = JSON_PutLit(out, ",\"ip_len\":");
+    out = JSON_PutUInt(out, GET_IP_DGMLEN(p));
+    out = JSON_PutLit(out, ",\"ip_tos\":");
+    out = JSON_PutUInt(out, GET_IPH_TOS(p));
+    out = JSON_PutLit(out, ",\"ip_ttl\":");
+    out = JSON_PutUInt(out, GET_IPH_TTL(p));
+    out = JSON_PutLit(out, ",\"ip_id\":");
+    out = JSON_PutUInt(out, IS_IP6(p) ? ntohl(GET_IPH_ID(p)) :
+                                        ntohs((u_int16_t)GET_IPH_ID(p)));
+
+    if ( IS_IP4(p) )
+    {
+        u_int16_t off = ntohs(GET_IPH_OFF(p));
+
+        out = JSON_PutLit(out, ",\"ip_flags\":");
+        out = JSON_PutUInt(out, (off & 0xe000) >> 13);
+        out = JSON_PutLit(out, ",\"ip_off\":");
+        out = JSON_PutUInt(out, off & 0x1fff);
+    }
+
+    if ( p->tcph != NULL )
+    {
+        out = JSON_PutLit(out, ",\"tcp_seq\":");
+        out = JSON_PutUInt(out, ntohl(p->tcph->th_seq));
+        out = JSON_PutLit(out, ",\"tcp_ack\":");
+        out = JSON_PutUInt(out, ntohl(p->tcph->th_ack));
+        out = JSON_PutLit(out, ",\"tcp_flags\":");
+        out = JSON_PutUInt(out, p->tcph->th_flags);
+        out = JSON_PutLit(out, ",\"tcp_win\":");
+        out = JSON_PutUInt(out, ntohs(p->tcph->th_win));
+        out = JSON_PutLit(out, ",\"tcp_hlen\":");
+        out = JSON_PutUInt(out, TCP_OFFSET(p->tcph) << 2);
+    }
+    else if ( p->udph != NULL )
+    {
+        out = JSON_PutLit(out, ",\"udp_len\":");
+        out = JSON_PutUInt(out, ntohs(p->udph->uh_len));
+    }
+
+    return out;
+}
+
+/*
+ * Function: AlertJSON(Packet *, void *, u_int32_t, void *)
+ *
+ * Purpose: Renders an alert as one line of JSON into the output buffer
+ *
+ * Arguments: p => pointer to the decoded packet (may be NULL)
+ *            event => unified2 event
+ *            event_type => unified2 type of the event
+ *            arg => plugin data
+ *
+ * Returns: void function
+ *
+ */
+static void AlertJSON(Packet *p, void *event, u_int32_t event_type, void *arg)
+{
+    AlertJSONData *data = (AlertJSONData *)arg;
+    Unified2EventCommon *common = (Unified2EventCommon *)event;
+    Unified2IDSEvent *ev4 = (Unified2IDSEvent *)event;
+    Unified2IDSEventIPv6 *ev6 = (Unified2IDSEventIPv6 *)event;
+    const SigFragment *frag;
+    const ExtraData *ed;
+    u_int32_t need = JSON_EVENT_RESERVE;
+    u_int32_t extra = 0;
+    u_int16_t sport, dport;
+    u_int8_t proto, blocked;
+    u_int32_t mpls = 0;
+    u_int16_t vlan = 0;
+    int ipv6;
+    char *out;
+
+    if ( event == NULL )
+        return;
+
+    switch ( event_type )
+    {
+        case UNIFIED2_IDS_EVENT:
+        case UNIFIED2_IDS_EVENT_MPLS:
+        case UNIFIED2_IDS_EVENT_VLAN:
+            ipv6 = 0;
+            sport = ntohs(ev4->sport_itype);
+            dport = ntohs(ev4->dport_icode);
+            proto = ev4->protocol;
+            blocked = ev4->blocked;
+
+            if ( event_type != UNIFIED2_IDS_EVENT )
+            {
+                mpls = ntohl(ev4->mpls_label);
+                vlan = ntohs(ev4->vlanId);
+            }
+            break;
+
+        case UNIFIED2_IDS_EVENT_IPV6:
+        case UNIFIED2_IDS_EVENT_IPV6_MPLS:
+        case UNIFIED2_IDS_EVENT_IPV6_VLAN:
+            ipv6 = 1;
+            sport = ntohs(ev6->sport_itype);
+            dport = ntohs(ev6->dport_icode);
+            proto = ev6->protocol;
+            blocked = ev6->blocked;
+
+            if ( event_type != UNIFIED2_IDS_EVENT_IPV6 )
+            {
+                mpls = ntohl(ev6->mpls_label);
+                vlan = ntohs(ev6->vlanId);
+            }
+            break;
+
+        default:
+            return;
+    }
+
+    if ( data->payload && p != NULL && p->data != NULL )
+        need += JSON_BASE64_LEN(p->dsize);
+
+    /* at most one member per type */
+    for ( ed = GetExtraData(event); ed != NULL && extra < EVENT_INFO_MAX; ed = ed->next )
+        extra++;
+    need += extra * JSON_EXTRA_DATA_LEN;
+
+    /* backpressure, wait for the destination to take what's buffered */
+    if ( data->size - data->len < need &&
+         (AlertJSONFlush(data, JSON_FLUSH_WAIT) || data->size - data->len < need) )
+    {
+        data->dropped++;
+        return;
+    }
+
+    out = data->buf + data->len;
+
+    out = JSON_PutLit(out, "{\"timestamp\":");
+    out = JSON_PutTime(data, out, ntohl(common->event_second),
+                       ntohl(common->event_microsecond));
+    out = JSON_PutLit(out, ",\"sensor_id\":");
+    out = JSON_PutUInt(out, ntohl(common->sensor_id));
+    out = JSON_PutLit(out, ",\"event_id\":");
+    out = JSON_PutUInt(out, ntohl(common->event_id));
+
+    frag = GetSigFragment(GetSigByGidSid(ntohl(common->generator_id),
+                                         ntohl(common->signature_id),
+                                         ntohl(common->signature_revision)),
+                          SIG_FRAG_JSON, common);
+    *out++ = ',';
+    out = JSON_Put(out, frag->data, frag->len);
+
+    out = JSON_PutLit(out, ",\"proto\":");
+    out = JSON_PutUInt(out, proto);
+    out = JSON_PutLit(out, ",\"src_ip\":");
+    out = ipv6 ? JSON_PutIPv6(out, &ev6->ip_source) :
+                 JSON_PutIPv4(out, (const u_int8_t *)&ev4->ip_source);
+
+    /* ICMP type and code are carried in the port fields */
+    if ( proto == IPPROTO_ICMP || proto == IPPROTO_ICMPV6 )
+    {
+        out = JSON_PutLit(out, ",\"dst_ip\":");
+        out = ipv6 ? JSON_PutIPv6(out, &ev6->ip_destination) :
+                     JSON_PutIPv4(out, (const u_int8_t *)&ev4->ip_destination);
+        out = JSON_PutLit(out, ",\"icmp_type\":");
+        out = JSON_PutUInt(out, sport);
+        out = JSON_PutLit(out, ",\"icmp_code\":");
+        out = JSON_PutUInt(out, dport);
+    }
+    else
+    {
+        out = JSON_PutLit(out, ",\"src_port\":");
+        out = JSON_PutUInt(out, sport);
+        out = JSON_PutLit(out, ",\"dst_ip\":");
+        out = ipv6 ? JSON_PutIPv6(out, &ev6->ip_destination) :
+                     JSON_PutIPv4(out, (const u_int8_t *)&ev4->ip_destination);
+        out = JSON_PutLit(out, ",\"dst_port\":");
+        out = JSON_PutUInt(out, dport);
+    }
+
+    out = JSON_PutLit(out, ",\"blocked\":");
+    out = JSON_PutUInt(out, blocked);
+
+    if ( vlan != 0 )
+    {
+        out = JSON_PutLit(out, ",\"vlan\":");
+        out = JSON_PutUInt(out, vlan);
+    }
+
+    if ( mpls != 0 )
+    {
+        out = JSON_PutLit(out, ",\"mpls\":");
+        out = JSON_PutUInt(out, mpls);
+    }
+
+    if ( p != NULL && p->tunnel_depth )
+        out = JSON_PutTunnel(out, p);
+
+    out = JSON_PutExtraData(out, event);
+
+    if ( p != NULL && IPH_IS_VALID(p) )
+        out = JSON_PutPacket(out, p);
+
+    if ( data->payload && p != NULL && p->data != NULL && p->dsize )
+    {
+        out = JSON_PutLit(out, ",\"payload\":");
+        out = JSON_PutBase64(out, p->data, p->dsize);
+    }
+
+    out = JSON_PutLit(out, "}\n");
+    data->len = out - data->buf;
+
+    if ( data->len >= JSON_BATCH_SIZE ||
+         (u_int32_t)(time(NULL) - data->last_flush) >= data->flush_interval )
+        AlertJSONFlush(data, JSON_FLUSH_NOWAIT);
+}
+
+/*
+ * Output connection.  Files are opened for appending, sockets are made non
+ * blocking once connected so a stalled reader can't hang a flush past an
+ * exit signal.
+ */
+static int AlertJSONConnectTCP(AlertJSONData *data)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1;
+    int rval;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ( (rval = getaddrinfo(data->name, data->port, &hints, &res)) != 0 )
+    {
+        ErrorMessage("alert_json: could not resolve %s: %s\n",
+                     data->name, gai_strerror(rval));
+        return -1;
+    }
+
+    for ( ai = res; ai != NULL; ai = ai->ai_next )
+    {
+        struct pollfd pfd;
+        socklen_t len = sizeof(rval);
+
+        if ( (fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 )
+            continue;
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        if ( connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 )
+            break;
+
+        if ( errno == EINPROGRESS )
+        {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+
+            if ( poll(&pfd, 1, JSON_CONNECT_TIMEOUT * 1000) == 1 &&
+                 getsockopt(fd, SOL_SOCKET, SO_ERROR, &rval, &len) == 0 &&
+                 rval == 0 )
+                break;
+
+            if ( rval != 0 )
+                errno = rval;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+static int AlertJSONConnectUnix(AlertJSONData *data)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, data->name, sizeof(sun.sun_path) - 1);
+
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 )
+        return -1;
+
+    if ( connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 )
+    {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+static int AlertJSONOpen(AlertJSONData *data)
+{
+    switch ( data->type )
+    {
+        case JSON_OUT_UNIX:
+            data->fd = AlertJSONConnectUnix(data);
+            break;
+
+        case JSON_OUT_TCP:
+            data->fd = AlertJSONConnectTCP(data);
+            break;
+
+        default:
+            data->fd = open(data->name, O_WRONLY | O_CREAT | O_APPEND, 0666);
+            break;
+    }
+
+    return data->fd < 0;
+}
+
+static void AlertJSONClose(AlertJSONData *data)
+{
+    if ( data->fd >= 0 )
+    {
+        close(data->fd);
+        data->fd = -1;
+    }
+}
+
+/* 1 while a flush in the given mode may keep waiting for the destination */
+static int AlertJSONMayWait(int mode, time_t deadline)
+{
+    if ( mode == JSON_FLUSH_EXIT )
+        return time(NULL) < deadline;
+
+    return mode == JSON_FLUSH_WAIT && exit_signal == 0;
+}
+
+/*
+ * (Re)open the output, retrying with an increasing delay (up to
+ * JSON_RECONNECT_MAX seconds) while the flush mode allows waiting.
+ */
+static int AlertJSONConnect(AlertJSONData *data, int mode, time_t deadline)
+{
+    for ( ;; )
+    {
+        time_t now = time(NULL);
+
+        if ( now >= data->reconnect_time )
+        {
+            if ( AlertJSONOpen(data) == 0 )
+            {
+                if ( data->reconnect_backoff )
+                    LogMessage("alert_json: output to %s resumed\n", data->name);
+
+                data->reconnect_backoff = 0;
+                return 0;
+            }
+
+            if ( data->reconnect_backoff == 0 )
+            {
+                ErrorMessage("alert_json: can't write to %s: %s, holding alerts until it is back\n",
+                             data->name, strerror(errno));
+                data->reconnect_backoff = JSON_RECONNECT_MIN;
+            }
+            else if ( (data->reconnect_backoff *= 2) > JSON_RECONNECT_MAX )
+            {
+                data->reconnect_backoff = JSON_RECONNECT_MAX;
+            }
+
+            data->reconnect_time = now + data->reconnect_backoff;
+        }
+
+        if ( !AlertJSONMayWait(mode, deadline) )
+            return 1;
+
+        sleep(1);
+    }
+}
+
+/*
+ * Drop the output after a write error.  A partly written line is written
+ * again in full on the next connection.
+ */
+static void AlertJSONDisconnect(AlertJSONData *data)
+{
+    char *nl;
+
+    ErrorMessage("alert_json: write to %s failed: %s\n", data->name, strerror(errno));
+    AlertJSONClose(data);
+
+    nl = data->sent ? memrchr(data->buf, '\n', data->sent) : NULL;
+    data->sent = nl ? (u_int32_t)(nl - data->buf) + 1 : 0;
+}
+
+/*
+ * Function: AlertJSONFlush(AlertJSONData *, int)
+ *
+ * Purpose: Writes out the buffered alerts
+ *
+ * Arguments: data => plugin data
+ *            mode => JSON_FLUSH_*, how long to wait for the destination
+ *
+ * Returns: 0 once the buffer is empty, 1 otherwise
+ *
+ */
+static int AlertJSONFlush(AlertJSONData *data, int mode)
+{
+    time_t deadline = time(NULL) + JSON_EXIT_TIMEOUT;
+    struct pollfd pfd;
+    ssize_t n;
+    char *nl;
+
+    while ( data->sent < data->len )
+    {
+        if ( data->fd < 0 && AlertJSONConnect(data, mode, deadline) )
+            break;
+
+        if ( data->type == JSON_OUT_FILE )
+            n = write(data->fd, data->buf + data->sent, data->len - data->sent);
+        else
+            n = send(data->fd, data->buf + data->sent, data->len - data->sent,
+                     MSG_NOSIGNAL);
+
+        if ( n > 0 )
+        {
+            data->sent += n;
+
+            /* on exit give up once the destination stops taking data */
+            if ( mode == JSON_FLUSH_EXIT )
+                deadline = time(NULL) + JSON_EXIT_TIMEOUT;
+            continue;
+        }
+
+        if ( n < 0 && errno == EINTR )
+            continue;
+
+        if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+        {
+            if ( !AlertJSONMayWait(mode, deadline) )
+                break;
+
+            pfd.fd = data->fd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, 1000);
+            continue;
+        }
+
+        AlertJSONDisconnect(data);
+    }
+
+    data->last_flush = time(NULL);
+
+    if ( data->sent == data->len )
+    {
+        data->len = data->sent = 0;
+        return 0;
+    }
+
+    /* make room by discarding the lines that are fully written */
+    if ( (nl = memrchr(data->buf, '\n', data->sent)) != NULL )
+    {
+        u_int32_t done = (u_int32_t)(nl - data->buf) + 1;
+
+        memmove(data->buf, data->buf + done, data->len - done);
+        data->len -= done;
+        data->sent -= done;
+    }
+
+    return 1;
+}
+
+/* write out what has been buffered while no records arrive */
+static void AlertJSONIdleFunc(int signal, void *arg)
+{
+    AlertJSONFlush((AlertJSONData *)arg, JSON_FLUSH_NOWAIT);
+}
+
+static void AlertJSONCleanup(int signal, void *arg, const char *msg)
+{
+    AlertJSONData *data = (AlertJSONData *)arg;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "%s\n", msg););
+
+    if ( data == NULL )
+        return;
+
+    /* one last attempt, a dead destination doesn't hold up the exit for long */
+    data->reconnect_time = 0;
+
+    if ( AlertJSONFlush(data, JSON_FLUSH_EXIT) )
+        ErrorMessage("alert_json: %u bytes of alerts to %s were not written\n",
+                     data->len - data->sent, data->name);
+
+    if ( data->dropped )
+        ErrorMessage("alert_json: %lu alerts were dropped while exiting\n",
+                     (unsigned long)data->dropped);
+
+    AlertJSONClose(data);
+
+    free(data->buf);
+    free(data->name);
+    if ( data->port )
+        free(data->port);
+    free(data);
+}
+
+static void AlertJSONCleanExitFunc(int signal, void *arg)
+{
+    AlertJSONCleanup(signal, arg, "AlertJSONCleanExitFunc");
+}
+
+static void AlertJSONRestartFunc(int signal, void *arg)
+{
+    AlertJSONCleanup(signal, arg, "AlertJSONRestartFunc");
+}
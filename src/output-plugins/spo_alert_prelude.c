@@ -821,7 +821,8 @@ static void snort_alert_prelude_init(char *args)
 
 void AlertPreludeSetup(void)
 {
-    RegisterOutputPlugin("alert_prelude", OUTPUT_TYPE_FLAG__ALERT, snort_alert_prelude_init);
+    RegisterOutputPlugin("alert_prelude", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__OPTIONS,
+                         snort_alert_prelude_init);
 }
 
 
@@ -92,10 +92,10 @@ int String2ULong(char *string, unsigned long *result);
 void AlertSFSocket_Setup(void)
 {
     RegisterOutputPlugin("alert_sf_socket", OUTPUT_TYPE_FLAG__ALERT,
-                         AlertSFSocket_Init);
+                         DECODE_LEVEL__L3, AlertSFSocket_Init);
 
     RegisterOutputPlugin("alert_sf_socket_sid", OUTPUT_TYPE_FLAG__ALERT,
-                         AlertSFSocketSid_Init);
+                         DECODE_LEVEL__L3, AlertSFSocketSid_Init);
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: AlertSFSocket "
                             "registered\n"););
@@ -60,6 +60,7 @@
 #include "barnyard2.h"
 #include "decode.h"
 #include "debug.h"
+#include "log_text.h"
 #include "map.h"
 #include "mstring.h"
 #include "parser.h"
@@ -102,7 +103,7 @@ void AlertSyslogSetup(void)
 {
     /* link the preprocessor keyword to the init function in
        the preproc list */
-    RegisterOutputPlugin("alert_syslog", OUTPUT_TYPE_FLAG__ALERT, AlertSyslogInit);
+    RegisterOutputPlugin("alert_syslog", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertSyslogInit);
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: Alert-Syslog is setup...\n"););
 }
 
@@ -501,14 +502,12 @@ void AlertSyslog(Packet *p, void *event, uint32_t event_type, void *arg)
 {
     char sip[16];
     char dip[16];
-    char pri_data[STD_BUF];
     char ip_data[STD_BUF];
-    char event_data[STD_BUF];
 #define SYSLOG_BUF  1024
     char event_string[SYSLOG_BUF];
     SyslogData		 	*data;
 	SigNode				*sn;
-	ClassType			*cn;
+	const SigFragment	*frag;
 
 	if ( p == NULL || event == NULL || arg == NULL )
 	{
@@ -519,9 +518,7 @@ void AlertSyslog(Packet *p, void *event, uint32_t event_type, void *arg)
 	sn = GetSigByGidSid(ntohl(((Unified2EventCommon *)event)->generator_id),
 			    ntohl(((Unified2EventCommon *)event)->signature_id),
 			    ntohl(((Unified2EventCommon *)event)->signature_revision));
-			    
 
-	cn = ClassTypeLookupById(barnyard2_conf, ntohl(((Unified2EventCommon *)event)->classification_id));
     event_string[0] = '\0';
 
     /* Remove this check when we support IPv6 below. */
@@ -539,51 +536,13 @@ void AlertSyslog(Packet *p, void *event, uint32_t event_type, void *arg)
         if (strlcpy(dip, inet_ntoa(GET_DST_ADDR(p)), sizeof(dip)) >= sizeof(dip))
             return;
 
-//        if(event != NULL)
-//        {
-            if( SnortSnprintf(event_data, STD_BUF, "[%lu:%lu:%lu] ",
-                              (unsigned long) ntohl(((Unified2EventCommon *)event)->generator_id),
-                              (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_id),
-                              (unsigned long) ntohl(((Unified2EventCommon *)event)->signature_revision)) != SNORT_SNPRINTF_SUCCESS )
-                return ;
+        /* "[gid:sid:rev] msg [Classification: c] [Priority: p]:" */
+        frag = GetSigFragment(sn, SIG_FRAG_SYSLOG, (Unified2EventCommon *)event);
 
-            if( strlcat(event_string, event_data, SYSLOG_BUF) >= SYSLOG_BUF )
-                return ;
-//        }
-
-        if(sn != NULL)
-        {
-           if( strlcat(event_string, sn->msg, SYSLOG_BUF) >= SYSLOG_BUF )
-                return ;
-        }
-        else
-        {
-           if(strlcat(event_string, "ALERT", SYSLOG_BUF) >= SYSLOG_BUF)
-                return ;
-        }
-
-        if(cn != NULL)
-        {
-            if( cn->name )
-            {
-                if( SnortSnprintf(pri_data, STD_BUF-1, " [Classification: %s] "
-                                  "[Priority: %d]:",
-                                  cn->name,
-                                  ntohl(((Unified2EventCommon *)event)->priority_id)) != SNORT_SNPRINTF_SUCCESS )
-                    return ;
-            }
-            if( strlcat(event_string, pri_data, SYSLOG_BUF) >= SYSLOG_BUF)
-                return ;
-        }
-        else if( ntohl(((Unified2EventCommon *)event)->priority_id) != 0 )
-        {
-            if( SnortSnprintf(pri_data, STD_BUF, "[Priority: %d]:",
-                              ntohl(((Unified2EventCommon *)event)->priority_id)) != SNORT_SNPRINTF_SUCCESS )
-                return ;
+        if( frag->len >= SYSLOG_BUF )
+            return;
 
-            if( strlcat(event_string, pri_data, SYSLOG_BUF) >= SYSLOG_BUF)
-                return;
-        }
+        memcpy(event_string, frag->data, frag->len + 1);
 
         if((GET_IPH_PROTO(p) != IPPROTO_TCP &&
                     GET_IPH_PROTO(p) != IPPROTO_UDP) ||
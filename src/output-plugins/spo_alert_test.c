@@ -124,7 +124,7 @@ void AlertTestSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("alert_test", OUTPUT_TYPE_FLAG__ALERT, AlertTestInit);
+    RegisterOutputPlugin("alert_test", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertTestInit);
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: AlertTest is setup...\n"););
 }
 
@@ -24,24 +24,38 @@
  * 
  * Purpose:  output plugin for Unix Socket alerting
  *
- * Arguments:  none (yet)
+ * Arguments:  [path] [sync] [batch=<n>] [ring=<size>[K|M|G]]
  *   
- * Effect:	???
+ * Effect:	Sends an Alertpkt datagram per alert to the socket, batch sends
+ *		up to n of them per sendmmsg() call.  With ring, alerts are
+ *		written as AlertRecords to a shared-memory ring whose file
+ *		descriptor is passed over the socket once, see
+ *		spo_alert_unixsock.h.
  *
  */
 
+/* for sendmmsg() and memfd_create() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
 #include <sys/types.h>
 #include <string.h>
+#include <ctype.h>
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
 #ifndef WIN32
+#include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #endif /* !WIN32 */
+#include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -58,6 +72,13 @@
 
 #define UNSOCK_FILE "barnyard2_alert"
 
+#define UNSOCK_BATCH_MAX 1024           /* alerts per sendmmsg() */
+#define UNSOCK_RING_MIN (64 << 10)
+#define UNSOCK_RING_MAX (1U << 30)
+
+/* records are 8 byte aligned in the ring */
+#define UNSOCK_RECORD_ALIGN(x) (((x) + 7) & ~(uint32_t)7)
+
 
 
 /*
@@ -69,13 +90,31 @@
 
 
 
-/* not used yet */
 typedef struct _SpoAlertUnixSockData
 {
     char *filename;
     int alertsd;
     int sync;
 
+    /* datagrams waiting to be sent, each slot remembers how much of
+     * alertmsg and pkt it used so only that needs clearing for the next */
+    Alertpkt *batch;
+    uint32_t *batchmsglen;
+    uint32_t *batchpktlen;
+    uint32_t batchsize;
+    uint32_t batchlen;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+#endif
+
+    /* shared-memory ring */
+    uint32_t ringsize;
+    int ringfd;
+    AlertRingHeader *ring;
+    uint8_t *ringdata;
+    uint64_t ringhead;
+
 } SpoAlertUnixSockData;
 
 
@@ -84,8 +123,12 @@ void AlertUnixSock(Packet *, void *, uint32_t, void *);
 SpoAlertUnixSockData *ParseAlertUnixSockArgs(char *);
 void AlertUnixSockCleanExit(int, void *);
 void AlertUnixSockRestart(int, void *);
+void AlertUnixSockIdle(int, void *);
 void OpenAlertSock(SpoAlertUnixSockData *);
 void CloseAlertSock(SpoAlertUnixSockData *);
+void OpenAlertRing(SpoAlertUnixSockData *);
+void CloseAlertRing(SpoAlertUnixSockData *);
+void FlushAlertSock(SpoAlertUnixSockData *);
 
 /*
  * Function: SetupAlertUnixSock()
@@ -103,7 +146,7 @@ void AlertUnixSockSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("alert_unixsock", OUTPUT_TYPE_FLAG__ALERT, AlertUnixSockInit);
+    RegisterOutputPlugin("alert_unixsock", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, AlertUnixSockInit);
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "Output plugin: AlertUnixSock is setup...\n"););
 }
 
@@ -130,6 +173,33 @@ void AlertUnixSockInit(char *args)
 
     OpenAlertSock(data);
 
+    if ( data->ringsize )
+    {
+        OpenAlertRing(data);
+    }
+    else
+    {
+        data->batch = (Alertpkt *)SnortAlloc(data->batchsize * sizeof(Alertpkt));
+        data->batchmsglen = (uint32_t *)SnortAlloc(data->batchsize * sizeof(uint32_t));
+        data->batchpktlen = (uint32_t *)SnortAlloc(data->batchsize * sizeof(uint32_t));
+#ifdef HAVE_SENDMMSG
+        {
+            uint32_t i;
+
+            data->msgs = (struct mmsghdr *)SnortAlloc(data->batchsize * sizeof(struct mmsghdr));
+            data->iovs = (struct iovec *)SnortAlloc(data->batchsize * sizeof(struct iovec));
+
+            for ( i = 0; i < data->batchsize; i++ )
+            {
+                data->iovs[i].iov_base = &data->batch[i];
+                data->iovs[i].iov_len = sizeof(Alertpkt);
+                data->msgs[i].msg_hdr.msg_iov = &data->iovs[i];
+                data->msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+        }
+#endif
+    }
+
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Linking UnixSockAlert functions to call lists...\n"););
 
     /* Set the preprocessor function into the function list */
@@ -137,6 +207,34 @@ void AlertUnixSockInit(char *args)
 
     AddFuncToCleanExitList(AlertUnixSockCleanExit, data);
     AddFuncToRestartList(AlertUnixSockRestart, data);
+    if ( data->batchsize > 1 )
+        AddFuncToIdleList(AlertUnixSockIdle, data);
+}
+
+
+/* <number>[K|M|G] */
+static uint32_t ParseAlertUnixSockSize(const char *arg)
+{
+    unsigned long size;
+    char *end;
+
+    size = strtoul(arg, &end, 10);
+
+    if ( end == arg )
+        FatalError("alert_unixsock: invalid size \"%s\" in %s(%i)\n",
+                   arg, file_name, file_line);
+
+    if ( toupper(*end) == 'G' )
+        size <<= 30;
+    else if ( toupper(*end) == 'M' )
+        size <<= 20;
+    else if ( toupper(*end) == 'K' )
+        size <<= 10;
+
+    if ( size > UNSOCK_RING_MAX )
+        size = UNSOCK_RING_MAX;
+
+    return (uint32_t)size;
 }
 
 
@@ -144,9 +242,11 @@ void AlertUnixSockInit(char *args)
  * Function: ParseAlertUnixSockArgs(char *)
  *
  * Purpose: Process positional args, if any.  Syntax is:
- * output alert_unixsock: [path ["sync"]]
+ * output alert_unixsock: [path ["sync"] ["batch=" n] ["ring=" size]]
  * path ::= <path of filesystem relative to log dir>
  * "sync" ::= specify that communication must be synchronous
+ * n ::= number of alerts sent per system call, default 1
+ * size ::= size of the shared-memory ring, rounded up to a power of two
  *
  * Arguments: args => argument list
  *
@@ -166,6 +266,8 @@ SpoAlertUnixSockData *ParseAlertUnixSockArgs(char *args)
         FatalError("alert_unixsock: unable to allocate memory!\n");
     }
     data->sync = 0;
+    data->batchsize = 1;
+    data->ringfd = -1;
 
     if ( !args ) args = "";
     toks = mSplit((char *)args, " \t", 0, &num_toks, '\\');
@@ -174,25 +276,38 @@ SpoAlertUnixSockData *ParseAlertUnixSockArgs(char *args)
     {
         const char* tok = toks[i];
 
-        switch (i)
+        if ( i == 0 )
         {
-            case 0:
-                filename = tok;
-                break;
+            filename = tok;
+        }
+        else if ( !strcasecmp(tok, "sync") )
+        {
+            data->sync = 1;
+        }
+        else if ( !strncasecmp(tok, "batch=", 6) )
+        {
+            data->batchsize = strtoul(tok + 6, NULL, 10);
+            if ( data->batchsize < 1 || data->batchsize > UNSOCK_BATCH_MAX )
+                FatalError("alert_unixsock: batch must be 1 to %d in %s(%i): %s\n",
+                    UNSOCK_BATCH_MAX, file_name, file_line, tok);
+        }
+        else if ( !strncasecmp(tok, "ring=", 5) )
+        {
+            uint32_t size = ParseAlertUnixSockSize(tok + 5);
 
-            case 1:
-                if ( !strcasecmp(tok, "sync") )
-                {
-                    data->sync = 1;
-                    continue;
-                }
-                /* Otherwise fall through to error */
-            case 2:
-                FatalError("alert_unixsock: error in %s(%i): %s\n",
-                    file_name, file_line, tok);
-                break;
+            for ( data->ringsize = UNSOCK_RING_MIN; data->ringsize < size; )
+                data->ringsize <<= 1;
+        }
+        else
+        {
+            FatalError("alert_unixsock: error in %s(%i): %s\n",
+                file_name, file_line, tok);
         }
     }
+
+    if ( data->sync && (data->batchsize > 1 || data->ringsize) )
+        FatalError("alert_unixsock: sync can not be used with batch or ring in %s(%i)\n",
+            file_name, file_line);
     
     if ( !filename )
     { 
@@ -211,6 +326,168 @@ SpoAlertUnixSockData *ParseAlertUnixSockArgs(char *args)
     return data;
 }
 
+/*
+ * Fills in where the headers of the packet start, as offsets from the
+ * start of the packet, and returns the validity flags.
+ */
+static uint32_t AlertUnixSockOffsets(Packet *p, uint32_t *dlthdr, uint32_t *nethdr,
+                                     uint32_t *transhdr, uint32_t *pdata)
+{
+    uint32_t val = 0;
+
+    *dlthdr = *nethdr = *transhdr = *pdata = 0;
+
+    if (p->eh) 
+    {
+        *dlthdr=(char *)p->eh-(char *)p->pkt;
+    }
+
+    /* we don't log any headers besides eth yet */
+    if (IPH_IS_VALID(p)) 
+    {
+        *nethdr=(char *)p->iph-(char *)p->pkt;
+
+        switch(GET_IPH_PROTO(p))
+        {
+            case IPPROTO_TCP:
+               if (p->tcph) 
+               {
+                   *transhdr=(char *)p->tcph-(char *)p->pkt;
+               }
+               break;
+
+            case IPPROTO_UDP:
+                if (p->udph) 
+                {
+                    *transhdr=(char *)p->udph-(char *)p->pkt;
+                }
+                break;
+
+            case IPPROTO_ICMP:
+               if (p->icmph) 
+               {
+                   *transhdr=(char *)p->icmph-(char *)p->pkt;
+               }
+               break;
+
+            default:
+                /* transhdr stays 0 */
+                val|=NO_TRANSHDR;
+                break;
+        }
+    }
+
+    if (p->data) *pdata=p->data - p->pkt;
+
+    return val;
+}
+
+/*
+ * Writes the alert as an AlertRecord to the ring, or counts it as dropped
+ * if the consumer has not made room for it.
+ */
+static void AlertUnixSockRing(SpoAlertUnixSockData *data, Packet *p,
+                              Unified2EventCommon *event, SigNode *sn)
+{
+    AlertRingHeader *ring = data->ring;
+    AlertRecord *rec;
+    uint64_t head = data->ringhead, tail;
+    uint32_t msglen, caplen, len, off, skip;
+
+    msglen = (sn != NULL && sn->msg != NULL) ? strlen(sn->msg) : 0;
+    if (msglen > 0xffff)
+        msglen = 0xffff;
+    caplen = p->pkt ? p->pkth->caplen : 0;
+
+    len = UNSOCK_RECORD_ALIGN(sizeof(AlertRecord) + msglen + caplen);
+    off = head & (data->ringsize - 1);
+    skip = (off + len > data->ringsize) ? data->ringsize - off : 0;
+
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head + skip + len - tail > data->ringsize)
+    {
+        ring->dropped++;
+        return;
+    }
+
+    if (skip)
+    {
+        /* the record does not fit before the end, wrap */
+        rec = (AlertRecord *)(data->ringdata + off);
+        rec->type = ALERT_RECORD_PAD;
+        rec->version = ALERT_RING_VERSION;
+        rec->length = skip;
+        head += skip;
+        off = 0;
+    }
+
+    rec = (AlertRecord *)(data->ringdata + off);
+    rec->type = ALERT_RECORD_ALERT;
+    rec->version = ALERT_RING_VERSION;
+    rec->msglen = msglen;
+    rec->length = len;
+    rec->sensor_id = ntohl(event->sensor_id);
+    rec->event_id = ntohl(event->event_id);
+    rec->event_second = ntohl(event->event_second);
+    rec->event_microsecond = ntohl(event->event_microsecond);
+    rec->signature_id = ntohl(event->signature_id);
+    rec->generator_id = ntohl(event->generator_id);
+    rec->signature_revision = ntohl(event->signature_revision);
+    rec->classification_id = ntohl(event->classification_id);
+    rec->priority_id = ntohl(event->priority_id);
+
+    if (p->pkt)
+    {
+        rec->ts_sec = p->pkth->ts.tv_sec;
+        rec->ts_usec = p->pkth->ts.tv_usec;
+        rec->caplen = caplen;
+        rec->pktlen = p->pkth->len;
+        rec->val = AlertUnixSockOffsets(p, &rec->dlthdr, &rec->nethdr,
+                                        &rec->transhdr, &rec->data);
+    }
+    else
+    {
+        rec->ts_sec = rec->ts_usec = rec->caplen = rec->pktlen = 0;
+        rec->dlthdr = rec->nethdr = rec->transhdr = rec->data = 0;
+        rec->val = NOPACKET_STRUCT;
+    }
+
+    if (msglen)
+        memcpy((uint8_t *)(rec + 1), sn->msg, msglen);
+    if (caplen)
+        memcpy((uint8_t *)(rec + 1) + msglen, p->pkt, caplen);
+
+    head += len;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    data->ringhead = head;
+}
+
+/*
+ * Sends the datagrams waiting in the batch.  As with single alerts, errors
+ * are ignored in non-sync mode.
+ */
+void FlushAlertSock(SpoAlertUnixSockData *data)
+{
+    uint32_t off = 0;
+    int sent;
+
+    while (off < data->batchlen)
+    {
+#ifdef HAVE_SENDMMSG
+        sent = sendmmsg(data->alertsd, data->msgs + off, data->batchlen - off, 0);
+#else
+        sent = send(data->alertsd, (const void *)&data->batch[off], sizeof(Alertpkt), 0) < 0 ? -1 : 1;
+#endif
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            break;
+        off += sent;
+    }
+
+    data->batchlen = 0;
+}
+
 /****************************************************************************
  *
  * Function: SpoUnixSockAlert(Packet *, char *)
@@ -223,9 +500,10 @@ SpoAlertUnixSockData *ParseAlertUnixSockArgs(char *args)
  ***************************************************************************/
 void AlertUnixSock(Packet *p, void *event, uint32_t event_type, void *arg)
 {
-    static Alertpkt		alertpkt;
+    Alertpkt		*alertpkt;
 	SigNode				*sn;
     SpoAlertUnixSockData *data;
+    uint32_t len;
     char buf[1];
     int err;
 
@@ -236,89 +514,75 @@ void AlertUnixSock(Packet *p, void *event, uint32_t event_type, void *arg)
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "Logging Alert data!\n"););
 
-    memset((char *)&alertpkt, 0, sizeof(alertpkt)); /* bzero() deprecated, replaced with memset() */
-    if (event)
+	sn = GetSigByGidSid(ntohl(((Unified2EventCommon *)event)->generator_id),
+			    ntohl(((Unified2EventCommon *)event)->signature_id),
+			    ntohl(((Unified2EventCommon *)event)->signature_revision));
+
+    if (data->ring)
     {
-	memmove((void *) &alertpkt.event, (const void *)event, sizeof(Unified2EventCommon)); /* bcopy() deprecated, replaced by memmove() */
+        AlertUnixSockRing(data, p, (Unified2EventCommon *)event, sn);
+        return;
     }
 
-    if(p && p->pkt)
+    /* Only what the previous alert in this slot used needs clearing */
+    alertpkt = &data->batch[data->batchlen];
+
+    memmove((void *) &alertpkt->event, (const void *)event, sizeof(Unified2EventCommon)); /* bcopy() deprecated, replaced by memmove() */
+    alertpkt->val = 0;
+
+    len = 0;
+    if(p->pkt)
     {
 	/* bcopy() deprecated, replaced by memmove() */
-	memmove((void *) &alertpkt.pkth, (const void *)p->pkth, sizeof(struct pcap_pkthdr));
-	memmove(alertpkt.pkt, (const void *)p->pkt,
-		 alertpkt.pkth.caplen > SNAPLEN ? SNAPLEN : alertpkt.pkth.caplen);
+	memmove((void *) &alertpkt->pkth, (const void *)p->pkth, sizeof(struct pcap_pkthdr));
+	len = alertpkt->pkth.caplen > SNAPLEN ? SNAPLEN : alertpkt->pkth.caplen;
+	memmove(alertpkt->pkt, (const void *)p->pkt, len);
     }
     else
-        alertpkt.val|=NOPACKET_STRUCT;
-
-	sn = GetSigByGidSid(ntohl(((Unified2EventCommon *)event)->generator_id),
-			    ntohl(((Unified2EventCommon *)event)->signature_id),
-			    ntohl(((Unified2EventCommon *)event)->signature_revision));
+    {
+        memset(&alertpkt->pkth, 0, sizeof(struct pcap_pkthdr));
+        alertpkt->val|=NOPACKET_STRUCT;
+    }
 
+    if (data->batchpktlen[data->batchlen] > len)
+        memset(alertpkt->pkt + len, 0, data->batchpktlen[data->batchlen] - len);
+    data->batchpktlen[data->batchlen] = len;
 
+    len = 0;
     if (sn != NULL)
     {
+	len = strlen(sn->msg) > ALERTMSG_LENGTH-1 ? ALERTMSG_LENGTH - 1 : strlen(sn->msg);
 	/* bcopy() deprecated, replaced by memmove() */
-	memmove((void *) alertpkt.alertmsg, (const void *) sn->msg,
-		strlen(sn->msg) > ALERTMSG_LENGTH-1 ? ALERTMSG_LENGTH - 1 : strlen(sn->msg));
+	memmove((void *) alertpkt->alertmsg, (const void *) sn->msg, len);
     }
 
+    if (data->batchmsglen[data->batchlen] > len)
+        memset(alertpkt->alertmsg + len, 0, data->batchmsglen[data->batchlen] - len);
+    data->batchmsglen[data->batchlen] = len;
+
     /* some data which will help monitoring utility to dissect packet */
-    if(!(alertpkt.val & NOPACKET_STRUCT))
+    if(!(alertpkt->val & NOPACKET_STRUCT))
     {
-        if(p)
-        {
-            if (p->eh) 
-            {
-                alertpkt.dlthdr=(char *)p->eh-(char *)p->pkt;
-            }
-    
-            /* we don't log any headers besides eth yet */
-            if (IPH_IS_VALID(p) && p->pkt) 
-            {
-                alertpkt.nethdr=(char *)p->iph-(char *)p->pkt;
-	
-                switch(GET_IPH_PROTO(p))
-                {
-                    case IPPROTO_TCP:
-                       if (p->tcph) 
-                       {
-                           alertpkt.transhdr=(char *)p->tcph-(char *)p->pkt;
-                       }
-                       break;
-		    
-                    case IPPROTO_UDP:
-                        if (p->udph) 
-                        {
-                            alertpkt.transhdr=(char *)p->udph-(char *)p->pkt;
-                        }
-                        break;
-		    
-                    case IPPROTO_ICMP:
-                       if (p->icmph) 
-                       {
-                           alertpkt.transhdr=(char *)p->icmph-(char *)p->pkt;
-                       }
-                       break;
-		    
-                    default:
-                        /* alertpkt.transhdr is null due to initial bzero */
-                        alertpkt.val|=NO_TRANSHDR;
-                        break;
-                }
-            }
-
-            if (p->data && p->pkt) alertpkt.data=p->data - p->pkt;
-        }
+        alertpkt->val |= AlertUnixSockOffsets(p, &alertpkt->dlthdr, &alertpkt->nethdr,
+                                              &alertpkt->transhdr, &alertpkt->data);
+    }
+    else
+    {
+        alertpkt->dlthdr = alertpkt->nethdr = alertpkt->transhdr = alertpkt->data = 0;
     }
 
-
-    err = send(data->alertsd,(const void *)&alertpkt,sizeof(Alertpkt),0);
+    if( ++data->batchlen < data->batchsize )
+        return;
 
     if( !data->sync )
+    {
         /* For backward compatability, in non-sync mode errors are ignored */
+        FlushAlertSock(data);
         return;
+    }
+
+    data->batchlen = 0;
+    err = send(data->alertsd,(const void *)alertpkt,sizeof(Alertpkt),0);
 
     if( err < 0 )
         FatalError("alert_unixsock: error writing alert to '%s': %s!\n", data->filename, strerror(errno));
@@ -330,6 +594,14 @@ void AlertUnixSock(Packet *p, void *event, uint32_t event_type, void *arg)
         FatalError("alert_unixsock: error reading response from '%s': %s!\n", data->filename, strerror(errno));
 }
 
+void AlertUnixSockIdle(int signal, void *arg)
+{
+    SpoAlertUnixSockData *data = (SpoAlertUnixSockData *)arg;
+
+    if( data->batchlen )
+        FlushAlertSock(data);
+}
+
 
 
 /*
@@ -374,11 +646,129 @@ void OpenAlertSock(SpoAlertUnixSockData *data)
     }
 }
 
+/*
+ * Function: OpenAlertRing
+ *
+ * Purpose:  Create the shared-memory ring and pass it to the other end of
+ *           the socket.
+ *
+ * Arguments: data => plugin data, with the socket connected
+ *
+ * Returns: void function
+ */
+void OpenAlertRing(SpoAlertUnixSockData *data)
+{
+    AlertRingAnnounce announce;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    size_t mapsize = sizeof(AlertRingHeader) + data->ringsize;
+    void *map;
+
+#ifdef HAVE_MEMFD_CREATE
+    data->ringfd = memfd_create("barnyard2_alert_ring", MFD_CLOEXEC);
+#else
+    {
+        FILE *fp = tmpfile();
+
+        /* the descriptor outlives the stream, which is unlinked already */
+        data->ringfd = fp ? dup(fileno(fp)) : -1;
+        if( fp ) fclose(fp);
+    }
+#endif
+    if( data->ringfd < 0 )
+        FatalError("alert_unixsock: unable to create ring: %s\n", strerror(errno));
+
+    if( ftruncate(data->ringfd, mapsize) < 0 )
+        FatalError("alert_unixsock: unable to size ring to %lu bytes: %s\n",
+            (unsigned long)mapsize, strerror(errno));
+
+    map = mmap(NULL, mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, data->ringfd, 0);
+    if( map == MAP_FAILED )
+        FatalError("alert_unixsock: unable to map ring: %s\n", strerror(errno));
+
+    data->ring = (AlertRingHeader *)map;
+    data->ringdata = (uint8_t *)map + sizeof(AlertRingHeader);
+    data->ringhead = 0;
+    data->ring->magic = ALERT_RING_MAGIC;
+    data->ring->version = ALERT_RING_VERSION;
+    data->ring->size = data->ringsize;
+
+    memset(&announce, 0, sizeof(announce));
+    announce.magic = ALERT_RING_MAGIC;
+    announce.version = ALERT_RING_VERSION;
+    announce.mapsize = mapsize;
+
+    iov.iov_base = &announce;
+    iov.iov_len = sizeof(announce);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &data->ringfd, sizeof(int));
+
+    if( sendmsg(data->alertsd, &msg, 0) < 0 )
+        FatalError("alert_unixsock: unable to pass ring to '%s': %s\n",
+            data->filename, strerror(errno));
+
+    LogMessage("alert_unixsock: passed a %u byte ring to '%s'\n",
+        data->ringsize, data->filename);
+}
+
+void CloseAlertRing(SpoAlertUnixSockData *data)
+{
+    if( data->ring != NULL )
+    {
+        if( data->ring->dropped )
+            LogMessage("alert_unixsock: %lu alerts did not fit in the ring\n",
+                (unsigned long)data->ring->dropped);
+
+        munmap(data->ring, sizeof(AlertRingHeader) + data->ringsize);
+        data->ring = NULL;
+    }
+
+    if( data->ringfd >= 0 )
+    {
+        close(data->ringfd);
+        data->ringfd = -1;
+    }
+}
+
+static void AlertUnixSockFree(SpoAlertUnixSockData *data)
+{
+    if( data->batchlen )
+        FlushAlertSock(data);
+
+    CloseAlertRing(data);
+    CloseAlertSock(data);
+
+    free(data->batch);
+    free(data->batchmsglen);
+    free(data->batchpktlen);
+#ifdef HAVE_SENDMMSG
+    free(data->msgs);
+    free(data->iovs);
+#endif
+}
+
 void AlertUnixSockCleanExit(int signal, void *arg) 
 {
     SpoAlertUnixSockData *data = (SpoAlertUnixSockData *)arg;
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertUnixSockCleanExitFunc\n"););
-    CloseAlertSock(data);
+    AlertUnixSockFree(data);
 
     if(data->filename)
     {
@@ -396,7 +786,7 @@ void AlertUnixSockRestart(int signal, void *arg)
 {
     SpoAlertUnixSockData *data = (SpoAlertUnixSockData *)arg;
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"AlertUnixSockRestartFunc\n"););
-    CloseAlertSock(data);
+    AlertUnixSockFree(data);
 
     if(data->filename)
     {
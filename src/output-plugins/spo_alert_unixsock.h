@@ -53,6 +53,70 @@ typedef struct _Alertpkt
     Unified2EventCommon event;
 } Alertpkt;
 
+/*
+ * Shared-memory ring ("ring" option).  Instead of an Alertpkt datagram per
+ * alert, a single AlertRingAnnounce datagram is sent when the plugin starts,
+ * carrying a file descriptor (SCM_RIGHTS) to map.  The mapping starts with an
+ * AlertRingHeader followed by 'size' bytes of records.  head and tail count
+ * bytes ever written and read; a record starts at offset (head % size) in the
+ * record area.  barnyard2 only writes head, the consumer only writes tail,
+ * and a record that does not fit is dropped and counted instead of waiting.
+ */
+#define ALERT_RING_MAGIC    0x42595247  /* "BYRG" */
+#define ALERT_RING_VERSION  1
+
+typedef struct _AlertRingAnnounce
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t mapsize;      /* header and records */
+} AlertRingAnnounce;
+
+typedef struct _AlertRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;         /* of the record area, a power of two */
+    uint64_t dropped;      /* records that did not fit */
+    uint8_t  pad0[40];
+    uint64_t head;         /* written by barnyard2 */
+    uint8_t  pad1[56];
+    uint64_t tail;         /* written by the consumer */
+    uint8_t  pad2[56];
+} AlertRingHeader;
+
+#define ALERT_RECORD_PAD    0   /* rest of the record area is unused, wrap */
+#define ALERT_RECORD_ALERT  1
+
+/* All fields are in host byte order.  The signature message (msglen bytes,
+ * not terminated) and then the packet (caplen bytes) follow the record, and
+ * length covers all of it, rounded up to a multiple of 8. */
+typedef struct _AlertRecord
+{
+    uint8_t  type;
+    uint8_t  version;      /* of this record type, ALERT_RING_VERSION */
+    uint16_t msglen;
+    uint32_t length;
+    uint32_t val;          /* NOPACKET_STRUCT, NO_TRANSHDR */
+    uint32_t sensor_id;
+    uint32_t event_id;
+    uint32_t event_second;
+    uint32_t event_microsecond;
+    uint32_t signature_id;
+    uint32_t generator_id;
+    uint32_t signature_revision;
+    uint32_t classification_id;
+    uint32_t priority_id;
+    uint32_t ts_sec;       /* packet header */
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t pktlen;
+    uint32_t dlthdr;       /* offsets into the packet, as in Alertpkt */
+    uint32_t nethdr;
+    uint32_t transhdr;
+    uint32_t data;
+} AlertRecord;
+
 void AlertUnixSockSetup(void);
 
 #endif  /* __SPO_ALERT_UNIXSOCK_H__ */
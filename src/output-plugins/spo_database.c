@@ -289,7 +289,7 @@ void DatabaseSetup(void)
        the preproc list */
 
     /* CHECKME: -elz I think it should also support OUTPUT_TYPE_FLAG__LOG.. */
-    RegisterOutputPlugin("database", OUTPUT_TYPE_FLAG__ALERT, DatabaseInit);
+    RegisterOutputPlugin("database", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__OPTIONS, DatabaseInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT, "database(debug): database plugin is registered...\n"););
 }
@@ -822,6 +822,11 @@ void DatabaseInitFinalize(int unused, void *arg)
 	/* XXX */
 	FatalError("database problems with schema version, bailing...\n");
     }
+
+    if( (data->extra_table = CheckExtraTable(data)) == 0)
+    {
+	LogMessage("database: no 'extra' table, extra data will not be logged\n");
+    }
     
     if( (DatabasePluginInitializeSensor(data)))
     {
@@ -1754,6 +1759,40 @@ int dbProcessEventInformation(DatabaseData *data,Packet *p,
 	    }
 	}
     }
+
+    /*** Build queries for the extra data, as many as there are queries left ***/
+    if(data->extra_table)
+    {
+	const ExtraData *ed;
+	char text[EXTRA_DATA_TEXT_MAX];
+
+	for(ed = GetExtraData(event), i = 0;
+	    ed != NULL && data->SQL.query_count < data->SQL.query_total;
+	    ed = ed->next, i++)
+	{
+	    if( (SQLQueryPtr=SQL_GetNextQuery(data)) == NULL)
+	    {
+		goto bad_query;
+	    }
+
+	    ExtraDataText(ed, text, sizeof(text));
+
+	    if (db_fmt_escape(data, SQLQueryPtr, MAX_QUERY_LENGTH,
+			      "INSERT INTO "
+			      "extra (sid,cid,xid,type,datatype,len,data) "
+			      "VALUES (%u,%u,%u,%u,%u,%u,'%s');",
+			      data->sid,
+			      data->cid,
+			      i,
+			      ed->type,
+			      ed->data_type,
+			      ed->length,
+			      text) < 0)
+	    {
+		goto bad_query;
+	    }
+	}
+    }
     
     return 0;
     
@@ -2239,6 +2278,55 @@ int CheckDBVersion(DatabaseData * data)
    return 0;
 }
 
+/*******************************************************************************
+ * Function: CheckExtraTable(DatabaseData * data)
+ *
+ * Purpose: To find out if the schema has the optional extra table, which
+ *          databases created before it was added don't
+ *
+ * Arguments: database information
+ *
+ * Returns: 1 if it does, 0 if not
+ *
+ ******************************************************************************/
+int CheckExtraTable(DatabaseData * data)
+{
+    u_int32_t tables = 0;
+
+    if(data == NULL)
+    {
+	return 0;
+    }
+
+#if defined(ENABLE_MYSQL)
+    if (data->dbtype_id == DB_MYSQL)
+    {
+	if (db_fmt_escape(data, data->SQL_SELECT, MAX_QUERY_LENGTH,
+			  "SELECT COUNT(*) FROM information_schema.tables "
+			  "WHERE table_schema = DATABASE() AND table_name = 'extra'") < 0)
+	{
+	    return 0;
+	}
+    }
+    else
+#endif
+    {
+	if (db_fmt_escape(data, data->SQL_SELECT, MAX_QUERY_LENGTH,
+			  "SELECT COUNT(*) FROM information_schema.tables "
+			  "WHERE table_schema = current_schema() AND table_name = 'extra'") < 0)
+	{
+	    return 0;
+	}
+    }
+
+    if( Select(data->SQL_SELECT,data,&tables))
+    {
+	return 0;
+    }
+
+    return tables != 0;
+}
+
 /*******************************************************************************
  * Function: BeginTransaction(DatabaseData * data)
  *
@@ -2291,6 +2379,7 @@ u_int32_t BeginTransaction(DatabaseData * data)
  ******************************************************************************/
 u_int32_t  CommitTransaction(DatabaseData * data)
 {
+    uint64_t commit_start;
 
     if(data == NULL)
     {
@@ -2310,11 +2399,16 @@ u_int32_t  CommitTransaction(DatabaseData * data)
     {
     default:
 	
+	commit_start = metrics_enabled ? MetricsNow() : 0;
+
 	if( Insert("COMMIT;", data,1))
 	{
 	    /*XXX */
 	    return 1;
 	}
+
+	if (metrics_enabled)
+	    MetricsObserve(&metrics_db_commit, commit_start);
 	
 	goto transaction_success;
 	
@@ -57,6 +57,7 @@
 #include "parser.h"
 #include "rules.h"
 #include "unified2.h"
+#include "extradata.h"
 #include "util.h"
 #include "khash.h"
 
@@ -83,7 +84,7 @@
 #include "plugbase.h"
 
 #ifndef MAX_SQL_QUERY_OPS
-#define MAX_SQL_QUERY_OPS 50 /* In case we get a IP packet with 40 options */
+#define MAX_SQL_QUERY_OPS 64 /* In case we get a IP packet with 40 options and extra data */
 #endif  /* MAX_SQL_QUERY_OPS */
 
 
@@ -340,6 +341,7 @@ typedef struct _DatabaseData
     int    ignore_bpf;
     int    tz;
     int    DBschema_version;
+    int    extra_table;         /* the optional extra table exists */
 
     char     *dbname;
     char     *host;
@@ -467,6 +469,7 @@ int Select(char *, DatabaseData *,u_int32_t *);
 int UpdateLastCid(DatabaseData *, int, int);
 int GetLastCid(DatabaseData *, int,u_int32_t *);
 int CheckDBVersion(DatabaseData *);
+int CheckExtraTable(DatabaseData *);
 
 u_int32_t BeginTransaction(DatabaseData * data);
 u_int32_t CommitTransaction(DatabaseData * data);
@@ -41,6 +41,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/time.h>
 #include <libwebsockets.h>
 #include <curl/curl.h>
 #include <json/json.h>
@@ -58,6 +59,23 @@
 #include "util.h"
 
 
+/* events submitted together, as one JSON array */
+typedef struct _EchidnaBatch
+{
+    char *body;
+    size_t len;
+    size_t size;
+    u_int32_t events;
+    struct _EchidnaBatch *next;
+} EchidnaBatch;
+
+/* a keep-alive connection to the node and the batch it is submitting */
+typedef struct _EchidnaSlot
+{
+    CURL *curl;
+    EchidnaBatch *batch;    /* NULL when idle */
+} EchidnaSlot;
+
 typedef struct _SpoEchidnaData
 {
     char *agent_name;
@@ -73,9 +91,26 @@ typedef struct _SpoEchidnaData
 
     int use_ssl;
 
+    CURLM *multi;
+    EchidnaSlot *slots;
+    char *uri;                  /* session_uri with the session key */
+    u_int32_t window;           /* requests in flight at most */
+    u_int32_t in_flight;
 
+    EchidnaBatch *batch;        /* being filled */
+    u_int32_t batch_size;
+    time_t batch_time;
 
-    CURL *curl;
+    EchidnaBatch *queue_head;   /* waiting for a slot */
+    EchidnaBatch *queue_tail;
+    u_int32_t queue_len;
+    u_int32_t queue_max;
+
+    u_int32_t retry_delay;      /* ms, 0 while the node accepts events */
+    u_int64_t retry_time;
+    u_int64_t dropped;
+
+    time_t session_retry;       /* next control connection attempt */
 } SpoEchidnaData;
 
 static int session_state = 0;
@@ -96,9 +131,21 @@ enum echidna_protocols {
 #define KEYWORD_NODEPORT      "port"
 #define KEYWORD_NODENAME      "name"
 #define KEYWORD_USESSL        "ssl"
+#define KEYWORD_BATCH         "batch"
+#define KEYWORD_WINDOW        "window"
+#define KEYWORD_QUEUE         "queue"
 
 #define DEFAULT_NODEADDRESS   "127.0.0.1"
 #define DEFAULT_NODEPORT      6968
+#define DEFAULT_BATCH         64      /* events per request */
+#define DEFAULT_WINDOW        4       /* requests in flight */
+#define DEFAULT_QUEUE         256     /* batches waiting, oldest dropped beyond */
+
+#define BATCH_FLUSH_INTERVAL  1       /* seconds an event may wait for its batch */
+#define RETRY_MIN_MS          500
+#define RETRY_MAX_MS          30000
+#define EXIT_TIMEOUT          10
+#define SESSION_RETRY         15      /* seconds between control connections */
 
 #define MAX_MSG_LEN       2048
 #define TMP_BUFFER        128
@@ -127,6 +174,12 @@ int EchidnaEventTCPDataAppend(json_object *, Packet *);
 int EchidnaEventUDPDataAppend(json_object *, Packet *);
 
 void EchidnaEventSubmit(SpoEchidnaData *, json_object *);
+void EchidnaIdle(int, void *);
+
+static void EchidnaSubmitInit(SpoEchidnaData *);
+static void EchidnaBatchClose(SpoEchidnaData *);
+static void EchidnaPump(SpoEchidnaData *);
+static int EchidnaDrain(SpoEchidnaData *, time_t);
 
 
 
@@ -150,7 +203,10 @@ callback_lws_mirror(struct libwebsocket_context *this, struct libwebsocket *wsi,
 
           /* session key is invalidated */
           if( session_key != NULL )
+          {
             free(session_key);
+            session_key = NULL;
+          }
 
           session_state = 0;
 
@@ -311,7 +367,7 @@ void EchidnaSetup()
 {
     /* link the preprocessor keyword to the init function in
        the preproc list */
-    RegisterOutputPlugin("echidna", OUTPUT_TYPE_FLAG__ALERT, EchidnaInit);
+    RegisterOutputPlugin("echidna", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, EchidnaInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "Output: Echidna is setup\n"););
 }
@@ -326,9 +382,7 @@ void EchidnaInit(char *args)
     spd_data = InitEchidnaData(args);
 
     AddFuncToPostConfigList(EchidnaInitFinalize, spd_data);
-
-    // TODO: 
-//    AddFuncToIdleList(EchidnaIdle, spd_data);
+    AddFuncToIdleList(EchidnaIdle, spd_data);
 
     lws_set_log_level(0, NULL);
 }
@@ -383,6 +437,8 @@ void EchidnaInitFinalize(int unused, void *arg)
     /* in windows, this will init the winsock stuff */
     curl_global_init(CURL_GLOBAL_ALL);
 
+    EchidnaSubmitInit(spd_data);
+
     /* set the preprocessor function into the function list */
     AddFuncToOutputList(Echidna, OUTPUT_TYPE__ALERT, spd_data);
     AddFuncToCleanExitList(EchidnaCleanExitFunc, spd_data);
@@ -699,6 +755,23 @@ int EchidnaEventUDPDataAppend(json_object *json, Packet *p)
     return 0;
 }
 
+/* open the control websocket the node hands out session keys on */
+static struct libwebsocket *EchidnaControlConnect(SpoEchidnaData *spd_data)
+{
+    /* create a client websocket using mirror protocol */
+    return libwebsocket_client_connect(
+        context,
+        spd_data->node_address,
+        spd_data->node_port,
+        spd_data->use_ssl,
+        "/control",
+        spd_data->node_address,
+        spd_data->node_address,
+        protocols[PROTOCOL_LWS_ECHIDNA].name,
+        -1 // latest
+      );
+}
+
 int EchidnaNodeConnect(SpoEchidnaData *spd_data)
 {
     int ws_ret = 0;
@@ -743,18 +816,7 @@ int EchidnaNodeConnect(SpoEchidnaData *spd_data)
     {
         if (wsi_echidna == NULL)
         {
-            /* create a client websocket using mirror protocol */
-            wsi_echidna = libwebsocket_client_connect(
-                context,
-                spd_data->node_address,
-                spd_data->node_port,
-                spd_data->use_ssl,
-                "/control",
-                spd_data->node_address,
-                spd_data->node_address,
-                protocols[PROTOCOL_LWS_ECHIDNA].name,
-                -1 // latest
-              );
+            wsi_echidna = EchidnaControlConnect(spd_data);
 
             DEBUG_WRAP(DebugMessage(DEBUG_LOG,"echidna: websocket connection opened."););
 
@@ -780,64 +842,444 @@ size_t _curl_dummy_write(char *ptr, size_t size, size_t nmemb, void *userdata)
      return size * nmemb;
 }
 
+static u_int64_t EchidnaNow(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (u_int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* the requests carry the session key in the uri */
+static void EchidnaSessionUri(SpoEchidnaData *spd_data)
+{
+    char uri[2048];
+
+    snprintf(uri, 2048, "%s?session=%s", session_uri, session_key);
+
+    if( spd_data->uri != NULL )
+        free(spd_data->uri);
+
+    spd_data->uri = SnortStrdup(uri);
+}
+
 /*
- * Function: void EchidnaEventSubmit(SpoEchidnaData *spd_data, char *msg)
+ * Function: void EchidnaSubmitInit(SpoEchidnaData *spd_data)
  *
- * Purpose: Submit the JSON event structure to the REST node.
+ * Purpose: Sets up the curl multi handle and one easy handle per in flight
+ *          request.  The easy handles are reused so their connections to the
+ *          node are kept alive between requests.
  *
- * Arguments: args => argument list
+ * Arguments: spd_data => plugin data
  *
  * Returns: void function
  *
  */
-void EchidnaEventSubmit(SpoEchidnaData *spd_data, json_object *json)
+static void EchidnaSubmitInit(SpoEchidnaData *spd_data)
 {
-    CURLcode res;
-    char uri[2048];
-    long rc = 0;
+    u_int32_t i;
 
-    if( spd_data->curl == NULL )
-    {
-        spd_data->curl = curl_easy_init();
+    EchidnaSessionUri(spd_data);
 
-        if( spd_data->curl )
-        {
-            snprintf(uri, 2048, "%s?session=%s", session_uri, session_key);
+    if( (spd_data->multi = curl_multi_init()) == NULL )
+        FatalError("echidna: unable to allocate a CURL multi structure.\n");
 
-            curl_easy_setopt(spd_data->curl, CURLOPT_URL, uri);
-            curl_easy_setopt(spd_data->curl, CURLOPT_WRITEFUNCTION, &_curl_dummy_write);
-        }
-        else
-        {
+    curl_multi_setopt(spd_data->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)spd_data->window);
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(spd_data->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+    spd_data->slots = (EchidnaSlot *)SnortAlloc(spd_data->window * sizeof(EchidnaSlot));
+
+    for( i = 0; i < spd_data->window; i++ )
+    {
+        CURL *curl = curl_easy_init();
+
+        if( curl == NULL )
             FatalError("echidna: unable to allocate a CURL structure.\n");
-        }
+
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &_curl_dummy_write);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, (char *)&spd_data->slots[i]);
+
+        spd_data->slots[i].curl = curl;
+    }
+}
+
+/* the node rejected our session key, it is dropped until a new one arrives */
+static void EchidnaSessionExpired(void)
+{
+    if( session_key != NULL )
+    {
+        free(session_key);
+        session_key = NULL;
+    }
+
+    session_state = 0;
+
+    /* the auth request goes out once the control socket is writeable */
+    if( wsi_echidna != NULL )
+        libwebsocket_callback_on_writable(context, wsi_echidna);
+}
+
+/*
+ * Function: void EchidnaSessionRefresh(SpoEchidnaData *spd_data)
+ *
+ * Purpose: Services the control websocket until the node hands out a new
+ *          session key.  Unlike EchidnaNodeConnect() this never waits, the
+ *          queued batches are held until the key arrives.
+ *
+ * Arguments: spd_data => plugin data
+ *
+ * Returns: void function
+ *
+ */
+static void EchidnaSessionRefresh(SpoEchidnaData *spd_data)
+{
+    if( wsi_echidna == NULL )
+    {
+        if( time(NULL) < spd_data->session_retry )
+            return;
+
+        spd_data->session_retry = time(NULL) + SESSION_RETRY;
+
+        if( (wsi_echidna = EchidnaControlConnect(spd_data)) == NULL )
+            return;
+    }
+
+    libwebsocket_service(context, 0);
+
+    if( session_state == 1 )
+    {
+        EchidnaSessionUri(spd_data);
+        LogMessage("echidna: received a new session key\n");
+    }
+}
+
+/* wait up to 100ms for one of the requests to make progress */
+static void EchidnaWait(SpoEchidnaData *spd_data)
+{
+    /* curl_multi_wait() doesn't wait without transfers, e.g. while backing off */
+    if( spd_data->in_flight )
+        curl_multi_wait(spd_data->multi, NULL, 0, 100, NULL);
+    else
+        usleep(100000);
+}
+
+/*
+ * Queue a batch for submission.  While the node is taking events a full
+ * queue waits for requests to finish, while it is failing the oldest
+ * batches are dropped instead so barnyard2 keeps going.
+ */
+static void EchidnaQueueBatch(SpoEchidnaData *spd_data, EchidnaBatch *batch)
+{
+    EchidnaBatch *old;
+
+    while( spd_data->queue_len >= spd_data->queue_max &&
+           spd_data->retry_delay == 0 && exit_signal == 0 )
+    {
+        EchidnaPump(spd_data);
+        EchidnaWait(spd_data);
+    }
+
+    while( spd_data->queue_len >= spd_data->queue_max && spd_data->queue_head != NULL )
+    {
+        old = spd_data->queue_head;
+
+        if( spd_data->dropped == 0 )
+            ErrorMessage("echidna: node is unavailable, dropping the oldest events\n");
+
+        spd_data->dropped += old->events;
+        spd_data->queue_head = old->next;
+        spd_data->queue_len--;
+
+        free(old->body);
+        free(old);
     }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "submitting: %s\n", json_object_to_json_string( json )););
+    batch->next = NULL;
+
+    if( spd_data->queue_head == NULL )
+        spd_data->queue_head = batch;
+    else
+        spd_data->queue_tail->next = batch;
+
+    spd_data->queue_tail = batch;
+    spd_data->queue_len++;
+}
+
+/* close the JSON array of the batch being filled and queue it */
+static void EchidnaBatchClose(SpoEchidnaData *spd_data)
+{
+    EchidnaBatch *batch = spd_data->batch;
+
+    if( batch == NULL )
+        return;
+
+    if( spd_data->batch_size > 1 )
+        batch->body[batch->len++] = ']';
+    batch->body[batch->len] = '\0';
+
+    spd_data->batch = NULL;
+    EchidnaQueueBatch(spd_data, batch);
+}
+
+/* a single event batch is sent as the bare object, like older nodes expect */
+static void EchidnaBatchAppend(SpoEchidnaData *spd_data, const char *msg, size_t len)
+{
+    EchidnaBatch *batch = spd_data->batch;
+
+    if( batch == NULL )
+    {
+        batch = (EchidnaBatch *)SnortAlloc(sizeof(EchidnaBatch));
+        batch->size = len + 3;
+        batch->body = (char *)SnortAlloc(batch->size);
 
-    curl_easy_setopt(spd_data->curl, CURLOPT_POSTFIELDS, json_object_to_json_string( json ) );
+        spd_data->batch = batch;
+        spd_data->batch_time = time(NULL);
+    }
 
-    while( rc != 200 )
+    /* separator, the message and room for "]\0" */
+    if( batch->len + len + 3 > batch->size )
     {
-        if( ( res = curl_easy_perform(spd_data->curl) ) == CURLE_OK )
+        while( batch->len + len + 3 > batch->size )
+            batch->size *= 2;
+
+        if( (batch->body = (char *)realloc(batch->body, batch->size)) == NULL )
+            FatalError("echidna: out of memory for a %lu byte batch\n",
+                       (unsigned long)batch->size);
+    }
+
+    if( spd_data->batch_size > 1 )
+        batch->body[batch->len++] = batch->events ? ',' : '[';
+
+    memcpy(batch->body + batch->len, msg, len);
+    batch->len += len;
+    batch->events++;
+}
+
+/* back off after a failed request, waiting between half and all of the delay */
+static void EchidnaRetryLater(SpoEchidnaData *spd_data)
+{
+    u_int64_t now = EchidnaNow();
+    u_int32_t wait;
+
+    /* requests that were already in flight don't add to the delay */
+    if( spd_data->retry_delay && now < spd_data->retry_time )
+        return;
+
+    if( spd_data->retry_delay == 0 )
+        spd_data->retry_delay = RETRY_MIN_MS;
+    else if( (spd_data->retry_delay *= 2) > RETRY_MAX_MS )
+        spd_data->retry_delay = RETRY_MAX_MS;
+
+    wait = spd_data->retry_delay / 2 + (u_int32_t)(random() % (spd_data->retry_delay / 2 + 1));
+    spd_data->retry_time = now + wait;
+}
+
+/* hand queued batches to idle slots */
+static void EchidnaStartTransfers(SpoEchidnaData *spd_data)
+{
+    EchidnaBatch *batch;
+    u_int32_t i;
+
+    if( spd_data->retry_delay && EchidnaNow() < spd_data->retry_time )
+        return;
+
+    if( session_state == 0 )
+        return;
+
+    for( i = 0; i < spd_data->window && spd_data->queue_head != NULL; i++ )
+    {
+        EchidnaSlot *slot = &spd_data->slots[i];
+
+        if( slot->batch != NULL )
+            continue;
+
+        batch = spd_data->queue_head;
+        if( (spd_data->queue_head = batch->next) == NULL )
+            spd_data->queue_tail = NULL;
+        spd_data->queue_len--;
+
+        slot->batch = batch;
+        curl_easy_setopt(slot->curl, CURLOPT_URL, spd_data->uri);
+        curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDS, batch->body);
+        curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDSIZE, (long)batch->len);
+        curl_multi_add_handle(spd_data->multi, slot->curl);
+        spd_data->in_flight++;
+
+        /* only probe with a single request while backing off */
+        if( spd_data->retry_delay )
+            break;
+    }
+}
+
+/* collect finished requests, failed batches go back to the head of the queue */
+static void EchidnaCheckTransfers(SpoEchidnaData *spd_data)
+{
+    CURLMsg *msg;
+    int left;
+
+    while( (msg = curl_multi_info_read(spd_data->multi, &left)) != NULL )
+    {
+        EchidnaSlot *slot = NULL;
+        EchidnaBatch *batch;
+        CURLcode res = msg->data.result;
+        long rc = 0;
+
+        if( msg->msg != CURLMSG_DONE )
+            continue;
+
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&slot);
+
+        if( res == CURLE_OK )
+            curl_easy_getinfo(slot->curl, CURLINFO_RESPONSE_CODE, &rc);
+
+        curl_multi_remove_handle(spd_data->multi, slot->curl);
+        spd_data->in_flight--;
+
+        batch = slot->batch;
+        slot->batch = NULL;
+
+        DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "RC: %lu\n", rc););
+
+        if( rc == 200 )
         {
-            curl_easy_getinfo(spd_data->curl, CURLINFO_RESPONSE_CODE, &rc);
-            DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "RC: %lu\n", rc););
+            if( spd_data->retry_delay )
+                LogMessage("echidna: node is accepting events again\n");
 
-            if( rc == 403 )
-            {
-                DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "forbidden. TODO: request new session key\n"););
-                sleep(15);
-            }
-            else if( rc != 200 )
+            spd_data->retry_delay = 0;
+
+            free(batch->body);
+            free(batch);
+            continue;
+        }
+
+        if( rc == 403 )
+        {
+            /* requests still in flight with the old key are rejected too */
+            if( session_state == 1 )
             {
-                DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res)););
-                sleep(15);
+                ErrorMessage("echidna: session key was rejected, requesting a new one\n");
+                EchidnaSessionExpired();
             }
         }
+        else if( spd_data->retry_delay == 0 )
+        {
+            if( res != CURLE_OK )
+                ErrorMessage("echidna: submission failed: %s, retrying\n", curl_easy_strerror(res));
+            else
+                ErrorMessage("echidna: submission failed: HTTP %ld, retrying\n", rc);
+        }
+
+        if( spd_data->queue_head == NULL )
+            spd_data->queue_tail = batch;
+        batch->next = spd_data->queue_head;
+        spd_data->queue_head = batch;
+        spd_data->queue_len++;
+
+        EchidnaRetryLater(spd_data);
     }
 }
 
+/*
+ * Function: void EchidnaPump(SpoEchidnaData *spd_data)
+ *
+ * Purpose: Moves the submissions along without blocking: starts requests
+ *          for queued batches, does whatever socket I/O is ready and
+ *          handles the requests that have finished.
+ *
+ * Arguments: spd_data => plugin data
+ *
+ * Returns: void function
+ *
+ */
+static void EchidnaPump(SpoEchidnaData *spd_data)
+{
+    int running;
+
+    if( session_state == 0 )
+        EchidnaSessionRefresh(spd_data);
+
+    EchidnaStartTransfers(spd_data);
+
+    if( spd_data->in_flight == 0 )
+        return;
+
+    curl_multi_perform(spd_data->multi, &running);
+    EchidnaCheckTransfers(spd_data);
+    EchidnaStartTransfers(spd_data);
+}
+
+/*
+ * Function: int EchidnaDrain(SpoEchidnaData *spd_data, time_t deadline)
+ *
+ * Purpose: Waits for the queued events to be submitted
+ *
+ * Arguments: spd_data => plugin data
+ *            deadline => give up at this time
+ *
+ * Returns: 0 once everything is submitted, 1 otherwise
+ *
+ */
+static int EchidnaDrain(SpoEchidnaData *spd_data, time_t deadline)
+{
+    EchidnaBatchClose(spd_data);
+
+    while( spd_data->queue_head != NULL || spd_data->in_flight )
+    {
+        if( time(NULL) >= deadline )
+            return 1;
+
+        EchidnaPump(spd_data);
+        EchidnaWait(spd_data);
+    }
+
+    return 0;
+}
+
+/*
+ * Function: void EchidnaEventSubmit(SpoEchidnaData *spd_data, json_object *json)
+ *
+ * Purpose: Adds the JSON event structure to the batch for the REST node.
+ *          Full batches are POSTed as a JSON array, up to window requests
+ *          at a time.  Failed requests are retried with a randomized,
+ *          increasing delay while new events keep being batched.
+ *
+ * Arguments: spd_data => plugin data
+ *            json => event
+ *
+ * Returns: void function
+ *
+ */
+void EchidnaEventSubmit(SpoEchidnaData *spd_data, json_object *json)
+{
+    const char *msg = json_object_to_json_string(json);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "submitting: %s\n", msg););
+
+    EchidnaBatchAppend(spd_data, msg, strlen(msg));
+
+    if( spd_data->batch->events >= spd_data->batch_size ||
+        time(NULL) - spd_data->batch_time >= BATCH_FLUSH_INTERVAL )
+        EchidnaBatchClose(spd_data);
+
+    EchidnaPump(spd_data);
+}
+
+/* submit the partial batch and keep the requests moving between records */
+void EchidnaIdle(int signal, void *arg)
+{
+    SpoEchidnaData *spd_data = (SpoEchidnaData *)arg;
+
+    if( spd_data->multi == NULL )
+        return;
+
+    EchidnaBatchClose(spd_data);
+    EchidnaPump(spd_data);
+}
+
 
 /*
  * Function: ParseEchidnaArgs(char *)
@@ -861,6 +1303,9 @@ void ParseEchidnaArgs(SpoEchidnaData *spd_data)
     /* initialise appropariate values to defaults */
     spd_data->node_port = DEFAULT_NODEPORT;
     spd_data->use_ssl = 0;
+    spd_data->batch_size = DEFAULT_BATCH;
+    spd_data->window = DEFAULT_WINDOW;
+    spd_data->queue_max = DEFAULT_QUEUE;
 
     if( spd_data->args == NULL )
     {
@@ -903,6 +1348,27 @@ void ParseEchidnaArgs(SpoEchidnaData *spd_data)
             else
                 LogMessage("echidna: agent_name error\n");
         }
+        else if( !strncasecmp(stoks[0], KEYWORD_BATCH, strlen(KEYWORD_BATCH)) )
+        {
+            if( num_stoks > 1 && atoi(stoks[1]) > 0 )
+                spd_data->batch_size = atoi(stoks[1]);
+            else
+                LogMessage("echidna: batch error\n");
+        }
+        else if( !strncasecmp(stoks[0], KEYWORD_WINDOW, strlen(KEYWORD_WINDOW)) )
+        {
+            if( num_stoks > 1 && atoi(stoks[1]) > 0 )
+                spd_data->window = atoi(stoks[1]);
+            else
+                LogMessage("echidna: window error\n");
+        }
+        else if( !strncasecmp(stoks[0], KEYWORD_QUEUE, strlen(KEYWORD_QUEUE)) )
+        {
+            if( num_stoks > 1 && atoi(stoks[1]) > 0 )
+                spd_data->queue_max = atoi(stoks[1]);
+            else
+                LogMessage("echidna: queue error\n");
+        }
         else
         {
             FatalError("echidna: unrecognised plugin argument \"%s\"!\n", index);
@@ -918,20 +1384,11 @@ void ParseEchidnaArgs(SpoEchidnaData *spd_data)
 
 char *EchidnaTimestamp(u_int32_t sec, u_int32_t usec)
 {
-    struct tm *lt;  /* localtime */
     char *buf;
-    time_t time = sec;
 
     buf = (char *)SnortAlloc(TMP_BUFFER * sizeof(char));
 
-    if( BcOutputUseUtc() )
-        lt = gmtime(&time);
-    else
-        lt = localtime(&time);
-
-    SnortSnprintf(buf, TMP_BUFFER, "%04i-%02i-%02i %02i:%02i:%02i.%06i",
-          1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-          lt->tm_hour, lt->tm_min, lt->tm_sec, usec);
+    FormatTimestamp(TIMESTAMP_ISO_USEC, sec, usec, 0, buf, TMP_BUFFER);
 
     return buf;
 }
@@ -949,8 +1406,47 @@ void EchidnaClose(void *arg)
         if( spd_data->args )
             free(spd_data->args);
 
-        if( spd_data->curl )
-            curl_easy_cleanup(spd_data->curl);
+        if( spd_data->multi )
+        {
+            EchidnaBatch *batch;
+            u_int32_t i;
+
+            if( EchidnaDrain(spd_data, time(NULL) + EXIT_TIMEOUT) )
+            {
+                for( batch = spd_data->queue_head; batch; batch = batch->next )
+                    spd_data->dropped += batch->events;
+
+                for( i = 0; i < spd_data->window; i++ )
+                    if( spd_data->slots[i].batch )
+                        spd_data->dropped += spd_data->slots[i].batch->events;
+            }
+
+            if( spd_data->dropped )
+                ErrorMessage("echidna: %lu events were not submitted\n",
+                             (unsigned long)spd_data->dropped);
+
+            for( i = 0; i < spd_data->window; i++ )
+            {
+                if( (batch = spd_data->slots[i].batch) != NULL )
+                {
+                    curl_multi_remove_handle(spd_data->multi, spd_data->slots[i].curl);
+                    free(batch->body);
+                    free(batch);
+                }
+                curl_easy_cleanup(spd_data->slots[i].curl);
+            }
+
+            while( (batch = spd_data->queue_head) != NULL )
+            {
+                spd_data->queue_head = batch->next;
+                free(batch->body);
+                free(batch);
+            }
+
+            curl_multi_cleanup(spd_data->multi);
+            free(spd_data->slots);
+            free(spd_data->uri);
+        }
 
         free(spd_data);
     }
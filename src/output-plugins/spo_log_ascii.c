@@ -30,8 +30,13 @@
  * This output module provides the default packet logging funtionality
  *
  * Arguments:
- *   
- * None.
+ *
+ * output log_ascii: [max_files <count>] [, flush <seconds>]
+ *
+ *   max_files  number of per-host log files kept open between packets,
+ *              0 opens and closes the file for every packet (default 64)
+ *   flush      flush the open files at least every <seconds> and when the
+ *              spool is idle (default 1)
  *
  * Effect:
  *
@@ -39,6 +44,10 @@
  *
  * Comments:
  *
+ * Files are cached least recently used first, along with the per-host
+ * directories already created, so that hosts that alert repeatedly do
+ * not cost a mkdir()/fopen()/fclose() for every packet.
+ *
  */
 
 #ifdef HAVE_CONFIG_H
@@ -48,6 +57,7 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -64,19 +74,54 @@
 #include "decode.h"
 #include "log.h"
 #include "map.h"
+#include "mstring.h"
 #include "parser.h"
 #include "plugbase.h"
 #include "unified2.h"
 #include "util.h"
 #include "ipv6_port.h"
 
+#include "khash.h"
+
+#define DEFAULT_MAX_FILES       64
+#define DEFAULT_FLUSH_INTERVAL  1
+#define MAX_LOG_DIRS            4096
+
+typedef struct _LogAsciiFile
+{
+    char *path;
+    FILE *fp;
+    struct _LogAsciiFile *prev;
+    struct _LogAsciiFile *next;
+} LogAsciiFile;
+
+KHASH_MAP_INIT_STR(LogAsciiFiles, LogAsciiFile *)
+KHASH_SET_INIT_STR(LogAsciiDirs)
+
+typedef struct _LogAsciiData
+{
+    khash_t(LogAsciiFiles) *files;  /* open log files keyed by path */
+    LogAsciiFile *mru;              /* most recently used open file */
+    LogAsciiFile *lru;              /* least recently used open file */
+    int num_files;
+    int max_files;
+    khash_t(LogAsciiDirs) *dirs;    /* per-host directories known to exist */
+    time_t flush_interval;
+    time_t last_flush;
+} LogAsciiData;
+
 /* internal functions */
 void LogAsciiInit(char *args);
 void LogAscii(Packet *, void *, uint32_t, void *);
 void LogAsciiCleanExit(int signal, void *arg);
 void LogAsciiRestart(int signal, void *arg);
+void LogAsciiIdle(int signal, void *arg);
 char *IcmpFileName(Packet * p);
-static FILE *OpenLogFile(int mode, Packet * p);
+static LogAsciiData *ParseLogAsciiArgs(char *);
+static FILE *OpenLogFile(LogAsciiData *, int mode, Packet * p);
+static FILE *LogAsciiOpen(LogAsciiData *, char *, char *);
+static void LogAsciiMakeDir(LogAsciiData *, char *);
+static void LogAsciiFlush(LogAsciiData *);
 
 
 #define DUMP              1
@@ -89,25 +134,103 @@ void LogAsciiSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("log_ascii", OUTPUT_TYPE_FLAG__LOG, LogAsciiInit);
+    RegisterOutputPlugin("log_ascii", OUTPUT_TYPE_FLAG__LOG, DECODE_LEVEL__PAYLOAD, LogAsciiInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "Output: LogAscii is setup\n"););
 }
 
 void LogAsciiInit(char *args)
 {
+    LogAsciiData *data;
+
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "Output: Ascii logging initialized\n"););
 
+    data = ParseLogAsciiArgs(args);
+
     /* Set the preprocessor function into the function list */
-    AddFuncToOutputList(LogAscii, OUTPUT_TYPE__LOG, NULL);
-    AddFuncToCleanExitList(LogAsciiCleanExit, NULL);
-    AddFuncToRestartList(LogAsciiRestart, NULL);
+    AddFuncToOutputList(LogAscii, OUTPUT_TYPE__LOG, data);
+    AddFuncToCleanExitList(LogAsciiCleanExit, data);
+    AddFuncToRestartList(LogAsciiRestart, data);
+    AddFuncToIdleList(LogAsciiIdle, data);
+}
+
+/*
+ * Function: ParseLogAsciiArgs(char *)
+ *
+ * Purpose: Process the comma separated options, if any.  Syntax is:
+ * output log_ascii: [max_files <count>] [, flush <seconds>]
+ *
+ * Arguments: args => argument list
+ *
+ * Returns: allocated and initialized LogAsciiData
+ */
+static LogAsciiData *ParseLogAsciiArgs(char *args)
+{
+    LogAsciiData *data;
+    char **toks;
+    char **stoks;
+    int num_toks;
+    int num_stoks;
+    char *end;
+    long value;
+    int i;
+
+    data = (LogAsciiData *)SnortAlloc(sizeof(LogAsciiData));
+    data->max_files = DEFAULT_MAX_FILES;
+    data->flush_interval = DEFAULT_FLUSH_INTERVAL;
+
+    if (args != NULL)
+    {
+        toks = mSplit(args, ",", 0, &num_toks, '\\');
+
+        for (i = 0; i < num_toks; i++)
+        {
+            stoks = mSplit(toks[i], " \t", 2, &num_stoks, 0);
+
+            if (num_stoks != 2)
+                FatalError("log_ascii: invalid option in %s(%i): %s\n",
+                    file_name, file_line, toks[i]);
+
+            value = strtol(stoks[1], &end, 10);
+            if (*end != '\0' || value < 0)
+                FatalError("log_ascii: invalid value in %s(%i): %s\n",
+                    file_name, file_line, toks[i]);
+
+            if (!strcasecmp("max_files", stoks[0]))
+                data->max_files = (int)value;
+            else if (!strcasecmp("flush", stoks[0]))
+                data->flush_interval = (time_t)value;
+            else
+                FatalError("log_ascii: unknown option in %s(%i): %s\n",
+                    file_name, file_line, toks[i]);
+
+            mSplitFree(&stoks, num_stoks);
+        }
+
+        mSplitFree(&toks, num_toks);
+    }
+
+    if (data->max_files > 0)
+    {
+        data->files = kh_init(LogAsciiFiles);
+        data->dirs = kh_init(LogAsciiDirs);
+
+        if (data->files == NULL || data->dirs == NULL)
+            FatalError("log_ascii: unable to allocate memory!\n");
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "log_ascii: max_files %d, flush %lu\n",
+        data->max_files, (unsigned long)data->flush_interval););
+
+    return data;
 }
 
 void LogAscii(Packet *p, void *event, uint32_t event_type, void *arg)
 {
+    LogAsciiData *data = (LogAsciiData *)arg;
     FILE *log_ptr = NULL;
 	SigNode				*sn = NULL;
+    time_t now;
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "LogPkt started\n"););
 
@@ -123,16 +246,16 @@ void LogAscii(Packet *p, void *event, uint32_t event_type, void *arg)
     if(p)
     { 
         if(IPH_IS_VALID(p))
-            log_ptr = OpenLogFile(0, p);
+            log_ptr = OpenLogFile(data, 0, p);
 #ifndef NO_NON_ETHER_DECODER
         else if(p->ah)
-            log_ptr = OpenLogFile(ARP, p);
+            log_ptr = OpenLogFile(data, ARP, p);
 #endif
         else
-            log_ptr = OpenLogFile(NON_IP, p);
+            log_ptr = OpenLogFile(data, NON_IP, p);
     }
     else
-        log_ptr = OpenLogFile(GENERIC_LOG, p);
+        log_ptr = OpenLogFile(data, GENERIC_LOG, p);
 
     if(!log_ptr)
         FatalError("Unable to open packet log file\n");
@@ -160,19 +283,275 @@ void LogAscii(Packet *p, void *event, uint32_t event_type, void *arg)
             PrintArpHeader(log_ptr, p);
 #endif
     }
-    if(log_ptr)
+
+    if(data->files == NULL)
+    {
         fclose(log_ptr);
+        return;
+    }
+
+    now = time(NULL);
+    if(now - data->last_flush >= data->flush_interval)
+    {
+        LogAsciiFlush(data);
+        data->last_flush = now;
+    }
 }
 
+/*
+ * Function: LogAsciiFlush(LogAsciiData *)
+ *
+ * Purpose: Write out the buffered output of all cached log files
+ *
+ * Arguments: data => plugin data
+ *
+ * Returns: void function
+ */
+static void LogAsciiFlush(LogAsciiData *data)
+{
+    LogAsciiFile *file;
+
+    for(file = data->mru; file != NULL; file = file->next)
+        fflush(file->fp);
+}
+
+/* Unlink a file from the LRU list */
+static void LogAsciiUnlink(LogAsciiData *data, LogAsciiFile *file)
+{
+    if(file->prev)
+        file->prev->next = file->next;
+    else
+        data->mru = file->next;
+
+    if(file->next)
+        file->next->prev = file->prev;
+    else
+        data->lru = file->prev;
+
+    file->prev = file->next = NULL;
+}
+
+/* Link a file at the most recently used end of the LRU list */
+static void LogAsciiLinkFront(LogAsciiData *data, LogAsciiFile *file)
+{
+    file->prev = NULL;
+    file->next = data->mru;
+
+    if(data->mru)
+        data->mru->prev = file;
+    else
+        data->lru = file;
+
+    data->mru = file;
+}
+
+/* Close a cached file and forget about it */
+static void LogAsciiClose(LogAsciiData *data, LogAsciiFile *file)
+{
+    khint_t k;
+
+    k = kh_get(LogAsciiFiles, data->files, file->path);
+    if(k != kh_end(data->files))
+        kh_del(LogAsciiFiles, data->files, k);
+
+    LogAsciiUnlink(data, file);
+    data->num_files--;
+
+    fclose(file->fp);
+    free(file->path);
+    free(file);
+}
+
+/* Forget about a directory that turned out to be gone */
+static void LogAsciiForgetDir(LogAsciiData *data, char *log_path)
+{
+    khint_t k;
+
+    if(data->dirs == NULL)
+        return;
+
+    k = kh_get(LogAsciiDirs, data->dirs, log_path);
+    if(k != kh_end(data->dirs))
+    {
+        free((char *)kh_key(data->dirs, k));
+        kh_del(LogAsciiDirs, data->dirs, k);
+    }
+}
+
+/* Forget about all created directories */
+static void LogAsciiClearDirs(LogAsciiData *data)
+{
+    khint_t k;
+
+    for(k = kh_begin(data->dirs); k != kh_end(data->dirs); ++k)
+    {
+        if(kh_exist(data->dirs, k))
+            free((char *)kh_key(data->dirs, k));
+    }
+    kh_clear(LogAsciiDirs, data->dirs);
+}
+
+static void LogAsciiCleanup(int signal, void *arg, const char *msg)
+{
+    LogAsciiData *data = (LogAsciiData *)arg;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "%s\n", msg););
+
+    if(data == NULL)
+        return;
+
+    if(data->files)
+    {
+        while(data->lru)
+            LogAsciiClose(data, data->lru);
+        kh_destroy(LogAsciiFiles, data->files);
+    }
+    if(data->dirs)
+    {
+        LogAsciiClearDirs(data);
+        kh_destroy(LogAsciiDirs, data->dirs);
+    }
+
+    free(data);
+}
 
 void LogAsciiCleanExit(int signal, void *arg)
 {
-    return;
+    LogAsciiCleanup(signal, arg, "LogAsciiCleanExit");
 }
 
 void LogAsciiRestart(int signal, void *arg)
 {
-    return;
+    LogAsciiCleanup(signal, arg, "LogAsciiRestart");
+}
+
+/* don't leave output sitting in the cached files while the spool is idle */
+void LogAsciiIdle(int signal, void *arg)
+{
+    LogAsciiData *data = (LogAsciiData *)arg;
+
+    if(data == NULL || data->files == NULL)
+        return;
+
+    LogAsciiFlush(data);
+    data->last_flush = time(NULL);
+}
+
+/*
+ * Function: LogAsciiMakeDir(LogAsciiData *, char *)
+ *
+ * Purpose: Create a per-host log directory unless it is known to exist.
+ *
+ * Arguments: data => plugin data
+ *            log_path => directory name
+ *
+ * Returns: void function
+ */
+static void LogAsciiMakeDir(LogAsciiData *data, char *log_path)
+{
+    int ret;
+
+    if(data->dirs &&
+       kh_get(LogAsciiDirs, data->dirs, log_path) != kh_end(data->dirs))
+    {
+        return;
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Creating directory: %s\n", log_path););
+
+    /* build the log directory */
+    if(mkdir(log_path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH))
+    {
+
+        if(errno != EEXIST)
+        {
+            FatalError("OpenLogFile() => mkdir(%s) log directory: %s\n",
+                       log_path, strerror(errno));
+        }
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Directory Created!\n"););
+
+    if(data->dirs)
+    {
+        /* the set only saves syscalls, start over rather than grow forever */
+        if(kh_size(data->dirs) >= MAX_LOG_DIRS)
+            LogAsciiClearDirs(data);
+
+        kh_put(LogAsciiDirs, data->dirs, SnortStrdup(log_path), &ret);
+    }
+}
+
+/*
+ * Function: LogAsciiOpen(LogAsciiData *, char *, char *)
+ *
+ * Purpose: Return the cached handle of a log file, opening it for append
+ *          if needed.  The least recently used file is closed when the
+ *          cache is full.  If the per-host directory was removed since it
+ *          was created (eg. by log rotation) it is created again.
+ *
+ * Arguments: data => plugin data
+ *            log_path => per-host directory, NULL if there is none
+ *            log_file => file name
+ *
+ * Returns: FILE pointer, fatal error on failure
+ */
+static FILE *LogAsciiOpen(LogAsciiData *data, char *log_path, char *log_file)
+{
+    LogAsciiFile *file;
+    FILE *log_ptr;
+    khint_t k;
+    int ret;
+
+    if(data->files)
+    {
+        k = kh_get(LogAsciiFiles, data->files, log_file);
+        if(k != kh_end(data->files))
+        {
+            file = kh_value(data->files, k);
+            if(file != data->mru)
+            {
+                LogAsciiUnlink(data, file);
+                LogAsciiLinkFront(data, file);
+            }
+            return file->fp;
+        }
+
+        if(data->num_files >= data->max_files)
+            LogAsciiClose(data, data->lru);
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Opening file: %s\n", log_file););
+
+    log_ptr = fopen(log_file, "a");
+    if (!log_ptr && errno == ENOENT && log_path != NULL)
+    {
+        LogAsciiForgetDir(data, log_path);
+        LogAsciiMakeDir(data, log_path);
+        log_ptr = fopen(log_file, "a");
+    }
+    if (!log_ptr)
+    {
+        FatalError("OpenLogFile() => fopen(%s) log file: %s\n",
+                   log_file, strerror(errno));
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "File opened...\n"););
+
+    if(data->files)
+    {
+        file = (LogAsciiFile *)SnortAlloc(sizeof(LogAsciiFile));
+        file->path = SnortStrdup(log_file);
+        file->fp = log_ptr;
+
+        k = kh_put(LogAsciiFiles, data->files, file->path, &ret);
+        kh_value(data->files, k) = file;
+
+        LogAsciiLinkFront(data, file);
+        data->num_files++;
+    }
+
+    return log_ptr;
 }
 
 static char *logfile[] =
@@ -185,17 +564,19 @@ static char *logfile[] =
  *          This function sucks, I've got to find a better way to do this
  *          this stuff.
  *
- * Arguments: None.
+ * Arguments: data => plugin data holding the open file cache
+ *            mode => type of log file
+ *               p => packet to log
  *
- * Returns: FILE pointer on success, else NULL
+ * Returns: FILE pointer on success, else NULL.  The file must only be
+ *          closed by the caller when caching is disabled.
  */
-FILE *OpenLogFile(int mode, Packet * p)
+static FILE *OpenLogFile(LogAsciiData *data, int mode, Packet * p)
 {
     char log_path[STD_BUF]; /* path to log file */
     char log_file[STD_BUF]; /* name of log file */
     char proto[5];      /* logged packet protocol */
     char suffix[5];     /* filename suffix */
-    FILE *log_ptr = NULL;
 #ifdef SUP_IP6
     snort_ip_p ip;
 #endif
@@ -216,14 +597,7 @@ FILE *OpenLogFile(int mode, Packet * p)
     {
         SnortSnprintf(log_file, STD_BUF, "%s/%s", barnyard2_conf->log_dir, logfile[mode]);
 
-        log_ptr = fopen(log_file, "a");
-        if (!log_ptr)
-        {
-            FatalError("OpenLogFile() => fopen(%s) log file: %s\n",
-                       log_file, strerror(errno));
-        }
-
-        return log_ptr;
+        return LogAsciiOpen(data, NULL, log_file);
     }
 
 #ifdef SUP_IP6
@@ -283,20 +657,7 @@ FILE *OpenLogFile(int mode, Packet * p)
         }
     }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Creating directory: %s\n", log_path););
-
-    /* build the log directory */
-    if(mkdir(log_path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH))
-    {
-
-        if(errno != EEXIST)
-        {
-            FatalError("OpenLogFile() => mkdir(%s) log directory: %s\n",
-                       log_path, strerror(errno));
-        }
-    }
-
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Directory Created!\n"););
+    LogAsciiMakeDir(data, log_path);
 
     /* build the log filename */
     if(GET_IPH_PROTO(p) == IPPROTO_TCP ||
@@ -351,18 +712,8 @@ FILE *OpenLogFile(int mode, Packet * p)
         }
     }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "Opening file: %s\n", log_file););
-
     /* finally open the log file */
-    log_ptr = fopen(log_file, "a");
-    if (!log_ptr)
-    {
-        FatalError("OpenLogFile() => fopen(%s) log file: %s\n",
-                   log_file, strerror(errno));
-    }
-
-    DEBUG_WRAP(DebugMessage(DEBUG_FLOW, "File opened...\n"););
-    return log_ptr;
+    return LogAsciiOpen(data, log_path, log_file);
 }
 
 
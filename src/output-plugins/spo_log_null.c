@@ -60,7 +60,7 @@ void LogNullSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("log_null", OUTPUT_TYPE_FLAG__LOG, LogNullInit);
+    RegisterOutputPlugin("log_null", OUTPUT_TYPE_FLAG__LOG, DECODE_LEVEL__NONE, LogNullInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "Output plugin: LogNull is setup...\n"););
 }
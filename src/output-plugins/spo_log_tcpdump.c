@@ -29,6 +29,13 @@
  * Arguments:
  *   
  * filename of the output log (default: snort.log)
+ * [<limit> [<linktype>]] [buffer <size>] [flush <seconds>] [preallocate]
+ * [split]
+ *
+ *   buffer       size of the in memory record buffer (default: 1M)
+ *   flush        write the buffer out at least every <seconds> (default: 1)
+ *   preallocate  reserve <limit> bytes of disk for each file (Linux only)
+ *   split        log reassembled TCP packets as one record per segment
  *
  * Effect:
  *
@@ -41,6 +48,11 @@
  *
  */
 
+/* for fallocate() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -59,8 +71,11 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 
 #include "decode.h"
+#include "checksum.h"
 #include "mstring.h"
 #include "plugbase.h"
 #include "parser.h"
@@ -76,6 +91,11 @@
 
 #define DEFAULT_FILE  "barnyard2.tcpdump.log"
 #define DEFAULT_LIMIT (128*M_BYTES)
+#define DEFAULT_BUFFER (1*M_BYTES)
+#define DEFAULT_FLUSH_INTERVAL 1
+
+/* payload bytes per record when splitting a rebuilt stream */
+#define STREAM_SEGMENT_SIZE 1460
 
 /*
  * <pcap file> ::= <pcap file hdr> [<pcap pkt hdr> <packet>]*
@@ -100,8 +120,27 @@ typedef struct _LogTcpdumpData
 
     int                 autolink;
     int                 linktype;
+
+    /* records are collected here and written to fd in one go */
+    int                 fd;
+    uint8_t             *buf;
+    size_t              buf_size;
+    size_t              buf_len;
+    time_t              lastFlush;
+    time_t              flush_interval;
+    int                 preallocate;
+    int                 split;
 } LogTcpdumpData;
 
+/* on disk <pcap pkt hdr>, see PCAP_PKT_HDR_SZ */
+typedef struct _TcpdumpRecordHdr
+{
+    uint32_t            ts_sec;
+    uint32_t            ts_usec;
+    uint32_t            caplen;
+    uint32_t            len;
+} TcpdumpRecordHdr;
+
 /* list of function prototypes for this preprocessor */
 static void LogTcpdumpInit(char *);
 static LogTcpdumpData *ParseTcpdumpArgs(char *);
@@ -111,8 +150,14 @@ static void TcpdumpInitLogFile(LogTcpdumpData *, int);
 static void TcpdumpRollLogFile(LogTcpdumpData*);
 static void SpoLogTcpdumpCleanExitFunc(int, void *);
 static void SpoLogTcpdumpRestartFunc(int, void *);
+static void SpoLogTcpdumpIdleFunc(int, void *);
 static void LogTcpdumpSingle(Packet *, void *, uint32_t, void *);
 static void LogTcpdumpStream(Packet *, void *, uint32_t, void *);
+static int TcpdumpIsRebuiltStream(LogTcpdumpData *, Packet *);
+static void TcpdumpWriteRecord(LogTcpdumpData *, const struct pcap_pkthdr *, const uint8_t *);
+static void TcpdumpFlush(LogTcpdumpData *);
+static void TcpdumpCloseLogFile(LogTcpdumpData *);
+static int TcpdumpWriteAll(int, struct iovec *, int);
 
 
 /* If you need to instantiate the plugin's data structure, do it here */
@@ -134,7 +179,7 @@ void LogTcpdumpSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("log_tcpdump", OUTPUT_TYPE_FLAG__LOG, LogTcpdumpInit);
+    RegisterOutputPlugin("log_tcpdump", OUTPUT_TYPE_FLAG__LOG, DECODE_LEVEL__NONE, LogTcpdumpInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_INIT,"Output plugin: Log-Tcpdump is setup...\n"););
 }
@@ -168,14 +213,39 @@ static void LogTcpdumpInit(char *args)
     AddFuncToOutputList(LogTcpdump, OUTPUT_TYPE__LOG, data);
     AddFuncToCleanExitList(SpoLogTcpdumpCleanExitFunc, data);
     AddFuncToRestartList(SpoLogTcpdumpRestartFunc, data);
+    AddFuncToIdleList(SpoLogTcpdumpIdleFunc, data);
+}
+
+/* Parse <number>('G'|'M'|K') */
+static size_t ParseTcpdumpSize(const char *tok)
+{
+    char *end;
+    size_t size = strtol(tok, &end, 10);
+
+    if ( tok == end )
+        FatalError("log_tcpdump error in %s(%i): %s\n",
+            file_name, file_line, tok);
+
+    if ( end && toupper(*end) == 'G' )
+        size <<= 30; /* GB */
+
+    else if ( end && toupper(*end) == 'M' )
+        size <<= 20; /* MB */
+
+    else if ( end && toupper(*end) == 'K' )
+        size <<= 10; /* KB */
+
+    return size;
 }
 
 /*
  * Function: ParseTcpdumpArgs(char *)
  *
  * Purpose: Process positional args, if any.  Syntax is:
- * output log_tcpdump: [<logpath> [<limit>]]
+ * output log_tcpdump: [<logpath> [<limit> [<linktype>]]] [<option>]*
  * limit ::= <number>('G'|'M'|K')
+ * option ::= "buffer" <number>('G'|'M'|K') | "flush" <seconds> | "preallocate" |
+ *            "split"
  *
  * Arguments: args => argument list
  *
@@ -187,6 +257,7 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
     int num_toks;
     LogTcpdumpData *data;
     int i;
+    int pos = 0;
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG, "ParseTcpdumpArgs: %s\n", args););
     data = (LogTcpdumpData *) SnortAlloc(sizeof(LogTcpdumpData));
@@ -197,6 +268,9 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
     }
     data->filename = NULL;
     data->limit = DEFAULT_LIMIT;
+    data->fd = -1;
+    data->buf_size = DEFAULT_BUFFER;
+    data->flush_interval = DEFAULT_FLUSH_INTERVAL;
 
     /* by default we will auto adapt to the link type and assume ethernet */
     data->linktype = DLT_EN10MB;
@@ -210,29 +284,55 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
     for (i = 0; i < num_toks; i++)
     {
         const char* tok = toks[i];
-        char *end;
 
-        switch (i)
+        /* keyword options may follow the positional ones */
+        if ( !strcasecmp(tok, "buffer") || !strcasecmp(tok, "flush") )
+        {
+            if ( ++i >= num_toks )
+                FatalError("log_tcpdump: missing value for %s in %s(%i)\n",
+                    tok, file_name, file_line);
+
+            if ( !strcasecmp(tok, "buffer") )
+            {
+                data->buf_size = ParseTcpdumpSize(toks[i]);
+            }
+            else
+            {
+                char *end;
+
+                data->flush_interval = (time_t)strtol(toks[i], &end, 10);
+                if ( *end != '\0' || data->flush_interval < 0 )
+                    FatalError("log_tcpdump error in %s(%i): %s\n",
+                        file_name, file_line, toks[i]);
+            }
+            continue;
+        }
+        if ( !strcasecmp(tok, "preallocate") )
+        {
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+            data->preallocate = 1;
+#else
+            LogMessage("WARNING: log_tcpdump: preallocate is not supported "
+                "on this platform, ignoring.\n");
+#endif
+            continue;
+        }
+        if ( !strcasecmp(tok, "split") )
+        {
+            /* segments are cut at the TCP payload */
+            data->split = 1;
+            RequireDecodeLevel(DECODE_LEVEL__L4);
+            continue;
+        }
+
+        switch (pos++)
         {
             case 0:
                 data->filename = SnortStrdup(tok);
                 break;
 
             case 1:
-                data->limit = strtol(tok, &end, 10);
-
-                if ( tok == end )
-                    FatalError("log_tcpdump error in %s(%i): %s\n",
-                        file_name, file_line, tok);
-
-                if ( end && toupper(*end) == 'G' )
-                    data->limit <<= 30; /* GB */
-
-                else if ( end && toupper(*end) == 'M' )
-                    data->limit <<= 20; /* MB */
-
-                else if ( end && toupper(*end) == 'K' )
-                    data->limit <<= 10; /* KB */
+                data->limit = ParseTcpdumpSize(tok);
                 break;
 
             case 2:
@@ -325,6 +425,12 @@ static LogTcpdumpData *ParseTcpdumpArgs(char *args)
     if ( data->filename == NULL )
         data->filename = SnortStrdup(DEFAULT_FILE);
 
+    if ( data->buf_size < PCAP_PKT_HDR_SZ )
+        FatalError("log_tcpdump: buffer size is too small in %s(%i)\n",
+            file_name, file_line);
+
+    data->buf = (uint8_t *)SnortAlloc(data->buf_size);
+
     DEBUG_WRAP(DebugMessage(
         DEBUG_INIT, "log_tcpdump: '%s' %ld\n", data->filename, data->limit
     ););
@@ -347,7 +453,7 @@ static void LogTcpdump(Packet *p, void *event, uint32_t event_type, void *arg)
 {
     if(p)
     {
-        if(p->packet_flags & PKT_REBUILT_STREAM)
+        if(TcpdumpIsRebuiltStream((LogTcpdumpData *)arg, p))
         {
             LogTcpdumpStream(p, event, event_type, arg);
         }
@@ -358,6 +464,23 @@ static void LogTcpdump(Packet *p, void *event, uint32_t event_type, void *arg)
     }
 }
 
+/*
+ * Function: TcpdumpIsRebuiltStream(LogTcpdumpData *, Packet *)
+ *
+ * Purpose: Unified2 doesn't say whether a packet was reassembled by snort,
+ *          so with "split" a TCP packet carrying more payload than a single
+ *          segment is taken to be one.
+ *
+ * Returns: 1 if the packet should be logged segment by segment
+ */
+static int TcpdumpIsRebuiltStream(LogTcpdumpData *data, Packet *p)
+{
+    if ( p->packet_flags & PKT_REBUILT_STREAM )
+        return 1;
+
+    return data->split && p->tcph != NULL && p->dsize > STREAM_SEGMENT_SIZE;
+}
+
 static INLINE size_t SizeOf (const struct pcap_pkthdr *pkth)
 {
     return PCAP_PKT_HDR_SZ + pkth->caplen;
@@ -386,45 +509,337 @@ static void LogTcpdumpSingle(Packet *p, void *event, uint32_t event_type, void *
     else if ( data->size + dumpSize > data->limit )
         TcpdumpRollLogFile(data);
 
-    pcap_dump((u_char *)data->dumpd, p->pkth, p->pkt);
+    TcpdumpWriteRecord(data, p->pkth, p->pkt);
     data->size += dumpSize;
 
-    if (!BcLineBufferedLogging())
-    { 
-#ifdef WIN32
-        fflush( NULL );  /* flush all open output streams */
-#else
-        /* we happen to know that pcap_dumper_t* is really just a FILE* */
-        fflush( (FILE*) data->dumpd );
+    /* without -f, don't keep packets in memory for long */
+    if ( !BcLineBufferedLogging() &&
+         time(NULL) - data->lastFlush >= data->flush_interval )
+    {
+        TcpdumpFlush(data);
+    }
+}
+
+/*
+ * Function: TcpdumpStreamHdrLen(Packet *)
+ *
+ * Purpose: Work out how many leading bytes of a rebuilt stream packet
+ *          (link, IP and TCP headers) are repeated in front of each
+ *          segment.
+ *
+ * Returns: header length, or 0 if the packet can't be split
+ */
+static uint32_t TcpdumpStreamHdrLen(Packet *p)
+{
+    uint32_t hlen;
+
+    if ( !p->iph || !p->tcph || !p->data || !p->dsize )
+        return 0;
+
+    /* only the inner headers would be fixed up */
+    if ( p->tunnel_depth != 0 )
+        return 0;
+#ifdef GRE
+    if ( p->encapsulated )
+        return 0;
 #endif
+
+    if ( p->data < p->pkt || (const uint8_t *)p->iph < p->pkt ||
+         (const uint8_t *)p->tcph < (const uint8_t *)p->iph ||
+         p->data < (const uint8_t *)p->tcph + TCP_HEADER_LEN )
+        return 0;
+
+    hlen = (uint32_t)(p->data - p->pkt);
+
+    if ( hlen + p->dsize > p->pkth->caplen )
+        return 0;
+
+    if ( IP_VER(p->iph) == 4 )
+        return hlen;
+
+    if ( IP_VER(p->iph) == 6 &&
+         (const uint8_t *)p->tcph >= (const uint8_t *)p->iph + IP6_HDR_LEN )
+        return hlen;
+
+    return 0;
+}
+
+/*
+ * Function: TcpdumpStreamSegment(uint8_t *, Packet *, uint32_t, uint32_t, uint32_t)
+ *
+ * Purpose: Write one <pcap pkt hdr> <packet> record for len payload bytes
+ *          starting at off into dst.  The headers are copied from the
+ *          rebuilt packet and the IP length, TCP sequence number and
+ *          checksums are fixed up to match the segment.
+ *
+ * Returns: number of bytes written to dst
+ */
+static size_t TcpdumpStreamSegment(uint8_t *dst, Packet *p,
+        uint32_t hlen, uint32_t off, uint32_t len)
+{
+    struct pseudoheader       /* pseudo header for TCP checksum calculations */
+    {
+        uint32_t sip, dip;
+        uint8_t  zero;
+        uint8_t  protocol;
+        uint16_t tcplen;
+    } ph;
+    struct pseudoheader6
+    {
+        uint32_t sip[4], dip[4];
+        uint8_t  zero;
+        uint8_t  protocol;
+        uint16_t tcplen;
+    } ph6;
+    TcpdumpRecordHdr hdr;
+    uint8_t *pkt = dst + PCAP_PKT_HDR_SZ;
+    uint32_t ip_off = (uint32_t)((const uint8_t *)p->iph - p->pkt);
+    uint32_t tcp_off = (uint32_t)((const uint8_t *)p->tcph - p->pkt);
+    uint32_t tcp_len = hlen - tcp_off + len;
+    TCPHdr *tcph;
+
+    hdr.ts_sec = (uint32_t)p->pkth->ts.tv_sec;
+    hdr.ts_usec = (uint32_t)p->pkth->ts.tv_usec;
+    hdr.caplen = hlen + len;
+    hdr.len = hlen + len;
+
+    memcpy(dst, &hdr, PCAP_PKT_HDR_SZ);
+    memcpy(pkt, p->pkt, hlen);
+    memcpy(pkt + hlen, p->data + off, len);
+
+    tcph = (TCPHdr *)(pkt + tcp_off);
+    tcph->th_seq = htonl(ntohl(p->tcph->th_seq) + off);
+    tcph->th_sum = 0;
+
+    if ( IP_VER(p->iph) == 4 )
+    {
+        IPHdr *iph = (IPHdr *)(pkt + ip_off);
+
+        iph->ip_len = htons((uint16_t)(hlen - ip_off + len));
+        iph->ip_csum = 0;
+        iph->ip_csum = in_chksum_ip((uint16_t *)iph, IP_HLEN(iph) << 2);
+
+        ph.sip = (uint32_t)iph->ip_src.s_addr;
+        ph.dip = (uint32_t)iph->ip_dst.s_addr;
+        ph.zero = 0;
+        ph.protocol = IPPROTO_TCP;
+        ph.tcplen = htons((uint16_t)tcp_len);
+
+        tcph->th_sum = in_chksum_tcp((uint16_t *)&ph, (uint16_t *)tcph, tcp_len);
+    }
+    else
+    {
+        IP6RawHdr *ip6h = (IP6RawHdr *)(pkt + ip_off);
+
+        ip6h->ip6plen = htons((uint16_t)(hlen - ip_off - IP6_HDR_LEN + len));
+
+        memcpy(ph6.sip, &ip6h->ip6_src, sizeof(ph6.sip));
+        memcpy(ph6.dip, &ip6h->ip6_dst, sizeof(ph6.dip));
+        ph6.zero = 0;
+        ph6.protocol = IPPROTO_TCP;
+        ph6.tcplen = htons((uint16_t)tcp_len);
+
+        tcph->th_sum = in_chksum_tcp6((uint16_t *)&ph6, (uint16_t *)tcph, tcp_len);
     }
+
+    return PCAP_PKT_HDR_SZ + hlen + len;
 }
 
+/*
+ * Function: LogTcpdumpStream(Packet *, void *, uint32_t, void *)
+ *
+ * Purpose: Log a rebuilt TCP stream packet as a series of segments of at
+ *          most STREAM_SEGMENT_SIZE payload bytes.  All of the records
+ *          are built in the buffer (or a temporary one if they don't fit)
+ *          so they go out together in a single write.
+ *
+ * Returns: void function
+ */
 static void LogTcpdumpStream(Packet *p, void *event, uint32_t event_type, void *arg)
 {
     LogTcpdumpData *data = (LogTcpdumpData *)arg;
-    size_t dumpSize = 0;
+    uint32_t hlen = TcpdumpStreamHdrLen(p);
+    uint32_t nsegs, off, len;
+    size_t dumpSize;
+    uint8_t *dst, *tmp = NULL;
+    struct iovec iov[2];
 
-//    if (stream_api)
-//        stream_api->traverse_reassembled(p, SizeOfCallback, &dumpSize);
+    if ( hlen == 0 || data->linktype != p->linktype )
+    {
+        LogTcpdumpSingle(p, event, event_type, arg);
+        return;
+    }
+
+    nsegs = (p->dsize + STREAM_SEGMENT_SIZE - 1) / STREAM_SEGMENT_SIZE;
+    dumpSize = nsegs * (PCAP_PKT_HDR_SZ + hlen) + p->dsize;
 
     if ( data->size + dumpSize > data->limit )
         TcpdumpRollLogFile(data);
 
-//    if (stream_api)
-//        stream_api->traverse_reassembled(p, LogTcpdumpStreamCallback, data);
+    if ( data->buf_len + dumpSize > data->buf_size )
+    {
+        if ( dumpSize > data->buf_size )
+            tmp = (uint8_t *)SnortAlloc(dumpSize);
+        else
+            TcpdumpFlush(data);
+    }
+    dst = tmp ? tmp : data->buf + data->buf_len;
+
+    for ( off = 0; off < p->dsize; off += len )
+    {
+        len = p->dsize - off;
+        if ( len > STREAM_SEGMENT_SIZE )
+            len = STREAM_SEGMENT_SIZE;
+
+        dst += TcpdumpStreamSegment(dst, p, hlen, off, len);
+    }
+
+    if ( tmp )
+    {
+        if ( data->fd >= 0 )
+        {
+            iov[0].iov_base = data->buf;
+            iov[0].iov_len = data->buf_len;
+            iov[1].iov_base = tmp;
+            iov[1].iov_len = dumpSize;
+
+            if ( TcpdumpWriteAll(data->fd, iov, 2) != 0 )
+                ErrorMessage("log_tcpdump: failed to write to \"%s\": %s\n",
+                             data->logdir, strerror(errno));
+        }
+        data->buf_len = 0;
+        data->lastFlush = time(NULL);
+        free(tmp);
+    }
+    else
+    {
+        data->buf_len += dumpSize;
+    }
 
     data->size += dumpSize;
 
-    if (!BcLineBufferedLogging())
-    { 
-#ifdef WIN32
-        fflush( NULL );  /* flush all open output streams */
-#else
-        /* we happen to know that pcap_dumper_t* is really just a FILE* */
-        fflush( (FILE*) data->dumpd );
-#endif
+    if ( !BcLineBufferedLogging() &&
+         time(NULL) - data->lastFlush >= data->flush_interval )
+    {
+        TcpdumpFlush(data);
+    }
+}
+
+/*
+ * Function: TcpdumpWriteAll(int, struct iovec *, int)
+ *
+ * Purpose: writev() the whole of iov, retrying short writes
+ *
+ * Returns: 0 on success, -1 on error with errno set
+ */
+static int TcpdumpWriteAll(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t ret;
+
+    while ( iovcnt > 0 )
+    {
+        ret = writev(fd, iov, iovcnt);
+
+        if ( ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        /* skip what was written */
+        while ( iovcnt > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 )
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function: TcpdumpFlush(LogTcpdumpData *)
+ *
+ * Purpose: Write the buffered records to the log file
+ *
+ * Returns: void function
+ */
+static void TcpdumpFlush(LogTcpdumpData *data)
+{
+    struct iovec iov;
+
+    data->lastFlush = time(NULL);
+
+    if ( data->buf_len == 0 || data->fd < 0 )
+    {
+        data->buf_len = 0;
+        return;
     }
+
+    iov.iov_base = data->buf;
+    iov.iov_len = data->buf_len;
+
+    if ( TcpdumpWriteAll(data->fd, &iov, 1) != 0 )
+        ErrorMessage("log_tcpdump: failed to write to \"%s\": %s\n",
+                     data->logdir, strerror(errno));
+
+    data->buf_len = 0;
+}
+
+/*
+ * Function: TcpdumpWriteRecord(LogTcpdumpData *, struct pcap_pkthdr *, uint8_t *)
+ *
+ * Purpose: Append a <pcap pkt hdr> <packet> record to the buffer, writing
+ *          the buffer out first if it is full.  Records larger than the
+ *          buffer are written along with it in a single writev().
+ *
+ * Returns: void function
+ */
+static void TcpdumpWriteRecord(LogTcpdumpData *data,
+        const struct pcap_pkthdr *pkth, const uint8_t *pkt)
+{
+    TcpdumpRecordHdr hdr;
+    struct iovec iov[3];
+    size_t need = PCAP_PKT_HDR_SZ + pkth->caplen;
+
+    hdr.ts_sec = (uint32_t)pkth->ts.tv_sec;
+    hdr.ts_usec = (uint32_t)pkth->ts.tv_usec;
+    hdr.caplen = pkth->caplen;
+    hdr.len = pkth->len;
+
+    if ( data->buf_len + need > data->buf_size )
+    {
+        if ( need > data->buf_size )
+        {
+            if ( data->fd >= 0 )
+            {
+                iov[0].iov_base = data->buf;
+                iov[0].iov_len = data->buf_len;
+                iov[1].iov_base = &hdr;
+                iov[1].iov_len = PCAP_PKT_HDR_SZ;
+                iov[2].iov_base = (void *)pkt;
+                iov[2].iov_len = pkth->caplen;
+
+                if ( TcpdumpWriteAll(data->fd, iov, 3) != 0 )
+                    ErrorMessage("log_tcpdump: failed to write to \"%s\": %s\n",
+                                 data->logdir, strerror(errno));
+            }
+            data->buf_len = 0;
+            data->lastFlush = time(NULL);
+            return;
+        }
+        TcpdumpFlush(data);
+    }
+
+    memcpy(data->buf + data->buf_len, &hdr, PCAP_PKT_HDR_SZ);
+    memcpy(data->buf + data->buf_len + PCAP_PKT_HDR_SZ, pkt, pkth->caplen);
+    data->buf_len += need;
 }
 
 static void TcpdumpInitLogFileFinalize(int unused, void *arg)
@@ -479,26 +894,55 @@ static void TcpdumpInitLogFile(LogTcpdumpData *data, int nostamps)
             FatalError("log_tcpdump: Failed to open log file \"%s\": %s\n",
                        data->logdir, strerror(errno));
         }
+
+        /* libpcap writes the file header, records bypass its stdio buffer */
+        pcap_dump_flush(data->dumpd);
+        data->fd = fileno(pcap_dump_file(data->dumpd));
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+        /* reserve the blocks up front, the file size only grows as written */
+        if(data->preallocate &&
+           fallocate(data->fd, FALLOC_FL_KEEP_SIZE, 0, data->limit) != 0)
+        {
+            LogMessage("WARNING: log_tcpdump: unable to preallocate \"%s\": %s\n",
+                       data->logdir, strerror(errno));
+        }
+#endif
     }
 
+    data->buf_len = 0;
+    data->lastFlush = data->lastTime;
     data->size = PCAP_FILE_HDR_SZ;
 }
 
-static void TcpdumpRollLogFile(LogTcpdumpData* data)
+/*
+ * Function: TcpdumpCloseLogFile(LogTcpdumpData *)
+ *
+ * Purpose: Write out buffered records and close the log file
+ *
+ * Returns: void function
+ */
+static void TcpdumpCloseLogFile(LogTcpdumpData *data)
 {
-    time_t now = time(NULL);
+    TcpdumpFlush(data);
 
-    /* don't roll over any sooner than resolution
-     * of filename discriminator
-     */
-    if ( now <= data->lastTime ) return;
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+    /* give back the reserved blocks past what was written */
+    if( data->preallocate && data->fd >= 0 &&
+        ftruncate(data->fd, (off_t)data->size) != 0 )
+    {
+        LogMessage("WARNING: log_tcpdump: unable to release preallocated "
+                   "space of \"%s\": %s\n", data->logdir, strerror(errno));
+    }
+#endif
+
+    data->fd = -1;
 
     /* close the output file */
     if( data->dumpd != NULL )
     {
         pcap_dump_close(data->dumpd);
         data->dumpd = NULL;
-        data->size = 0;
     }
 
     /* close the pcap */
@@ -507,6 +951,19 @@ static void TcpdumpRollLogFile(LogTcpdumpData* data)
         pcap_close(data->pd);
         data->pd = NULL;
     }
+}
+
+static void TcpdumpRollLogFile(LogTcpdumpData* data)
+{
+    time_t now = time(NULL);
+
+    /* don't roll over any sooner than resolution
+     * of filename discriminator
+     */
+    if ( now <= data->lastTime ) return;
+
+    TcpdumpCloseLogFile(data);
+    data->size = 0;
 
     /* Have to add stamps now to distinguish files */
     TcpdumpInitLogFile(data, 0);
@@ -529,19 +986,7 @@ static void SpoLogTcpdumpCleanup(int signal, void *arg, const char* msg)
 
     DEBUG_WRAP(DebugMessage(DEBUG_LOG,"%s\n", msg););
 
-    /* close the output file */
-    if( data->dumpd != NULL )
-    {
-        pcap_dump_close(data->dumpd);
-        data->dumpd = NULL;
-    }
-
-    /* close the pcap */
-    if (data->pd != NULL)
-    {
-        pcap_close(data->pd);
-        data->pd = NULL;
-    }
+    TcpdumpCloseLogFile(data);
 
     /* 
      * if we haven't written any data, dump the output file so there aren't
@@ -566,6 +1011,11 @@ static void SpoLogTcpdumpCleanup(int signal, void *arg, const char* msg)
         free (data->filename);
     }
 
+    if (data->buf)
+    {
+        free (data->buf);
+    }
+
     memset(data,'\0',sizeof(LogTcpdumpData));
     free(data);
 }
@@ -580,6 +1030,11 @@ static void SpoLogTcpdumpRestartFunc(int signal, void *arg)
     SpoLogTcpdumpCleanup(signal, arg, "SpoLogTcpdumpRestartFunc");
 }
 
+static void SpoLogTcpdumpIdleFunc(int signal, void *arg)
+{
+    TcpdumpFlush((LogTcpdumpData *)arg);
+}
+
 void LogTcpdumpReset(void)
 {
     TcpdumpRollLogFile(log_tcpdump_ptr);
@@ -593,7 +1048,7 @@ void DirectLogTcpdump(struct pcap_pkthdr *ph, uint8_t *pkt)
         TcpdumpRollLogFile(log_tcpdump_ptr);
 
     pc.log_pkts++;
-    pcap_dump((u_char *)log_tcpdump_ptr->dumpd, ph, pkt);
+    TcpdumpWriteRecord(log_tcpdump_ptr, ph, pkt);
 
     log_tcpdump_ptr->size += dumpSize;
 }
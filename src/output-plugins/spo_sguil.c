@@ -50,6 +50,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <poll.h>
 
 
 #include "barnyard2.h"
@@ -67,6 +68,18 @@
 #include <tcl.h>
 #endif
 
+#define MAX_MSG_LEN             2048
+
+typedef struct _SguilEvent
+{
+    u_int32_t			cid;
+    u_int8_t			confirmed;
+    time_t				sent;
+    char				*msg;       /* RTEVENT line including the newline */
+    size_t				len;
+    size_t				size;       /* allocated size of msg */
+} SguilEvent;
+
 typedef struct _SpoSguilData
 {
     char				*sensor_name;
@@ -82,6 +95,24 @@ typedef struct _SpoSguilData
     u_int16_t			agent_port;
     int					agent_sock;
 
+    /** RTEVENTs sent to the agent but not confirmed yet, kept in a ring
+     *  of "window" slots in cid order so they can be resent after a
+     *  timeout or reconnect. */
+    SguilEvent			*pending;
+    u_int32_t			window;
+    u_int32_t			pending_head;
+    u_int32_t			pending_count;
+    u_int32_t			confirm_timeout;
+
+    /** partial line received from the agent */
+    char				recv_buf[MAX_MSG_LEN];
+    size_t				recv_len;
+
+    u_int64_t			events_sent;
+    u_int64_t			events_confirmed;
+    u_int64_t			events_resent;
+    u_int64_t			reconnects;
+
 	char				*args;
 } SpoSguilData;
 
@@ -90,10 +121,19 @@ typedef struct _SpoSguilData
 #define KEYWORD_SENSORNAME      "sensor_name"
 #define KEYWORD_TAGPATH         "tag_path"
 #define KEYWORD_PASSWORD        "passwd"
+#define KEYWORD_WINDOW          "window"
+#define KEYWORD_CONFIRMTIMEOUT  "confirm_timeout"
 
-#define MAX_MSG_LEN             2048
 #define TMP_BUFFER              128
 
+#define SGUIL_DEFAULT_WINDOW    32
+#define SGUIL_MAX_WINDOW        4096
+#define SGUIL_CONFIRM_TIMEOUT   15
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 /* output plug-in API functions */
 void SguilInit(char *args);
 void SguilInitFinalize(int unused, void *arg);
@@ -103,6 +143,7 @@ void ParseSguilArgs(SpoSguilData *ssd_data);
 
 void SguilCleanExitFunc(int, void *);
 void SguilRestartFunc(int, void *);
+void SguilIdleFunc(int, void *);
 
 
 /* internal sguil functions */
@@ -110,15 +151,28 @@ void Sguil(Packet *, void *, uint32_t, void *);
 
 int SguilSensorAgentConnect(SpoSguilData *);
 int SguilSensorAgentInit(SpoSguilData *);
-int SguilRTEventMsg(SpoSguilData *, char *);
+int SguilRTEventMsg(SpoSguilData *, char *, size_t);
 int SguilSendAgentMsg(SpoSguilData *, char *);
-int SguilRecvAgentMsg(SpoSguilData *, char *);
+int SguilSendAll(SpoSguilData *, const char *, size_t);
+int SguilRecvAgentMsg(SpoSguilData *, char *, int);
+int SguilAgentReconnect(SpoSguilData *);
+int SguilAgentPump(SpoSguilData *, int);
+int SguilResendPending(SpoSguilData *);
+void SguilProcessAgentMsg(SpoSguilData *, char *);
+void SguilConfirmEvent(SpoSguilData *, u_int32_t);
+void SguilDrain(SpoSguilData *, u_int32_t);
+void SguilReport(SpoSguilData *);
+void SguilFree(SpoSguilData *);
 
 char *SguilTimestamp(u_int32_t);
 
 #ifdef ENABLE_TCL
 int SguilAppendIPHdrDataEVT(Tcl_DString *, void *);
 int SguilAppendIPHdrData(Tcl_DString *, Packet *);
+int SguilAppendIP6HdrDataEVT(Tcl_DString *, void *);
+#ifdef SUP_IP6
+int SguilAppendIP6HdrData(Tcl_DString *, Packet *);
+#endif
 int SguilAppendICMPData(Tcl_DString *, Packet *);
 int SguilAppendTCPData(Tcl_DString *, Packet *);
 int SguilAppendUDPData(Tcl_DString *, Packet *);
@@ -130,7 +184,7 @@ void SguilSetup(void)
 {
     /* link the preprocessor keyword to the init function in 
        the preproc list */
-    RegisterOutputPlugin("sguil", OUTPUT_TYPE_FLAG__ALERT, SguilInit);
+    RegisterOutputPlugin("sguil", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, SguilInit);
 
     DEBUG_WRAP(DebugMessage(DEBUG_PLUGIN, "Output: Sguil is setup\n"););
 }
@@ -204,8 +258,12 @@ void SguilInitFinalize(int unused, void *arg)
     {
         LogMessage("sguil:  sensor name = %s\n", ssd_data->sensor_name);
         LogMessage("sguil:  agent port =  %u\n", ssd_data->agent_port);
+        LogMessage("sguil:  window =      %u\n", ssd_data->window);
     }
 
+    ssd_data->pending = (SguilEvent *)SnortAlloc(ssd_data->window * sizeof(SguilEvent));
+    ssd_data->agent_sock = -1;
+
 	/* connect to sensor_agent */
     SguilSensorAgentConnect(ssd_data);
 
@@ -218,12 +276,13 @@ void SguilInitFinalize(int unused, void *arg)
     do {
         if (SguilSensorAgentInit(ssd_data) == 0)
             break;
-    } while (1);
+    } while (exit_signal == 0);
 
     /* set the preprocessor function into the function list */
     AddFuncToOutputList(Sguil, OUTPUT_TYPE__ALERT, ssd_data);
     AddFuncToCleanExitList(SguilCleanExitFunc, ssd_data);
     AddFuncToRestartList(SguilRestartFunc, ssd_data);
+    AddFuncToIdleList(SguilIdleFunc, ssd_data);
 }
 
 void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
@@ -243,16 +302,6 @@ void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
 		return;
 	}
 
-    if(p != NULL)
-    {
-        if(p->ip6h != NULL)
-        {
-          LogMessage("[%s] Received a IPv6 Packets, ignoring \n",
-                    __FUNCTION__);
-          return;
-        }
-    }
-
     data = (SpoSguilData *)arg;
 
 	/* grab the appropriate signature and classification information */
@@ -292,6 +341,11 @@ void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
     **
     **      46
     ** {data payload}
+    **
+    ** IPv6 addresses have no decimal form, so the decimal sip and dip are
+    ** sent as 0 and the address only appears in the string fields. IPv6
+    ** has no header id, fragment flags, offset or checksum, those fields
+    ** are left empty.
     */
 
     Tcl_DStringInit(&list);
@@ -366,19 +420,25 @@ void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
     /* Pull decoded info from the packet */
     if(p != NULL)
     {
-        if(p->iph)
+        if(IPH_IS_VALID(p))
         {
             int i;
 
             /* add IP header */
+#ifdef SUP_IP6
+            if(IS_IP6(p))
+                SguilAppendIP6HdrData(&list, p);
+            else
+#endif
             SguilAppendIPHdrData(&list, p);
 
             /* add ICMP || UDP || TCP data */
             if ( !(p->packet_flags & PKT_REBUILT_FRAG) )
             {
-                switch(p->iph->ip_proto)
+                switch(GET_IPH_PROTO(p))
                 {
                     case IPPROTO_ICMP:
+                    case IPPROTO_ICMPV6:
                         SguilAppendICMPData(&list, p);
                         break;
 
@@ -417,13 +477,20 @@ void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
     else
     {
         /* ack! an event without a packet. Append IP data from event struct and append
-        26 fillers */
-        if ( (event_type == UNIFIED2_IDS_EVENT_VLAN)||
+        27 fillers */
+        if ( (event_type == UNIFIED2_IDS_EVENT) ||
                 (event_type == UNIFIED2_IDS_EVENT_MPLS) ||
                 (event_type == UNIFIED2_IDS_EVENT_VLAN)){
             SguilAppendIPHdrDataEVT(&list, event);
             int i;
-            for(i = 0; i < 26; ++i)
+            for(i = 0; i < 27; ++i)
+            Tcl_DStringAppendElement(&list, "");
+        } else if ( (event_type == UNIFIED2_IDS_EVENT_IPV6) ||
+                (event_type == UNIFIED2_IDS_EVENT_IPV6_MPLS) ||
+                (event_type == UNIFIED2_IDS_EVENT_IPV6_VLAN)){
+            SguilAppendIP6HdrDataEVT(&list, event);
+            int i;
+            for(i = 0; i < 27; ++i)
             Tcl_DStringAppendElement(&list, "");
         } else {
         /* ack! an event without a packet. and no IP Data in eventAppend 32 fillers */
@@ -434,92 +501,333 @@ void Sguil(Packet *p, void *event, uint32_t event_type, void *arg)
 
     }
 
-    /* send msg to sensor_agent */
-    if (SguilRTEventMsg(data, Tcl_DStringValue(&list)))
-        FatalError("Unable to send RT Events to sensor agent.\n");
+    /* queue msg for sensor_agent, this only blocks while the window is full */
+    if (SguilRTEventMsg(data, Tcl_DStringValue(&list), Tcl_DStringLength(&list)) == 0)
+    {
+        /* bump the event id */
+        data->event_id_max++;
+    }
+    else
+    {
+        ErrorMessage("sguil: Unable to send event %u to sensor_agent.\n",
+                data->event_id_max);
+    }
 
     /* free the mallocs! */
     Tcl_DStringFree(&list);
 	free(timestamp_string);
-
-    /* bump the event id */
-    data->event_id_max++;
 #endif
 }
 
 static unsigned int sguil_agent_setup_timeouts = 0;
 
-int SguilRTEventMsg(SpoSguilData *data, char *msg)
+/*
+ * Queue an RTEVENT for the sensor_agent and send it right away. Up to
+ * "window" events are kept in flight; the Confirm for each one is matched
+ * asynchronously by SguilAgentPump(). Only when the window is full do we
+ * wait for the agent to catch up.
+ *
+ * return 0 on success
+ * return 1 if we are exiting and the event could not be queued
+ */
+int SguilRTEventMsg(SpoSguilData *data, char *msg, size_t len)
 {
+    SguilEvent *ev;
 
-    char tmpRecvMsg[MAX_MSG_LEN];
+    /* wait for the oldest events to be confirmed */
+    while (data->pending_count == data->window && exit_signal == 0)
+    {
+        if (SguilAgentPump(data, 1000))
+            break;
+    }
+
+    if (data->pending_count == data->window)
+        return 1;
+
+    ev = &data->pending[(data->pending_head + data->pending_count) % data->window];
+
+    if (ev->size < len + 1)
+    {
+        free(ev->msg);
+        ev->size = len + 1;
+        ev->msg = (char *)SnortAlloc(ev->size);
+    }
 
-    /* Send Msg */
-    SguilSendAgentMsg(data, msg);
+    memcpy(ev->msg, msg, len);
+    ev->msg[len] = '\n';
+    ev->len = len + 1;
+    ev->cid = data->event_id_max;
+    ev->confirmed = 0;
+    ev->sent = time(NULL);
 
-    /* Get confirmation */
-    memset(tmpRecvMsg, 0x0, MAX_MSG_LEN);
-    if (SguilRecvAgentMsg(data, tmpRecvMsg) == 1)
+    if (data->pending_count == 0)
+        data->event_id_min = ev->cid;
+
+    data->pending_count++;
+    data->events_sent++;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "sguil: sending \"%s\"", msg););
+
+    if (SguilSendAll(data, ev->msg, ev->len))
     {
         if (BcLogVerbose())
-            LogMessage("sguil: Retrying\n");
+            LogMessage("sguil: Lost connection to sensor_agent.\n");
 
-        SguilRTEventMsg(data, msg);
+        /* the event stays pending, a reconnect resends it with the rest */
+        SguilAgentReconnect(data);
     }
-    else
-    {
-        char **toks;
-        int num_toks;
 
-        if (BcLogVerbose())
-            LogMessage("sguil: Received: %s", tmpRecvMsg);
+    /* pick up any confirms that are already waiting */
+    SguilAgentPump(data, 0);
+
+    return 0;
+}
 
-        /* Parse the response */
-        toks = mSplit(tmpRecvMsg, " ", 2, &num_toks, 0);
+/*
+ * Read and process everything the agent has sent us, waiting up to
+ * timeout_ms for the first line. Pending events whose Confirm is overdue
+ * are resent and a lost connection is re-established.
+ *
+ * return 0 on success
+ * return 1 if a reconnect was abandoned because we are exiting
+ */
+int SguilAgentPump(SpoSguilData *data, int timeout_ms)
+{
+    char line[MAX_MSG_LEN];
+    SguilEvent *ev;
+    int rval;
 
-        /* if the agent registration timed out once or several times we can
-         * receive unexpected SidCidResponse messages. */
-        if (sguil_agent_setup_timeouts > 0 && strcasecmp("SidCidResponse", toks[0]) == 0)
+    while (1)
+    {
+        if (data->agent_sock < 0)
         {
-            sguil_agent_setup_timeouts--;
+            if (SguilAgentReconnect(data))
+                return 1;
+        }
 
-	    if (BcLogVerbose())
-		    LogMessage("sguil: Ignored: %s", tmpRecvMsg);
+        rval = SguilRecvAgentMsg(data, line, timeout_ms);
+
+        if (rval == 0)
+        {
+            SguilProcessAgentMsg(data, line);
+            timeout_ms = 0;
+        }
+        else if (rval < 0)
+        {
+            if (SguilAgentReconnect(data))
+                return 1;
+            timeout_ms = 0;
         }
         else
         {
-            int event_id = atoi(toks[1]);
-            if (event_id < 0)
-            {
-                FatalError("sguil: Malformed response, expected \"Confirm %u\", got: %s\n",
-                        data->event_id_max, tmpRecvMsg);
-            }
+            break;
+        }
+    }
 
-            if(strcasecmp("Confirm", toks[0]) != 0) {
-
-                if ((uint)event_id != data->event_id_max) {
-                    if ((uint)event_id == data->event_id_min) {
-                        if (BcLogVerbose())
-                            LogMessage("sguil: processed delayed Confirm: %s", tmpRecvMsg);
-                    }
-                    else
-                    {
-                        FatalError("sguil: Expected Confirm %u and got: %s\n", data->event_id_max, tmpRecvMsg);
-                    }
-                }
+    if (data->pending_count == 0)
+        return 0;
 
-                /* either we are in sync or the confirm we got confirmed
-                 * event_id_min. Either way, we can increment it */
-                data->event_id_min++;
-            }
+    ev = &data->pending[data->pending_head];
+
+    if (time(NULL) - ev->sent >= (time_t)data->confirm_timeout)
+    {
+        if (BcLogVerbose())
+            LogMessage("sguil: Timed out waiting for Confirm %u, retrying\n", ev->cid);
+
+        if (SguilResendPending(data))
+        {
+            if (SguilAgentReconnect(data))
+                return 1;
         }
+    }
 
-        mSplitFree(&toks, num_toks);
+    return 0;
+}
+
+/*
+ * Resend every event that hasn't been confirmed yet, oldest first.
+ *
+ * return 0 on success
+ * return -1 if the connection was lost
+ */
+int SguilResendPending(SpoSguilData *data)
+{
+    SguilEvent *ev;
+    time_t now = time(NULL);
+    u_int32_t i;
+
+    for (i = 0; i < data->pending_count; i++)
+    {
+        ev = &data->pending[(data->pending_head + i) % data->window];
+
+        if (ev->confirmed)
+            continue;
+
+        if (SguilSendAll(data, ev->msg, ev->len))
+            return -1;
+
+        ev->sent = now;
+        data->events_resent++;
     }
 
     return 0;
 }
 
+/*
+ * Drop the current connection, connect again and resend what is still
+ * pending.
+ *
+ * return 0 on success
+ * return 1 if we gave up because we are exiting
+ */
+int SguilAgentReconnect(SpoSguilData *data)
+{
+    while (exit_signal == 0)
+    {
+        if (data->agent_sock >= 0)
+        {
+            close(data->agent_sock);
+            data->agent_sock = -1;
+        }
+
+        data->recv_len = 0;
+
+        if (SguilSensorAgentConnect(data))
+            break;
+
+        data->reconnects++;
+
+        if (data->pending_count > 0 && BcLogVerbose())
+            LogMessage("sguil: Resending %u unconfirmed events\n", data->pending_count);
+
+        if (SguilResendPending(data) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+void SguilProcessAgentMsg(SpoSguilData *data, char *msg)
+{
+    char **toks;
+    int num_toks;
+
+    if (BcLogVerbose())
+        LogMessage("sguil: Received: %s\n", msg);
+
+    /* Parse the response */
+    toks = mSplit(msg, " ", 2, &num_toks, 0);
+
+    if (num_toks == 0)
+    {
+        mSplitFree(&toks, num_toks);
+        return;
+    }
+
+    if (num_toks > 1 && strcasecmp("Confirm", toks[0]) == 0)
+    {
+        char *end;
+        unsigned long event_id = strtoul(toks[1], &end, 10);
+
+        if (end == toks[1] || event_id > 0xffffffffUL)
+        {
+            if (BcLogVerbose())
+                LogMessage("sguil: Malformed response, expected \"Confirm <cid>\", got: %s\n", msg);
+        }
+        else
+        {
+            SguilConfirmEvent(data, (u_int32_t)event_id);
+        }
+    }
+    /* if the agent registration timed out once or several times we can
+     * receive unexpected SidCidResponse messages. */
+    else if (sguil_agent_setup_timeouts > 0 && strcasecmp("SidCidResponse", toks[0]) == 0)
+    {
+        sguil_agent_setup_timeouts--;
+
+        if (BcLogVerbose())
+            LogMessage("sguil: Ignored: %s\n", msg);
+    }
+    else if (BcLogVerbose())
+    {
+        LogMessage("sguil: Ignored unexpected message: %s\n", msg);
+    }
+
+    mSplitFree(&toks, num_toks);
+}
+
+/*
+ * Pending events carry consecutive cids, so the slot for a Confirm is its
+ * distance from the oldest pending cid. Confirms may arrive out of order;
+ * the ring only advances past events that have all been confirmed.
+ */
+void SguilConfirmEvent(SpoSguilData *data, u_int32_t cid)
+{
+    SguilEvent *ev;
+    u_int32_t offset;
+
+    if (data->pending_count == 0)
+    {
+        if (BcLogVerbose())
+            LogMessage("sguil: Ignored Confirm %u, nothing pending\n", cid);
+        return;
+    }
+
+    offset = cid - data->pending[data->pending_head].cid;
+
+    if (offset >= data->pending_count)
+    {
+        /* a second Confirm for an event we resent */
+        if (BcLogVerbose())
+            LogMessage("sguil: Ignored stale Confirm %u\n", cid);
+        return;
+    }
+
+    ev = &data->pending[(data->pending_head + offset) % data->window];
+
+    if (ev->confirmed)
+        return;
+
+    ev->confirmed = 1;
+    data->events_confirmed++;
+
+    if (offset != 0 && BcLogVerbose())
+        LogMessage("sguil: Confirm %u arrived before Confirm %u\n", cid,
+                data->pending[data->pending_head].cid);
+
+    while (data->pending_count > 0 && data->pending[data->pending_head].confirmed)
+    {
+        data->pending_head = (data->pending_head + 1) % data->window;
+        data->pending_count--;
+    }
+
+    if (data->pending_count > 0)
+        data->event_id_min = data->pending[data->pending_head].cid;
+    else
+        data->event_id_min = data->event_id_max + 1;
+}
+
+/*
+ * Wait for the agent to confirm everything we have sent. A timeout of 0
+ * waits until the queue is empty or we are told to exit.
+ */
+void SguilDrain(SpoSguilData *data, u_int32_t timeout)
+{
+    time_t deadline = time(NULL) + timeout;
+
+    while (data->pending_count > 0)
+    {
+        if (timeout == 0 && exit_signal != 0)
+            break;
+
+        if (timeout != 0 && time(NULL) >= deadline)
+            break;
+
+        if (SguilAgentPump(data, 250))
+            break;
+    }
+}
+
 /*
  * Function: ParseSguilArgs(char *)
  *
@@ -548,6 +856,8 @@ void ParseSguilArgs(SpoSguilData *ssd_data)
 
 	/* initialise appropariate values to 0 */
 	ssd_data->agent_port = 0;
+	ssd_data->window = SGUIL_DEFAULT_WINDOW;
+	ssd_data->confirm_timeout = SGUIL_CONFIRM_TIMEOUT;
 
     /* parse out your args */
     toks = mSplit(ssd_data->args, ", ", 31, &num_toks, '\\');
@@ -590,6 +900,22 @@ void ParseSguilArgs(SpoSguilData *ssd_data)
             else
                 LogMessage("sguil: passwd error\n");
         }
+        else if ( !strncasecmp(stoks[0], KEYWORD_WINDOW, strlen(KEYWORD_WINDOW)) )
+        {
+            if(num_stoks > 1)
+                ssd_data->window = atoi(stoks[1]);
+
+            if(ssd_data->window < 1 || ssd_data->window > SGUIL_MAX_WINDOW)
+                FatalError("sguil: window must be between 1 and %u\n", SGUIL_MAX_WINDOW);
+        }
+        else if ( !strncasecmp(stoks[0], KEYWORD_CONFIRMTIMEOUT, strlen(KEYWORD_CONFIRMTIMEOUT)) )
+        {
+            if(num_stoks > 1)
+                ssd_data->confirm_timeout = atoi(stoks[1]);
+
+            if(ssd_data->confirm_timeout < 1)
+                FatalError("sguil: confirm_timeout must be at least 1 second\n");
+        }
         else
         {
 			LogMessage("sguil: unrecognised argument = %s\n", index);
@@ -653,6 +979,26 @@ int SguilAppendIPHdrDataEVT(Tcl_DString *list, void *event)
 }
 #endif
 
+#ifdef ENABLE_TCL
+int SguilAppendIP6HdrDataEVT(Tcl_DString *list, void *event)
+{
+    char buffer[INET6_ADDRSTRLEN];
+
+    Tcl_DStringAppendElement(list, "0");
+    if (inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_source, buffer, sizeof(buffer)) == NULL)
+        buffer[0] = '\0';
+    Tcl_DStringAppendElement(list, buffer);
+    Tcl_DStringAppendElement(list, "0");
+    if (inet_ntop(AF_INET6, &((Unified2IDSEventIPv6 *)event)->ip_destination, buffer, sizeof(buffer)) == NULL)
+        buffer[0] = '\0';
+    Tcl_DStringAppendElement(list, buffer);
+    SnortSnprintf(buffer, sizeof(buffer), "%u", ((Unified2IDSEventIPv6 *)event)->protocol);
+    Tcl_DStringAppendElement(list, buffer);
+
+    return 0;
+}
+#endif
+
 #ifdef ENABLE_TCL
 int SguilAppendIPHdrData(Tcl_DString *list, Packet *p)
 {
@@ -726,6 +1072,47 @@ int SguilAppendIPHdrData(Tcl_DString *list, Packet *p)
 }
 #endif
 
+#if defined(ENABLE_TCL) && defined(SUP_IP6)
+int SguilAppendIP6HdrData(Tcl_DString *list, Packet *p)
+{
+    char buffer[TMP_BUFFER];
+    int i;
+
+    memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
+
+    /* same compressed form as the event-only path */
+    Tcl_DStringAppendElement(list, "0");
+    if (inet_ntop(AF_INET6, GET_SRC_IP(p)->ip8, buffer, TMP_BUFFER) == NULL)
+        buffer[0] = '\0';
+    Tcl_DStringAppendElement(list, buffer);
+    Tcl_DStringAppendElement(list, "0");
+    if (inet_ntop(AF_INET6, GET_DST_IP(p)->ip8, buffer, TMP_BUFFER) == NULL)
+        buffer[0] = '\0';
+    Tcl_DStringAppendElement(list, buffer);
+    SnortSnprintf(buffer, TMP_BUFFER, "%u", GET_IPH_PROTO(p));
+    Tcl_DStringAppendElement(list, buffer);
+    Tcl_DStringAppendElement(list, "6");
+    SnortSnprintf(buffer, TMP_BUFFER, "%u", GET_IPH_HLEN(p));
+    Tcl_DStringAppendElement(list, buffer);
+    SnortSnprintf(buffer, TMP_BUFFER, "%u", GET_IPH_TOS(p));
+    Tcl_DStringAppendElement(list, buffer);
+    SnortSnprintf(buffer, TMP_BUFFER, "%u", GET_IP_DGMLEN(p));
+    Tcl_DStringAppendElement(list, buffer);
+
+    /* no id, flags or offset in the IPv6 header */
+    for(i = 0; i < 3; i++)
+        Tcl_DStringAppendElement(list, "");
+
+    SnortSnprintf(buffer, TMP_BUFFER, "%u", GET_IPH_TTL(p));
+    Tcl_DStringAppendElement(list, buffer);
+
+    /* and no checksum */
+    Tcl_DStringAppendElement(list, "");
+
+    return 0;
+}
+#endif
+
 #ifdef ENABLE_TCL
 int SguilAppendICMPData(Tcl_DString *list, Packet *p)
 {
@@ -735,7 +1122,24 @@ int SguilAppendICMPData(Tcl_DString *list, Packet *p)
 
     memset(buffer, 0, TMP_BUFFER); /* bzero() deprecated, replaced by memset() */
 
-    if (!p->icmph)
+    if (!p->icmph && p->icmp6h)
+    {
+
+        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->icmp6h->type);
+        Tcl_DStringAppendElement(list, buffer);
+
+        SnortSnprintf(buffer, TMP_BUFFER, "%u", p->icmp6h->code);
+        Tcl_DStringAppendElement(list, buffer);
+
+        SnortSnprintf(buffer, TMP_BUFFER, "%u", ntohs(p->icmp6h->csum));
+        Tcl_DStringAppendElement(list, buffer);
+
+        /* no ICMPv6 ID or Seq */
+        for(i=0; i < 2; i++)
+            Tcl_DStringAppendElement(list, "");
+
+    }
+    else if (!p->icmph)
     {
 
         /* Null out ICMP fields */
@@ -997,15 +1401,23 @@ int SguilSensorAgentInit(SpoSguilData *ssd_data)
 {
     char tmpSendMsg[MAX_MSG_LEN];
     char tmpRecvMsg[MAX_MSG_LEN];
+    int rval;
 
     /* Send our Request */
     snprintf(tmpSendMsg, MAX_MSG_LEN, "SidCidRequest %s", ssd_data->sensor_name);
-    SguilSendAgentMsg(ssd_data, tmpSendMsg);
+    if ( SguilSendAgentMsg(ssd_data, tmpSendMsg) )
+        return 1;
 
     /* Get the Results */
-    memset(tmpRecvMsg,0x0,MAX_MSG_LEN);
+    rval = SguilRecvAgentMsg(ssd_data, tmpRecvMsg, ssd_data->confirm_timeout * 1000);
 
-    if ( SguilRecvAgentMsg(ssd_data, tmpRecvMsg) == 1 )
+    if ( rval < 0 )
+    {
+        /* nothing is pending yet, so this just reconnects */
+        SguilAgentReconnect(ssd_data);
+        return 1;
+    }
+    else if ( rval == 1 )
     {
         if (BcLogVerbose())
 	        LogMessage("sguil: Agent registration timed out, retrying\n");
@@ -1020,12 +1432,12 @@ int SguilSensorAgentInit(SpoSguilData *ssd_data)
         char **toks;
         int num_toks;
 
-        DEBUG_WRAP(DebugMessage(DEBUG_LOG, "sguil: received \"%s\"", tmpRecvMsg););
+        DEBUG_WRAP(DebugMessage(DEBUG_LOG, "sguil: received \"%s\"\n", tmpRecvMsg););
 
         /* parse the response */
         toks = mSplit(tmpRecvMsg, " ", 3, &num_toks, 0);
 
-        if ( strcasecmp("SidCidResponse", toks[0]) == 0 )
+        if ( num_toks == 3 && strcasecmp("SidCidResponse", toks[0]) == 0 )
         {
             ssd_data->sensor_id = atoi(toks[1]);
             ssd_data->event_id_min = ssd_data->event_id_max = atoi(toks[2]);
@@ -1049,155 +1461,220 @@ int SguilSensorAgentInit(SpoSguilData *ssd_data)
     return 0;
 }
 
+/*
+ * Send a single line to the agent.
+ *
+ * return 0 on success
+ * return 1 if the connection was lost and had to be re-established
+ */
 int SguilSendAgentMsg(SpoSguilData *data, char *msg)
 {
-    int					schars;
-    size_t				len;
-    char				*tmpMsg;
+    char				tmpMsg[MAX_MSG_LEN];
+    int					len;
 
-    len = strlen(msg)+2;
-    tmpMsg = SnortAlloc(len);
-    snprintf(tmpMsg, len, "%s\n", msg);
+    len = snprintf(tmpMsg, MAX_MSG_LEN, "%s\n", msg);
+    if (len < 0 || len >= MAX_MSG_LEN)
+    {
+        ErrorMessage("sguil: message too long for sensor_agent\n");
+        return 0;
+    }
 
-    if ( (schars = send(data->agent_sock, tmpMsg, sizeof(char)*strlen(tmpMsg), 0)) < 0 )
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "sguil: sending \"%s\"", tmpMsg););
+
+    if ( SguilSendAll(data, tmpMsg, len) )
     {
         if(BcLogVerbose())
 		    LogMessage("sguil: Lost connection to sensor_agent.\n");
 
-        /* resend our message */
-        SguilSendAgentMsg(data, msg);
+        SguilAgentReconnect(data);
+        return 1;
     }
 
-    DEBUG_WRAP(DebugMessage(DEBUG_LOG, "sguil: sending \"%s\"", tmpMsg););
+    return 0;
+}
+
+/*
+ * Write the whole buffer, riding out short writes and signals.
+ *
+ * return 0 on success
+ * return -1 on error, the socket is closed
+ */
+int SguilSendAll(SpoSguilData *data, const char *buf, size_t len)
+{
+    ssize_t				schars;
+
+    if (data->agent_sock < 0)
+        return -1;
+
+    while (len > 0)
+    {
+        schars = send(data->agent_sock, buf, len, MSG_NOSIGNAL);
+
+        if (schars < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            close(data->agent_sock);
+            data->agent_sock = -1;
+            return -1;
+        }
 
-    free(tmpMsg);
+        buf += schars;
+        len -= schars;
+    }
 
     return 0;
 }
 
 /**
- *  \brief Receive a message from the Sguil server
+ *  \brief Receive a line from the sensor_agent, without the newline
+ *  \param timeout_ms how long to wait for a complete line
+ *  \retval 0 a line was copied into line_to_return (MAX_MSG_LEN bytes)
  *  \retval 1 on timeout
+ *  \retval -1 if the connection was lost, the socket is closed
  */
-
-/* I love google. http://pont.net/socket/prog/tcpServer.c */
-int SguilRecvAgentMsg(SpoSguilData *ssd_data, char *line_to_return)
+int SguilRecvAgentMsg(SpoSguilData *ssd_data, char *line_to_return, int timeout_ms)
 {
-	static int			rcv_ptr = 0;
-	static char			rcv_msg[MAX_MSG_LEN];
-	static int			n;
-	struct timeval		tv;
-	fd_set				read_fds;
-	int					offset;
+	struct pollfd		pfd;
+	char				*eol;
+	size_t				len;
+	ssize_t				n;
 
-	offset=0;
-
-	/* wait up to 15 secs for our response */
-	tv.tv_sec = 15;
-	tv.tv_usec = 0;
+	while (1)
+	{
+		/* hand out any complete line we already have */
+		eol = memchr(ssd_data->recv_buf, '\n', ssd_data->recv_len);
+		if (eol != NULL)
+		{
+			len = eol - ssd_data->recv_buf;
+			memcpy(line_to_return, ssd_data->recv_buf, len);
+			line_to_return[len] = '\0';
 
-	FD_ZERO(&read_fds);
-	FD_SET(ssd_data->agent_sock, &read_fds);
+			if (len > 0 && line_to_return[len - 1] == '\r')
+				line_to_return[len - 1] = '\0';
 
-    /* loop listening for external signals */
-	while (exit_signal == 0)
-	{
+			ssd_data->recv_len -= len + 1;
+			memmove(ssd_data->recv_buf, eol + 1, ssd_data->recv_len);
 
-		/* wait for response from sguild */
-		select(ssd_data->agent_sock+1, &read_fds, NULL, NULL, &tv);
+			return 0;
+		}
 
-		if ( !(FD_ISSET(ssd_data->agent_sock, &read_fds)) )
+		if (ssd_data->recv_len == MAX_MSG_LEN)
 		{
-			/* timed out */
-			if (BcLogVerbose())
-				LogMessage("sguil: Timed out waiting for response.\n");
+			LogMessage("sguil: Discarding overlong line from sensor_agent\n");
+			ssd_data->recv_len = 0;
+		}
+
+		if (ssd_data->agent_sock < 0)
+			return -1;
+
+		pfd.fd = ssd_data->agent_sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
 
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+		{
+			/* timed out or interrupted, let the caller look at exit_signal */
 			return 1;
 		}
-		else
-		{
-			if (rcv_ptr == 0)
-			{
-				memset(rcv_msg,0x0,MAX_MSG_LEN);
-				n = recv(ssd_data->agent_sock, rcv_msg, MAX_MSG_LEN, 0);
-				if (n < 0)
-				{
-					LogMessage("ERROR: Unable to read data.\n");
-
-					/* reconnect to sensor_agent */
-					SguilSensorAgentConnect(ssd_data);
-				}
-				else if (n == 0)
-				{
-					LogMessage("ERROR: Connecton closed by client\n");
-					close(ssd_data->agent_sock);
-
-					/* reconnect to sensor_agent */
-					SguilSensorAgentConnect(ssd_data);
-				}
-			}
-
-			/* if new data read on socket */
-			/* OR */
-			/* if another line is still in buffer */
-
-			/* copy line into 'line_to_return' */
-			while (*(rcv_msg+rcv_ptr) != 0x0A && rcv_ptr < n )
-			{
-				memcpy(line_to_return+offset,rcv_msg+rcv_ptr,1);
-				offset++;
-				rcv_ptr++;
-			}
 
-			/* end of line + end of buffer => return line */
-			if (rcv_ptr == (n - 1))
-			{
-				/* set last byte to END_LINE */
-				*(line_to_return + offset) = 0x0A;
-				rcv_ptr = 0;
+		n = recv(ssd_data->agent_sock, ssd_data->recv_buf + ssd_data->recv_len,
+				MAX_MSG_LEN - ssd_data->recv_len, 0);
 
-				return ++offset;
-			}
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
 
-			/* end of line but still some data in buffer => return line */
-			if (rcv_ptr < (n - 1))
-			{
-				/* set last byte to END_LINE */
-		        *(line_to_return+offset) = 0x0A;
-			    rcv_ptr++;
+		if (n <= 0)
+		{
+			if (n < 0)
+				LogMessage("sguil: Unable to read from sensor_agent: %s\n", strerror(errno));
+			else
+				LogMessage("sguil: Connection closed by sensor_agent\n");
 
-				return ++offset;
-			}
+			close(ssd_data->agent_sock);
+			ssd_data->agent_sock = -1;
+			ssd_data->recv_len = 0;
 
-			/* end of buffer but line is not ended => */
-			/*  wait for more data to arrive on socket */
-			if (rcv_ptr == n)
-			{
-				rcv_ptr = 0;
-			}
+			return -1;
 		}
-	}
 
-	return 0;
+		ssd_data->recv_len += n;
+	}
 }
 
 char *SguilTimestamp(u_int32_t sec)
 {
-    struct tm           *lt;  /* localtime */
     char                *buf;
-    time_t              Time = sec;
 
     buf = (char *)SnortAlloc(TMP_BUFFER * sizeof(char));
 
-	if (BcOutputUseUtc())
-		lt = gmtime(&Time);
-	else
-		lt = localtime(&Time);
+    FormatTimestamp(TIMESTAMP_ISO_SEC, sec, 0, 0, buf, TMP_BUFFER);
+
+    return buf;
+}
+
+void SguilIdleFunc(int signal, void *arg)
+{
+    SpoSguilData *ssd_data = (SpoSguilData *)arg;
+
+    if (ssd_data == NULL)
+        return;
+
+    /* collect confirms and retry overdue events between records */
+    SguilAgentPump(ssd_data, 0);
+}
 
-    SnortSnprintf(buf, TMP_BUFFER, "%04i-%02i-%02i %02i:%02i:%02i",
-					1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-					lt->tm_hour, lt->tm_min, lt->tm_sec);
-  return buf;
+void SguilReport(SpoSguilData *ssd_data)
+{
+    LogMessage("sguil: " STDu64 " events sent, " STDu64 " confirmed, "
+            STDu64 " resent, " STDu64 " reconnects\n",
+            ssd_data->events_sent, ssd_data->events_confirmed,
+            ssd_data->events_resent, ssd_data->reconnects);
+}
+
+void SguilFree(SpoSguilData *ssd_data)
+{
+    u_int32_t i;
+
+    /* give the agent a chance to confirm what is still in flight */
+    if (ssd_data->pending_count > 0)
+        SguilDrain(ssd_data, ssd_data->confirm_timeout);
+
+    if (ssd_data->pending_count > 0)
+        LogMessage("sguil: %u events were not confirmed by sensor_agent (cid %u - %u)\n",
+                ssd_data->pending_count, ssd_data->event_id_min,
+                ssd_data->event_id_max - 1);
+
+    SguilReport(ssd_data);
+
+    if(ssd_data->agent_sock >= 0)
+    {
+	close(ssd_data->agent_sock);
+	ssd_data->agent_sock = -1;
+    }
+
+    if (ssd_data->pending)
+    {
+	for (i = 0; i < ssd_data->window; i++)
+	    free(ssd_data->pending[i].msg);
+
+	free(ssd_data->pending);
+    }
+
+    if (ssd_data->sensor_name)
+	free(ssd_data->sensor_name);
+
+    if (ssd_data->tag_path)
+	free(ssd_data->tag_path);
+
+    if (ssd_data->passwd)
+	free(ssd_data->passwd);
+
+    if (ssd_data->args)
+	free(ssd_data->args);
+
+    free(ssd_data);
 }
 
 void SguilCleanExitFunc(int signal, void *arg)
@@ -1208,62 +1685,17 @@ void SguilCleanExitFunc(int signal, void *arg)
 
     /* free allocated memory from SpoSguilData */
 	if (ssd_data)
-	{
-
-	    if(ssd_data->agent_sock > 0)
-	    {
-		close(ssd_data->agent_sock);
-		ssd_data->agent_sock = -1;
-	    }
-	    
-	    
-	    if (ssd_data->sensor_name)
-		free(ssd_data->sensor_name);
-	    
-	    if (ssd_data->tag_path)
-		free(ssd_data->tag_path);
-	    
-	    if (ssd_data->passwd)
-		free(ssd_data->passwd);
-	    
-	    if (ssd_data->args)
-		free(ssd_data->args);
-	    
-	    free(ssd_data);
-	}
-
+	    SguilFree(ssd_data);
 }
 
 void SguilRestartFunc(int signal, void *arg)
 {
     SpoSguilData *ssd_data = (SpoSguilData *)arg;
 
-    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"SguilCleanExitFunc\n"););
+    DEBUG_WRAP(DebugMessage(DEBUG_LOG,"SguilRestartFunc\n"););
 
     /* free allocated memory from SpoSguilData */
 	if (ssd_data)
-	{
-
-	    if(ssd_data->agent_sock > 0)
-	    {
-		close(ssd_data->agent_sock);
-		ssd_data->agent_sock = -1;
-	    }
-	    
-	    if (ssd_data->sensor_name)
-		free(ssd_data->sensor_name);
-	    
-	    if (ssd_data->tag_path)
-		free(ssd_data->tag_path);
-	    
-	    if (ssd_data->passwd)
-		free(ssd_data->passwd);
-	    
-	    if (ssd_data->args)
-		free(ssd_data->args);
-	    
-	    free(ssd_data);
-	}
+	    SguilFree(ssd_data);
 }
 
-
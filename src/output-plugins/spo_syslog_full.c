@@ -36,6 +36,12 @@
 #      log_priority   $log_priority     - used by local option for syslog priority call. (man syslog(3) for supported options) (default: LOG_INFO)
 #      log_facility  $log_facility      - used by local option for syslog facility call. (man syslog(3) for supported options) (default: LOG_USER)
 #      payload_encoding                 - (default: hex)  support hex/ascii/base64 for log_syslog_full using operation_mode complete only.
+#      queue_size $bytes                - size of the queue holding messages not yet sent to the server, oldest messages are dropped when it is full (default: 1048576)
+#      batch_size $count                - number of queued messages that triggers a send, messages are also sent at least once a second (default: 64)
+#
+# Remote messages are sent in batches, several per sendmsg()/sendmmsg() call.  TCP messages use RFC 6587 octet-counting framing.
+# If the server goes away the plugin keeps queueing and reconnects with an increasing delay (up to 60 seconds).
+# TCP connects don't block, an attempt is given up after 5 seconds.
 
 # Usage Examples:
 # output alert_syslog_full: sensor_name snortIds1-eth2, server xxx.xxx.xxx.xxx, protocol udp, port 514, operation_mode default
@@ -49,11 +55,30 @@
 
 */
 
+/* for sendmmsg() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "output-plugins/spo_syslog_full.h"
 #include "ipv6_port.h"
+#include "encode.h"
+#include "extradata.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* don't block or take a SIGPIPE on a slow or dead server */
+#define SYSLOG_SEND_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
 
 /* Output plugin API functions */
 static void OpSyslog_Exit(int signal,void *outputPlugin);
+static void OpSyslog_Idle(int signal,void *outputPlugin);
 static void OpSyslog_Alert(Packet *, void *, uint32_t, void *);
 static void OpSyslog_Log(Packet *, void *, uint32_t, void *);
 static int OpSyslog_LogConfig(void *outputPlugin);
@@ -64,7 +89,12 @@ static OpSyslog_Data *OpSyslog_ParseArgs(char *);
 static int NetClose(OpSyslog_Data *data);
 static int NetSend(OpSyslog_Data *data);
 static int NetConnect(OpSyslog_Data *data);
-static int NetTestSocket(OpSyslog_Data *op_data);
+static void NetResolve(OpSyslog_Data *data);
+static void NetDisconnect(OpSyslog_Data *data);
+static int NetQueue(OpSyslog_Data *data, const char *msg, u_int32_t len);
+static int NetFlush(OpSyslog_Data *data, int flags);
+static int NetConnectPoll(OpSyslog_Data *data);
+static void NetDrain(OpSyslog_Data *data, time_t deadline);
 
 //CHECKME: -elz Need to investigate
 //static int Syslog_FormatReference(OpSyslog_Data *data, ReferenceNode *refer);
@@ -77,8 +107,8 @@ char *db_proto[] = {"udp", "tcp", NULL};
 /* Setup routine makes this processor available for dataprocessor directives */
 void OpSyslog_Setup(void)
 {
-    RegisterOutputPlugin("alert_syslog_full", OUTPUT_TYPE_FLAG__ALERT, OpSyslog_InitAlert);
-    RegisterOutputPlugin("log_syslog_full",  OUTPUT_TYPE_FLAG__LOG, OpSyslog_InitLog);
+    RegisterOutputPlugin("alert_syslog_full", OUTPUT_TYPE_FLAG__ALERT, DECODE_LEVEL__L4, OpSyslog_InitAlert);
+    RegisterOutputPlugin("log_syslog_full",  OUTPUT_TYPE_FLAG__LOG, DECODE_LEVEL__L4, OpSyslog_InitLog);
     return;
 }
 
@@ -123,6 +153,7 @@ void OpSyslog_Init(char *args,u_int8_t context)
 
     AddFuncToCleanExitList(OpSyslog_Exit,(void *)syslogContext);
     AddFuncToShutdownList(OpSyslog_Exit,(void *)syslogContext);
+    AddFuncToIdleList(OpSyslog_Idle,(void *)syslogContext);
     
     switch(syslogContext->log_context)
     {
@@ -155,13 +186,21 @@ void OpSyslog_Init(char *args,u_int8_t context)
     /* Since we are in init phase */
     syslogContext->socket = -1;
     
+    if(syslogContext->local_logging == 0)
+    {
+	if( (syslogContext->queue = malloc(syslogContext->queue_size)) == NULL)
+	{
+	    FatalError("OpSyslog_Init(): Can't allocate queue memory, bailling \n");
+	}
+
+	NetResolve(syslogContext);
+	syslogContext->last_flush = time(NULL);
+    }
+
+    /* the server may come up later, messages are queued until then */
     if(NetConnect(syslogContext)) 
     {
-        FatalError("OpSyslog_Init(): Failed to connect to host: [%s] %s:%u\n",
-		   db_proto[syslogContext->proto], 
-		   syslogContext->server, 
-		   syslogContext->port);
-        return;
+	NetDisconnect(syslogContext);
     }
     
     if( (syslogContext->payload = malloc(SYSLOG_MAX_QUERY_SIZE)) == NULL)
@@ -171,14 +210,6 @@ void OpSyslog_Init(char *args,u_int8_t context)
     
     memset(syslogContext->payload,'\0',(SYSLOG_MAX_QUERY_SIZE));
     
-    
-    if( (syslogContext->formatBuffer = malloc(SYSLOG_MAX_QUERY_SIZE)) == NULL)
-    {
-	FatalError("OpSyslog_Init(): Can't allocate payload memory, bailling \n");
-    }
-    
-    memset(syslogContext->formatBuffer,'\0',(SYSLOG_MAX_QUERY_SIZE));
-    
     OpSyslog_LogConfig(syslogContext);    
     
     return;
@@ -198,6 +229,24 @@ void OpSyslog_Exit(int signal,void *pSyslogContext)
     }
 
     iSyslogContext =(OpSyslog_Data *)pSyslogContext;
+
+    /* last chance for queued messages, wait a while rather than lose them */
+    if(iSyslogContext->queue)
+    {
+	iSyslogContext->reconnect_time = 0;
+	NetDrain(iSyslogContext, time(NULL) + SYSLOG_EXIT_TIMEOUT);
+
+	if(iSyslogContext->queue_head != iSyslogContext->queue_tail)
+	{
+	    LogMessage("syslog_full: %u messages to %s:%u were not sent\n",
+		       iSyslogContext->queue_count,
+		       iSyslogContext->server,
+		       iSyslogContext->port);
+	}
+
+	free(iSyslogContext->queue);
+	iSyslogContext->queue = NULL;
+    }
     
     if(iSyslogContext->payload)
     {
@@ -205,12 +254,6 @@ void OpSyslog_Exit(int signal,void *pSyslogContext)
 	iSyslogContext->payload = NULL;
     }
     
-    if(iSyslogContext->formatBuffer)
-    {
-	free(iSyslogContext->formatBuffer);
-	iSyslogContext->formatBuffer = NULL;
-    }
-    
     if(iSyslogContext->server)
     {
 	free(iSyslogContext->server);
@@ -231,60 +274,188 @@ void OpSyslog_Exit(int signal,void *pSyslogContext)
 }
 
 
-/* Used to concat current format to current the syslog payload message */
-int OpSyslog_Concat(OpSyslog_Data *syslogContext)
+/* Called when the spooler runs out of events, push out a partial batch */
+void OpSyslog_Idle(int signal,void *pSyslogContext)
 {
-    
-    if( (syslogContext == NULL) ||
-	(syslogContext->payload == NULL) ||
-	(syslogContext->formatBuffer == NULL))
+    OpSyslog_Data *iSyslogContext = (OpSyslog_Data *)pSyslogContext;
+
+    if(iSyslogContext->queue)
+    {
+	NetFlush(iSyslogContext, SYSLOG_SEND_FLAGS);
+    }
+}
+
+
+/*
+ * Messages are built in place in syslogContext->payload, each helper
+ * appends at payload_current_pos.  They return 1 (and append nothing)
+ * if the message would not fit.
+ */
+static INLINE int Syslog_Put(OpSyslog_Data *data, const char *str, u_int32_t len)
+{
+    if( (data->payload_current_pos + len) >= SYSLOG_MAX_QUERY_SIZE)
     {
-	/* XXX */
 	return 1;
     }
-    
-    if( (syslogContext->payload_current_pos + syslogContext->format_current_pos) >= SYSLOG_MAX_QUERY_SIZE)
+
+    memcpy(data->payload + data->payload_current_pos, str, len);
+    data->payload_current_pos += len;
+
+    return 0;
+}
+
+static INLINE int Syslog_PutStr(OpSyslog_Data *data, const char *str)
+{
+    return Syslog_Put(data, str, strlen(str));
+}
+
+static INLINE int Syslog_PutChar(OpSyslog_Data *data, char c)
+{
+    if( (data->payload_current_pos + 1) >= SYSLOG_MAX_QUERY_SIZE)
     {
-	/* XXX */
 	return 1;
     }
-    
-    switch(syslogContext->operation_mode)
+
+    data->payload[data->payload_current_pos++] = c;
+
+    return 0;
+}
+
+/* same as "%u" */
+static int Syslog_PutUInt(OpSyslog_Data *data, unsigned long n)
+{
+    char tmp[3 * sizeof(n)];
+    int i = sizeof(tmp);
+
+    do
     {
+	tmp[--i] = '0' + (n % 10);
+	n /= 10;
+    } while(n);
 
-    case OUT_MODE_DEFAULT:
-	if( (syslogContext->payload_current_pos += snprintf((syslogContext->payload+syslogContext->payload_current_pos),
-							    (SYSLOG_MAX_QUERY_SIZE - syslogContext->payload_current_pos),
-							    "%s",
-							    syslogContext->formatBuffer))  >= SYSLOG_MAX_QUERY_SIZE)
+    return Syslog_Put(data, tmp + i, sizeof(tmp) - i);
+}
+
+/* same as inet_ntoa() of the source or destination address */
+static int Syslog_PutIP(OpSyslog_Data *data, Packet *p, int dst)
+{
+    const u_int8_t *addr;
+    int rval = 0;
+    int i;
+
+#ifdef SUP_IP6
+    sfip_t *ip = dst ? GET_DST_ADDR(p) : GET_SRC_ADDR(p);
+
+    if(ip->family != AF_INET)
+    {
+	return Syslog_PutStr(data, sfip_ntoa(ip));
+    }
+    addr = ip->ip8;
+#else
+    struct in_addr ip = dst ? GET_DST_ADDR(p) : GET_SRC_ADDR(p);
+
+    addr = (const u_int8_t *)&ip.s_addr;
+#endif
+
+    for(i = 0; i < 4; i++)
+    {
+	if(i)
 	{
-	    /* XXX */
-	    return 1;
+	    rval |= Syslog_PutChar(data, '.');
 	}
-	break;
-	
-    case OUT_MODE_FULL:
-	if( (syslogContext->payload_current_pos += snprintf((syslogContext->payload+syslogContext->payload_current_pos),
-							    (SYSLOG_MAX_QUERY_SIZE - syslogContext->payload_current_pos),
-							    "%c %s %c",
-							    syslogContext->delim,
-							    syslogContext->formatBuffer,
-							    syslogContext->delim))  >= SYSLOG_MAX_QUERY_SIZE)
+	rval |= Syslog_PutUInt(data, addr[i]);
+    }
+
+    return rval;
+}
+
+/* upper case hex of len bytes, same as fasthex() */
+static int Syslog_PutHex(OpSyslog_Data *data, const u_char *xdata, u_int32_t len)
+{
+    if( (data->payload_current_pos + (len * 2)) >= SYSLOG_MAX_QUERY_SIZE)
+    {
+	return 1;
+    }
+
+    data->payload_current_pos +=
+	EncodeHex(data->payload + data->payload_current_pos, xdata, len);
+
+    return 0;
+}
+
+/* In complete mode each section of the message is written as "<delim> <section> <delim>" */
+static INLINE int Syslog_SectionStart(OpSyslog_Data *data)
+{
+    if(data->operation_mode != OUT_MODE_FULL)
+    {
+	return 0;
+    }
+
+    return Syslog_PutChar(data, data->delim) | Syslog_PutChar(data, ' ');
+}
+
+static INLINE int Syslog_SectionEnd(OpSyslog_Data *data)
+{
+    if(data->operation_mode != OUT_MODE_FULL)
+    {
+	return 0;
+    }
+
+    return Syslog_PutChar(data, ' ') | Syslog_PutChar(data, data->delim);
+}
+
+/*
+ * The event's extra data records as "name:value", one section with the
+ * records separated by field_separators in complete mode, " [name:value]"
+ * each otherwise.
+ */
+static int Syslog_FormatExtraData(OpSyslog_Data *data, void *event)
+{
+    const ExtraData *ed = GetExtraData(event);
+    char text[EXTRA_DATA_TEXT_MAX];
+    const char *name;
+    int rval = 0;
+    int n = 0;
+
+    if(ed == NULL)
+    {
+	return 0;
+    }
+
+    rval |= Syslog_SectionStart(data);
+
+    for(; ed != NULL; ed = ed->next)
+    {
+	if( (name = ExtraDataName(ed->type)) == NULL)
 	{
-	    /* XXX */
-	    return 1;
+	    continue;
+	}
+
+	ExtraDataText(ed, text, sizeof(text));
+
+	if(data->operation_mode == OUT_MODE_FULL)
+	{
+	    if(n++)
+	    {
+		rval |= Syslog_PutChar(data, data->field_separators);
+	    }
+	}
+	else
+	{
+	    rval |= Syslog_PutStr(data, " [");
+	}
+
+	rval |= Syslog_PutStr(data, name);
+	rval |= Syslog_PutChar(data, ':');
+	rval |= Syslog_PutStr(data, text);
+
+	if(data->operation_mode != OUT_MODE_FULL)
+	{
+	    rval |= Syslog_PutChar(data, ']');
 	}
-	break;
-	
-    default:
-	break;
-	
     }
-    
-    memset(syslogContext->formatBuffer,'\0',SYSLOG_MAX_QUERY_SIZE);
-    syslogContext->format_current_pos = 0;
-    
-    return 0;
+
+    return rval | Syslog_SectionEnd(data);
 }
 
 int OpSyslog_LogConfig(void *pSyslogContext)
@@ -309,6 +480,9 @@ int OpSyslog_LogConfig(void *pSyslogContext)
 		   iSyslogContext->port);
 	LogMessage("\tReporting Protocol: %s\n", 
 		   db_proto[iSyslogContext->proto]);
+	LogMessage("\tQueue Size: %u bytes, Batch Size: %u\n",
+		   iSyslogContext->queue_size,
+		   iSyslogContext->batch_size);
     }
     else if(iSyslogContext->local_logging == 1)
     {
@@ -348,9 +522,8 @@ return 0;
 
 static int Syslog_FormatTrigger(OpSyslog_Data *syslogData, Unified2EventCommon *pEvent,int opType) 
 {
-    
-    char tSigBuf[256] = {0};
     char *timestamp_string = NULL;
+    int rval = 0;
     
     SigNode             *sn = NULL;
     ClassType           *cn = NULL;
@@ -368,19 +541,13 @@ static int Syslog_FormatTrigger(OpSyslog_Data *syslogData, Unified2EventCommon *
 	
     case OUT_MODE_DEFAULT:
 	/* Alert */
-	if( (syslogData->format_current_pos += snprintf(syslogData->formatBuffer,SYSLOG_MAX_QUERY_SIZE,"[SNORTIDS[ALERT]: [%s] ]", syslogData->sensor_name)) >=  SYSLOG_MAX_QUERY_SIZE)
-	{
-	    /* XXX */
-	    return 1;
-	}
+	rval |= Syslog_SectionStart(syslogData);
+	rval |= Syslog_PutStr(syslogData, "[SNORTIDS[ALERT]: [");
 	break;
     case OUT_MODE_FULL:
 	/* Log */
-	if( (syslogData->format_current_pos += snprintf(syslogData->formatBuffer,SYSLOG_MAX_QUERY_SIZE,"[SNORTIDS[LOG]: [%s] ]", syslogData->sensor_name)) >=  SYSLOG_MAX_QUERY_SIZE)
-	{
-	    /* XXX */
-	    return 1;
-	}
+	rval |= Syslog_SectionStart(syslogData);
+	rval |= Syslog_PutStr(syslogData, "[SNORTIDS[LOG]: [");
 	break;
 	
     default:
@@ -390,13 +557,9 @@ static int Syslog_FormatTrigger(OpSyslog_Data *syslogData, Unified2EventCommon *
 	break;
     }
     
-    
-    if( OpSyslog_Concat(syslogData))
-    {
-	/* XXX */
-	FatalError("OpSyslog_Concat(): Failed \n");
-    }
-
+    rval |= Syslog_PutStr(syslogData, syslogData->sensor_name);
+    rval |= Syslog_PutStr(syslogData, "] ]");
+    rval |= Syslog_SectionEnd(syslogData);
     
     if( (timestamp_string = GetTimestampByComponent(
 	     ntohl(pEvent->event_second),
@@ -411,19 +574,12 @@ static int Syslog_FormatTrigger(OpSyslog_Data *syslogData, Unified2EventCommon *
 	    return 1;
 	}
 	
-	memset(timestamp_string,'\0',256);
 	snprintf(timestamp_string,256,"sec:[%u] msec:[%u] Second away from UTC:[%u] ",
 		 ntohl(pEvent->event_second),
 		 ntohl(pEvent->event_microsecond),
 		 GetLocalTimezone());
     }
     
-    
-    snprintf(tSigBuf,256,"Snort Alert [%u:%u:%u]",
-	     ntohl(pEvent->generator_id),
-	     ntohl(pEvent->signature_id),
-	     ntohl(pEvent->signature_revision));
-    
     sn = GetSigByGidSid(ntohl(pEvent->generator_id),
 			ntohl(pEvent->signature_id),
 			ntohl(pEvent->signature_revision));
@@ -431,67 +587,54 @@ static int Syslog_FormatTrigger(OpSyslog_Data *syslogData, Unified2EventCommon *
     cn = ClassTypeLookupById(barnyard2_conf, 
 			     ntohl(pEvent->classification_id));
     
-    if( (syslogData->format_current_pos += snprintf(syslogData->formatBuffer,SYSLOG_MAX_QUERY_SIZE,"%s%c%u%c[%u:%u:%u]%c%s", 
-						    timestamp_string,syslogData->field_separators,
-						    ntohl(pEvent->priority_id),syslogData->field_separators,
-						    ntohl(pEvent->generator_id),ntohl(pEvent->signature_id),ntohl(pEvent->signature_revision),syslogData->field_separators,
-						    sn != NULL ? sn->msg : tSigBuf)) >=  SYSLOG_MAX_QUERY_SIZE)
-    {
-	/* XXX */
-	free(timestamp_string);
-	return 1;
-    }
-    
-
-    if( OpSyslog_Concat(syslogData))
-    {
-	/* XXX */
-	FatalError("OpSyslog_Concat(): Failed \n");
-    }
-    
-    if(cn)
-    {
-	if( (syslogData->format_current_pos += snprintf(syslogData->formatBuffer,SYSLOG_MAX_QUERY_SIZE,"%s", 
-							cn->type)) >= SYSLOG_MAX_QUERY_SIZE)
-	{
-	    /* XXX */
-	    free(timestamp_string);
-	    return 1;
-	}
+    /* "<timestamp> <priority> [gid:sid:rev] <msg>" */
+    rval |= Syslog_SectionStart(syslogData);
+    rval |= Syslog_PutStr(syslogData, timestamp_string);
+    rval |= Syslog_PutChar(syslogData, syslogData->field_separators);
+    rval |= Syslog_PutUInt(syslogData, ntohl(pEvent->priority_id));
+    rval |= Syslog_PutChar(syslogData, syslogData->field_separators);
+    rval |= Syslog_PutChar(syslogData, '[');
+    rval |= Syslog_PutUInt(syslogData, ntohl(pEvent->generator_id));
+    rval |= Syslog_PutChar(syslogData, ':');
+    rval |= Syslog_PutUInt(syslogData, ntohl(pEvent->signature_id));
+    rval |= Syslog_PutChar(syslogData, ':');
+    rval |= Syslog_PutUInt(syslogData, ntohl(pEvent->signature_revision));
+    rval |= Syslog_PutChar(syslogData, ']');
+    rval |= Syslog_PutChar(syslogData, syslogData->field_separators);
+
+    if(sn != NULL)
+    {
+	rval |= Syslog_PutStr(syslogData, sn->msg);
     }
     else
     {
-	if( ( syslogData->format_current_pos += snprintf(syslogData->formatBuffer,SYSLOG_MAX_QUERY_SIZE,"%s", 
-							 "[Unknown Classification]") >= SYSLOG_MAX_QUERY_SIZE))
-	{
-	    /* XXX */
-	    free(timestamp_string);
-	    return 1;
-	}
+	rval |= Syslog_PutStr(syslogData, "Snort Alert [");
+	rval |= Syslog_PutUInt(syslogData, ntohl(pEvent->generator_id));
+	rval |= Syslog_PutChar(syslogData, ':');
+	rval |= Syslog_PutUInt(syslogData, ntohl(pEvent->signature_id));
+	rval |= Syslog_PutChar(syslogData, ':');
+	rval |= Syslog_PutUInt(syslogData, ntohl(pEvent->signature_revision));
+	rval |= Syslog_PutChar(syslogData, ']');
     }
+    rval |= Syslog_SectionEnd(syslogData);
     
-    if( OpSyslog_Concat(syslogData))
-    {
-	/* XXX */
-	FatalError("OpSyslog_Concat(): Failed \n");
-    }
+    rval |= Syslog_SectionStart(syslogData);
+    rval |= Syslog_PutStr(syslogData, cn ? cn->type : "[Unknown Classification]");
+    rval |= Syslog_SectionEnd(syslogData);
     
     /*CHECKME: -elz  Need to investigate */
     //Syslog_FormatReference(syslogData, sn->refs);
     
     free(timestamp_string);
     
-    return 0;
+    return rval;
 }
 
 
 
 static int Syslog_FormatIPHeaderAlert(OpSyslog_Data *data, Packet *p) 
 {
-    char *p_ip = NULL;
-    char s_ip[16] ={0};
-    char d_ip[16] ={0};
-    
+    int rval = 0;
 
     if(data == NULL ||
        p == NULL)
@@ -500,25 +643,18 @@ static int Syslog_FormatIPHeaderAlert(OpSyslog_Data *data, Packet *p)
 	return 1;
     }
     
+    rval |= Syslog_SectionStart(data);
+
     if(p->iph)
     {
-        p_ip = inet_ntoa(GET_SRC_ADDR(p));
-	memcpy(s_ip,p_ip,strlen(p_ip));
-	
-	p_ip = inet_ntoa(GET_DST_ADDR(p));
-	memcpy(d_ip,p_ip,strlen(p_ip));
-	
-	if( (data->format_current_pos += snprintf(data->formatBuffer,SYSLOG_MAX_QUERY_SIZE,"%lu%c%s%c%s",   
-						  (u_long)p->iph->ip_proto,data->field_separators, 
-						  s_ip,data->field_separators,
-						  d_ip)) >= SYSLOG_MAX_QUERY_SIZE)
-	{
-	    /* XXX */
-	    return 1;
-	}
+	rval |= Syslog_PutUInt(data, p->iph->ip_proto);
+	rval |= Syslog_PutChar(data, data->field_separators);
+	rval |= Syslog_PutIP(data, p, 0);
+	rval |= Syslog_PutChar(data, data->field_separators);
+	rval |= Syslog_PutIP(data, p, 1);
     }
     
-    return OpSyslog_Concat(data);
+    return rval | Syslog_SectionEnd(data);
 }
 
 static int Syslog_FormatIPHeaderLog(OpSyslog_Data *data, Packet *p) 
@@ -526,12 +662,10 @@ static int Syslog_FormatIPHeaderLog(OpSyslog_Data *data, Packet *p)
 
     //unsigned int s, d, 
     unsigned int proto, ver, hlen, tos, len, id, off, ttl, csum;
+    int rval = 0;
     //s=d=...;
     proto=ver=hlen=tos=len=id=off=ttl=csum=0;
 
-    char sip[16] = {0};
-    char dip[16] = {0};
-
     if(p->iph) 
     {
 	/*
@@ -561,54 +695,46 @@ static int Syslog_FormatIPHeaderLog(OpSyslog_Data *data, Packet *p)
 	    ttl = htons(p->iph->ip_csum);
     }
 
-    if (strlcpy(sip, inet_ntoa(GET_SRC_ADDR(p)), sizeof(sip)) >= sizeof(sip))
-    {
-	FatalError("[%s()], strlcpy() error , bailing \n",
-		   __FUNCTION__);
-	return 1;
-    }
-
-
-    if (strlcpy(dip, inet_ntoa(GET_DST_ADDR(p)), sizeof(dip)) >= sizeof(dip))
-    {
-	FatalError("[%s()], strlcpy() error , bailing \n",
-		   __FUNCTION__);
-	return 1;
-    }
-
-    
-    if( (data->format_current_pos += snprintf(data->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-					      "%u%c%s%c%s%c%u%c%u%c%u%c%u%c%u%c%u%c%u%c%u%c%u",
-					      proto,data->field_separators, 
-					      sip, data->field_separators, 
-                                              //s, data->field_separators, 
-					      dip, data->field_separators, 
-                                              //d, data->field_separators, 					      
-					      ver, data->field_separators, 
-					      hlen, data->field_separators, 
-					      tos, data->field_separators, 
-					      len, data->field_separators, 
-					      id, data->field_separators, 
+    /* proto sip dip ver hlen tos len id flags offset ttl csum */
+    rval |= Syslog_SectionStart(data);
+    rval |= Syslog_PutUInt(data, proto);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutIP(data, p, 0);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutIP(data, p, 1);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, ver);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, hlen);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, tos);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, len);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, id);
+    rval |= Syslog_PutChar(data, data->field_separators);
 #if defined(WORDS_BIGENDIAN)
-					      ((off & 0xE000) >> 13),data->field_separators, 
-					      htons(off & 0x1FFF),data->field_separators, 
+    rval |= Syslog_PutUInt(data, ((off & 0xE000) >> 13));
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, htons(off & 0x1FFF));
 #else
-					      ((off & 0x00E0) >> 5),data->field_separators, 
-					      htons(off & 0xFF1F), data->field_separators, 
-#endif	     
-					      ttl,data->field_separators, 
-					      csum)) >= SYSLOG_MAX_QUERY_SIZE)
-    {
-	/* XXX */
-	return 1;
-    }
-
-    return OpSyslog_Concat(data);
+    rval |= Syslog_PutUInt(data, ((off & 0x00E0) >> 5));
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, htons(off & 0xFF1F));
+#endif
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, ttl);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, csum);
+
+    return rval | Syslog_SectionEnd(data);
 }
 
 
 static int Syslog_FormatTCPHeaderAlert(OpSyslog_Data *data, Packet *p) 
 {
+    int rval = 0;
+
     if( (data == NULL) ||
 	(p == NULL) || 
 	(p->tcph == NULL))
@@ -617,21 +743,19 @@ static int Syslog_FormatTCPHeaderAlert(OpSyslog_Data *data, Packet *p)
 	return 1;
     }
     
-    if( (data->format_current_pos += snprintf(data->formatBuffer,SYSLOG_MAX_QUERY_SIZE,"%u%c%u", 
-					      ntohs(p->tcph->th_sport),data->field_separators,
-					      ntohs(p->tcph->th_dport))) > SYSLOG_MAX_QUERY_SIZE)
-    {
-	/* XXX */
-	return 1;
-    }
+    rval |= Syslog_SectionStart(data);
+    rval |= Syslog_PutUInt(data, ntohs(p->tcph->th_sport));
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, ntohs(p->tcph->th_dport));
     
-    return OpSyslog_Concat(data);
+    return rval | Syslog_SectionEnd(data);
 }
 
 static int Syslog_FormatTCPHeaderLog(OpSyslog_Data *data, Packet *p) 
 {
     
     unsigned int th_win, th_sum, th_flags, th_ack, th_seq, th_urp, th_off, th_x2;
+    int rval = 0;
     
     th_win=th_sum=th_flags=th_ack=th_seq=th_urp=th_off=th_x2=0;
     
@@ -663,29 +787,35 @@ static int Syslog_FormatTCPHeaderLog(OpSyslog_Data *data, Packet *p)
 	    th_urp = ntohs(p->tcph->th_urp);
     }
     
-    if( (data->format_current_pos += snprintf(data->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-					       "%u%c%u%c%u%c%u%c%u%c%u%c%u%c%u%c%u%c%u", 
-					       p->sp,data->field_separators,  
-					       p->dp, data->field_separators, 
-					       th_seq, data->field_separators, 
-					       th_ack, data->field_separators, 
-					       th_off, data->field_separators, 
-					       th_x2, data->field_separators, 
-					       th_flags, data->field_separators, 
-					       th_win, data->field_separators, 
-					       th_sum, data->field_separators, 
-					       th_urp)) > SYSLOG_MAX_QUERY_SIZE)
-    {
-	/* XXX */
-	return 1;
-    }
-    
-    return OpSyslog_Concat(data);
+    /* sp dp seq ack off x2 flags win sum urp */
+    rval |= Syslog_SectionStart(data);
+    rval |= Syslog_PutUInt(data, p->sp);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, p->dp);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_seq);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_ack);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_off);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_x2);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_flags);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_win);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_sum);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, th_urp);
+    
+    return rval | Syslog_SectionEnd(data);
 }
 
 
 static int Syslog_FormatUDPHeaderAlert(OpSyslog_Data *data, Packet *p) 
 {
+    int rval = 0;
     
     if( (data == NULL) ||
 	(p == NULL) || 
@@ -695,22 +825,18 @@ static int Syslog_FormatUDPHeaderAlert(OpSyslog_Data *data, Packet *p)
 	return 1;
     }
     
+    rval |= Syslog_SectionStart(data);
+    rval |= Syslog_PutUInt(data, ntohs(p->udph->uh_sport));
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, ntohs(p->udph->uh_dport));
     
-    if( (data->format_current_pos += snprintf(data->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-					      "%u%c%u", 
-					      ntohs(p->udph->uh_sport),data->field_separators,  
-					      ntohs(p->udph->uh_dport)) >= SYSLOG_MAX_QUERY_SIZE))
-    {
-	/* XXX */
-	return 1;
-    }
-    
-    return OpSyslog_Concat(data);;
+    return rval | Syslog_SectionEnd(data);
 }
 
 static int Syslog_FormatUDPHeaderLog(OpSyslog_Data *data, Packet *p) 
 {
     unsigned int uh_len=0, uh_chk=0;
+    int rval = 0;
 
     if( (data == NULL) ||
         (p == NULL) ||
@@ -728,23 +854,23 @@ static int Syslog_FormatUDPHeaderLog(OpSyslog_Data *data, Packet *p)
 	    uh_chk =  ntohs(p->udph->uh_chk);
     }
     
-    if( (data->format_current_pos +=  snprintf(data->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-					       "%u%c%u%c%u%c%u",
-					       ntohs(p->udph->uh_sport),data->field_separators, 
-					       ntohs(p->udph->uh_dport),data->field_separators, 
-					       uh_len, data->field_separators, 
-					       uh_chk)) >= SYSLOG_MAX_QUERY_SIZE)
-    {
-	/* XXX */
-	return 1;
-    }
+    rval |= Syslog_SectionStart(data);
+    rval |= Syslog_PutUInt(data, ntohs(p->udph->uh_sport));
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, ntohs(p->udph->uh_dport));
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, uh_len);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, uh_chk);
     
-    return OpSyslog_Concat(data);
+    return rval | Syslog_SectionEnd(data);
 }
 
 /* Not Complete */
 static int Syslog_FormatICMPHeaderAlert(OpSyslog_Data *data, Packet *p) 
 {
+    int rval = 0;
+
     if( (data == NULL) ||
         (p == NULL) ||
         (p->icmph == NULL))
@@ -753,22 +879,19 @@ static int Syslog_FormatICMPHeaderAlert(OpSyslog_Data *data, Packet *p)
         return 1;
     }
     
-    if( (data->format_current_pos +=  snprintf(data->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-					       "%u%c%u",
-					       p->icmph->type,data->field_separators, 
-					       p->icmph->code)) >= SYSLOG_MAX_QUERY_SIZE)
-    {
-	/* XXX */
-	return 1;
-    }
+    rval |= Syslog_SectionStart(data);
+    rval |= Syslog_PutUInt(data, p->icmph->type);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, p->icmph->code);
     
-    return OpSyslog_Concat(data);
+    return rval | Syslog_SectionEnd(data);
 }
 
 static int Syslog_FormatICMPHeaderLog(OpSyslog_Data *data, Packet *p) 
 {
     
     unsigned int type, code, csum, id, seq;
+    int rval = 0;
     type=code=csum=id=seq=0;
     
     if( (data == NULL) ||
@@ -794,23 +917,25 @@ static int Syslog_FormatICMPHeaderLog(OpSyslog_Data *data, Packet *p)
 	
     } 
     
-    if( (data->format_current_pos +=  snprintf(data->formatBuffer, SYSLOG_MAX_QUERY_SIZE,
-					       "%u%c%u%c%u%c%u%c%u",  
-					       type,data->field_separators, 
-					       code,data->field_separators, 
-					       csum,data->field_separators, 
-					       id,data->field_separators, 
-					       seq)) >= SYSLOG_MAX_QUERY_SIZE)
-    {
-	/* XXX */
-	return 1;
-    }
-    
-    return OpSyslog_Concat(data);
+    rval |= Syslog_SectionStart(data);
+    rval |= Syslog_PutUInt(data, type);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, code);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, csum);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, id);
+    rval |= Syslog_PutChar(data, data->field_separators);
+    rval |= Syslog_PutUInt(data, seq);
+    
+    return rval | Syslog_SectionEnd(data);
 }
 
 int Syslog_FormatPayload(OpSyslog_Data *data, Packet *p) {
     
+    u_int32_t start;
+    int rval = 0;
+
     if( (data == NULL) ||
         (p == NULL) ||
 	(p->pkt == NULL))
@@ -820,38 +945,39 @@ int Syslog_FormatPayload(OpSyslog_Data *data, Packet *p) {
         return 1;
     }
     
+    start = data->payload_current_pos;
+    rval |= Syslog_SectionStart(data);
+
     if(p->pkth->len > 0) 
     {
-	memset(data->payload_escape_buffer,'\0',MAX_QUERY_LENGTH);
+	rval |= Syslog_PutUInt(data, p->pkth->len);
+	rval |= Syslog_PutChar(data, data->field_separators);
 
 	switch(data->payload_encoding)
 	{
 	    
 	case ENCODE_HEX:
-	    if( (fasthex_STATIC(p->pkt, p->pkth->len,
-				data->payload_escape_buffer)))
-	    {
-		/* XXX */
-		return 1;
-	    }
+	    rval |= Syslog_PutHex(data, p->pkt, p->pkth->len);
 	    break;
 	    
 	case ENCODE_ASCII:
 	    if( (ascii_STATIC(p->pkt,p->pkth->len,
 			      data->payload_escape_buffer)))
 	    {
-		/* XXX */
-		return 1;
+		rval = 1;
+		break;
 	    }
+	    rval |= Syslog_PutStr(data, data->payload_escape_buffer);
 	    break;
 
 	case ENCODE_BASE64:
 	    if( (base64_STATIC(p->pkt,p->pkth->len,
 			      data->payload_escape_buffer)))
 	    {
-		/* XXX */
-		return 1;
+		rval = 1;
+		break;
 	    }
+	    rval |= Syslog_PutStr(data, data->payload_escape_buffer);
 	    break;
 
 	default:
@@ -860,61 +986,31 @@ int Syslog_FormatPayload(OpSyslog_Data *data, Packet *p) {
 		       data->payload_encoding);
 	    break;
 	}
-	
-	if( (data->format_current_pos +=  snprintf(data->formatBuffer, SYSLOG_MAX_QUERY_SIZE,
-						   "%u%c%s",
-						   p->pkth->len,data->field_separators, 
-						   data->payload_escape_buffer)) >= SYSLOG_MAX_QUERY_SIZE)
-	{
-	    /* XXX */
-	    return 1;
-	}
-	
+    }
+
+    /* leave the section out rather than send a partial payload */
+    if( (rval |= Syslog_SectionEnd(data)))
+    {
+	data->payload_current_pos = start;
     }
     
-    return OpSyslog_Concat(data);
+    return rval;
 }
 
 
-void  OpSyslog_Alert(Packet *p, void *event, uint32_t event_type, void *arg)
+/*
+ * Builds the alert message for the event into the payload buffer of the
+ * context, returns non-zero when it was dropped.
+ */
+int OpSyslog_FormatAlert(OpSyslog_Data *syslogContext, Packet *p, void *event)
 {
-    OpSyslog_Data *syslogContext = NULL;    
-    Unified2EventCommon *iEvent = NULL;
+    Unified2EventCommon *iEvent = event;
 
     SigNode                         *sn = NULL;
-    ClassType                       *cn = NULL;
+    const SigFragment               *frag = NULL;
+    int rval = 0;
 
-    
-    char sip[16] = {0};
-    char dip[16] = {0};
-    
-    if( (p == NULL) ||
-	(event == NULL) ||
-	(arg == NULL))
-    {
-	LogMessage("OpSyslog_Alert(): Invoked with Packet[0x%x] Event[0x%x] Event Type [%u] Context pointer[0x%x]\n",
-		   p,
-		   event,
-		   event_type,
-		   arg);
-	return;
-    }
-    
-    if(event_type != UNIFIED2_IDS_EVENT)
-    {
-        LogMessage("OpSyslog_Alert(): Is currently unable to handle Event Type [%u] \n",
-                   event_type);
-	return;
-    }
-    
-    
-    syslogContext = (OpSyslog_Data *)arg;
-    iEvent = event;
-    
-    memset(syslogContext->payload,'\0',(SYSLOG_MAX_QUERY_SIZE));
-    memset(syslogContext->formatBuffer,'\0',(SYSLOG_MAX_QUERY_SIZE));
     syslogContext->payload_current_pos = 0;
-    syslogContext->format_current_pos = 0;
 
     
     switch(syslogContext->operation_mode)
@@ -922,194 +1018,55 @@ void  OpSyslog_Alert(Packet *p, void *event, uint32_t event_type, void *arg)
 
     case OUT_MODE_DEFAULT:  
 	
-	if(IPH_IS_VALID(p))
-	{	
-	    if (strlcpy(sip, inet_ntoa(GET_SRC_ADDR(p)), sizeof(sip)) >= sizeof(sip))
-	    {
-		FatalError("[%s()], strlcpy() error , bailing \n",
-			   __FUNCTION__);
-		return;
-	    }
-	    
-	    
-	    if (strlcpy(dip, inet_ntoa(GET_DST_ADDR(p)), sizeof(dip)) >= sizeof(dip))
-	    {
-		FatalError("[%s()], strlcpy() error , bailing \n",
-			   __FUNCTION__);
-		return;
-	    }
-	}
-	
 	sn = GetSigByGidSid(ntohl(iEvent->generator_id),
 			    ntohl(iEvent->signature_id),
 			    ntohl(iEvent->signature_revision));
 	
-	cn = ClassTypeLookupById(barnyard2_conf,
-				 ntohl(iEvent->classification_id));
-	
-	if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-							   "[%u:%u:%u] ",
-							   ntohl(iEvent->generator_id),
-							   ntohl(iEvent->signature_id),
-							   ntohl(iEvent->signature_revision))) >=  SYSLOG_MAX_QUERY_SIZE)
-	{
-	    /* XXX */
-	    FatalError("[%s()], failed call to snprintf \n",
-		       __FUNCTION__);
-	}
-	
-	if( OpSyslog_Concat(syslogContext))
-        {
-            /* XXX */
-            FatalError("OpSyslog_Concat(): Failed \n");
-        }
+	/* "[gid:sid:rev] msg [Classification: c] [Priority: p]:" */
+	frag = GetSigFragment(sn, SIG_FRAG_SYSLOG_FULL, iEvent);
+
+	rval |= Syslog_Put(syslogContext, frag->data, frag->len);
 	
-	if(sn != NULL)
+	if(IPH_IS_VALID(p) && protocol_names[GET_IPH_PROTO(p)])
 	{
-	    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-							    "%s ",
-							    sn->msg)) >=  SYSLOG_MAX_QUERY_SIZE)
+	    /* " [<interface>] {proto} sip[:sp] -> dip[:dp]" */
+	    if(BcAlertInterface())
 	    {
-		/* XXX */
-		FatalError("[%s()], failed call to snprintf \n",
-			   __FUNCTION__);
+		rval |= Syslog_PutStr(syslogContext, " <");
+		rval |= Syslog_PutStr(syslogContext, barnyard2_conf->interface);
+		rval |= Syslog_PutChar(syslogContext, '>');
 	    }
-	}
-	else
-	{
-	    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-							       "ALERT ")) >=  SYSLOG_MAX_QUERY_SIZE)
-            {
-                /* XXX */
-                FatalError("[%s()], failed call to snprintf \n",
-                           __FUNCTION__);
-            }
-	    
-	}
-	
-	if( OpSyslog_Concat(syslogContext))
-        {
-            /* XXX */
-            FatalError("OpSyslog_Concat(): Failed \n");
-        }
 
+	    rval |= Syslog_PutStr(syslogContext, " {");
+	    rval |= Syslog_PutStr(syslogContext, protocol_names[GET_IPH_PROTO(p)]);
+	    rval |= Syslog_PutStr(syslogContext, "} ");
+	    rval |= Syslog_PutIP(syslogContext, p, 0);
 
-	
-	if(cn != NULL)
-        {
-            if( cn->name )
-            {
-                if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-								"[Classification: %s] [Priority: %d]:",
-								cn->name,
-								ntohl(((Unified2EventCommon *)event)->priority_id))) >= SYSLOG_MAX_QUERY_SIZE)
-		{
-		    /* XXX */
-		    FatalError("[%s()], failed call to snprintf \n",
-			       __FUNCTION__);
-		}
-		
-            }
-        }
-        else if( ntohl(((Unified2EventCommon *)event)->priority_id) != 0 )
-        {
-	    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-							    "[Priority: %d]:",
-							    ntohl(((Unified2EventCommon *)event)->priority_id))) >= SYSLOG_MAX_QUERY_SIZE)
+	    if( (GET_IPH_PROTO(p) != IPPROTO_TCP &&
+		 GET_IPH_PROTO(p) != IPPROTO_UDP &&
+		 GET_IPH_PROTO(p) != IPPROTO_ICMP) ||
+		p->frag_flag)
 	    {
-		/* XXX */
-		FatalError("[%s()], failed call to snprintf \n",
-			   __FUNCTION__);
-	    }
-        }
-	
-	if( OpSyslog_Concat(syslogContext))
-        {
-            /* XXX */
-            FatalError("OpSyslog_Concat(): Failed \n");
-        }	
-	
-	
-	if( (IPH_IS_VALID(p)) &&	
-	    (((GET_IPH_PROTO(p) != IPPROTO_TCP &&
-	       GET_IPH_PROTO(p) != IPPROTO_UDP &&
-	       GET_IPH_PROTO(p) != IPPROTO_ICMP) ||
-	      p->frag_flag)))
-	{
-	    if(!BcAlertInterface())
-	    {
-		if(protocol_names[GET_IPH_PROTO(p)])
-		{
-		    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-								       " {%s} %s -> %s",
-								       protocol_names[GET_IPH_PROTO(p)],
-								       sip, dip))   >= SYSLOG_MAX_QUERY_SIZE)
-		    {
-			/* XXX */
-			FatalError("[%s()], failed call to snprintf \n",
-				   __FUNCTION__);
-		    }
-		}
+		rval |= Syslog_PutStr(syslogContext, " -> ");
+		rval |= Syslog_PutIP(syslogContext, p, 1);
 	    }
 	    else
 	    {
-		if(protocol_names[GET_IPH_PROTO(p)])
-		{
-		    
-		    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-								       " <%s> {%s} %s -> %s",
-								       barnyard2_conf->interface,
-								       protocol_names[GET_IPH_PROTO(p)],
-								       sip, dip)) >= SYSLOG_MAX_QUERY_SIZE)
-		    {
-			/* XXX */
-			FatalError("[%s()], failed call to snprintf \n",
-				   __FUNCTION__);
-		    
-		    }
-		}
+		rval |= Syslog_PutChar(syslogContext, ':');
+		rval |= Syslog_PutUInt(syslogContext, p->sp);
+		rval |= Syslog_PutStr(syslogContext, " -> ");
+		rval |= Syslog_PutIP(syslogContext, p, 1);
+		rval |= Syslog_PutChar(syslogContext, ':');
+		rval |= Syslog_PutUInt(syslogContext, p->dp);
 	    }
 	}
-	else if (IPH_IS_VALID(p))
-	{
-	    if(BcAlertInterface())
-	    {
-		if(protocol_names[GET_IPH_PROTO(p)])
-		{
-		    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-								       " <%s> {%s} %s:%i -> %s:%i",
-								       barnyard2_conf->interface,
-								       protocol_names[GET_IPH_PROTO(p)], sip,
-								       p->sp, dip, p->dp)) >= SYSLOG_MAX_QUERY_SIZE)
-		    {
-			/* XXX */
-			FatalError("[%s()], failed call to snprintf \n",
-				   __FUNCTION__);
-		    }
-		}
-	    }
-	    else
-	    {
-		if(protocol_names[GET_IPH_PROTO(p)])
-		{
-		    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-								       " {%s} %s:%i -> %s:%i",
-								       protocol_names[GET_IPH_PROTO(p)], sip, p->sp,
-								       dip, p->dp)) >= SYSLOG_MAX_QUERY_SIZE)
-		    {
-			/* XXX */
-			FatalError("[%s()], failed call to snprintf \n",
-				   __FUNCTION__);
-		    }
-		}
-	    }
-	}
-	
+
+	rval |= Syslog_FormatExtraData(syslogContext, event);
 	
-	if( OpSyslog_Concat(syslogContext))
+	if(rval)
 	{
-	    /* XXX */
-	    FatalError("OpSyslog_Concat(): Failed \n");
+	    LogMessage("WARNING: syslog_full message too long, dropped.\n");
+	    return 1;
 	}
 
 	break;
@@ -1119,7 +1076,7 @@ void  OpSyslog_Alert(Packet *p, void *event, uint32_t event_type, void *arg)
 	if(Syslog_FormatTrigger(syslogContext, iEvent,0) ) 
 	{
 	    LogMessage("WARNING: Unable to append Trigger header.\n");
-	    return;
+	    return 1;
 	}
 	
 	/* Support for portscan ip */
@@ -1128,7 +1085,7 @@ void  OpSyslog_Alert(Packet *p, void *event, uint32_t event_type, void *arg)
 	    if(Syslog_FormatIPHeaderAlert(syslogContext, p) ) 
 	    {
 		LogMessage("WARNING: Unable to append Trigger header.\n");
-		return;
+		return 1;
 	    }
 	}	
 	
@@ -1148,19 +1105,20 @@ void  OpSyslog_Alert(Packet *p, void *event, uint32_t event_type, void *arg)
 		break;
 	    }
 	}
-	
-	/* CHECKME: -elz will update formating later on .. */
-	if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-							   "\n")) >= SYSLOG_MAX_QUERY_SIZE)
+
+	if(Syslog_FormatExtraData(syslogContext, event))
 	{
-	    /* XXX */
-	    FatalError("Couldn't finalize payload string ....\n");
+	    LogMessage("WARNING: Unable to append extra data.\n");
+	    return 1;
 	}
 	
-	if( OpSyslog_Concat(syslogContext))
+	/* CHECKME: -elz will update formating later on .. */
+	if( Syslog_SectionStart(syslogContext) ||
+	    Syslog_PutChar(syslogContext, '\n') ||
+	    Syslog_SectionEnd(syslogContext))
 	{
-	    /* XXX */
-	    FatalError("OpSyslog_Concat(): Failed \n");
+	    LogMessage("WARNING: syslog_full message too long, dropped.\n");
+	    return 1;
 	}
 	
 	break;
@@ -1170,16 +1128,41 @@ void  OpSyslog_Alert(Packet *p, void *event, uint32_t event_type, void *arg)
 		   __FUNCTION__);
 	break;
     }
+
+    return 0;
+}
+
+
+void  OpSyslog_Alert(Packet *p, void *event, uint32_t event_type, void *arg)
+{
+    OpSyslog_Data *syslogContext = NULL;    
+    
+    if( (p == NULL) ||
+	(event == NULL) ||
+	(arg == NULL))
+    {
+	LogMessage("OpSyslog_Alert(): Invoked with Packet[0x%x] Event[0x%x] Event Type [%u] Context pointer[0x%x]\n",
+		   p,
+		   event,
+		   event_type,
+		   arg);
+	return;
+    }
     
-    if(NetSend(syslogContext)) 
+    if(event_type != UNIFIED2_IDS_EVENT)
     {
-	NetClose(syslogContext);
-	if(syslogContext->local_logging != 1)
-	{
-	    FatalError("NetSend(): call failed for host:port '%s:%u' bailing...\n", syslogContext->server, syslogContext->port);
-	}
+        LogMessage("OpSyslog_Alert(): Is currently unable to handle Event Type [%u] \n",
+                   event_type);
+	return;
     }
     
+    
+    syslogContext = (OpSyslog_Data *)arg;
+
+    if(OpSyslog_FormatAlert(syslogContext, p, event))
+	return;
+
+    NetSend(syslogContext);
 
     return;
 }
@@ -1211,10 +1194,7 @@ void OpSyslog_Log(Packet *p, void *event, uint32_t event_type, void *arg)
     syslogContext = (OpSyslog_Data *)arg;
     iEvent = event;
 
-    memset(syslogContext->payload,'\0',(SYSLOG_MAX_QUERY_SIZE));
-    memset(syslogContext->formatBuffer,'\0',(SYSLOG_MAX_QUERY_SIZE));
     syslogContext->payload_current_pos = 0;
-    syslogContext->format_current_pos = 0;
     
     if(Syslog_FormatTrigger(syslogContext, iEvent,1) ) 
     {
@@ -1242,31 +1222,25 @@ void OpSyslog_Log(Packet *p, void *event, uint32_t event_type, void *arg)
 	}
     }
     
-    Syslog_FormatPayload(syslogContext, p);    
-    
-    /* CHECKME: -elz will update formating later on .. */
-    if( (syslogContext->format_current_pos += snprintf(syslogContext->formatBuffer,SYSLOG_MAX_QUERY_SIZE,
-                                                       "\n")) >= SYSLOG_MAX_QUERY_SIZE)
-    {
-        /* XXX */
-        FatalError("Couldn't finalize payload string ....\n");
-    }
-    
-    if( OpSyslog_Concat(syslogContext))
+    if(Syslog_FormatExtraData(syslogContext, event))
     {
-        /* XXX */
-        FatalError("OpSyslog_Concat(): Failed \n");
+	LogMessage("WARNING: Unable to append extra data.\n");
+	return;
     }
+
+    Syslog_FormatPayload(syslogContext, p);    
     
-    if(NetSend(syslogContext)) 
+    /* CHECKME: -elz will update formating later on .. */
+    if( Syslog_SectionStart(syslogContext) ||
+	Syslog_PutChar(syslogContext, '\n') ||
+	Syslog_SectionEnd(syslogContext))
     {
-	NetClose(syslogContext);
-	//Reliability...
-	FatalError("WARNING: Unable to connect to our syslog host: '%s:%u'\n", syslogContext->server, syslogContext->port);
-	
+	LogMessage("WARNING: syslog_full message too long, dropped.\n");
 	return;
     }
     
+    NetSend(syslogContext);
+
     return;
 }
 
@@ -1443,6 +1417,22 @@ OpSyslog_Data *OpSyslog_ParseArgs(char *args)
 		    op_data->payload_encoding = ENCODE_HEX;
                 }
             }
+	    else if(strcasecmp("queue_size", stoks[0]) == 0)
+	    {
+		if(num_stoks > 1)
+		    op_data->queue_size = strtoul(stoks[1], NULL, 0);
+		else
+		    LogMessage("Argument Error in %s(%i): %s\n", file_name,
+			       file_line, index);
+	    }
+	    else if(strcasecmp("batch_size", stoks[0]) == 0)
+	    {
+		if(num_stoks > 1)
+		    op_data->batch_size = strtoul(stoks[1], NULL, 0);
+		else
+		    LogMessage("Argument Error in %s(%i): %s\n", file_name,
+			       file_line, index);
+	    }
 	    else if(strcasecmp("local", stoks[0]) == 0)
 	    {
 		op_data->local_logging = 1;
@@ -1666,6 +1656,21 @@ OpSyslog_Data *OpSyslog_ParseArgs(char *args)
 	{
 	    FatalError("You must specify a valid server \n");
 	}
+
+	if(op_data->queue_size == 0)
+	{
+	    op_data->queue_size = SYSLOG_DEFAULT_QUEUE_SIZE;
+	}
+	else if(op_data->queue_size < SYSLOG_MIN_QUEUE_SIZE)
+	{
+	    LogMessage("queue_size too small, using %u \n",SYSLOG_MIN_QUEUE_SIZE);
+	    op_data->queue_size = SYSLOG_MIN_QUEUE_SIZE;
+	}
+
+	if(op_data->batch_size == 0)
+	{
+	    op_data->batch_size = SYSLOG_DEFAULT_BATCH_SIZE;
+	}
 	
     }
     
@@ -1732,6 +1737,10 @@ int UDPConnect(OpSyslog_Data *op_data)
 }
 
 
+/*
+ * Start connecting without waiting for the server, NetFlush() finishes
+ * the connection through NetConnectPoll() before anything is sent.
+ */
 int TCPConnect(OpSyslog_Data *op_data) 
 {
     int option=1;
@@ -1758,9 +1767,17 @@ int TCPConnect(OpSyslog_Data *op_data)
 	return 1;
     }
     
+    fcntl(op_data->socket, F_SETFL, fcntl(op_data->socket, F_GETFL, 0) | O_NONBLOCK);
+
     if( connect(op_data->socket,(struct sockaddr *)&op_data->sockaddr, sizeof(op_data->sockaddr)) != 0 )
     {
-	perror("connect()");
+	if(errno == EINPROGRESS)
+	{
+	    op_data->connecting = 1;
+	    op_data->connect_deadline = time(NULL) + SYSLOG_CONNECT_TIMEOUT;
+	    return 0;
+	}
+
 	close(op_data->socket);
 	op_data->socket = -1;
 	return 1;
@@ -1770,31 +1787,47 @@ int TCPConnect(OpSyslog_Data *op_data)
     return 0;
 }
 
-int NetConnect(OpSyslog_Data *op_data)
+
+/*
+ * Check on a connect started by TCPConnect().  Returns 0 once connected,
+ * 1 while still in progress and -1 if it failed or timed out.
+ */
+int NetConnectPoll(OpSyslog_Data *op_data)
 {
-    if(op_data == NULL)
-    {
-	/* XXX */
-	return 1;
-    }
-    
-    if(op_data->local_logging == 1)
+    struct pollfd pfd;
+    socklen_t errlen;
+    int err;
+
+    if(!op_data->connecting)
     {
 	return 0;
     }
 
-    if(op_data->socket > 0)
+    pfd.fd = op_data->socket;
+    pfd.events = POLLOUT;
+
+    if(poll(&pfd, 1, 0) < 1)
     {
-	if(NetTestSocket(op_data))
+	if(time(NULL) >= op_data->connect_deadline)
 	{
-	    op_data->socket = -1;
-	    /* Test reconnection */
+	    return -1;
 	}
+	return 1;
     }
 
-    
-    /* Set socket information */
-    
+    errlen = sizeof(err);
+    if(getsockopt(op_data->socket, SOL_SOCKET, SO_ERROR, &err, &errlen) || err)
+    {
+	return -1;
+    }
+
+    op_data->connecting = 0;
+    return 0;
+}
+
+/* Resolve the server once, reconnects reuse op_data->sockaddr */
+void NetResolve(OpSyslog_Data *op_data)
+{
     if (inet_aton(op_data->server,&op_data->sockaddr.sin_addr) != 1) 
     {
 	if ((op_data->hostPtr = gethostbyname(op_data->server)) == NULL) 
@@ -1804,13 +1837,24 @@ int NetConnect(OpSyslog_Data *op_data)
 	
 	memcpy(&op_data->sockaddr.sin_addr,op_data->hostPtr->h_addr,sizeof(op_data->sockaddr.sin_addr));
     }
-    
 
     op_data->sockaddr.sin_port = htons(op_data->port);
     op_data->sockaddr.sin_family = AF_INET;
+}
 
-
+int NetConnect(OpSyslog_Data *op_data)
+{
+    if(op_data == NULL)
+    {
+	/* XXX */
+	return 1;
+    }
     
+    if(op_data->local_logging == 1)
+    {
+	return 0;
+    }
+
     switch(op_data->proto)
     {
     case LOG_UDP:
@@ -1847,112 +1891,373 @@ int NetClose(OpSyslog_Data *op_data)
         return 0;
     }
 
-    if(op_data->socket)
+    if(op_data->socket >= 0)
     {
 	rval = close(op_data->socket);
 	op_data->socket = -1;
     }
+    op_data->connecting = 0;
     
     return rval;
 }
 
 
-int NetTestSocket(OpSyslog_Data *op_data)
+/*
+ * Drop the connection and schedule the next attempt, backing off
+ * exponentially up to SYSLOG_RECONNECT_MAX seconds.  Queued messages are
+ * kept, a partially sent one is resent in full on the new connection.
+ */
+void NetDisconnect(OpSyslog_Data *op_data)
 {
-    struct sockaddr addr = {0};
-    socklen_t socklen = {0};
+    NetClose(op_data);
+    op_data->queue_sent = 0;
 
-    if (op_data == NULL)
+    if(op_data->reconnect_backoff == 0)
     {
-	/* XXX */
-	return 1;
+	LogMessage("syslog_full: no connection to [%s] %s:%u, queueing messages until it is back\n",
+		   db_proto[op_data->proto],
+		   op_data->server,
+		   op_data->port);
+	op_data->reconnect_backoff = SYSLOG_RECONNECT_MIN;
     }
-    
-    if(op_data->local_logging == 1)
+    else if( (op_data->reconnect_backoff *= 2) > SYSLOG_RECONNECT_MAX)
     {
-	/* We skip */
-        return 0;
+	op_data->reconnect_backoff = SYSLOG_RECONNECT_MAX;
     }
 
+    op_data->reconnect_time = time(NULL) + op_data->reconnect_backoff;
+}
+
+
+/* Remove the message at the head of the queue */
+static void NetQueuePop(OpSyslog_Data *op_data)
+{
+    u_int32_t len;
 
-    if( getsockname(op_data->socket,&addr,&socklen) != 0)
+    memcpy(&len, op_data->queue + op_data->queue_head, sizeof(len));
+    op_data->queue_head += sizeof(len) + len;
+    op_data->queue_count--;
+
+    if(op_data->queue_head == op_data->queue_tail)
     {
-	/* XXX */
-	perror("NetTestSocket():");
-	return 1;
+	op_data->queue_head = op_data->queue_tail = 0;
     }
-    
-    return 0;
 }
 
-int NetSend(OpSyslog_Data *op_data) 
+
+/*
+ * Append a framed copy of msg to the queue.  TCP messages use RFC 6587
+ * octet counting ("<len> <msg>"), UDP datagrams keep their trailing NUL.
+ * When the queue is full the oldest messages are dropped.
+ */
+int NetQueue(OpSyslog_Data *op_data, const char *msg, u_int32_t len)
 {
+    char hdr[16];
+    u_int32_t hdr_len = 0;
+    u_int32_t rec_len;
+    u_int32_t need;
+
+    if(op_data->proto == LOG_TCP)
+    {
+	hdr_len = snprintf(hdr, sizeof(hdr), "%u ", len);
+	rec_len = hdr_len + len;
+    }
+    else
+    {
+	rec_len = len + 1;
+    }
 
-    int sendSize = 0;
-    int sendRetVal = 0;
+    need = sizeof(rec_len) + rec_len;
 
-    if(op_data == NULL)
+    if(op_data->queue_tail + need > op_data->queue_size)
     {
-	/* XXX */
-	return 1;
+	/* a partially sent message can't be dropped without breaking the stream */
+	while( (op_data->queue_head != op_data->queue_tail) &&
+	       (op_data->queue_sent == 0) &&
+	       (op_data->queue_tail - op_data->queue_head + need > op_data->queue_size))
+	{
+	    NetQueuePop(op_data);
+
+	    if(op_data->queue_dropped++ == 0)
+	    {
+		LogMessage("syslog_full: queue full, dropping messages for %s:%u\n",
+			   op_data->server,
+			   op_data->port);
+	    }
+	}
+
+	if(op_data->queue_tail - op_data->queue_head + need > op_data->queue_size)
+	{
+	    op_data->queue_dropped++;
+	    return 1;
+	}
+
+	memmove(op_data->queue,
+		op_data->queue + op_data->queue_head,
+		op_data->queue_tail - op_data->queue_head);
+	op_data->queue_tail -= op_data->queue_head;
+	op_data->queue_head = 0;
     }
-    
-    if(NetTestSocket(op_data))
+
+    memcpy(op_data->queue + op_data->queue_tail, &rec_len, sizeof(rec_len));
+    op_data->queue_tail += sizeof(rec_len);
+
+    if(hdr_len)
+    {
+	memcpy(op_data->queue + op_data->queue_tail, hdr, hdr_len);
+	op_data->queue_tail += hdr_len;
+    }
+
+    memcpy(op_data->queue + op_data->queue_tail, msg, len);
+    op_data->queue_tail += len;
+
+    if(op_data->proto != LOG_TCP)
     {
-	if( NetConnect(op_data))
+	op_data->queue[op_data->queue_tail++] = '\0';
+    }
+
+    op_data->queue_count++;
+    return 0;
+}
+
+
+/* Send up to SYSLOG_MAX_IOV queued messages with one call, returns bytes (tcp) or messages (udp) sent */
+static ssize_t NetSendBatch(OpSyslog_Data *op_data, int flags)
+{
+    struct iovec iov[SYSLOG_MAX_IOV];
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[SYSLOG_MAX_IOV];
+#endif
+    struct msghdr msg;
+    u_int32_t pos = op_data->queue_head;
+    u_int32_t len;
+    int n = 0;
+#ifndef HAVE_SENDMMSG
+    int rval;
+#endif
+
+    while( (pos != op_data->queue_tail) && (n < SYSLOG_MAX_IOV))
+    {
+	memcpy(&len, op_data->queue + pos, sizeof(len));
+	iov[n].iov_base = op_data->queue + pos + sizeof(len);
+	iov[n].iov_len = len;
+
+	if(n == 0 && op_data->queue_sent)
 	{
-	    FatalError("NetSend(): Failed to connect to host: [%s] %s:%u\n",
-		       db_proto[op_data->proto],
-		       op_data->server,
-		       op_data->port);
+	    iov[n].iov_base = (char *)iov[n].iov_base + op_data->queue_sent;
+	    iov[n].iov_len -= op_data->queue_sent;
 	}
+	pos += sizeof(len) + len;
+	n++;
     }
-    
-    sendSize=strlen(op_data->payload);
-    
+
+    if(op_data->proto == LOG_TCP)
+    {
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+
+	return sendmsg(op_data->socket, &msg, flags);
+    }
+
+#ifdef HAVE_SENDMMSG
+    memset(msgs, 0, sizeof(msgs[0]) * n);
+
+    for(pos = 0; pos < (u_int32_t)n; pos++)
+    {
+	msgs[pos].msg_hdr.msg_name = &op_data->sockaddr;
+	msgs[pos].msg_hdr.msg_namelen = sizeof(op_data->sockaddr);
+	msgs[pos].msg_hdr.msg_iov = &iov[pos];
+	msgs[pos].msg_hdr.msg_iovlen = 1;
+    }
+
+    return sendmmsg(op_data->socket, msgs, n, flags);
+#else
+    rval = sendto(op_data->socket, iov[0].iov_base, iov[0].iov_len, flags,
+		  (struct sockaddr *)&op_data->sockaddr, sizeof(op_data->sockaddr));
+
+    return rval < 0 ? rval : 1;
+#endif
+}
+
+
+/*
+ * Send everything that is queued, (re)connecting first if needed.
+ * Returns 0 if the queue was sent or the socket would block and 1 if
+ * the server is unreachable, in which case messages stay queued.
+ */
+int NetFlush(OpSyslog_Data *op_data, int flags)
+{
+    ssize_t sent;
+    u_int32_t len;
+
     if(op_data->local_logging == 1)
     {
-	syslog(op_data->syslog_priority,
-	       "%s",
-	       op_data->payload);
 	return 0;
     }
-    
 
-    switch(op_data->proto) 
+    op_data->last_flush = time(NULL);
+
+    if(op_data->queue_head == op_data->queue_tail)
     {
-	
-    case LOG_UDP: 
-	/* UDP */
-	if(sendto(op_data->socket,op_data->payload, strlen(op_data->payload)+1, 0 , (struct sockaddr *)&op_data->sockaddr, sizeof(struct sockaddr)) <= 0) 
+	return 0;
+    }
+
+    if(op_data->socket < 0)
+    {
+	if(op_data->last_flush < op_data->reconnect_time)
 	{
-	    /* XXX */
-	    close(op_data->socket);
-	    op_data->socket = -1;
 	    return 1;
 	}
-	break;
-	
-    case LOG_TCP: 
-	/* TCP */ 
-	
-	sendRetVal = send(op_data->socket, op_data->payload, strlen(op_data->payload)+1,0);
-	
-	if((sendRetVal < sendSize) ||
-	   (sendRetVal < 0) )
+
+	if(NetConnect(op_data))
 	{
-	    /* XXX */
-	    perror("send():");
-	    close(op_data->socket);
-	    op_data->socket = -1;
+	    NetDisconnect(op_data);
 	    return 1;
 	}
-	break;
-	
-    default:
+    }
+
+    switch(NetConnectPoll(op_data))
+    {
+    case 1:
+	return 0;
+    case -1:
+	NetDisconnect(op_data);
+	return 1;
+    }
+
+    if(op_data->reconnect_backoff)
+    {
+	LogMessage("syslog_full: reconnected to [%s] %s:%u\n",
+		   db_proto[op_data->proto],
+		   op_data->server,
+		   op_data->port);
+	op_data->reconnect_backoff = 0;
+    }
+
+    while(op_data->queue_head != op_data->queue_tail)
+    {
+	if( (sent = NetSendBatch(op_data, flags)) < 0)
+	{
+	    if(errno == EINTR)
+	    {
+		continue;
+	    }
+
+	    if(errno == EAGAIN || errno == EWOULDBLOCK)
+	    {
+		return 0;
+	    }
+
+	    LogMessage("syslog_full: send to %s:%u failed: %s\n",
+		       op_data->server,
+		       op_data->port,
+		       strerror(errno));
+	    NetDisconnect(op_data);
+	    return 1;
+	}
+
+	if(op_data->proto == LOG_TCP)
+	{
+	    /* skip what was written, remembering where a short write stopped */
+	    sent += op_data->queue_sent;
+	    op_data->queue_sent = 0;
+
+	    while(op_data->queue_head != op_data->queue_tail)
+	    {
+		memcpy(&len, op_data->queue + op_data->queue_head, sizeof(len));
+
+		if((size_t)sent < len)
+		{
+		    op_data->queue_sent = sent;
+		    break;
+		}
+		sent -= len;
+		NetQueuePop(op_data);
+	    }
+	}
+	else
+	{
+	    while(sent-- > 0)
+	    {
+		NetQueuePop(op_data);
+	    }
+	}
+    }
+
+    if(op_data->queue_dropped)
+    {
+	LogMessage("syslog_full: %u messages to %s:%u were dropped while the queue was full\n",
+		   op_data->queue_dropped,
+		   op_data->server,
+		   op_data->port);
+	op_data->queue_dropped = 0;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Keep flushing until the queue is empty, the server turns out to be
+ * unreachable or the deadline has passed, waiting for the socket in
+ * between.
+ */
+void NetDrain(OpSyslog_Data *op_data, time_t deadline)
+{
+    struct pollfd pfd;
+
+    while(1)
+    {
+	NetFlush(op_data, SYSLOG_SEND_FLAGS);
+
+	if( (op_data->queue_head == op_data->queue_tail) ||
+	    (time(NULL) >= deadline))
+	{
+	    return;
+	}
+
+	if(op_data->socket < 0)
+	{
+	    return;
+	}
+
+	pfd.fd = op_data->socket;
+	pfd.events = POLLOUT;
+	poll(&pfd, 1, 100);
+    }
+}
+
+
+/*
+ * Hand the current payload to local syslog, or queue it for the remote
+ * server and flush once a batch is ready or SYSLOG_FLUSH_INTERVAL has
+ * passed.  Delivery problems never stop barnyard2, the queue is kept
+ * until the server comes back.
+ */
+int NetSend(OpSyslog_Data *op_data) 
+{
+    if(op_data == NULL)
+    {
 	/* XXX */
 	return 1;
-	break;
+    }
+    
+    if(op_data->local_logging == 1)
+    {
+	op_data->payload[op_data->payload_current_pos] = '\0';
+	syslog(op_data->syslog_priority,
+	       "%s",
+	       op_data->payload);
+	return 0;
+    }
+
+    NetQueue(op_data, op_data->payload, op_data->payload_current_pos);
+
+    if( (op_data->queue_count >= op_data->batch_size) ||
+	(time(NULL) - op_data->last_flush >= SYSLOG_FLUSH_INTERVAL))
+    {
+	return NetFlush(op_data, SYSLOG_SEND_FLAGS);
     }
     
     return 0;
@@ -24,17 +24,21 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "barnyard2.h"
+#include "log_text.h"
 #include "map.h"
 #include "mstring.h"
 #include "parser.h"
@@ -55,6 +59,17 @@
 
 #define SYSLOG_MAX_QUERY_SIZE MAX_QUERY_LENGTH  
 
+/* remote messages are queued and sent in batches, see NetQueue() */
+#define SYSLOG_DEFAULT_QUEUE_SIZE (1024 * 1024)
+#define SYSLOG_MIN_QUEUE_SIZE (SYSLOG_MAX_QUERY_SIZE + 64)
+#define SYSLOG_DEFAULT_BATCH_SIZE 64
+#define SYSLOG_MAX_IOV 64
+#define SYSLOG_FLUSH_INTERVAL 1
+#define SYSLOG_RECONNECT_MIN 1
+#define SYSLOG_RECONNECT_MAX 60
+#define SYSLOG_CONNECT_TIMEOUT 5
+#define SYSLOG_EXIT_TIMEOUT 10
+
 typedef struct _OpSyslog_Data 
 {
     char *server;
@@ -83,16 +98,29 @@ typedef struct _OpSyslog_Data
     struct sockaddr_in sockaddr;
     int socket;
 
-    char *payload;
-    char *formatBuffer;
+    char *payload;              /* message being built, not NUL terminated */
     u_int32_t payload_current_pos;
-    u_int32_t format_current_pos;
 
-    
+    /* unsent messages, each stored as <u_int32_t len><framed message> */
+    char *queue;
+    u_int32_t queue_size;
+    u_int32_t queue_head;
+    u_int32_t queue_tail;
+    u_int32_t queue_count;
+    u_int32_t queue_sent;       /* bytes of the head message already sent (tcp) */
+    u_int32_t queue_dropped;
+    u_int32_t batch_size;
+
+    time_t last_flush;
+    time_t reconnect_time;
+    u_int32_t reconnect_backoff;
+    u_int8_t connecting;        /* tcp connect still in progress */
+    time_t connect_deadline;
 } OpSyslog_Data;
 
 void OpSyslog_Setup(void);
 void OpSyslog_Init(char *args,u_int8_t context);
+int OpSyslog_FormatAlert(OpSyslog_Data *syslogContext, Packet *p, void *event);
 
 
 #endif  /* __OP_SYSLOG_FULL_H_ */
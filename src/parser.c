@@ -208,6 +208,8 @@ static const ConfigFunc config_opts[] =
     { CONFIG_OPT__LOG_DIR, 1, 1, ConfigLogDir },
     { CONFIG_OPT__OBFUSCATE, 0, 1, ConfigObfuscate },
     { CONFIG_OPT__SIGSUPPRESS,0,0,ConfigSigSuppress},
+    { CONFIG_OPT__AGGREGATE, 0, 1, ConfigAggregate },
+    { CONFIG_OPT__METRICS, 1, 1, ConfigMetrics },
     /* XXX We can configure this on the command line - why not in config file ??? */
 #ifdef NOT_UNTIL_WE_DAEMONIZE_AFTER_READING_CONFFILE
     { CONFIG_OPT__PID_PATH, 1, 1, ConfigPidPath },
@@ -591,12 +593,18 @@ void ResolveOutputPlugins(Barnyard2Config *cmd_line, Barnyard2Config *config_fil
 
 void ConfigureOutputPlugins(Barnyard2Config *bc)
 {
+    static const char *decode_level_names[DECODE_LEVEL__MAX] =
+        { "none", "L3", "L4", "options", "payload" };
     OutputConfig *config;
     char *stored_file_name = file_name;
     int stored_file_line = file_line;
+    int instance = 0;
 
     barnyard2_conf_for_parsing = bc;
 
+    /* raised to the deepest level the configured outputs need */
+    bc->decode_level = DECODE_LEVEL__NONE;
+
     DEBUG_WRAP(DebugMessage(DEBUG_CONFIGRULES,"Output Plugin\n"););
 
     for (config = bc->output_configs; config != NULL; config = config->next)
@@ -610,9 +618,14 @@ void ConfigureOutputPlugins(Barnyard2Config *bc)
         if (func == NULL)
             ParseError("Unknown output plugin: \"%s\"", config->keyword);
 
+        RequireDecodeLevel(GetOutputDecodeLevel(config->keyword));
         func(config->opts);
+        NameOutputFuncs(config->keyword, instance++);
     }
 
+    LogMessage("Decoding packets to level: %s\n",
+               decode_level_names[bc->decode_level]);
+
     /* Reset these since we're done with configuring dynamic preprocessors */
     file_name = stored_file_name;
     file_line = stored_file_line;
@@ -2693,7 +2706,196 @@ void ConfigSigSuppress(Barnyard2Config *bc, char *args)
     return;
 }
 
+/*
+ * config aggregate[: window <secs>, samples <n>, max_keys <n>,
+ *                    key <sig|src|dst|sport|dport|proto ...>, log <file>]
+ */
+void ConfigAggregate(Barnyard2Config *bc, char *args)
+{
+    AggregateConfig *ac;
+    char **toks = NULL;
+    int num_toks = 0;
+    char **opts = NULL;
+    int num_opts = 0;
+    unsigned long val;
+    int i, j;
+
+    if (bc == NULL)
+        return;
+
+    ac = (AggregateConfig *)SnortAlloc(sizeof(AggregateConfig));
+    ac->key = AGGREGATE_KEY_DEFAULT;
+    ac->window = AGGREGATE_DEFAULT_WINDOW;
+    ac->samples = AGGREGATE_DEFAULT_SAMPLES;
+    ac->max_keys = AGGREGATE_DEFAULT_MAX_KEYS;
+
+    if (args != NULL)
+        toks = mSplit(args, ",", 0, &num_toks, 0);
+
+    for (i = 0; i < num_toks; i++)
+    {
+        opts = mSplit(toks[i], " \t", 0, &num_opts, 0);
+
+        if (num_opts < 2)
+        {
+            ParseError("config aggregate: missing value for \"%s\"", toks[i]);
+        }
+
+        if (strcasecmp(opts[0], "key") == 0)
+        {
+            ac->key = 0;
+
+            for (j = 1; j < num_opts; j++)
+            {
+                if (strcasecmp(opts[j], "sig") == 0)
+                    ac->key |= AGGREGATE_KEY_SIG;
+                else if (strcasecmp(opts[j], "src") == 0)
+                    ac->key |= AGGREGATE_KEY_SRC;
+                else if (strcasecmp(opts[j], "dst") == 0)
+                    ac->key |= AGGREGATE_KEY_DST;
+                else if (strcasecmp(opts[j], "sport") == 0)
+                    ac->key |= AGGREGATE_KEY_SPORT;
+                else if (strcasecmp(opts[j], "dport") == 0)
+                    ac->key |= AGGREGATE_KEY_DPORT;
+                else if (strcasecmp(opts[j], "proto") == 0)
+                    ac->key |= AGGREGATE_KEY_PROTO;
+                else
+                    ParseError("config aggregate: unknown key field \"%s\"", opts[j]);
+            }
+        }
+        else if (strcasecmp(opts[0], "log") == 0)
+        {
+            if (ac->log_file != NULL)
+                free(ac->log_file);
+
+            ac->log_file = SnortStrdup(opts[1]);
+        }
+        else
+        {
+            if (num_opts != 2 || BY2Strtoul(opts[1], &val))
+                ParseError("config aggregate: invalid value for \"%s\"", opts[0]);
+
+            if (strcasecmp(opts[0], "window") == 0)
+            {
+                if (val == 0 || val > AGGREGATE_MAX_WINDOW)
+                    ParseError("config aggregate: window must be between 1 and %d seconds",
+                               AGGREGATE_MAX_WINDOW);
+                ac->window = (uint32_t)val;
+            }
+            else if (strcasecmp(opts[0], "samples") == 0)
+            {
+                if (val > UINT32_MAX)
+                    ParseError("config aggregate: samples out of range");
+                ac->samples = (uint32_t)val;
+            }
+            else if (strcasecmp(opts[0], "max_keys") == 0)
+            {
+                if (val == 0 || val > AGGREGATE_MAX_KEYS)
+                    ParseError("config aggregate: max_keys must be between 1 and %d",
+                               AGGREGATE_MAX_KEYS);
+                ac->max_keys = (uint32_t)val;
+            }
+            else
+            {
+                ParseError("config aggregate: unknown option \"%s\"", opts[0]);
+            }
+        }
+
+        mSplitFree(&opts, num_opts);
+    }
+
+    mSplitFree(&toks, num_toks);
 
+    if (ac->key == 0)
+        ParseError("config aggregate: empty key");
+
+    AggregateConfigFree(bc->aggregate);
+    bc->aggregate = ac;
+}
+
+/*
+ * config metrics: [listen <unix:path|[addr:]port>], [file <file>],
+ *                 [interval <secs>], [trace], [lag_warning <secs>]
+ */
+void ConfigMetrics(Barnyard2Config *bc, char *args)
+{
+    MetricsConfig *mc;
+    char **toks = NULL;
+    int num_toks = 0;
+    char **opts = NULL;
+    int num_opts = 0;
+    unsigned long val;
+    int i;
+
+    if (bc == NULL || args == NULL)
+        return;
+
+    mc = (MetricsConfig *)SnortAlloc(sizeof(MetricsConfig));
+    mc->interval = METRICS_DEFAULT_INTERVAL;
+
+    toks = mSplit(args, ",", 0, &num_toks, 0);
+
+    for (i = 0; i < num_toks; i++)
+    {
+        opts = mSplit(toks[i], " \t", 0, &num_opts, 0);
+
+        if (num_opts == 1 && strcasecmp(opts[0], "trace") == 0)
+        {
+            mc->trace = 1;
+            mSplitFree(&opts, num_opts);
+            continue;
+        }
+
+        if (num_opts != 2)
+            ParseError("config metrics: invalid option \"%s\"", toks[i]);
+
+        if (strcasecmp(opts[0], "listen") == 0)
+        {
+            if (mc->listen != NULL)
+                free(mc->listen);
+
+            mc->listen = SnortStrdup(opts[1]);
+        }
+        else if (strcasecmp(opts[0], "file") == 0)
+        {
+            if (mc->file != NULL)
+                free(mc->file);
+
+            mc->file = SnortStrdup(opts[1]);
+        }
+        else if (strcasecmp(opts[0], "interval") == 0)
+        {
+            if (BY2Strtoul(opts[1], &val) || val == 0 || val > METRICS_MAX_INTERVAL)
+                ParseError("config metrics: interval must be between 1 and %d seconds",
+                           METRICS_MAX_INTERVAL);
+
+            mc->interval = (uint32_t)val;
+        }
+        else if (strcasecmp(opts[0], "lag_warning") == 0)
+        {
+            if (BY2Strtoul(opts[1], &val) || val == 0 || val > UINT32_MAX)
+                ParseError("config metrics: invalid lag_warning \"%s\"", opts[1]);
+
+            /* warnings come from the tracing */
+            mc->lag_warning = (uint32_t)val;
+            mc->trace = 1;
+        }
+        else
+        {
+            ParseError("config metrics: unknown option \"%s\"", opts[0]);
+        }
+
+        mSplitFree(&opts, num_opts);
+    }
+
+    mSplitFree(&toks, num_toks);
+
+    if (mc->listen == NULL && mc->file == NULL && !mc->trace)
+        ParseError("config metrics: needs a listen socket, a file or trace");
+
+    MetricsConfigFree(bc->metrics);
+    bc->metrics = mc;
+}
 
 
 #ifdef MPLS
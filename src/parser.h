@@ -77,6 +77,8 @@
 #define CONFIG_OPT__VERBOSE                         "verbose"
 #define CONFIG_OPT__WALDO_FILE                      "waldo_file"
 #define CONFIG_OPT__SIGSUPPRESS                     "sig_suppress"
+#define CONFIG_OPT__AGGREGATE                       "aggregate"
+#define CONFIG_OPT__METRICS                         "metrics"
 #ifdef MPLS
 # define CONFIG_OPT__MAX_MPLS_LABELCHAIN_LEN        "max_mpls_labelchain_len"
 # define CONFIG_OPT__MPLS_PAYLOAD_TYPE              "mpls_payload_type"
@@ -153,6 +155,8 @@ void ConfigMaxMplsLabelChain(Barnyard2Config *, char *);
 void ConfigMplsPayloadType(Barnyard2Config *, char *);
 #endif
 void ConfigSigSuppress(Barnyard2Config *, char *);
+void ConfigAggregate(Barnyard2Config *, char *);
+void ConfigMetrics(Barnyard2Config *, char *);
 void DisplaySigSuppress(SigSuppress_list **);
 
 
@@ -64,6 +64,7 @@
 #include "output-plugins/spo_alert_fast.h"
 #include "output-plugins/spo_alert_full.h"
 #include "output-plugins/spo_alert_fwsam.h"
+#include "output-plugins/spo_alert_json.h"
 #include "output-plugins/spo_alert_syslog.h"
 #include "output-plugins/spo_alert_test.h"
 #include "output-plugins/spo_alert_prelude.h"
@@ -81,6 +82,7 @@ extern OutputConfigFuncNode *output_config_funcs;
 extern PluginSignalFuncNode *plugin_shutdown_funcs;
 extern PluginSignalFuncNode *plugin_clean_exit_funcs;
 extern PluginSignalFuncNode *plugin_restart_funcs;
+extern PluginSignalFuncNode *plugin_idle_funcs;
 
 extern InputFuncNode  *InputList;
 extern OutputFuncNode *AlertList;
@@ -335,6 +337,7 @@ void RegisterOutputPlugins(void)
     AlertUnixSockSetup();
 #endif /* !WIN32 */
     AlertCSVSetup();
+    AlertJSONSetup();
     LogNullSetup();
     LogAsciiSetup();
 
@@ -371,12 +374,14 @@ void RegisterOutputPlugins(void)
  * Arguments: keyword => The output keyword to associate with the
  *                       output processor
  *            type => alert or log types
+ *            decode_level => how far packets have to be decoded for it
  *            *func => function pointer to the handler
  *
  * Returns: void function
  *
  ***************************************************************************/
-void RegisterOutputPlugin(char *keyword, int type_flags, OutputConfigFunc func)
+void RegisterOutputPlugin(char *keyword, int type_flags, DecodeLevel decode_level,
+                          OutputConfigFunc func)
 {
     OutputConfigFuncNode *node = (OutputConfigFuncNode *)SnortAlloc(sizeof(OutputConfigFuncNode));
 
@@ -411,6 +416,7 @@ void RegisterOutputPlugin(char *keyword, int type_flags, OutputConfigFunc func)
     node->keyword = SnortStrdup(keyword);
     node->func = func;
     node->output_type_flags = type_flags;
+    node->decode_level = decode_level;
 }
 
 OutputConfigFunc GetOutputConfigFunc(char *keyword)
@@ -449,6 +455,35 @@ int GetOutputTypeFlags(char *keyword)
     return 0;
 }
 
+DecodeLevel GetOutputDecodeLevel(char *keyword)
+{
+    OutputConfigFuncNode *head = output_config_funcs;
+
+    if (keyword == NULL)
+        return DECODE_LEVEL__PAYLOAD;
+
+    while (head != NULL)
+    {
+        if (strcasecmp(head->keyword, keyword) == 0)
+           return head->decode_level;
+
+        head = head->next;
+    }
+
+    return DECODE_LEVEL__PAYLOAD;
+}
+
+/* For outputs whose options need more of the packet than they registered
+ * with (eg. a packet dump), called from their init function. */
+void RequireDecodeLevel(DecodeLevel level)
+{
+    if (barnyard2_conf_for_parsing == NULL)
+        return;
+
+    if ((int)level > barnyard2_conf_for_parsing->decode_level)
+        barnyard2_conf_for_parsing->decode_level = level;
+}
+
 void FreeOutputConfigFuncs(void)
 {
     OutputConfigFuncNode *head = output_config_funcs;
@@ -527,6 +562,15 @@ void FreeOutputList(OutputFuncNode *list)
 
 	if(tmp != NULL)
 	{
+	    if (tmp->keyword != NULL)
+	        free(tmp->keyword);
+
+	    if (tmp->event_lag != NULL)
+	        free(tmp->event_lag);
+
+	    if (tmp->read_lag != NULL)
+	        free(tmp->read_lag);
+
 	    free(tmp);
 	}
     }
@@ -662,7 +706,47 @@ int pbCheckSignatureSuppression(void *event)
 
 
 
-void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_t event_type)
+/* label the output functions an output line just added, for the metrics */
+void NameOutputFuncs(const char *keyword, int instance)
+{
+    OutputFuncNode *lists[2] = { AlertList, LogList };
+    OutputFuncNode *idx;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (idx = lists[i]; idx != NULL; idx = idx->next)
+        {
+            if (idx->keyword != NULL)
+                continue;
+
+            idx->keyword = SnortStrdup(keyword);
+            idx->instance = instance;
+        }
+    }
+}
+
+static inline void CallOutputFunc(OutputFuncNode *idx, Packet *packet, void *event,
+                                  uint32_t event_type, uint64_t read_time)
+{
+    uint64_t start;
+
+    if (!metrics_enabled)
+    {
+        idx->func(packet, event, event_type, idx->arg);
+        return;
+    }
+
+    start = MetricsNow();
+    idx->func(packet, event, event_type, idx->arg);
+    MetricsObserve(&idx->latency, start);
+
+    if (metrics_trace)
+        MetricsTrace(idx, packet, event, read_time);
+}
+
+void CallOutputPlugins(OutputType out_type, Packet *packet, void *event,
+                       uint32_t event_type, uint64_t read_time)
 {
     OutputFuncNode *idx = NULL;
 
@@ -679,14 +763,14 @@ void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_
         idx = AlertList;
         while (idx != NULL)
         {
-            idx->func(packet, event, event_type, idx->arg);
+            CallOutputFunc(idx, packet, event, event_type, read_time);
             idx = idx->next;
         }
 
         idx = LogList;
         while (idx != NULL)
         {
-            idx->func(packet, event, event_type, idx->arg);
+            CallOutputFunc(idx, packet, event, event_type, read_time);
             idx = idx->next;
         }
     }
@@ -698,7 +782,7 @@ void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_
 	
         while (idx != NULL)
         {
-            idx->func(packet, event, event_type, idx->arg);
+            CallOutputFunc(idx, packet, event, event_type, read_time);
             idx = idx->next;
         }
 	
@@ -706,7 +790,7 @@ void CallOutputPlugins(OutputType out_type, Packet *packet, void *event, uint32_
 
         while (idx != NULL)
         {
-            idx->func(packet, event, event_type, idx->arg);
+            CallOutputFunc(idx, packet, event, event_type, read_time);
             idx = idx->next;
         }
 	
@@ -742,6 +826,21 @@ void AddFuncToShutdownList(PluginSignalFunc func, void *arg)
     AddFuncToSignalList(func, arg, &plugin_shutdown_funcs);
 }
 
+/* Called whenever the spooler runs out of records to process, so that
+ * plugins buffering output can write it out */
+void AddFuncToIdleList(PluginSignalFunc func, void *arg)
+{
+    AddFuncToSignalList(func, arg, &plugin_idle_funcs);
+}
+
+void CallIdleFuncs(void)
+{
+    PluginSignalFuncNode *idx;
+
+    for (idx = plugin_idle_funcs; idx != NULL; idx = idx->next)
+        idx->func(0, idx->arg);
+}
+
 void AddFuncToPostConfigList(PluginSignalFunc func, void *arg)
 {
     Barnyard2Config *bc = barnyard2_conf_for_parsing;
@@ -30,6 +30,7 @@
 //#include "rules.h"
 #include "sf_types.h"
 #include "debug.h"
+#include "metrics.h"
 
 #ifndef WIN32
 #  include <sys/ioctl.h>
@@ -147,6 +148,7 @@ typedef struct _OutputConfigFuncNode
 {
     char *keyword;
     int output_type_flags;
+    DecodeLevel decode_level;   /* how much of the packet it reads */
     OutputConfigFunc func;
     struct _OutputConfigFuncNode *next;
 
@@ -158,17 +160,26 @@ typedef struct _OutputFuncNode
     OutputFunc func;
     struct _OutputFuncNode *next;
 
+    char *keyword;              /* output plugin it belongs to */
+    int instance;               /* position of its output line */
+    MetricsHistogram latency;
+    MetricsLatency *event_lag;  /* event time to output, when tracing */
+    MetricsLatency *read_lag;   /* record read to output, when tracing */
+
 } OutputFuncNode;
 
 void RegisterOutputPlugins(void);
-void RegisterOutputPlugin(char *, int, OutputConfigFunc);
+void RegisterOutputPlugin(char *, int, DecodeLevel, OutputConfigFunc);
 OutputConfigFunc GetOutputConfigFunc(char *);
 int GetOutputTypeFlags(char *);
+DecodeLevel GetOutputDecodeLevel(char *);
+void RequireDecodeLevel(DecodeLevel);
 void DumpOutputPlugins(void);
 void AddFuncToOutputList(OutputFunc, OutputType, void *);
 void FreeOutputConfigFuncs(void);
 void FreeOutputList(OutputFuncNode *);
-void CallOutputPlugins(OutputType, Packet *, void *, uint32_t);
+void NameOutputFuncs(const char *, int);
+void CallOutputPlugins(OutputType, Packet *, void *, uint32_t, uint64_t);
 
 
 /*************************** Miscellaneous  API  ***************************/
@@ -187,6 +198,8 @@ void AddFuncToRestartList(PluginSignalFunc, void *);
 void AddFuncToCleanExitList(PluginSignalFunc, void *);
 void AddFuncToShutdownList(PluginSignalFunc, void *);
 void AddFuncToPostConfigList(PluginSignalFunc, void *);
+void AddFuncToIdleList(PluginSignalFunc, void *);
+void CallIdleFuncs(void);
 void AddFuncToSignalList(PluginSignalFunc, void *, PluginSignalFuncNode **);
 void PostConfigInitPlugins(PluginSignalFuncNode *);
 void FreePluginSigFuncs(PluginSignalFuncNode *);
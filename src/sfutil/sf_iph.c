@@ -323,8 +323,8 @@ void sfiph_build(Packet *p, const void *hdr, int family)
         return;
 
     /* If family is already set, we've been here before.
-     * That means this is a nested IP.  */
-    if (p->family != NO_IP)
+     * That means this is a nested IP, the outer header is the first one.  */
+    if (p->family != NO_IP && p->outer_family == NO_IP)
     {
         if (p->iph_api->ver == IPH_API_V4)
             memcpy(&p->outer_ip4h, &p->inner_ip4h, sizeof(IP4Hdr));
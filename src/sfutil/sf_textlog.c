@@ -173,7 +173,7 @@ bool TextLog_Putc (TextLog* this, char c)
 }
 
 /*-------------------------------------------------------------------
- * TextLog_Write: append string to buffer
+ * TextLog_Write: append len bytes of string to buffer
  *-------------------------------------------------------------------
  */
 bool TextLog_Write (TextLog* this, const char* str, int len)
@@ -185,22 +185,61 @@ bool TextLog_Write (TextLog* this, const char* str, int len)
         TextLog_Flush(this);
         avail = TextLog_Avail(this);
     }
-    len = snprintf(this->buf+this->pos, avail, "%s", str);
-
-    if ( len >= avail )
+    if ( len < 0 )
     {
-        this->pos = this->maxBuf - 1;
-        this->buf[this->pos] = '\0';
         return FALSE;
     }
-    else if ( len < 0 )
+    if ( len > avail )
     {
+        memcpy(this->buf+this->pos, str, avail);
+        this->pos = this->maxBuf - 1;
+        this->buf[this->pos] = '\0';
         return FALSE;
     }
+    memcpy(this->buf+this->pos, str, len);
     this->pos += len;
+    this->buf[this->pos] = '\0';
     return TRUE;
 }
 
+/*-------------------------------------------------------------------
+ * TextLog_PutUInt: append unsigned decimal number to buffer
+ *-------------------------------------------------------------------
+ */
+bool TextLog_PutUInt (TextLog* this, unsigned long n)
+{
+    char tmp[3*sizeof(n)];
+    int i = sizeof(tmp);
+
+    do
+    {
+        tmp[--i] = '0' + (n % 10);
+        n /= 10;
+    } while ( n );
+
+    return TextLog_Write(this, tmp+i, sizeof(tmp)-i);
+}
+
+/*-------------------------------------------------------------------
+ * TextLog_PutHex: append unsigned number to buffer as upper case hex
+ * without leading zeros or prefix (same as "%lX")
+ *-------------------------------------------------------------------
+ */
+bool TextLog_PutHex (TextLog* this, unsigned long n)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    char tmp[2*sizeof(n)];
+    int i = sizeof(tmp);
+
+    do
+    {
+        tmp[--i] = digits[n & 0xF];
+        n >>= 4;
+    } while ( n );
+
+    return TextLog_Write(this, tmp+i, sizeof(tmp)-i);
+}
+
 /*-------------------------------------------------------------------
  * TextLog_Printf: append formatted string to buffer
  *-------------------------------------------------------------------
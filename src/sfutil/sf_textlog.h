@@ -83,6 +83,8 @@ bool TextLog_Putc(TextLog*, char);
 bool TextLog_Quote(TextLog*, const char*);
 bool TextLog_Write(TextLog*, const char*, int len);
 bool TextLog_Print(TextLog*, const char* format, ...);
+bool TextLog_PutUInt(TextLog*, unsigned long);
+bool TextLog_PutHex(TextLog*, unsigned long);
 
 bool TextLog_Flush(TextLog*);
 
@@ -50,6 +50,7 @@ Spooler *spoolerOpen(const char *, const char *, uint32_t);
 int spoolerReadRecordHeader(Spooler *);
 int spoolerReadRecord(Spooler *);
 void spoolerProcessRecord(Spooler *, int);
+void spoolerFireEvent(OutputType, Packet *, EventRecordNode *, uint64_t);
 void spoolerFreeRecord(Record *record);
 
 int spoolerWriteWaldo(Waldo *, Spooler *);
@@ -165,6 +166,7 @@ Spooler *spoolerOpen(const char *dirpath, const char *filename, uint32_t extensi
     /* allocate some extra structures required (ie. Packet) */
 
     spooler->fd = -1;
+    spooler->linktype = -1;
 
     /* build the full filepath */
     if (extension == 0)
@@ -231,6 +233,10 @@ int spoolerClose(Spooler *spooler)
     /* free record */
     spoolerFreeRecord(&spooler->record);
 
+    /* a held packet is dropped, its event is output again from the waldo */
+    free(spooler->held_pkt);
+    free(spooler->held_data);
+
 	//avoid a possible double free!
 	UnRegisterSpooler(spooler);
 
@@ -274,6 +280,77 @@ void UnRegisterSpooler(Spooler *spooler) {
     return;
 }
 
+/*
+** How far the spooler is behind the newest spooled data: the unread part of
+** the current file plus, in continuous mode, every newer spool file. The
+** record count is estimated from the mean record size of the current file.
+*/
+void spoolerGetLag(Spooler *spooler, uint64_t *bytes, uint64_t *records, uint32_t *files)
+{
+    struct stat         st;
+    off_t               pos;
+    DIR                 *dir;
+    struct dirent       *dir_entry;
+    const char          *dirpath;
+    const char          *filebase;
+    size_t              filebase_len;
+    char                path[MAX_FILEPATH_BUF];
+    char                *endptr;
+    unsigned long       file_timestamp;
+
+    *bytes = 0;
+    *records = 0;
+    *files = 0;
+
+    if (spooler == NULL || spooler->fd == -1)
+        return;
+
+    pos = lseek(spooler->fd, 0, SEEK_CUR);
+    if (pos == -1 || fstat(spooler->fd, &st) != 0)
+        return;
+
+    if (st.st_size > pos)
+        *bytes = st.st_size - pos;
+
+    if (BcContinuousMode())
+    {
+        dirpath = barnyard2_conf->waldo.data.spool_dir;
+        filebase = barnyard2_conf->waldo.data.spool_filebase;
+        filebase_len = strlen(filebase);
+
+        if ( (dir=opendir(dirpath)) != NULL )
+        {
+            while ( (dir_entry=readdir(dir)) )
+            {
+                if (strncmp(filebase, dir_entry->d_name, filebase_len) != 0 ||
+                    dir_entry->d_name[filebase_len] != '.')
+                    continue;
+
+                errno = 0;
+                file_timestamp = strtoul(dir_entry->d_name + filebase_len + 1, &endptr, 10);
+                if (errno == ERANGE || *endptr != '\0' ||
+                    file_timestamp <= spooler->timestamp)
+                    continue;
+
+                if (SnortSnprintf(path, sizeof(path), "%s/%s", dirpath,
+                                  dir_entry->d_name) != SNORT_SNPRINTF_SUCCESS)
+                    continue;
+
+                if (stat(path, &st) == 0)
+                {
+                    *bytes += st.st_size;
+                    (*files)++;
+                }
+            }
+
+            closedir(dir);
+        }
+    }
+
+    if (spooler->record_idx > 0 && pos > 0)
+        *records = *bytes * spooler->record_idx / pos;
+}
+
 
 
 int spoolerReadRecordHeader(Spooler *spooler)
@@ -333,6 +410,9 @@ int spoolerReadRecord(Spooler *spooler)
         spooler->state = SPOOLER_STATE_RECORD_READ;
         spooler->record_idx++;
         spooler->offset = 0;
+
+        if (metrics_trace)
+            spooler->record_read = MetricsNow();
     }
     else
     {
@@ -402,6 +482,10 @@ int ProcessBatch(const char *dirpath, const char *filename)
         }
     }
 
+    /* output the last event before the plugins write out what they buffered */
+    spoolerFireHeld(spooler, 0);
+    CallIdleFuncs();
+
     /* we've finished with the spooler so destroy and cleanup */
     spoolerClose(spooler);
     spooler = NULL;
@@ -480,6 +564,7 @@ int ProcessContinuous(const char *dirpath, const char *filebase,
                     barnyard2_conf->process_new_records_only_flag = 0;
                 }
 
+                CallIdleFuncs();
                 sleep(1);
                 continue;
             }
@@ -612,6 +697,8 @@ int ProcessContinuous(const char *dirpath, const char *filebase,
                         break;
                 }
 
+                spoolerFireHeld(spooler, 1);
+
                 /* archive the file */
                 if (BcArchiveDir() != NULL)
                     ArchiveFile(spooler->filepath, BcArchiveDir());
@@ -649,6 +736,9 @@ int ProcessContinuous(const char *dirpath, const char *filebase,
                         barnyard2_conf->process_new_records_only_flag = 0;
                     }
 
+                    /* nothing more is coming for the held packet for now */
+                    spoolerFireHeld(spooler, 1);
+                    CallIdleFuncs();
                     sleep(1);
                     continue;
                 }
@@ -656,6 +746,8 @@ int ProcessContinuous(const char *dirpath, const char *filebase,
         }
     }
 
+    spoolerFireHeld(spooler, 1);
+
     /* close waldo if appropriate */
     if(barnyard2_conf)
     	spoolerCloseWaldo(&barnyard2_conf->waldo);
@@ -701,10 +793,17 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
         case UNIFIED2_IDS_EVENT_IPV6_VLAN:
             pc.total_events++;
             break;
+        case UNIFIED2_EXTRA_DATA:
+            pc.total_extra_data++;
+            break;
         default:
             pc.total_unknown++;
     }
 
+    /* anything but more extra data means the held packet's event is complete */
+    if (type != UNIFIED2_EXTRA_DATA)
+        spoolerFireHeld(spooler, 0);
+
     /* check if it's packet */
     if (type == UNIFIED2_PACKET)
     {
@@ -724,15 +823,30 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
 
         /* decode the packet from the Unified2Packet information */
         datalink = ntohl(((Unified2Packet *)spooler->record.data)->linktype);
-        DecodePacket(datalink, spooler->record.pkt, &pkth, 
-                     ((Unified2Packet *)spooler->record.data)->packet_data);
+        if (datalink != spooler->linktype)
+        {
+            spooler->decode = GetDatalinkDecoder(datalink);
+            spooler->linktype = datalink;
+        }
 
-	/* This is a fixup for portscan... */
-	if( (spooler->record.pkt->iph == NULL) && 
-	    ((spooler->record.pkt->inner_iph != NULL) && (spooler->record.pkt->inner_iph->ip_proto == 255)))
-	    {
-		spooler->record.pkt->iph = spooler->record.pkt->inner_iph;
-	    }
+        if (BcDecodeLevel() == DECODE_LEVEL__NONE)
+        {
+            /* the outputs only write out the raw packet */
+            spooler->record.pkt->pkth = &pkth;
+            spooler->record.pkt->pkt = ((Unified2Packet *)spooler->record.data)->packet_data;
+            spooler->record.pkt->linktype = datalink;
+        }
+        else if (metrics_enabled)
+        {
+            uint64_t start = MetricsNow();
+
+            DecodeDatalink(spooler->decode, datalink, spooler->record.pkt, &pkth,
+                           ((Unified2Packet *)spooler->record.data)->packet_data);
+            MetricsObserve(&metrics_decode, start);
+        }
+        else
+            DecodeDatalink(spooler->decode, datalink, spooler->record.pkt, &pkth,
+                           ((Unified2Packet *)spooler->record.data)->packet_data);
 
         /* check if it's been re-assembled */
         if (spooler->record.pkt->packet_flags & PKT_REBUILT_STREAM)
@@ -746,12 +860,21 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
             /* call output plugins with a "SPECIAL" alert format (both Event and Packet information) */
             DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing SPECIAL style (Packet+Event)\n"););
 
-            if ( fire_output && 
+            /* snort writes the extra data of an event after its packet, so
+             * the packet is held until the next record shows it is all in */
+            if ( fire_output && ernCache->aggregated == 0 &&
                  ((ernCache->used == 0) || BcAlertOnEachPacketInStream()) )
-                CallOutputPlugins(OUTPUT_TYPE__SPECIAL, 
-                              spooler->record.pkt, 
-                              ernCache->data, 
-                              ernCache->type);
+            {
+                spooler->held_event = ernCache;
+                spooler->held_pkt = spooler->record.pkt;
+                spooler->held_data = spooler->record.data;
+                spooler->held_pkth = pkth;
+                spooler->held_pkt->pkth = &spooler->held_pkth;
+                spooler->held_read = spooler->record_read;
+
+                spooler->record.pkt = NULL;
+                spooler->record.data = NULL;
+            }
 
             /* indicate that the cached event has been used */
             ernCache->used = 1;
@@ -766,11 +889,9 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
                 /* call output plugins with an "ALERT" format (cached Event information only) */
                 DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing ALERT style (Event only)\n"););
 
-                if (fire_output)
-                    CallOutputPlugins(OUTPUT_TYPE__ALERT, 
-                                      NULL,
-                                      ernCache->data, 
-                                      ernCache->type);
+                if (fire_output && ernCache->aggregated == 0)
+                    spoolerFireEvent(OUTPUT_TYPE__ALERT, NULL, ernCache,
+                                     ernCache->read_time);
 
                 /* set the event cache used flag */
                 ernCache->used = 1;
@@ -783,15 +904,17 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
                 CallOutputPlugins(OUTPUT_TYPE__SPECIAL,
                                   spooler->record.pkt, 
                                   NULL, 
-                                  0);
+                                  0,
+                                  spooler->record_read);
         }
 
         /* free the memory allocated in this function */
         free(spooler->record.pkt);
         spooler->record.pkt = NULL;
 
-        /* waldo operations occur after the output plugins are called */
-        if (fire_output)
+        /* waldo operations occur after the output plugins are called, a
+         * held packet has not been output yet */
+        if (fire_output && spooler->held_event == NULL)
             spoolerWriteWaldo(&barnyard2_conf->waldo, spooler);
     }
     /* check if it's an event of known sorts */
@@ -807,11 +930,9 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
 
             ernCache = spoolerEventCacheGetHead(spooler);
 
-            if (fire_output)
-                CallOutputPlugins(OUTPUT_TYPE__ALERT, 
-                              NULL,
-                              ernCache->data, 
-                              ernCache->type);
+            if (fire_output && ernCache->aggregated == 0)
+                spoolerFireEvent(OUTPUT_TYPE__ALERT, NULL, ernCache,
+                                 ernCache->read_time);
 
             /* flush the event cache flag */
             ernCache->used = 1;
@@ -821,14 +942,47 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
         spoolerEventCachePush(spooler, type, spooler->record.data);
         spooler->record.data = NULL;
 
+        /* duplicates folded into an aggregate are never output */
+        if (fire_output)
+            spooler->event_cache->aggregated = AggregateEvent(type, spooler->event_cache->data);
+
         /* waldo operations occur after the output plugins are called */
         if (fire_output)
             spoolerWriteWaldo(&barnyard2_conf->waldo, spooler);
     }
     else if (type == UNIFIED2_EXTRA_DATA)
     {
+        ExtraData *ed;
+        ExtraData **tail;
+
+        /* keep it with its event, which is output later */
+        ed = ExtraDataParse(spooler->record.data,
+                            ntohl(((Unified2RecordHeader *)spooler->record.header)->length));
+
+        if (ed != NULL &&
+            (ernCache = spoolerEventCacheGetByEventID(spooler, ed->event_id)) != NULL)
+        {
+            for (tail = &ernCache->extra; *tail != NULL; tail = &(*tail)->next)
+                ;
+
+            *tail = ed;
+            spooler->record.data = NULL;
+        }
+        else
+        {
+            DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Extra data without a cached event\n"););
+            pc.total_extra_unmatched++;
+
+            if (ed != NULL)
+            {
+                /* the record is freed with the others */
+                ed->record = NULL;
+                ExtraDataFree(ed);
+            }
+        }
+
         /* waldo operations occur after the output plugins are called */
-        if (fire_output)
+        if (fire_output && spooler->held_event == NULL)
             spoolerWriteWaldo(&barnyard2_conf->waldo, spooler);
     }
     else
@@ -841,11 +995,9 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
 
             ernCache = spoolerEventCacheGetHead(spooler);
 
-            if (fire_output)
-                CallOutputPlugins(OUTPUT_TYPE__ALERT, 
-                              NULL,
-                              ernCache->data, 
-                              ernCache->type);
+            if (fire_output && ernCache->aggregated == 0)
+                spoolerFireEvent(OUTPUT_TYPE__ALERT, NULL, ernCache,
+                                 ernCache->read_time);
 
             /* waldo operations occur after the output plugins are called */
             if (fire_output)
@@ -855,6 +1007,46 @@ void spoolerProcessRecord(Spooler *spooler, int fire_output)
 
     /* clean the cache out */
     spoolerEventCacheClean(spooler);
+
+    if (metrics_enabled)
+        MetricsTick();
+}
+
+/* output an event, with its extra data bound for the plugins; read_time is
+ * when the record being output was read, for the latency trace */
+void spoolerFireEvent(OutputType out_type, Packet *p, EventRecordNode *ern,
+                      uint64_t read_time)
+{
+    ExtraDataBind(ern->data, ern->extra);
+    CallOutputPlugins(out_type, p, ern->data, ern->type, read_time);
+    ExtraDataBind(NULL, NULL);
+}
+
+/*
+** spoolerFireHeld(Spooler *spooler, int write_waldo)
+**
+** Description:
+**   Output the packet held back for the extra data of its event, if any,
+**   and free it. write_waldo is set where no record follows to do it.
+*/
+void spoolerFireHeld(Spooler *spooler, int write_waldo)
+{
+    if (spooler == NULL || spooler->held_event == NULL)
+        return;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_SPOOLER,"Firing SPECIAL style (Packet+Event)\n"););
+
+    spoolerFireEvent(OUTPUT_TYPE__SPECIAL, spooler->held_pkt, spooler->held_event,
+                     spooler->held_read);
+
+    free(spooler->held_pkt);
+    free(spooler->held_data);
+    spooler->held_pkt = NULL;
+    spooler->held_data = NULL;
+    spooler->held_event = NULL;
+
+    if (write_waldo)
+        spoolerWriteWaldo(&barnyard2_conf->waldo, spooler);
 }
 
 int spoolerEventCachePush(Spooler *spooler, uint32_t type, void *data)
@@ -868,8 +1060,11 @@ int spoolerEventCachePush(Spooler *spooler, uint32_t type, void *data)
 
     /* create the new node */
     ernNode->used = 0;
+    ernNode->aggregated = 0;
+    ernNode->extra = NULL;
     ernNode->type = type;
     ernNode->data = data;
+    ernNode->read_time = spooler->record_read;
 
     /* add new events to the front of the cache */
     ernNode->next = spooler->event_cache;
@@ -931,7 +1126,7 @@ int spoolerEventCacheClean(Spooler *spooler)
     {
 	ernNext = ernCurrent->next;
 	
-	if ( ernCurrent->used == 1 )
+	if ( ernCurrent->used == 1 && ernCurrent != spooler->held_event )
         {
 	    /* Delete from list */
 	    if (ernCurrent == spooler->event_cache)
@@ -949,6 +1144,8 @@ int spoolerEventCacheClean(Spooler *spooler)
 	    {
 		free(ernCurrent->data);
 	    }
+
+	    ExtraDataFree(ernCurrent->extra);
 	    
 	    if(ernCurrent != NULL)
 	    {
@@ -987,6 +1184,8 @@ void spoolerEventCacheFlush(Spooler *spooler)
 	    free(evt_ptr->data);
 	    evt_ptr->data = NULL;
 	}
+
+	ExtraDataFree(evt_ptr->extra);
 	
 	free(evt_ptr);
 
@@ -994,6 +1193,13 @@ void spoolerEventCacheFlush(Spooler *spooler)
     }
     
     spooler->event_cache = NULL;
+
+    /* the held packet's event is gone */
+    free(spooler->held_pkt);
+    free(spooler->held_data);
+    spooler->held_pkt = NULL;
+    spooler->held_data = NULL;
+    spooler->held_event = NULL;
     
     return;
 }
@@ -30,6 +30,7 @@
 #include <sys/types.h>
 
 #include "plugbase.h"
+#include "extradata.h"
 
 #define SPOOLER_EXTENSION_FOUND     0
 #define SPOOLER_EXTENSION_NONE      1
@@ -72,6 +73,9 @@ typedef struct _EventRecordNode
     uint32_t                type;   /* type of event stored */
     void                    *data;  /* unified2 event (eg IPv4, IPV6, MPLS, etc) */
     uint8_t                 used;   /* has the event be retrieved */
+    uint8_t                 aggregated; /* folded into an aggregate, not output */
+    ExtraData               *extra; /* extra data records naming the event */
+    uint64_t                read_time; /* when the event was read, when tracing */
     
     struct _EventRecordNode *next;  /* reference to next event record */
 } EventRecordNode;
@@ -93,6 +97,7 @@ typedef struct _Spooler
     uint32_t                state;      // current read state
     uint32_t                offset;     // current file offest
     uint32_t                record_idx; // current record number
+    uint64_t                record_read; // when the current record was read, when tracing
 
     uint32_t                magic;      
     void                    *header;    // header of input file
@@ -104,6 +109,15 @@ typedef struct _Spooler
 
     PacketRecordNode        *packet_cache; // linked list of concurrent packets
     uint32_t                packets_cached;
+
+    int                     linktype;   // linktype of the last packet
+    DatalinkDecodeFunc      decode;     // its decoder
+
+    EventRecordNode         *held_event; // event of a packet waiting for its extra data
+    Packet                  *held_pkt;
+    void                    *held_data;  // the Unified2Packet held_pkt points into
+    struct pcap_pkthdr      held_pkth;
+    uint64_t                held_read;   // when held_pkt was read, when tracing
 } Spooler;
 
 typedef struct _WaldoData
@@ -131,8 +145,10 @@ int ProcessWaldoFile(const char *);
 
 int spoolerReadWaldo(Waldo *);
 void spoolerEventCacheFlush(Spooler *);
+void spoolerFireHeld(Spooler *, int);
 void RegisterSpooler(Spooler *);
 void UnRegisterSpooler(Spooler *);
+void spoolerGetLag(Spooler *, uint64_t *, uint64_t *, uint32_t *);
 
 int spoolerCloseWaldo(Waldo *);
 int spoolerClose(Spooler *);
@@ -137,7 +137,17 @@ typedef enum _EventInfoEnum
     EVENT_INFO_XFF_IPV4 = 1,
     EVENT_INFO_XFF_IPV6 ,
     EVENT_INFO_REVIEWED_BY,
-    EVENT_INFO_GZIP_DATA
+    EVENT_INFO_GZIP_DATA,
+    EVENT_INFO_SMTP_FILENAME,
+    EVENT_INFO_SMTP_MAILFROM,
+    EVENT_INFO_SMTP_RCPTTO,
+    EVENT_INFO_SMTP_EMAIL_HDRS,
+    EVENT_INFO_HTTP_URI,
+    EVENT_INFO_HTTP_HOSTNAME,
+    EVENT_INFO_IPV6_SRC,
+    EVENT_INFO_IPV6_DST,
+    EVENT_INFO_JSNORM_DATA,
+    EVENT_INFO_MAX
 }EventInfoEnum;
 
 typedef enum _EventDataType
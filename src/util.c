@@ -65,6 +65,7 @@
 #include "mstring.h"
 #include "debug.h"
 #include "util.h"
+#include "encode.h"
 #include "parser.h"
 #include "plugbase.h"
 #include "sf_types.h"
@@ -182,12 +183,8 @@ int DisplayBanner(void)
  ****************************************************************************/
 void ts_print(register const struct timeval *tvp, char *timebuf)
 {
-    register int s;
-    int    localzone;
-    time_t Time;
     struct timeval tv;
     struct timezone tz;
-    struct tm *lt;    /* place to stick the adjusted clock data */
 
     /* if null was passed, we use current time */
     if(!tvp)
@@ -198,34 +195,8 @@ void ts_print(register const struct timeval *tvp, char *timebuf)
         tvp = &tv;
     }
 
-    localzone = barnyard2_conf->thiszone;
-   
-    /*
-    **  If we're doing UTC, then make sure that the timezone is correct.
-    */
-    if(BcOutputUseUtc())
-        localzone = 0;
-        
-    s = (tvp->tv_sec + localzone) % 86400;
-    Time = (tvp->tv_sec + localzone) - s;
-
-    lt = gmtime(&Time);
-
-    if(BcOutputIncludeYear())
-    {
-        (void) SnortSnprintf(timebuf, TIMEBUF_SIZE, 
-                        "%02d/%02d/%02d-%02d:%02d:%02d.%06u ", 
-                        lt->tm_mon + 1, lt->tm_mday, lt->tm_year - 100, 
-                        s / 3600, (s % 3600) / 60, s % 60, 
-                        (u_int) tvp->tv_usec);
-    } 
-    else 
-    {
-        (void) SnortSnprintf(timebuf, TIMEBUF_SIZE,
-                        "%02d/%02d-%02d:%02d:%02d.%06u ", lt->tm_mon + 1,
-                        lt->tm_mday, s / 3600, (s % 3600) / 60, s % 60,
-                        (u_int) tvp->tv_usec);
-    }
+    FormatTimestamp(TIMESTAMP_TCPDUMP, tvp->tv_sec, tvp->tv_usec, 0,
+                    timebuf, TIMEBUF_SIZE);
 }
 
 /****************************************************************************
@@ -244,39 +215,180 @@ void ts_print(register const struct timeval *tvp, char *timebuf)
  ****************************************************************************/
 void ts_print2(uint32_t sec, uint32_t usec, char *timebuf)
 {
-    register int s;
-    int    localzone;
-    time_t Time;
-    struct tm *lt;    /* place to stick the adjusted clock data */
+    FormatTimestamp(TIMESTAMP_TCPDUMP, sec, usec, 0, timebuf, TIMEBUF_SIZE);
+}
 
-    localzone = barnyard2_conf->thiszone;
-   
-    /*
-    **  If we're doing UTC, then make sure that the timezone is correct.
-    */
-    if(BcOutputUseUtc())
-        localzone = 0;
-        
-    s = (sec + localzone) % 86400;
-    Time = (sec + localzone) - s;
-
-    lt = gmtime(&Time);
-
-    if(BcOutputIncludeYear())
-    {
-        (void) SnortSnprintf(timebuf, TIMEBUF_SIZE, 
-                        "%02d/%02d/%02d-%02d:%02d:%02d.%06u ", 
-                        lt->tm_mon + 1, lt->tm_mday, lt->tm_year - 100, 
-                        s / 3600, (s % 3600) / 60, s % 60, 
-                        (u_int) usec);
-    } 
-    else 
+/****************************************************************************
+ *
+ * Function: FormatTimestamp(TimestampFormat, time_t, uint32_t, int,
+ *                           char *, size_t)
+ *
+ * Purpose: Render a timestamp in one of the layouts used by the outputs.
+ *          Alerts come in bursts within the same second, so the date and
+ *          time of the last second rendered are kept for each layout and
+ *          only the sub-second digits are written until the second changes,
+ *          which saves the localtime() and snprintf() for most alerts.
+ *
+ *          The ISO layouts are in local time unless UTC output is on, the
+ *          tcpdump and syslog ones add barnyard2_conf->thiszone to UTC.
+ *
+ * Arguments: format => TIMESTAMP_* layout
+ *            sec, usec => the time to render
+ *            tz => offset appended to TIMESTAMP_ISO_MSEC in local time
+ *            buf, size => where to put it, truncated like snprintf()
+ *
+ * Returns: void function
+ *
+ ****************************************************************************/
+typedef struct _TimestampCache
+{
+    int         valid;
+    time_t      sec;            /* the second rendered */
+    uint32_t    output_flags;   /* UTC and year settings it was rendered with */
+    int         thiszone;
+    int         tz;
+    char        prefix[32];     /* everything up to the sub-second digits */
+    size_t      prefix_len;
+    char        suffix[16];     /* and after them */
+    size_t      suffix_len;
+} TimestampCache;
+
+#define TIMESTAMP_FLAGS (OUTPUT_FLAG__USE_UTC | OUTPUT_FLAG__INCLUDE_YEAR)
+
+static TimestampCache timestamp_cache[TIMESTAMP_MAX];
+
+static void TimestampCacheFill(TimestampCache *tc, TimestampFormat format,
+                               time_t sec, int tz)
+{
+    static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    struct tm tm;
+    time_t t;
+    int len;
+
+    tc->valid = 1;
+    tc->sec = sec;
+    tc->output_flags = barnyard2_conf->output_flags & TIMESTAMP_FLAGS;
+    tc->thiszone = barnyard2_conf->thiszone;
+    tc->tz = tz;
+    tc->suffix[0] = '\0';
+
+    switch (format)
+    {
+        case TIMESTAMP_TCPDUMP:
+        case TIMESTAMP_SYSLOG:
+            t = sec + (BcOutputUseUtc() ? 0 : tc->thiszone);
+            gmtime_r(&t, &tm);
+
+            if (format == TIMESTAMP_SYSLOG)
+                len = snprintf(tc->prefix, sizeof(tc->prefix), "%s %2d %02d:%02d:%02d",
+                               months[tm.tm_mon], tm.tm_mday, tm.tm_hour, tm.tm_min,
+                               tm.tm_sec);
+            else if (BcOutputIncludeYear())
+                len = snprintf(tc->prefix, sizeof(tc->prefix), "%02d/%02d/%02d-%02d:%02d:%02d.",
+                               tm.tm_mon + 1, tm.tm_mday, tm.tm_year - 100, tm.tm_hour,
+                               tm.tm_min, tm.tm_sec);
+            else
+                len = snprintf(tc->prefix, sizeof(tc->prefix), "%02d/%02d-%02d:%02d:%02d.",
+                               tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+                               tm.tm_sec);
+
+            /* ts_print() has always left a blank after it */
+            if (format == TIMESTAMP_TCPDUMP)
+            {
+                tc->suffix[0] = ' ';
+                tc->suffix[1] = '\0';
+            }
+            break;
+
+        default:
+            /* the _r variants leave the zone as it was at the first call
+             * instead of checking it for every alert */
+            if (BcOutputUseUtc())
+                gmtime_r(&sec, &tm);
+            else
+                localtime_r(&sec, &tm);
+
+            len = snprintf(tc->prefix, sizeof(tc->prefix), "%04i-%02i-%02i %02i:%02i:%02i%s",
+                           1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                           tm.tm_min, tm.tm_sec, format == TIMESTAMP_ISO_SEC ? "" : ".");
+
+            if (format == TIMESTAMP_ISO_MSEC && !BcOutputUseUtc())
+                snprintf(tc->suffix, sizeof(tc->suffix), "+%03i", tz);
+            break;
+    }
+
+    if (len < 0 || (size_t)len >= sizeof(tc->prefix))
+        len = strlen(tc->prefix);
+
+    tc->prefix_len = len;
+    tc->suffix_len = strlen(tc->suffix);
+}
+
+void FormatTimestamp(TimestampFormat format, time_t sec, uint32_t usec, int tz,
+                     char *buf, size_t size)
+{
+    TimestampCache *tc = &timestamp_cache[format];
+    char out[64];
+    size_t len;
+    uint32_t val, limit;
+    int digits, i;
+
+    if (buf == NULL || size == 0)
+        return;
+
+    if (!tc->valid || tc->sec != sec || tc->tz != tz ||
+        tc->output_flags != (barnyard2_conf->output_flags & TIMESTAMP_FLAGS) ||
+        tc->thiszone != barnyard2_conf->thiszone)
+    {
+        TimestampCacheFill(tc, format, sec, tz);
+    }
+
+    memcpy(out, tc->prefix, tc->prefix_len);
+    len = tc->prefix_len;
+
+    switch (format)
     {
-        (void) SnortSnprintf(timebuf, TIMEBUF_SIZE,
-                        "%02d/%02d-%02d:%02d:%02d.%06u ", lt->tm_mon + 1,
-                        lt->tm_mday, s / 3600, (s % 3600) / 60, s % 60,
-                        (u_int) usec);
+        case TIMESTAMP_ISO_MSEC:
+            val = usec / 1000;
+            limit = 1000;
+            digits = 3;
+            break;
+        case TIMESTAMP_ISO_USEC:
+        case TIMESTAMP_TCPDUMP:
+            val = usec;
+            limit = 1000000;
+            digits = 6;
+            break;
+        default:
+            val = limit = 0;
+            digits = 0;
+            break;
     }
+
+    if (digits != 0 && val < limit)
+    {
+        for (i = digits - 1; i >= 0; i--)
+        {
+            out[len + i] = '0' + val % 10;
+            val /= 10;
+        }
+        len += digits;
+    }
+    else if (digits != 0)
+    {
+        /* bogus microseconds, print them in full like snprintf() did */
+        len += snprintf(out + len, sizeof(out) - len, "%u", val);
+    }
+
+    memcpy(out + len, tc->suffix, tc->suffix_len);
+    len += tc->suffix_len;
+
+    if (len >= size)
+        len = size - 1;
+
+    memcpy(buf, out, len);
+    buf[len] = '\0';
 }
 
 /****************************************************************************
@@ -841,10 +953,16 @@ void DropStats(int exiting)
                CalcPct(pc.total_events, pc.total_records));
     LogMessage("   Packets:"     FMTu64("12") " (%.3f%%)\n", pc.total_packets,
                CalcPct(pc.total_packets, pc.total_records));
+    LogMessage("   Extra data:"  FMTu64("12") " (%.3f%%)\n", pc.total_extra_data,
+               CalcPct(pc.total_extra_data, pc.total_records));
+    LogMessage("   Unmatched:"   FMTu64("12") " (%.3f%%)\n", pc.total_extra_unmatched,
+               CalcPct(pc.total_extra_unmatched, pc.total_records));
     LogMessage("   Unknown:"     FMTu64("12") " (%.3f%%)\n", pc.total_unknown,
                CalcPct(pc.total_unknown, pc.total_records));
     LogMessage("   Suppressed:"  FMTu64("12") " (%.3f%%)\n", pc.total_suppressed,
                CalcPct(pc.total_suppressed, pc.total_records));
+    LogMessage("   Aggregated:"  FMTu64("12") " (%.3f%%)\n", pc.total_aggregated,
+               CalcPct(pc.total_aggregated, pc.total_records));
 
     total = pc.total_packets;
 
@@ -954,6 +1072,12 @@ void DropStats(int exiting)
                pc.gre_ipx, CalcPct(pc.gre_ipx, total));
     LogMessage(" GRE LOOP: " FMTu64("-10") " (%.3f%%)\n", 
                pc.gre_loopback, CalcPct(pc.gre_loopback, total));
+    LogMessage("    VXLAN: " FMTu64("-10") " (%.3f%%)\n", 
+               pc.vxlan, CalcPct(pc.vxlan, total));
+    LogMessage("   GENEVE: " FMTu64("-10") " (%.3f%%)\n", 
+               pc.geneve, CalcPct(pc.geneve, total));
+    LogMessage("    GTP-U: " FMTu64("-10") " (%.3f%%)\n", 
+               pc.gtp, CalcPct(pc.gtp, total));
 #endif  /* GRE */
 #ifdef MPLS
     LogMessage("     MPLS: " FMTu64("-10") " (%.3f%%)\n", 
@@ -991,6 +1115,8 @@ void DropStats(int exiting)
 #endif  /* DLT_IEEE802_11 */
 #endif  // NO_NON_ETHER_DECODER
 
+    MetricsTraceReport();
+
     LogMessage("=============================================="
                "=================================\n");
 
@@ -1908,32 +2034,11 @@ char *GetHostname(void)
  ***************************************************************************/
 char *GetTimestampByComponent(uint32_t sec, uint32_t usec, int tz)
 {
-    struct tm			*lt;  /* localtime */
     char				*buf;
-    time_t				Time;
-    int					msec;
     
     buf = (char *)SnortAlloc(SMALLBUFFER * sizeof(char));
     
-    Time = sec;
-    msec = usec / 1000;
-
-    if (BcOutputUseUtc())
-    {
-	lt = gmtime(&Time);
-        SnortSnprintf(buf, SMALLBUFFER,
-		      "%04i-%02i-%02i %02i:%02i:%02i.%03i",
-		      1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-		      lt->tm_hour, lt->tm_min, lt->tm_sec, msec);
-    }
-    else
-    {
-	lt = localtime(&Time);
-        SnortSnprintf(buf, SMALLBUFFER,
-		      "%04i-%02i-%02i %02i:%02i:%02i.%03i+%03i",
-		      1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-		      lt->tm_hour, lt->tm_min, lt->tm_sec, msec, tz);
-    }
+    FormatTimestamp(TIMESTAMP_ISO_MSEC, sec, usec, tz, buf, SMALLBUFFER);
     
     return buf;
 }
@@ -1941,35 +2046,13 @@ char *GetTimestampByComponent(uint32_t sec, uint32_t usec, int tz)
 /* Same a above using a static buffer */
 u_int32_t GetTimestampByComponent_STATIC(uint32_t sec, uint32_t usec, int tz,char *buf)
 {
-    struct tm                   *lt;  /* localtime */
-    time_t                              Time;
-    int                                 msec;
-    
     if(buf == NULL)
     {
 	/* XXX */
 	return 1;
     }
     
-    Time = sec;
-    msec = usec / 1000;
-
-    if (BcOutputUseUtc())
-    {
-        lt = gmtime(&Time);
-        SnortSnprintf(buf, SMALLBUFFER,
-                      "%04i-%02i-%02i %02i:%02i:%02i.%03i",
-                      1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-                      lt->tm_hour, lt->tm_min, lt->tm_sec, msec);
-    }
-    else
-    {
-        lt = localtime(&Time);
-        SnortSnprintf(buf, SMALLBUFFER,
-                      "%04i-%02i-%02i %02i:%02i:%02i.%03i+%03i",
-                      1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-                      lt->tm_hour, lt->tm_min, lt->tm_sec, msec, tz);
-    }
+    FormatTimestamp(TIMESTAMP_ISO_MSEC, sec, usec, tz, buf, SMALLBUFFER);
     
     return 0;
 }
@@ -1989,29 +2072,11 @@ u_int32_t GetTimestampByComponent_STATIC(uint32_t sec, uint32_t usec, int tz,cha
  ***************************************************************************/
 char *GetTimestampByStruct(register const struct timeval *tvp, int tz)
 {
-    struct tm *lt;  /* localtime */
     char * buf;
-    int msec;
 
     buf = (char *)SnortAlloc(SMALLBUFFER * sizeof(char));
 
-    msec = tvp->tv_usec / 1000;
-
-    if (BcOutputUseUtc())
-    {
-        lt = gmtime((time_t *)&tvp->tv_sec);
-        SnortSnprintf(buf, SMALLBUFFER, "%04i-%02i-%02i %02i:%02i:%02i.%03i",
-                1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-                lt->tm_hour, lt->tm_min, lt->tm_sec, msec);
-    }
-    else
-    {
-        lt = localtime((time_t *)&tvp->tv_sec);
-        SnortSnprintf(buf, SMALLBUFFER,
-                "%04i-%02i-%02i %02i:%02i:%02i.%03i+%03i",
-                1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-                lt->tm_hour, lt->tm_min, lt->tm_sec, msec, tz);
-    }
+    FormatTimestamp(TIMESTAMP_ISO_MSEC, tvp->tv_sec, tvp->tv_usec, tz, buf, SMALLBUFFER);
 
     return buf;
 }
@@ -2020,32 +2085,13 @@ char *GetTimestampByStruct(register const struct timeval *tvp, int tz)
 /* Same as above using static buffer */
 u_int32_t GetTimestampByStruct_STATIC(register const struct timeval *tvp, int tz,char *buf)
 {
-    struct tm *lt;  /* localtime */
-    int msec;
-    
     if(buf == NULL)
     {
 	/* XXX */
 	return 1;
     }
     
-    msec = tvp->tv_usec / 1000;
-    
-    if (BcOutputUseUtc())
-    {
-        lt = gmtime((time_t *)&tvp->tv_sec);
-        SnortSnprintf(buf, SMALLBUFFER, "%04i-%02i-%02i %02i:%02i:%02i.%03i",
-		      1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-		      lt->tm_hour, lt->tm_min, lt->tm_sec, msec);
-    }
-    else
-    {
-        lt = localtime((time_t *)&tvp->tv_sec);
-        SnortSnprintf(buf, SMALLBUFFER,
-		      "%04i-%02i-%02i %02i:%02i:%02i.%03i+%03i",
-		      1900 + lt->tm_year, lt->tm_mon + 1, lt->tm_mday,
-		      lt->tm_hour, lt->tm_min, lt->tm_sec, msec, tz);
-    }
+    FormatTimestamp(TIMESTAMP_ISO_MSEC, tvp->tv_sec, tvp->tv_usec, tz, buf, SMALLBUFFER);
     
     return 0;
 }
@@ -2199,144 +2245,26 @@ u_int32_t GetCurrentTimestamp_STATIC(char *buf)
  ***************************************************************************/
 char * base64(const u_char * xdata, int length)
 {
-    int count, cols, bits, c, char_count;
-    unsigned char alpha[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";  /* 64 bytes */
-    char * payloadptr;
     char * output;
-    char_count = 0;
-    bits = 0;
-    cols = 0;
 
     output = (char *)SnortAlloc( ((unsigned int) (length * 1.5 + 4)) * sizeof(char) );
 
-    payloadptr = output;
-
-    for(count = 0; count < length; count++)
-    {
-        c = xdata[count];
-
-        if(c > 255)
-        {
-            ErrorMessage("plugbase.c->base64(): encountered char > 255 (decimal %d)\n If you see this error message a char is more than one byte on your machine\n This means your base64 results can not be trusted", c);
-        }
-
-        bits += c;
-        char_count++;
+    EncodeBase64(output, xdata, length, ENCODE_BASE64_WRAP);
 
-        if(char_count == 3)
-        {
-            *output = alpha[bits >> 18]; output++;
-            *output = alpha[(bits >> 12) & 0x3f]; output++;
-            *output = alpha[(bits >> 6) & 0x3f]; output++;
-            *output = alpha[bits & 0x3f]; output++; 
-            cols += 4;
-            if(cols == 72)
-            {
-                *output = '\n'; output++;
-                cols = 0;
-            }
-            bits = 0;
-            char_count = 0;
-        }
-        else
-        {
-            bits <<= 8;
-        }
-    }
-
-    if(char_count != 0)
-    {
-        bits <<= 16 - (8 * char_count);
-        *output = alpha[bits >> 18]; output++;
-        *output = alpha[(bits >> 12) & 0x3f]; output++;
-        if(char_count == 1)
-        {
-            *output = '='; output++;
-            *output = '='; output++;
-        }
-        else
-        {
-            *output = alpha[(bits >> 6) & 0x3f]; 
-            output++; *output = '='; 
-            output++;
-        }
-    }
-    *output = '\0';
-    return payloadptr;
+    return output;
 } 
 
 /* Same as above but uses a static buffer provided as a 3rd argument to function.. */
 u_int32_t base64_STATIC(const u_char * xdata, int length,char *output)
 {
-    int count, cols, bits, c, char_count;
-    unsigned char alpha[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";  /* 64 bytes */
-    
-
-    char_count = 0;
-    bits = 0;
-    cols = 0;
-
-    if( ((length * 1.5) + 4 ) > MAX_QUERY_LENGTH)
+    if( (length < 0) ||
+	(((length * 1.5) + 4 ) > MAX_QUERY_LENGTH))
     {
 	/* XXX */
 	return 1;
     }
-    
-    memset(output,'\0',MAX_QUERY_LENGTH);
-
-
-    for(count = 0; count < length; count++)
-    {
-        c = xdata[count];
-
-        if(c > 255)
-        {
-            ErrorMessage("plugbase.c->base64(): encountered char > 255 (decimal %d)\n If you see this error message a char is more than one byte on your machine\n This means your base64 results can not be trusted", c);
-        }
-
-        bits += c;
-        char_count++;
-
-        if(char_count == 3)
-        {
-            *output = alpha[bits >> 18]; output++;
-            *output = alpha[(bits >> 12) & 0x3f]; output++;
-            *output = alpha[(bits >> 6) & 0x3f]; output++;
-            *output = alpha[bits & 0x3f]; output++;
-            cols += 4;
-            if(cols == 72)
-            {
-                *output = '\n'; output++;
-                cols = 0;
-            }
-            bits = 0;
-            char_count = 0;
-        }
-        else
-        {
-            bits <<= 8;
-        }
-    }
-
-    if(char_count != 0)
-    {
-        bits <<= 16 - (8 * char_count);
-        *output = alpha[bits >> 18]; output++;
-        *output = alpha[(bits >> 12) & 0x3f]; output++;
-        if(char_count == 1)
-        {
-            *output = '='; output++;
-            *output = '='; output++;
-        }
-        else
-        {
-            *output = alpha[(bits >> 6) & 0x3f];
-            output++; *output = '=';
-            output++;
-        }
-    }
-    *output = '\0';
 
+    EncodeBase64(output, xdata, length, ENCODE_BASE64_WRAP);
 
     return 0;
 }
@@ -2358,27 +2286,14 @@ u_int32_t base64_STATIC(const u_char * xdata, int length,char *output)
  ***************************************************************************/
 char *ascii(const u_char *xdata, int length)
 {
-     char *d_ptr, *ret_val;
-     int i,count = 0;
-     int size;
+     char *ret_val;
      
-     if(xdata == NULL)
+     if((xdata == NULL) || (length < 0))
      {
          return NULL;         
      }
      
-     for(i=0;i<length;i++)
-     {
-         if(xdata[i] == '<')
-             count+=4;              /* &lt; */
-         else if(xdata[i] == '&')
-             count+=5;              /* &amp; */
-         else if(xdata[i] == '>')   /* &gt;  */
-             count += 4;
-     }
-
-     size = length + count + 1;
-     ret_val = (char *) calloc(1,size);
+     ret_val = (char *) malloc(EncodeAsciiLen(xdata, length) + 1);
      
      if(ret_val == NULL)
      {
@@ -2386,39 +2301,7 @@ char *ascii(const u_char *xdata, int length)
          return NULL;
      }
      
-     d_ptr = ret_val; 
-     
-     for(i=0;i<length;i++)
-     {
-         if((xdata[i] > 0x1F) && (xdata[i] < 0x7F))
-         {
-             if(xdata[i] == '<')
-             {
-                 SnortStrncpy(d_ptr, "&lt;", size - (d_ptr - ret_val));
-                 d_ptr+=4;
-             }
-             else if(xdata[i] == '&')
-             {
-                 SnortStrncpy(d_ptr, "&amp;", size - (d_ptr - ret_val));
-                 d_ptr += 5;
-             }
-             else if(xdata[i] == '>')
-             {
-                 SnortStrncpy(d_ptr, "&gt;", size - (d_ptr - ret_val));
-                 d_ptr += 4;
-             }
-             else
-             {
-                 *d_ptr++ = xdata[i];
-             }
-         }
-         else
-         {
-             *d_ptr++ = '.';
-         }        
-     }
-     
-     *d_ptr++ = '\0';
+     EncodeAscii(ret_val, xdata, length);
      
      return ret_val;
 }
@@ -2426,71 +2309,24 @@ char *ascii(const u_char *xdata, int length)
 /* Same as above but working with a static buffer .. */
 u_int32_t ascii_STATIC(const u_char *xdata, int length,char *ret_val)
 {
-    char *d_ptr;
-    int i,count = 0;
-    int size;
-    
     if( (xdata == NULL) ||
-	(ret_val == NULL))
+	(ret_val == NULL) ||
+	(length < 0))
     {
 	return 1;
     }
     
-    for(i=0;i<length;i++)
-    {
-	if(xdata[i] == '<')
-	    count+=4;              /* &lt; */
-	else if(xdata[i] == '&')
-	    count+=5;              /* &amp; */
-	else if(xdata[i] == '>')   /* &gt;  */
-	    count += 4;
-    }
-
-    size = length + count + 1;
-
-    if(size > MAX_QUERY_LENGTH)
+    /* entities are at most 5 characters, only count them when that could
+       overflow the buffer */
+    if( (((length * 5) + 1) > MAX_QUERY_LENGTH) &&
+	((EncodeAsciiLen(xdata, length) + 1) > MAX_QUERY_LENGTH))
     {
 	return 1;
     }
     
-    memset(ret_val,'\0',MAX_QUERY_LENGTH);
-    
-    d_ptr = ret_val;
-
-    for(i=0;i<length;i++)
-    {
-	if((xdata[i] > 0x1F) && (xdata[i] < 0x7F))
-	{
-	    if(xdata[i] == '<')
-	    {
-		SnortStrncpy(d_ptr, "&lt;", size - (d_ptr - ret_val));
-		d_ptr+=4;
-	    }
-	    else if(xdata[i] == '&')
-	    {
-		SnortStrncpy(d_ptr, "&amp;", size - (d_ptr - ret_val));
-		d_ptr += 5;
-	    }
-	    else if(xdata[i] == '>')
-	    {
-		SnortStrncpy(d_ptr, "&gt;", size - (d_ptr - ret_val));
-		d_ptr += 4;
-	    }
-	    else
-	    {
-		*d_ptr++ = xdata[i];
-	    }
-	}
-	else
-	{
-	    *d_ptr++ = '.';
-	}
-    }
-
-    *d_ptr++ = '\0';
+    EncodeAscii(ret_val, xdata, length);
 
     return 0;
-    
 }
 
 
@@ -2540,23 +2376,11 @@ char *hex(const u_char *xdata, int length)
 
 char *fasthex(const u_char *xdata, int length)
 {
-    char conv[] = "0123456789ABCDEF";
     char *retbuf = NULL; 
-    const u_char *index;
-    const u_char *end;
-    char *ridx;
 
-    index = xdata;
-    end = xdata + length;
     retbuf = (char *)SnortAlloc(((length * 2) + 1) * sizeof(char));
-    ridx = retbuf;
 
-    while(index < end)
-    {
-        *ridx++ = conv[((*index & 0xFF)>>4)];
-        *ridx++ = conv[((*index & 0xFF)&0x0F)];
-        index++;
-    }
+    EncodeHex(retbuf, xdata, length);
 
     return retbuf;
 }
@@ -2564,32 +2388,16 @@ char *fasthex(const u_char *xdata, int length)
 /* same as above but working with a static buffer */
 u_int32_t fasthex_STATIC(const u_char *xdata, int length,char *retbuf)
 {
-    char conv[] = "0123456789ABCDEF";
-    const u_char *index;
-    const u_char *end;
-    char *ridx;
-
     if( (xdata == NULL) ||
 	(retbuf == NULL) ||
+	(length < 0) ||
 	(((length *2) + 1) > MAX_QUERY_LENGTH))
     {
 	/* XXX */
 	return 1;
     }
 
-    index = xdata;
-    end = xdata + length;
-    
-    memset(retbuf,'\0',MAX_QUERY_LENGTH);
-    
-    ridx = retbuf;
-    
-    while(index < end)
-    {
-        *ridx++ = conv[((*index & 0xFF)>>4)];
-        *ridx++ = conv[((*index & 0xFF)&0x0F)];
-        index++;
-    }
+    EncodeHex(retbuf, xdata, length);
     
     return 0;
 }
@@ -111,6 +111,17 @@ typedef struct _PcapPktStats
 
 } PcapPktStats;
 
+/* timestamp layouts of FormatTimestamp() */
+typedef enum _TimestampFormat
+{
+    TIMESTAMP_ISO_MSEC = 0,     /* 2014-05-13 16:53:20.123[+tz] */
+    TIMESTAMP_ISO_USEC,         /* 2014-05-13 16:53:20.123456 */
+    TIMESTAMP_ISO_SEC,          /* 2014-05-13 16:53:20 */
+    TIMESTAMP_TCPDUMP,          /* 05/13[/14]-16:53:20.123456 */
+    TIMESTAMP_SYSLOG,           /* May 13 16:53:20 */
+    TIMESTAMP_MAX
+} TimestampFormat;
+
 
 typedef struct _IntervalStats
 {
@@ -173,6 +184,7 @@ void GetTime(char *);
 int gmt2local(time_t);
 void ts_print(register const struct timeval *, char *);
 void ts_print2(u_int32_t, u_int32_t, char *);
+void FormatTimestamp(TimestampFormat, time_t, uint32_t, int, char *, size_t);
 char *copy_argv(char **);
 char * strtrim(char *);
 void strip(char *);